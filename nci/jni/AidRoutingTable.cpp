@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Mirror of the AID routing table the stack accepted, kept in step with
+ *  the requested routes by sending only what changed.
+ */
+
+#include "OverrideLog.h"
+#include "AidRoutingTable.h"
+#include <algorithm>
+
+
+static bool aidEntryLess (const AidTrie::Entry& a, const AidTrie::Entry& b)
+{
+    return a.mAid < b.mAid;
+}
+
+static bool aidEntryAddedBefore (const AidTrie::Entry& a, const AidTrie::Entry& b)
+{
+    return a.mSequence < b.mSequence;
+}
+
+
+/*******************************************************************************
+**
+** Function:        AidRoutingTable
+**
+** Description:     Initialize member variables.
+**                  addAid: adds an AID to the stack's table.
+**                  removeAid: removes an AID from the stack's table.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+AidRoutingTable::AidRoutingTable (tADD_AID addAid, tREMOVE_AID removeAid)
+:   mAddAid (addAid),
+    mRemoveAid (removeAid)
+{
+}
+
+
+/*******************************************************************************
+**
+** Function:        update
+**
+** Description:     Send to the stack only the AIDs that differ from what it
+**                  last accepted.  Controllers that treat every entry as a
+**                  prefix match in table order, so in that mode any change
+**                  rewrites the table in the order the AIDs were added.
+**                  routes: the requested routes.
+**                  prefixOnly: controller matches every entry as a prefix.
+**
+** Returns:         True if the stack's table changed.
+**
+*******************************************************************************/
+bool AidRoutingTable::update (const AidTrie& routes, bool prefixOnly)
+{
+    static const char fn [] = "AidRoutingTable::update";
+    std::vector<AidTrie::Entry> wanted;
+    std::vector<AidTrie::Entry> accepted;
+    std::vector<AidTrie::Entry> added;
+    size_t numRemoved = 0;
+    size_t w = 0, c = 0;
+
+    routes.getEntries (wanted);
+    accepted.reserve (wanted.size());
+
+    //walk both tables in ascending byte order
+    while ((w < wanted.size()) || (c < mCommitted.size()))
+    {
+        int order;
+        if (w == wanted.size())
+            order = 1;
+        else if (c == mCommitted.size())
+            order = -1;
+        else if (wanted [w].mAid < mCommitted [c].mAid)
+            order = -1;
+        else if (mCommitted [c].mAid < wanted [w].mAid)
+            order = 1;
+        else
+            order = 0;
+
+        if ((order == 0) && (wanted [w].mRoute == mCommitted [c].mRoute))
+        {
+            accepted.push_back (wanted [w]);
+            w++;
+            c++;
+            continue;
+        }
+
+        if (order >= 0)
+        {
+            //stale or re-routed entry
+            AidTrie::Entry& old = mCommitted [c];
+            tNFA_STATUS nfaStat = mRemoveAid (old.mAid.size(), &old.mAid[0]);
+            if (nfaStat == NFA_STATUS_OK)
+                numRemoved++;
+            else
+            {
+                ALOGE ("%s: failed to remove AID; error=0x%X", fn, nfaStat);
+                accepted.push_back (old);
+                if (order == 0)
+                    w++; //cannot re-route while the old entry remains
+            }
+            c++;
+            if ((order > 0) || (nfaStat != NFA_STATUS_OK))
+                continue;
+        }
+
+        added.push_back (wanted [w]);
+        w++;
+    }
+
+    if (prefixOnly && (numRemoved + added.size() > 0))
+    {
+        //first match in the table wins; re-add everything in the order Java added it
+        for (size_t i = 0; i < accepted.size(); i++)
+        {
+            tNFA_STATUS nfaStat = mRemoveAid (accepted [i].mAid.size(), &accepted [i].mAid[0]);
+            if (nfaStat == NFA_STATUS_OK)
+                added.push_back (accepted [i]);
+            else
+                ALOGE ("%s: failed to remove AID; error=0x%X", fn, nfaStat);
+        }
+        accepted.clear ();
+        std::sort (added.begin(), added.end(), aidEntryAddedBefore);
+    }
+
+    for (size_t i = 0; i < added.size(); i++)
+    {
+        tNFA_STATUS nfaStat = mAddAid (added [i].mRoute, added [i].mAid.size(), &added [i].mAid[0], 0x01);
+        if (nfaStat == NFA_STATUS_OK)
+            accepted.push_back (added [i]);
+        else
+            ALOGE ("%s: failed to route AID; error=0x%X", fn, nfaStat);
+    }
+
+    ALOGD ("%s: %u AIDs; removed %u; added %u", fn, wanted.size(), numRemoved, added.size());
+    if (numRemoved + added.size() == 0)
+        return false;
+
+    //keep the stack's table sorted for the next comparison
+    std::sort (accepted.begin(), accepted.end(), aidEntryLess);
+    mCommitted.swap (accepted);
+    return true;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Mirror of the AID routing table the stack accepted, kept in step with
+ *  the requested routes by sending only what changed.
+ */
+
+#pragma once
+#include "NfcJniUtil.h"
+#include "AidTrie.h"
+#include <vector>
+extern "C"
+{
+    #include "nfa_api.h"
+    #include "nfa_ee_api.h"
+}
+
+
+class AidRoutingTable
+{
+public:
+    //signatures of NFA_EeAddAidRouting() and NFA_EeRemoveAidRouting()
+    typedef tNFA_STATUS (*tADD_AID) (tNFA_HANDLE eeHandle, UINT8 aidLen, UINT8* aid, tNFA_EE_PWR_STATE powerState);
+    typedef tNFA_STATUS (*tREMOVE_AID) (UINT8 aidLen, UINT8* aid);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        AidRoutingTable
+    **
+    ** Description:     Initialize member variables.
+    **                  addAid: adds an AID to the stack's table.
+    **                  removeAid: removes an AID from the stack's table.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    AidRoutingTable (tADD_AID addAid, tREMOVE_AID removeAid);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        update
+    **
+    ** Description:     Send to the stack only the AIDs that differ from what it
+    **                  last accepted.  Controllers that treat every entry as a
+    **                  prefix match in table order, so in that mode any change
+    **                  rewrites the table in the order the AIDs were added.
+    **                  routes: the requested routes.
+    **                  prefixOnly: controller matches every entry as a prefix.
+    **
+    ** Returns:         True if the stack's table changed.
+    **
+    *******************************************************************************/
+    bool update (const AidTrie& routes, bool prefixOnly);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        getEntries
+    **
+    ** Description:     Get the AIDs in the stack's table.
+    **
+    ** Returns:         The AIDs in ascending byte order.
+    **
+    *******************************************************************************/
+    const std::vector<AidTrie::Entry>& getEntries () const {return mCommitted;}
+
+
+    /*******************************************************************************
+    **
+    ** Function:        clear
+    **
+    ** Description:     Forget the stack's table, after the stack emptied it.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void clear () {mCommitted.clear ();}
+
+private:
+    tADD_AID mAddAid;
+    tREMOVE_AID mRemoveAid;
+    std::vector<AidTrie::Entry> mCommitted; //AIDs in the stack's table, in ascending byte order
+
+    AidRoutingTable (const AidRoutingTable&);
+    AidRoutingTable& operator= (const AidRoutingTable&);
+};
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Store AID routes in a prefix tree.
+ */
+
+#include "AidTrie.h"
+
+const int AidTrie::NO_ROUTE;
+
+
+/*******************************************************************************
+**
+** Function:        AidTrie
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+AidTrie::AidTrie ()
+:   mSize (0),
+    mNextSequence (0)
+{
+    mRoot.mRoute = NO_ROUTE;
+    mRoot.mSequence = 0;
+}
+
+
+/*******************************************************************************
+**
+** Function:        ~AidTrie
+**
+** Description:     Release all resources.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+AidTrie::~AidTrie ()
+{
+    deleteChildren (&mRoot);
+}
+
+
+/*******************************************************************************
+**
+** Function:        deleteChildren
+**
+** Description:     Delete all descendants of a node.
+**                  node: the node.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void AidTrie::deleteChildren (Node* node)
+{
+    for (size_t i = 0; i < node->mChildren.size(); i++)
+    {
+        deleteChildren (node->mChildren [i].second);
+        delete node->mChildren [i].second;
+    }
+    node->mChildren.clear ();
+}
+
+
+/*******************************************************************************
+**
+** Function:        findChild
+**
+** Description:     Find the child of a node for an octet.
+**                  node: the node.
+**                  octet: next octet of the AID.
+**
+** Returns:         The child; NULL if there is none.
+**
+*******************************************************************************/
+AidTrie::Node* AidTrie::findChild (const Node* node, UINT8 octet)
+{
+    const std::vector<std::pair<UINT8, Node*> >& children = node->mChildren;
+    size_t low = 0, high = children.size();
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (children [mid].first < octet)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if ((low < children.size()) && (children [low].first == octet))
+        return children [low].second;
+    return NULL;
+}
+
+
+/*******************************************************************************
+**
+** Function:        put
+**
+** Description:     Route an AID; replace its route if it is already present.
+**                  aid: buffer of the AID.
+**                  aidLen: length of the AID.
+**                  route: the route.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void AidTrie::put (const UINT8* aid, UINT8 aidLen, int route)
+{
+    Node* node = &mRoot;
+    for (UINT8 i = 0; i < aidLen; i++)
+    {
+        Node* child = findChild (node, aid [i]);
+        if (child == NULL)
+        {
+            child = new Node;
+            child->mRoute = NO_ROUTE;
+            child->mSequence = 0;
+            std::vector<std::pair<UINT8, Node*> >::iterator pos = node->mChildren.begin();
+            while ((pos != node->mChildren.end()) && (pos->first < aid [i]))
+                ++pos;
+            node->mChildren.insert (pos, std::make_pair (aid [i], child));
+        }
+        node = child;
+    }
+    if (node->mRoute == NO_ROUTE)
+        mSize++;
+    if (node->mRoute != route)
+        node->mSequence = mNextSequence++;
+    node->mRoute = route;
+}
+
+
+/*******************************************************************************
+**
+** Function:        removeFrom
+**
+** Description:     Remove the route of an AID below a node and prune nodes
+**                  that no longer lead to any AID.
+**                  node: the node.
+**                  aid: remaining octets of the AID.
+**                  aidLen: number of remaining octets.
+**
+** Returns:         True if the AID was present.
+**
+*******************************************************************************/
+bool AidTrie::removeFrom (Node* node, const UINT8* aid, UINT8 aidLen)
+{
+    if (aidLen == 0)
+    {
+        if (node->mRoute == NO_ROUTE)
+            return false;
+        node->mRoute = NO_ROUTE;
+        mSize--;
+        return true;
+    }
+
+    Node* child = findChild (node, aid [0]);
+    if ((child == NULL) || !removeFrom (child, aid + 1, aidLen - 1))
+        return false;
+
+    if ((child->mRoute == NO_ROUTE) && child->mChildren.empty())
+    {
+        for (size_t i = 0; i < node->mChildren.size(); i++)
+        {
+            if (node->mChildren [i].second == child)
+            {
+                node->mChildren.erase (node->mChildren.begin() + i);
+                break;
+            }
+        }
+        delete child;
+    }
+    return true;
+}
+
+
+/*******************************************************************************
+**
+** Function:        remove
+**
+** Description:     Remove the route of an AID.
+**                  aid: buffer of the AID.
+**                  aidLen: length of the AID.
+**
+** Returns:         True if the AID was present.
+**
+*******************************************************************************/
+bool AidTrie::remove (const UINT8* aid, UINT8 aidLen)
+{
+    return removeFrom (&mRoot, aid, aidLen);
+}
+
+
+/*******************************************************************************
+**
+** Function:        find
+**
+** Description:     Find the route of exactly this AID.
+**                  aid: buffer of the AID.
+**                  aidLen: length of the AID.
+**
+** Returns:         The route; NO_ROUTE if there is none.
+**
+*******************************************************************************/
+int AidTrie::find (const UINT8* aid, UINT8 aidLen) const
+{
+    const Node* node = &mRoot;
+    for (UINT8 i = 0; (i < aidLen) && (node != NULL); i++)
+        node = findChild (node, aid [i]);
+    return node ? node->mRoute : NO_ROUTE;
+}
+
+
+/*******************************************************************************
+**
+** Function:        findLongestPrefix
+**
+** Description:     Find the route of the longest AID that is a prefix of
+**                  (or equal to) this AID.
+**                  aid: buffer of the AID.
+**                  aidLen: length of the AID.
+**
+** Returns:         The route; NO_ROUTE if there is none.
+**
+*******************************************************************************/
+int AidTrie::findLongestPrefix (const UINT8* aid, UINT8 aidLen) const
+{
+    const Node* node = &mRoot;
+    int route = NO_ROUTE;
+    for (UINT8 i = 0; i < aidLen; i++)
+    {
+        node = findChild (node, aid [i]);
+        if (node == NULL)
+            break;
+        if (node->mRoute != NO_ROUTE)
+            route = node->mRoute;
+    }
+    return route;
+}
+
+
+/*******************************************************************************
+**
+** Function:        collect
+**
+** Description:     Append the AIDs below a node in ascending byte order.
+**                  node: the node.
+**                  aid: octets leading to the node.
+**                  entries: receives the AIDs.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void AidTrie::collect (const Node* node, std::vector<UINT8>& aid, std::vector<Entry>& entries)
+{
+    if (node->mRoute != NO_ROUTE)
+    {
+        Entry entry;
+        entry.mAid = aid;
+        entry.mRoute = node->mRoute;
+        entry.mSequence = node->mSequence;
+        entries.push_back (entry);
+    }
+    for (size_t i = 0; i < node->mChildren.size(); i++)
+    {
+        aid.push_back (node->mChildren [i].first);
+        collect (node->mChildren [i].second, aid, entries);
+        aid.pop_back ();
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        getEntries
+**
+** Description:     Get all routed AIDs in ascending byte order.
+**                  entries: receives the AIDs.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void AidTrie::getEntries (std::vector<Entry>& entries) const
+{
+    std::vector<UINT8> aid;
+    entries.clear ();
+    entries.reserve (mSize);
+    collect (&mRoot, aid, entries);
+}
+
+
+/*******************************************************************************
+**
+** Function:        clear
+**
+** Description:     Remove all routes.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void AidTrie::clear ()
+{
+    deleteChildren (&mRoot);
+    mRoot.mRoute = NO_ROUTE;
+    mSize = 0;
+}
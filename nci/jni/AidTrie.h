@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Store AID routes in a prefix tree.
+ */
+
+#pragma once
+#include "NfcJniUtil.h"
+#include <vector>
+extern "C"
+{
+    #include "nfa_api.h"
+}
+
+
+class AidTrie
+{
+public:
+    static const int NO_ROUTE = -1;
+
+    struct Entry
+    {
+        std::vector<UINT8> mAid;
+        int mRoute;
+        UINT32 mSequence; //order in which the AID was added
+    };
+
+
+    /*******************************************************************************
+    **
+    ** Function:        AidTrie
+    **
+    ** Description:     Initialize member variables.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    AidTrie ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        ~AidTrie
+    **
+    ** Description:     Release all resources.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    ~AidTrie ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        put
+    **
+    ** Description:     Route an AID; replace its route if it is already present.
+    **                  aid: buffer of the AID.
+    **                  aidLen: length of the AID.
+    **                  route: the route.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void put (const UINT8* aid, UINT8 aidLen, int route);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        remove
+    **
+    ** Description:     Remove the route of an AID.
+    **                  aid: buffer of the AID.
+    **                  aidLen: length of the AID.
+    **
+    ** Returns:         True if the AID was present.
+    **
+    *******************************************************************************/
+    bool remove (const UINT8* aid, UINT8 aidLen);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        find
+    **
+    ** Description:     Find the route of exactly this AID.
+    **                  aid: buffer of the AID.
+    **                  aidLen: length of the AID.
+    **
+    ** Returns:         The route; NO_ROUTE if there is none.
+    **
+    *******************************************************************************/
+    int find (const UINT8* aid, UINT8 aidLen) const;
+
+
+    /*******************************************************************************
+    **
+    ** Function:        findLongestPrefix
+    **
+    ** Description:     Find the route of the longest AID that is a prefix of
+    **                  (or equal to) this AID.
+    **                  aid: buffer of the AID.
+    **                  aidLen: length of the AID.
+    **
+    ** Returns:         The route; NO_ROUTE if there is none.
+    **
+    *******************************************************************************/
+    int findLongestPrefix (const UINT8* aid, UINT8 aidLen) const;
+
+
+    /*******************************************************************************
+    **
+    ** Function:        getEntries
+    **
+    ** Description:     Get all routed AIDs in ascending byte order.
+    **                  entries: receives the AIDs.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void getEntries (std::vector<Entry>& entries) const;
+
+
+    /*******************************************************************************
+    **
+    ** Function:        size
+    **
+    ** Description:     Get the number of routed AIDs.
+    **
+    ** Returns:         Number of AIDs.
+    **
+    *******************************************************************************/
+    size_t size () const {return mSize;}
+
+
+    /*******************************************************************************
+    **
+    ** Function:        clear
+    **
+    ** Description:     Remove all routes.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void clear ();
+
+private:
+    struct Node
+    {
+        int mRoute; //NO_ROUTE if no AID ends at this node
+        UINT32 mSequence;
+        std::vector<std::pair<UINT8, Node*> > mChildren; //sorted by octet
+    };
+
+    Node mRoot;
+    size_t mSize;
+    UINT32 mNextSequence;
+
+    AidTrie (const AidTrie&);
+    AidTrie& operator= (const AidTrie&);
+
+    static Node* findChild (const Node* node, UINT8 octet);
+    static void deleteChildren (Node* node);
+    bool removeFrom (Node* node, const UINT8* aid, UINT8 aidLen);
+    static void collect (const Node* node, std::vector<UINT8>& aid, std::vector<Entry>& entries);
+};
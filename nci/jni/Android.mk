@@ -23,7 +23,7 @@ ifeq ($(BOARD_USES_SEC_NFC),true)
 	LOCAL_CFLAGS += -DUSES_SEC_NFC
 endif
 
-LOCAL_SRC_FILES:= $(call all-cpp-files-under, .)
+LOCAL_SRC_FILES:= $(filter-out tests/%, $(call all-cpp-files-under, .))
 
 LOCAL_C_INCLUDES += \
     bionic \
@@ -59,3 +59,5 @@ LOCAL_MODULE := libnfc_nci_jni
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
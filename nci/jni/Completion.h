@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ *  Turn a stack callback into the result of a blocking call.
+ */
+#pragma once
+#include <stdint.h>
+#include "CondVar.h"
+#include "Mutex.h"
+
+
+/*****************************************************************************
+**
+**  Name:           Completion
+**
+**  Description:    Single-slot latch for one outstanding request.  The waiter
+**                  hands in a payload when it starts the request; the stack
+**                  callback fills it and completes the request; the waiter
+**                  takes the payload back.  Payloads are swapped, never
+**                  copied, so T must provide swap().
+**
+**                  Stack callbacks carry no request ID and always act on the
+**                  slot.  The ID from begin() only tells a waiter whether a
+**                  later begin() replaced its request.  When a wait times
+**                  out, the stack still owes the request its final callback;
+**                  that one callback is dropped, so it cannot complete the
+**                  next request.  Use withdraw() for a request the stack
+**                  never accepted, since no callback will come for it.
+**
+*****************************************************************************/
+template <typename T>
+class Completion
+{
+public:
+    static const uint32_t NO_REQUEST = 0;
+
+
+    /*******************************************************************************
+    **
+    ** Function:        Completion
+    **
+    ** Description:     Initialize member variables.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    Completion ()
+    :   mNextId (NO_REQUEST + 1),
+        mPendingId (NO_REQUEST),
+        mDone (false),
+        mLate (false),
+        mStatus (0)
+    {
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        begin
+    **
+    ** Description:     Start a request, abandoning any request still outstanding.
+    **                  Call before the stack is asked to do the work, so a
+    **                  callback that comes back at once finds the request.
+    **                  payload: Swapped in for the callback to fill.
+    **
+    ** Returns:         ID of the request.
+    **
+    *******************************************************************************/
+    uint32_t begin (T& payload)
+    {
+        AutoMutex mutex (mMutex);
+        mPendingId = mNextId++;
+        if (mNextId == NO_REQUEST)
+            mNextId++;
+        mDone = false;
+        mStatus = 0;
+        mPayload.swap (payload);
+        return mPendingId;
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        wait
+    **
+    ** Description:     Block until a request completes or the timeout expires,
+    **                  then take back its payload.  The request is no longer
+    **                  outstanding afterwards, whatever the outcome.  On
+    **                  timeout, the next final callback is dropped as late.
+    **                  id: ID returned by begin().
+    **                  millisec: Timeout in milliseconds; negative waits forever.
+    **                  status: Receives the status the request completed with.
+    **                  payload: Receives the payload.
+    **
+    ** Returns:         True if the request completed; false if timeout occurs.
+    **
+    *******************************************************************************/
+    bool wait (uint32_t id, long millisec, int& status, T& payload)
+    {
+        AutoMutex mutex (mMutex);
+        struct timespec deadline;
+        CondVar::deadlineAfter (millisec, deadline);
+        while ((mPendingId == id) && !mDone)
+        {
+            if (millisec < 0)
+                mCondVar.wait (mMutex);
+            else if (!mCondVar.waitUntil (mMutex, deadline)) //same deadline across spurious wake-ups
+                break;
+        }
+        if (mPendingId != id)
+            return false; //abandoned by a later begin()
+        bool done = mDone;
+        if (!done)
+            mLate = true;
+        status = mStatus;
+        mPayload.swap (payload);
+        mPendingId = NO_REQUEST;
+        return done;
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        withdraw
+    **
+    ** Description:     Take back the payload of a request the stack did not
+    **                  accept; no callback is expected for it.
+    **                  id: ID returned by begin().
+    **                  payload: Receives the payload.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void withdraw (uint32_t id, T& payload)
+    {
+        AutoMutex mutex (mMutex);
+        if (mPendingId != id)
+            return;
+        mPayload.swap (payload);
+        mPendingId = NO_REQUEST;
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        isPending
+    **
+    ** Description:     Whether a request was started and its waiter has not yet
+    **                  taken back the payload.
+    **
+    ** Returns:         True if a request is outstanding.
+    **
+    *******************************************************************************/
+    bool isPending ()
+    {
+        AutoMutex mutex (mMutex);
+        return mPendingId != NO_REQUEST;
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        complete
+    **
+    ** Description:     Complete the outstanding request, if any, and wake its
+    **                  waiter.  The late callback of a request whose wait timed
+    **                  out is dropped instead.
+    **                  status: Status to hand to the waiter.
+    **
+    ** Returns:         True if a request was outstanding.
+    **
+    *******************************************************************************/
+    bool complete (int status)
+    {
+        Pending pending (*this);
+        if (pending.isLate ())
+        {
+            pending.dropLate ();
+            return false;
+        }
+        if (!pending.isActive ())
+            return false;
+        pending.complete (status);
+        return true;
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        abort
+    **
+    ** Description:     Complete the outstanding request, if any, and forget any
+    **                  late callback; the stack will not send it, for instance
+    **                  because the tag was deactivated.
+    **                  status: Status to hand to the waiter.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void abort (int status)
+    {
+        Pending pending (*this);
+        pending.dropLate ();
+        if (pending.isActive ())
+            pending.complete (status);
+    }
+
+
+    /*****************************************************************************
+    **
+    **  Name:           Pending
+    **
+    **  Description:    Lock the completion so a callback can fill the payload
+    **                  of the outstanding request, across several events if
+    **                  need be, and then complete it.
+    **
+    *****************************************************************************/
+    class Pending
+    {
+    public:
+        Pending (Completion& completion)
+        :   mCompletion (completion)
+        {
+            mCompletion.mMutex.lock ();
+        }
+
+        ~Pending ()
+        {
+            mCompletion.mMutex.unlock ();
+        }
+
+        // Whether a request is outstanding and not yet completed
+        bool isActive () const
+        {
+            return (mCompletion.mPendingId != NO_REQUEST) && !mCompletion.mDone && !mCompletion.mLate;
+        }
+
+        // Whether callbacks still belong to a request whose wait timed out
+        bool isLate () const
+        {
+            return mCompletion.mLate;
+        }
+
+        // The late request got its final callback; later ones are current
+        void dropLate ()
+        {
+            mCompletion.mLate = false;
+        }
+
+        // Payload of the outstanding request; only valid while isActive()
+        T& payload ()
+        {
+            return mCompletion.mPayload;
+        }
+
+        void complete (int status)
+        {
+            mCompletion.mStatus = status;
+            mCompletion.mDone = true;
+            mCompletion.mCondVar.notifyOne ();
+        }
+
+    private:
+        Completion& mCompletion;
+        Pending (const Pending&);
+        Pending& operator= (const Pending&);
+    };
+
+private:
+    Completion (const Completion&);
+    Completion& operator= (const Completion&);
+
+    Mutex mMutex;
+    CondVar mCondVar;
+    uint32_t mNextId;
+    uint32_t mPendingId; //NO_REQUEST if nothing is outstanding
+    bool mDone;
+    bool mLate; //a request whose wait timed out is still owed its final callback
+    int mStatus;
+    T mPayload;
+};
@@ -38,13 +38,19 @@ CondVar::CondVar ()
 {
     pthread_condattr_t attr;
     pthread_condattr_init(&attr);
-    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    //deadlines are on CLOCK_MONOTONIC so that wall-clock changes (e.g. NITZ) do not move them
+    int res = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (res)
+    {
+        ALOGE ("CondVar::CondVar: fail set clock; error=0x%X", res);
+    }
     memset (&mCondition, 0, sizeof(mCondition));
-    int const res = pthread_cond_init (&mCondition, &attr);
+    res = pthread_cond_init (&mCondition, &attr);
     if (res)
     {
         ALOGE ("CondVar::CondVar: fail init; error=0x%X", res);
     }
+    pthread_condattr_destroy(&attr);
 }
 
 
@@ -98,31 +104,59 @@ void CondVar::wait (Mutex& mutex)
 *******************************************************************************/
 bool CondVar::wait (Mutex& mutex, long millisec)
 {
-    bool retVal = false;
-    struct timespec absoluteTime;
+    struct timespec deadline;
+    deadlineAfter (millisec, deadline);
+    return waitUntil (mutex, deadline);
+}
+
 
-    if (clock_gettime (CLOCK_MONOTONIC, &absoluteTime) == -1)
+/*******************************************************************************
+**
+** Function:        waitUntil
+**
+** Description:     Block the caller and wait for a condition.
+**                  deadline: Absolute time on CLOCK_MONOTONIC.
+**
+** Returns:         True if wait is successful; false if the deadline passes.
+**
+*******************************************************************************/
+bool CondVar::waitUntil (Mutex& mutex, const struct timespec& deadline)
+{
+    int waitResult = pthread_cond_timedwait (&mCondition, mutex.nativeHandle(), &deadline);
+    if ((waitResult != 0) && (waitResult != ETIMEDOUT))
+        ALOGE ("CondVar::waitUntil: fail timed wait; error=0x%X", waitResult);
+    return (waitResult == 0); //waited successfully
+}
+
+
+/*******************************************************************************
+**
+** Function:        deadlineAfter
+**
+** Description:     Compute the deadline that lies a number of milliseconds from now.
+**                  millisec: Timeout in milliseconds.
+**                  deadline: Receives the absolute time on CLOCK_MONOTONIC.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void CondVar::deadlineAfter (long millisec, struct timespec& deadline)
+{
+    if (clock_gettime (CLOCK_MONOTONIC, &deadline) == -1)
     {
-        ALOGE ("CondVar::wait: fail get time; errno=0x%X", errno);
+        ALOGE ("CondVar::deadlineAfter: fail get time; errno=0x%X", errno);
+        memset (&deadline, 0, sizeof(deadline));
     }
-    else
+    if (millisec < 0)
+        millisec = 0;
+    deadline.tv_sec += millisec / 1000;
+    long ns = deadline.tv_nsec + ((millisec % 1000) * 1000000);
+    if (ns >= 1000000000)
     {
-        absoluteTime.tv_sec += millisec / 1000;
-        long ns = absoluteTime.tv_nsec + ((millisec % 1000) * 1000000);
-        if (ns > 1000000000)
-        {
-            absoluteTime.tv_sec++;
-            absoluteTime.tv_nsec = ns - 1000000000;
-        }
-        else
-            absoluteTime.tv_nsec = ns;
+        deadline.tv_sec++;
+        ns -= 1000000000;
     }
-
-    int waitResult = pthread_cond_timedwait (&mCondition, mutex.nativeHandle(), &absoluteTime);
-    if ((waitResult != 0) && (waitResult != ETIMEDOUT))
-        ALOGE ("CondVar::wait: fail timed wait; error=0x%X", waitResult);
-    retVal = (waitResult == 0); //waited successfully
-    return retVal;
+    deadline.tv_nsec = ns;
 }
 
 
@@ -144,3 +178,21 @@ void CondVar::notifyOne ()
     }
 }
 
+
+/*******************************************************************************
+**
+** Function:        notifyAll
+**
+** Description:     Unblock all waiting threads.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void CondVar::notifyAll ()
+{
+    int const res = pthread_cond_broadcast (&mCondition);
+    if (res)
+    {
+        ALOGE ("CondVar::notifyAll: fail broadcast; error=0x%X", res);
+    }
+}
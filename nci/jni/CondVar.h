@@ -20,6 +20,7 @@
 
 #pragma once
 #include <pthread.h>
+#include <time.h>
 #include "Mutex.h"
 
 
@@ -75,6 +76,36 @@ public:
     bool wait (Mutex& mutex, long millisec);
 
 
+    /*******************************************************************************
+    **
+    ** Function:        waitUntil
+    **
+    ** Description:     Block the caller and wait for a condition.  Waiting again
+    **                  with the same deadline after a spurious wake-up does not
+    **                  extend the total time waited.
+    **                  deadline: Absolute time on CLOCK_MONOTONIC.
+    **
+    ** Returns:         True if wait is successful; false if the deadline passes.
+    **
+    *******************************************************************************/
+    bool waitUntil (Mutex& mutex, const struct timespec& deadline);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        deadlineAfter
+    **
+    ** Description:     Compute the deadline for waitUntil() that lies a number of
+    **                  milliseconds from now.  Wall-clock changes do not move it.
+    **                  millisec: Timeout in milliseconds.
+    **                  deadline: Receives the absolute time on CLOCK_MONOTONIC.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    static void deadlineAfter (long millisec, struct timespec& deadline);
+
+
     /*******************************************************************************
     **
     ** Function:        notifyOne
@@ -86,6 +117,18 @@ public:
     *******************************************************************************/
     void notifyOne ();
 
+
+    /*******************************************************************************
+    **
+    ** Function:        notifyAll
+    **
+    ** Description:     Unblock all waiting threads.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void notifyAll ();
+
 private:
     pthread_cond_t mCondition;
 };
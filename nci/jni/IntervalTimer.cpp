@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+
 /*
  *  Asynchronous interval timer.
  */
@@ -24,40 +25,22 @@
 
 IntervalTimer::IntervalTimer()
 {
-    mTimerId = 0;
     mCb = NULL;
 }
 
 
 bool IntervalTimer::set(int ms, TIMER_FUNC cb)
 {
-    if (mTimerId == 0)
-    {
-        if (cb == NULL)
-            return false;
-
-        if (!create(cb))
-            return false;
-    }
-    if (cb != mCb)
-    {
-        kill();
-        if (!create(cb))
-            return false;
-    }
-
-    int stat = 0;
-    struct itimerspec ts;
-    ts.it_value.tv_sec = ms / 1000;
-    ts.it_value.tv_nsec = (ms % 1000) * 1000000;
-
-    ts.it_interval.tv_sec = 0;
-    ts.it_interval.tv_nsec = 0;
-
-    stat = timer_settime(mTimerId, 0, &ts, 0);
-    if (stat == -1)
+    if (cb != NULL)
+        mCb = cb;
+    if (mCb == NULL)
+        return false;
+
+    //moving an armed timer only relinks it in the wheel; no kernel timer is involved
+    bool ok = TimerWheel::getInstance().schedule(mTimer, ms, mCb, this);
+    if (!ok)
         ALOGE("IntervalTimer::set: fail set timer");
-    return stat == 0;
+    return ok;
 }
 
 
@@ -67,33 +50,19 @@ IntervalTimer::~IntervalTimer()
 }
 
 
+//waits for a callback that is running, so the timer can be destroyed afterwards
 void IntervalTimer::kill()
 {
-    if (mTimerId == 0)
+    if (mCb == NULL)
         return;
 
-    timer_delete(mTimerId);
-    mTimerId = 0;
+    TimerWheel::getInstance().cancel(mTimer);
     mCb = NULL;
 }
 
 
 bool IntervalTimer::create(TIMER_FUNC cb)
 {
-    struct sigevent se;
-    int stat = 0;
-
-    /*
-     * Set the sigevent structure to cause the signal to be
-     * delivered by creating a new thread.
-     */
-    se.sigev_notify = SIGEV_THREAD;
-    se.sigev_value.sival_ptr = &mTimerId;
-    se.sigev_notify_function = cb;
-    se.sigev_notify_attributes = NULL;
     mCb = cb;
-    stat = timer_create(CLOCK_MONOTONIC, &se, &mTimerId);
-    if (stat == -1)
-        ALOGE("IntervalTimer::create: fail create timer");
-    return stat == 0;
+    return cb != NULL;
 }
@@ -14,17 +14,20 @@
  * limitations under the License.
  */
 
+
 /*
  *  Asynchronous interval timer.
  */
 
+#pragma once
 #include <time.h>
+#include "TimerWheel.h"
 
 
 class IntervalTimer
 {
 public:
-    typedef void (*TIMER_FUNC) (union sigval);
+    typedef TimerWheel::TIMER_FUNC TIMER_FUNC;
 
     IntervalTimer();
     ~IntervalTimer();
@@ -33,6 +36,6 @@ public:
     bool create(TIMER_FUNC );
 
 private:
-    timer_t mTimerId;
+    TimerWheel::Timer mTimer; //expiries are run by the process-wide timer thread
     TIMER_FUNC mCb;
 };
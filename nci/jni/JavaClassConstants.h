@@ -29,6 +29,7 @@ namespace android
      */
     extern jmethodID gCachedNfcManagerNotifyHostEmuActivated;
     extern jmethodID gCachedNfcManagerNotifyHostEmuData;
+    extern jmethodID gCachedNfcManagerNotifyHostEmuDataDirect;
     extern jmethodID gCachedNfcManagerNotifyHostEmuDeactivated;
 
     extern const char* gNativeP2pDeviceClassName;
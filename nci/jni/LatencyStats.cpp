@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Collect latency and throughput statistics of data paths for dumpsys.
+ */
+
+#include "LatencyStats.h"
+#include <stdio.h>
+#include <string.h>
+
+
+LatencyStats gTransceiveLatency ("transceive");
+LatencyStats gNdefReadLatency ("ndef read");
+LatencyStats gNdefWriteLatency ("ndef write");
+LatencyStats gLlcpSendLatency ("llcp send");
+LatencyStats gHceAssemblyLatency ("hce assembly");
+LatencyStats gHceDataLatency ("hce data");
+
+
+/*******************************************************************************
+**
+** Function:        LatencyStats
+**
+** Description:     Initialize member variables.
+**                  name: label used in the dump.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+LatencyStats::LatencyStats (const char* name)
+:   mName (name),
+    mCount (0),
+    mTotalMicros (0),
+    mTotalBytes (0)
+{
+    memset (mBuckets, 0, sizeof(mBuckets));
+}
+
+
+/*******************************************************************************
+**
+** Function:        record
+**
+** Description:     Record one completed operation that started at start.
+**                  start: CLOCK_MONOTONIC time when the operation started.
+**                  numBytes: number of payload octets moved by the operation.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void LatencyStats::record (const struct timespec& start, uint32_t numBytes)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    int64_t micros = (int64_t) (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+    if (micros < 0)
+        micros = 0;
+
+    int bucket = 0;
+    while ((bucket < NUM_BUCKETS - 1) && (micros >= ((int64_t) 1 << bucket)))
+        bucket++;
+
+    AutoMutex mutex (mMutex);
+    mBuckets [bucket]++;
+    mCount++;
+    mTotalMicros += micros;
+    mTotalBytes += numBytes;
+}
+
+
+/*******************************************************************************
+**
+** Function:        percentile
+**
+** Description:     Get the upper bound of the bucket holding a percentile.
+**                  Caller must hold mMutex.
+**                  percent: the percentile.
+**
+** Returns:         Latency in microseconds.
+**
+*******************************************************************************/
+uint32_t LatencyStats::percentile (uint32_t percent)
+{
+    uint64_t needed = ((uint64_t) mCount * percent + 99) / 100;
+    uint32_t sum = 0;
+    int bucket = 0;
+    for (; bucket < NUM_BUCKETS - 1; bucket++)
+    {
+        sum += mBuckets [bucket];
+        if (sum >= needed)
+            break;
+    }
+    return (uint32_t) 1 << bucket;
+}
+
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Append a line with count, throughput and p50/p99 latency.
+**                  Throughput is bytes per busy second: bytes over the summed
+**                  latencies, so idle time between operations is not counted.
+**                  out: receives the text.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void LatencyStats::dump (std::string& out)
+{
+    char buffer [160];
+    AutoMutex mutex (mMutex);
+    if (mCount == 0)
+    {
+        snprintf (buffer, sizeof(buffer), "%s: no samples\n", mName);
+    }
+    else
+    {
+        unsigned long bytesPerBusySec = mTotalMicros ? (unsigned long) (mTotalBytes * 1000000 / mTotalMicros) : 0;
+        snprintf (buffer, sizeof(buffer), "%s: count=%u; bytes=%llu; throughput=%lu B/busy-s; p50<=%u us; p99<=%u us\n",
+                mName, mCount, (unsigned long long) mTotalBytes, bytesPerBusySec, percentile (50), percentile (99));
+    }
+    out += buffer;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Collect latency and throughput statistics of data paths for dumpsys.
+ */
+
+#pragma once
+#include "NfcJniUtil.h"
+#include "Mutex.h"
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+
+class LatencyStats
+{
+public:
+    /*******************************************************************************
+    **
+    ** Function:        LatencyStats
+    **
+    ** Description:     Initialize member variables.
+    **                  name: label used in the dump.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    LatencyStats (const char* name);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        record
+    **
+    ** Description:     Record one completed operation that started at start.
+    **                  start: CLOCK_MONOTONIC time when the operation started.
+    **                  numBytes: number of payload octets moved by the operation.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void record (const struct timespec& start, uint32_t numBytes);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        dump
+    **
+    ** Description:     Append a line with count, throughput and p50/p99 latency.
+    **                  Throughput is bytes per busy second: bytes over the summed
+    **                  latencies, so idle time between operations is not counted.
+    **                  out: receives the text.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void dump (std::string& out);
+
+private:
+    static const int NUM_BUCKETS = 25; //bucket i counts operations shorter than 2^i microseconds
+
+    const char* mName;
+    Mutex mMutex;
+    uint32_t mCount;
+    uint64_t mTotalMicros;
+    uint64_t mTotalBytes;
+    uint32_t mBuckets [NUM_BUCKETS];
+
+    uint32_t percentile (uint32_t percent);
+};
+
+
+extern LatencyStats gTransceiveLatency;
+extern LatencyStats gNdefReadLatency;
+extern LatencyStats gNdefWriteLatency;
+extern LatencyStats gLlcpSendLatency;
+extern LatencyStats gHceAssemblyLatency;
+extern LatencyStats gHceDataLatency;
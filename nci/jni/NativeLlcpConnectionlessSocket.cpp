@@ -14,13 +14,16 @@
  * limitations under the License.
  */
 
-#include <semaphore.h>
 #include <errno.h>
 #include "OverrideLog.h"
 #include "NfcJniUtil.h"
 #include "JavaClassConstants.h"
+#include "SyncEvent.h"
 #include <ScopedLocalRef.h>
 #include <ScopedPrimitiveArray.h>
+#include <map>
+#include <string>
+#include <vector>
 extern "C"
 {
     #include "nfa_api.h"
@@ -37,11 +40,85 @@ namespace android
 ** private variables and functions
 **
 *****************************************************************************/
-static sem_t        sConnlessRecvSem;
-static jboolean     sConnlessRecvWaitingForData = JNI_FALSE;
-static uint8_t*     sConnlessRecvBuf = NULL;
-static uint32_t     sConnlessRecvLen = 0;
-static uint32_t     sConnlessRecvRemoteSap = 0;
+#define CONNLESS_RING_SIZE  16     // datagrams held per socket while no receiver is waiting
+
+struct tConnlessDatagram
+{
+    uint32_t    mRemoteSap;
+    uint32_t    mLen;
+    uint8_t     mData [LLCP_MAX_MIU];
+};
+
+// A datagram copied out of the ring, so Java objects are built without the lock
+struct tConnlessPacket
+{
+    uint32_t                mRemoteSap;
+    std::vector<uint8_t>    mData;
+};
+
+// Receive queue of one socket
+struct tConnlessQueue
+{
+    tConnlessDatagram   mRing [CONNLESS_RING_SIZE];
+    uint32_t            mHead;          // oldest datagram
+    uint32_t            mCount;         // datagrams in ring
+    uint32_t            mReceived;      // datagrams queued
+    uint32_t            mDropped;       // datagrams lost to a full ring or a lost link
+    uint32_t            mTruncated;     // datagrams cut to fit
+
+    tConnlessQueue () : mHead (0), mCount (0), mReceived (0), mDropped (0), mTruncated (0) {}
+};
+
+typedef std::map<tNFA_HANDLE, tConnlessQueue*> tConnlessQueues;
+
+// Variables below are protected by sConnlessRecvEvent
+static SyncEvent            sConnlessRecvEvent;         // receivers of every socket wait here
+static tConnlessQueues      sConnlessQueues;            // receive queue of each socket by NFA handle
+static uint32_t             sConnlessAbortCount = 0;    // bumped to unblock receivers
+
+
+/*******************************************************************************
+**
+** Function:        findQueue
+**
+** Description:     Find the receive queue of a socket.  Caller holds
+**                  sConnlessRecvEvent.
+**                  handle: NFA handle of the socket.
+**                  create: Create the queue if the socket has none yet.
+**
+** Returns:         Receive queue; NULL if there is none.
+**
+*******************************************************************************/
+static tConnlessQueue* findQueue (tNFA_HANDLE handle, bool create)
+{
+    tConnlessQueues::iterator it = sConnlessQueues.find (handle);
+    if (it != sConnlessQueues.end ())
+        return it->second;
+    if (!create)
+        return NULL;
+    tConnlessQueue* queue = new tConnlessQueue;
+    sConnlessQueues [handle] = queue;
+    return queue;
+}
+
+
+/*******************************************************************************
+**
+** Function:        getSocketHandle
+**
+** Description:     Get the NFA handle of a Java socket object.
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         NFA handle.
+**
+*******************************************************************************/
+static tNFA_HANDLE getSocketHandle (JNIEnv* e, jobject o)
+{
+    ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
+    jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
+    return (tNFA_HANDLE) e->GetIntField(o, f);
+}
 
 
 /*******************************************************************************
@@ -90,7 +167,10 @@ static jboolean nativeLlcpConnectionlessSocket_doSendTo (JNIEnv *e, jobject o, j
 **
 ** Function:        nativeLlcpConnectionlessSocket_receiveData
 **
-** Description:     Receive data from the stack.
+** Description:     Receive data from the stack.  The datagram is queued on its
+**                  socket until a receiver takes it; if the socket's queue is
+**                  full it is dropped.
+**                  handle: NFA handle of the socket.
 **                  data: buffer contains data.
 **                  len: length of data.
 **                  remoteSap: remote service access point.
@@ -98,151 +178,251 @@ static jboolean nativeLlcpConnectionlessSocket_doSendTo (JNIEnv *e, jobject o, j
 ** Returns:         None
 **
 *******************************************************************************/
-void nativeLlcpConnectionlessSocket_receiveData (uint8_t* data, uint32_t len, uint32_t remoteSap)
+void nativeLlcpConnectionlessSocket_receiveData (tNFA_HANDLE handle, uint8_t* data, uint32_t len, uint32_t remoteSap)
 {
-    ALOGD ("%s: waiting for data = %d, len = %d", __FUNCTION__, sConnlessRecvWaitingForData, len);
+    SyncEventGuard guard (sConnlessRecvEvent);
+    tConnlessQueue& queue = *findQueue (handle, true);
 
-    // Sanity...
-    if (sConnlessRecvLen < len)
+    if (queue.mCount == CONNLESS_RING_SIZE)
     {
-        len = sConnlessRecvLen;
+        queue.mDropped++;
+        ALOGE ("%s: queue full; h = 0x%X  dropped len = %u  remote sap = 0x%X  total dropped = %u",
+                __FUNCTION__, handle, len, remoteSap, queue.mDropped);
+        return;
     }
 
-    if (sConnlessRecvWaitingForData)
+    tConnlessDatagram& slot = queue.mRing [(queue.mHead + queue.mCount) % CONNLESS_RING_SIZE];
+    if (len > sizeof(slot.mData))
     {
-        sConnlessRecvWaitingForData = JNI_FALSE;
-        sConnlessRecvLen = len;
-        memcpy (sConnlessRecvBuf, data, len);
-        sConnlessRecvRemoteSap = remoteSap;
-
-        sem_post (&sConnlessRecvSem);
+        queue.mTruncated++;
+        len = sizeof(slot.mData);
     }
+    slot.mRemoteSap = remoteSap;
+    slot.mLen = len;
+    memcpy (slot.mData, data, len);
+    queue.mCount++;
+    queue.mReceived++;
+
+    ALOGD ("%s: h = 0x%X  len = %u  remote sap = 0x%X  queued = %u", __FUNCTION__, handle, len, remoteSap, queue.mCount);
+    sConnlessRecvEvent.notifyAll (); //receivers of other sockets wait on the same event
 }
 
 
 /*******************************************************************************
 **
-** Function:        connectionlessCleanup
+** Function:        nativeLlcpConnectionlessSocket_abortWait
 **
-** Description:     Free resources.
+** Description:     Abort current operation and unblock threads.  Datagrams
+**                  still queued belong to the link that went away; discard them.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-static jobject connectionlessCleanup ()
+void nativeLlcpConnectionlessSocket_abortWait ()
 {
-    sConnlessRecvWaitingForData = JNI_FALSE;
-    sConnlessRecvLen = 0;
-    if (sConnlessRecvBuf != NULL)
+    SyncEventGuard guard (sConnlessRecvEvent);
+    sConnlessAbortCount++;
+    for (tConnlessQueues::iterator it = sConnlessQueues.begin (); it != sConnlessQueues.end (); ++it)
     {
-        free (sConnlessRecvBuf);
-        sConnlessRecvBuf = NULL;
+        tConnlessQueue& queue = *it->second;
+        queue.mDropped += queue.mCount;
+        queue.mHead = 0;
+        queue.mCount = 0;
     }
-    return NULL;
+    sConnlessRecvEvent.notifyAll ();
 }
 
 
 /*******************************************************************************
 **
-** Function:        nativeLlcpConnectionlessSocket_abortWait
+** Function:        nativeLlcpConnectionlessSocket_dump
 **
-** Description:     Abort current operation and unblock threads.
+** Description:     Append receive queue counters to a dump.
+**                  dump: Text to append to.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void nativeLlcpConnectionlessSocket_abortWait ()
+void nativeLlcpConnectionlessSocket_dump (std::string& dump)
 {
-    sem_post (&sConnlessRecvSem);
+    char buffer [160];
+    SyncEventGuard guard (sConnlessRecvEvent);
+    if (sConnlessQueues.empty ())
+        dump.append ("llcp connectionless: no sockets\n");
+    for (tConnlessQueues::iterator it = sConnlessQueues.begin (); it != sConnlessQueues.end (); ++it)
+    {
+        const tConnlessQueue& queue = *it->second;
+        snprintf (buffer, sizeof(buffer), "llcp connectionless 0x%X: received=%u queued=%u dropped=%u truncated=%u\n",
+                it->first, queue.mReceived, queue.mCount, queue.mDropped, queue.mTruncated);
+        dump.append (buffer);
+    }
 }
 
 
 /*******************************************************************************
 **
-** Function:        nativeLlcpConnectionlessSocket_doReceiveFrom
+** Function:        takeDatagrams
 **
-** Description:     Receive data from a peer.
-**                  e: JVM environment.
-**                  o: Java object.
-**                  linkMiu: max info unit
+** Description:     Wait for at least one datagram on a socket, then take up
+**                  to maxPackets of its datagrams.
+**                  handle: NFA handle of the socket.
+**                  linkMiu: max info unit; longer datagrams are truncated.
+**                  maxPackets: max number of datagrams to take.
+**                  packets: Receives the datagrams.
 **
-** Returns:         LlcpPacket Java object.
+** Returns:         False if the wait was aborted or the socket was closed.
 **
 *******************************************************************************/
-static jobject nativeLlcpConnectionlessSocket_doReceiveFrom (JNIEnv* e, jobject, jint linkMiu)
+static bool takeDatagrams (tNFA_HANDLE handle, uint32_t linkMiu, uint32_t maxPackets, std::vector<tConnlessPacket>& packets)
 {
-    ALOGD ("%s: linkMiu = %d", __FUNCTION__, linkMiu);
-    jobject llcpPacket = NULL;
-    ScopedLocalRef<jclass> clsLlcpPacket(e, NULL);
+    SyncEventGuard guard (sConnlessRecvEvent);
+    uint32_t abortCount = sConnlessAbortCount;
+    tConnlessQueue* queue = findQueue (handle, true);
 
-    if (sConnlessRecvWaitingForData != JNI_FALSE)
+    while ((queue != NULL) && (queue->mCount == 0) && (sConnlessAbortCount == abortCount))
     {
-        ALOGD ("%s: Already waiting for incoming data", __FUNCTION__);
-        return NULL;
+        sConnlessRecvEvent.wait ();
+        queue = findQueue (handle, false); //gone if the socket was closed
     }
+    if ((queue == NULL) || (queue->mCount == 0))
+        return false;
 
-    sConnlessRecvBuf = (uint8_t*) malloc (linkMiu);
-    if (sConnlessRecvBuf == NULL)
+    while ((queue->mCount > 0) && (packets.size() < maxPackets))
     {
-        ALOGD ("%s: Failed to allocate %d bytes memory buffer", __FUNCTION__, linkMiu);
-        return NULL;
-    }
-    sConnlessRecvLen = linkMiu;
-
-    // Create the write semaphore
-    if (sem_init (&sConnlessRecvSem, 0, 0) == -1)
-    {
-        ALOGE ("%s: semaphore creation failed (errno=0x%08x)", __FUNCTION__, errno);
-        return connectionlessCleanup ();
+        const tConnlessDatagram& slot = queue->mRing [queue->mHead];
+        uint32_t len = slot.mLen;
+        if (len > linkMiu)
+        {
+            queue->mTruncated++;
+            len = linkMiu;
+        }
+
+        packets.push_back (tConnlessPacket());
+        packets.back().mRemoteSap = slot.mRemoteSap;
+        packets.back().mData.assign (slot.mData, slot.mData + len);
+
+        queue->mHead = (queue->mHead + 1) % CONNLESS_RING_SIZE;
+        queue->mCount--;
     }
+    return true;
+}
 
-    sConnlessRecvWaitingForData = JNI_TRUE;
 
-    // Wait for sConnlessRecvSem completion status
-    if (sem_wait (&sConnlessRecvSem))
-    {
-        ALOGE ("%s: Failed to wait for write semaphore (errno=0x%08x)", __FUNCTION__, errno);
-        goto TheEnd;
-    }
+/*******************************************************************************
+**
+** Function:        createLlcpPacket
+**
+** Description:     Create an LlcpPacket Java object.
+**                  e: JVM environment.
+**                  packet: Remote SAP and data.
+**
+** Returns:         LlcpPacket Java object; NULL if error.
+**
+*******************************************************************************/
+static jobject createLlcpPacket (JNIEnv* e, const tConnlessPacket& packet)
+{
+    jobject llcpPacket = NULL;
 
     // Create new LlcpPacket object
     if (nfc_jni_cache_object_local (e, "com/android/nfc/LlcpPacket", &(llcpPacket)) == -1)
     {
         ALOGE ("%s: Find LlcpPacket class error", __FUNCTION__);
-        return connectionlessCleanup ();
+        return NULL;
     }
 
     // Get NativeConnectionless class object
-    clsLlcpPacket.reset(e->GetObjectClass(llcpPacket));
+    ScopedLocalRef<jclass> clsLlcpPacket(e, e->GetObjectClass(llcpPacket));
     if (e->ExceptionCheck())
     {
         e->ExceptionClear();
         ALOGE ("%s: Get Object class error", __FUNCTION__);
-        return connectionlessCleanup ();
+        e->DeleteLocalRef (llcpPacket);
+        return NULL;
     }
 
     // Set Llcp Packet remote SAP
     jfieldID f;
     f = e->GetFieldID(clsLlcpPacket.get(), "mRemoteSap", "I");
-    e->SetIntField(llcpPacket, f, (jbyte) sConnlessRecvRemoteSap);
+    e->SetIntField(llcpPacket, f, (jbyte) packet.mRemoteSap);
 
     // Set Llcp Packet Buffer
-    ALOGD ("%s: Received Llcp packet buffer size = %d\n", __FUNCTION__, sConnlessRecvLen);
+    ALOGD ("%s: Received Llcp packet buffer size = %u", __FUNCTION__, packet.mData.size());
     f = e->GetFieldID(clsLlcpPacket.get(), "mDataBuffer", "[B");
 
+    ScopedLocalRef<jbyteArray> receivedData(e, e->NewByteArray(packet.mData.size()));
+    if (!packet.mData.empty())
+        e->SetByteArrayRegion(receivedData.get(), 0, packet.mData.size(), (const jbyte*) &packet.mData[0]);
+    e->SetObjectField(llcpPacket, f, receivedData.get());
+    return llcpPacket;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeLlcpConnectionlessSocket_doReceiveFrom
+**
+** Description:     Receive data from a peer.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  linkMiu: max info unit
+**
+** Returns:         LlcpPacket Java object.
+**
+*******************************************************************************/
+static jobject nativeLlcpConnectionlessSocket_doReceiveFrom (JNIEnv* e, jobject o, jint linkMiu)
+{
+    ALOGD ("%s: linkMiu = %d", __FUNCTION__, linkMiu);
+    std::vector<tConnlessPacket> packets;
+
+    if ((linkMiu <= 0) || !takeDatagrams (getSocketHandle (e, o), linkMiu, 1, packets))
+        return NULL;
+    return createLlcpPacket (e, packets[0]);
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeLlcpConnectionlessSocket_doReceiveFromBatch
+**
+** Description:     Receive several datagrams from peers in one call.  Waits
+**                  for the first one, then takes whatever else is queued.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  linkMiu: max info unit
+**                  maxPackets: max number of datagrams to return.
+**
+** Returns:         Array of LlcpPacket Java objects; NULL if error.
+**
+*******************************************************************************/
+static jobjectArray nativeLlcpConnectionlessSocket_doReceiveFromBatch (JNIEnv* e, jobject o, jint linkMiu, jint maxPackets)
+{
+    ALOGD ("%s: linkMiu = %d  maxPackets = %d", __FUNCTION__, linkMiu, maxPackets);
+    std::vector<tConnlessPacket> packets;
+
+    if ((linkMiu <= 0) || (maxPackets <= 0) || !takeDatagrams (getSocketHandle (e, o), linkMiu, maxPackets, packets))
+        return NULL;
+
+    ScopedLocalRef<jclass> clsLlcpPacket(e, e->FindClass("com/android/nfc/LlcpPacket"));
+    if (clsLlcpPacket.get() == NULL)
     {
-        ScopedLocalRef<jbyteArray> receivedData(e, e->NewByteArray(sConnlessRecvLen));
-        e->SetByteArrayRegion(receivedData.get(), 0, sConnlessRecvLen, (jbyte*) sConnlessRecvBuf);
-        e->SetObjectField(llcpPacket, f, receivedData.get());
+        ALOGE ("%s: Find LlcpPacket class error", __FUNCTION__);
+        return NULL;
     }
+    jobjectArray result = e->NewObjectArray (packets.size(), clsLlcpPacket.get(), NULL);
+    if (result == NULL)
+        return NULL;
 
-TheEnd: // TODO: should all the "return connectionlessCleanup()"s in this function jump here instead?
-    connectionlessCleanup ();
-    if (sem_destroy (&sConnlessRecvSem))
+    for (size_t i = 0; i < packets.size(); i++)
     {
-        ALOGE ("%s: Failed to destroy sConnlessRecvSem semaphore (errno=0x%08x)", __FUNCTION__, errno);
+        ScopedLocalRef<jobject> llcpPacket(e, createLlcpPacket (e, packets[i]));
+        if (llcpPacket.get() == NULL)
+        {
+            e->DeleteLocalRef (result);
+            return NULL;
+        }
+        e->SetObjectArrayElement (result, i, llcpPacket.get());
     }
-    return llcpPacket;
+    return result;
 }
 
 
@@ -250,7 +430,8 @@ TheEnd: // TODO: should all the "return connectionlessCleanup()"s in this functi
 **
 ** Function:        nativeLlcpConnectionlessSocket_doClose
 **
-** Description:     Close socket.
+** Description:     Close socket.  Its receive queue is freed, and receivers
+**                  waiting on it are unblocked.
 **                  e: JVM environment.
 **                  o: Java object.
 **
@@ -261,11 +442,19 @@ static jboolean nativeLlcpConnectionlessSocket_doClose (JNIEnv *e, jobject o)
 {
     ALOGD ("%s", __FUNCTION__);
 
-    ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-    jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
-    jint handle = e->GetIntField(o, f);
+    tNFA_HANDLE handle = getSocketHandle (e, o);
+    {
+        SyncEventGuard guard (sConnlessRecvEvent);
+        tConnlessQueues::iterator it = sConnlessQueues.find (handle);
+        if (it != sConnlessQueues.end ())
+        {
+            delete it->second;
+            sConnlessQueues.erase (it);
+        }
+        sConnlessRecvEvent.notifyAll ();
+    }
 
-    tNFA_STATUS status = NFA_P2pDisconnect((tNFA_HANDLE) handle, FALSE);
+    tNFA_STATUS status = NFA_P2pDisconnect(handle, FALSE);
     if (status != NFA_STATUS_OK)
     {
         ALOGE ("%s: disconnect failed, status = %d", __FUNCTION__, status);
@@ -284,6 +473,7 @@ static JNINativeMethod gMethods[] =
 {
     {"doSendTo", "(I[B)Z", (void*) nativeLlcpConnectionlessSocket_doSendTo},
     {"doReceiveFrom", "(I)Lcom/android/nfc/LlcpPacket;", (void*) nativeLlcpConnectionlessSocket_doReceiveFrom},
+    {"doReceiveFromBatch", "(II)[Lcom/android/nfc/LlcpPacket;", (void*) nativeLlcpConnectionlessSocket_doReceiveFromBatch},
     {"doClose", "()Z", (void*) nativeLlcpConnectionlessSocket_doClose},
 };
 
@@ -128,6 +128,44 @@ static jboolean nativeLlcpSocket_doSend (JNIEnv* e, jobject o, jbyteArray data)
 }
 
 
+/*******************************************************************************
+**
+** Function:        nativeLlcpSocket_doSendSegmented
+**
+** Description:     Send a payload of any length to peer; it is split into
+**                  PDUs of at most the peer's MIU in native code.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  data: Buffer of data.
+**                  offset: Offset of payload in data.
+**                  length: Length of payload.
+**                  segmentSize: Upper bound for a PDU; 0 to use peer's MIU.
+**
+** Returns:         True if sent ok.
+**
+*******************************************************************************/
+static jboolean nativeLlcpSocket_doSendSegmented (JNIEnv* e, jobject o, jbyteArray data, jint offset, jint length, jint segmentSize)
+{
+    ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: enter; offset=%d  length=%d  segment size=%d", __FUNCTION__, offset, length, segmentSize);
+
+    ScopedByteArrayRO bytes(e, data);
+    if ((bytes.get() == NULL) || (offset < 0) || (length < 0) || (segmentSize < 0)
+            || ((size_t) offset > bytes.size()) || ((size_t) length > bytes.size() - offset))
+    {
+        ALOGE ("%s: invalid range", __FUNCTION__);
+        return JNI_FALSE;
+    }
+
+    PeerToPeer::tJNI_HANDLE jniHandle = (PeerToPeer::tJNI_HANDLE) nfc_jni_get_nfc_socket_handle(e, o);
+    UINT16 maxSegmentLen = (segmentSize > 0xFFFF) ? 0 : (UINT16) segmentSize;
+    bool stat = PeerToPeer::getInstance().sendSegmented (jniHandle, reinterpret_cast<const UINT8*>(bytes.get()) + offset,
+            length, maxSegmentLen);
+
+    ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: exit", __FUNCTION__);
+    return stat ? JNI_TRUE : JNI_FALSE;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        nativeLlcpSocket_doReceive
@@ -163,6 +201,62 @@ static jint nativeLlcpSocket_doReceive(JNIEnv *e, jobject o, jbyteArray origBuff
 }
 
 
+/*******************************************************************************
+**
+** Function:        nativeLlcpSocket_doReceiveNonBlocking
+**
+** Description:     Receive data from peer if any is queued; never waits.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  origBuffer: Buffer to put received data.
+**
+** Returns:         Number of bytes received; 0 if nothing is queued;
+**                  -1 if the connection is closed.
+**
+*******************************************************************************/
+static jint nativeLlcpSocket_doReceiveNonBlocking(JNIEnv *e, jobject o, jbyteArray origBuffer)
+{
+    ScopedByteArrayRW bytes(e, origBuffer);
+    if (bytes.get() == NULL)
+    {
+        ALOGE ("%s: no buffer", __FUNCTION__);
+        return -1;
+    }
+
+    PeerToPeer::tJNI_HANDLE jniHandle = (PeerToPeer::tJNI_HANDLE) nfc_jni_get_nfc_socket_handle(e, o);
+    uint16_t actualLen = 0;
+    PeerToPeer::tRecvStatus stat = PeerToPeer::getInstance().receiveNonBlocking(jniHandle,
+            reinterpret_cast<UINT8*>(&bytes[0]), bytes.size(), actualLen);
+
+    jint retval = 0;
+    if (stat == PeerToPeer::RECV_OK)
+        retval = actualLen;
+    else if (stat == PeerToPeer::RECV_CLOSED)
+        retval = -1;
+
+    ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: exit; actual len=%d", __FUNCTION__, retval);
+    return retval;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeLlcpSocket_doWatchReadable
+**
+** Description:     Report this socket to NativeNfcManager.waitForLlcpData().
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static jboolean nativeLlcpSocket_doWatchReadable(JNIEnv *e, jobject o)
+{
+    PeerToPeer::tJNI_HANDLE jniHandle = (PeerToPeer::tJNI_HANDLE) nfc_jni_get_nfc_socket_handle(e, o);
+    return PeerToPeer::getInstance().watchReadable (jniHandle) ? JNI_TRUE : JNI_FALSE;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        nativeLlcpSocket_doGetRemoteSocketMIU
@@ -220,7 +314,10 @@ static JNINativeMethod gMethods[] =
     {"doConnectBy", "(Ljava/lang/String;)Z", (void*) nativeLlcpSocket_doConnectBy},
     {"doClose", "()Z", (void *) nativeLlcpSocket_doClose},
     {"doSend", "([B)Z", (void *) nativeLlcpSocket_doSend},
+    {"doSendSegmented", "([BIII)Z", (void *) nativeLlcpSocket_doSendSegmented},
     {"doReceive", "([B)I", (void *) nativeLlcpSocket_doReceive},
+    {"doReceiveNonBlocking", "([B)I", (void *) nativeLlcpSocket_doReceiveNonBlocking},
+    {"doWatchReadable", "()Z", (void *) nativeLlcpSocket_doWatchReadable},
     {"doGetRemoteSocketMiu", "()I", (void *) nativeLlcpSocket_doGetRemoteSocketMIU},
     {"doGetRemoteSocketRw", "()I", (void *) nativeLlcpSocket_doGetRemoteSocketRW},
 };
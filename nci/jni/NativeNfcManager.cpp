@@ -27,6 +27,8 @@
 #include "PowerSwitch.h"
 #include "JavaClassConstants.h"
 #include "Pn544Interop.h"
+#include "LatencyStats.h"
+#include "TimerWheel.h"
 #include <ScopedLocalRef.h>
 #include <ScopedUtfChars.h>
 #include <ScopedPrimitiveArray.h>
@@ -62,7 +64,9 @@ namespace android
     extern void nativeNfcTag_abortWaits ();
     extern void nativeLlcpConnectionlessSocket_abortWait ();
     extern void nativeNfcTag_registerNdefTypeHandler ();
-    extern void nativeLlcpConnectionlessSocket_receiveData (uint8_t* data, uint32_t len, uint32_t remote_sap);
+    extern void nativeLlcpConnectionlessSocket_receiveData (tNFA_HANDLE handle, uint8_t* data, uint32_t len, uint32_t remote_sap);
+    extern void nativeLlcpConnectionlessSocket_dump (std::string& dump);
+    extern void nativeNfcTag_dump (std::string& dump);
 }
 
 
@@ -83,6 +87,7 @@ namespace android
     jmethodID               gCachedNfcManagerNotifyLlcpFirstPacketReceived;
     jmethodID               gCachedNfcManagerNotifyHostEmuActivated;
     jmethodID               gCachedNfcManagerNotifyHostEmuData;
+    jmethodID               gCachedNfcManagerNotifyHostEmuDataDirect;
     jmethodID               gCachedNfcManagerNotifyHostEmuDeactivated;
     jmethodID               gCachedNfcManagerNotifyRfFieldActivated;
     jmethodID               gCachedNfcManagerNotifyRfFieldDeactivated;
@@ -561,6 +566,9 @@ static jboolean nfcManager_initNativeStruc (JNIEnv* e, jobject o)
     gCachedNfcManagerNotifyHostEmuData = e->GetMethodID(cls.get(),
             "notifyHostEmuData", "([B)V");
 
+    gCachedNfcManagerNotifyHostEmuDataDirect = e->GetMethodID(cls.get(),
+            "notifyHostEmuDataDirect", "(Ljava/nio/ByteBuffer;II)V");
+
     gCachedNfcManagerNotifyHostEmuDeactivated = e->GetMethodID(cls.get(),
             "notifyHostEmuDeactivated", "()V");
 
@@ -925,13 +933,15 @@ TheEnd:
 **                  o: Java object.
 **                  technologies_mask: the bitmask of technologies for which to enable discovery
 **                  enable_lptd: whether to enable low power polling (default: false)
+**                  skip_ndef_check: whether reader mode skips the NDEF check,
+**                  so tags are not read eagerly at activation
 **
 ** Returns:         None
 **
 *******************************************************************************/
 static void nfcManager_enableDiscovery (JNIEnv* e, jobject o, jint technologies_mask, \
     jboolean enable_lptd, jboolean reader_mode, jboolean enable_host_routing,
-    jboolean restart)
+    jboolean skip_ndef_check, jboolean restart)
 {
     tNFA_TECHNOLOGY_MASK tech_mask = DEFAULT_TECH_MASK;
     struct nfc_jni_native_data *nat = getNative(e, o);
@@ -950,6 +960,8 @@ static void nfcManager_enableDiscovery (JNIEnv* e, jobject o, jint technologies_
 
     tNFA_STATUS stat = NFA_STATUS_OK;
 
+    NfcTag::getInstance ().setSkipNdefCheck (reader_mode && skip_ndef_check);
+
     PowerSwitch::getInstance ().setLevel (PowerSwitch::FULL_POWER);
 
     if (sRfEnabled) {
@@ -1385,6 +1397,44 @@ static jboolean nfcManager_doCheckLlcp(JNIEnv*, jobject)
 }
 
 
+/*******************************************************************************
+**
+** Function:        nfcManager_doWaitForLlcpData
+**
+** Description:     Wait until LLCP connection-oriented sockets have data queued
+**                  or have been closed by the peer.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  readyHandles: Receives handles of the ready sockets.
+**                  timeoutMs: Max wait; -1 waits forever, 0 only polls.
+**
+** Returns:         Number of ready sockets; 0 on timeout; -1 on error.
+**
+*******************************************************************************/
+static jint nfcManager_doWaitForLlcpData (JNIEnv* e, jobject, jintArray readyHandles, jint timeoutMs)
+{
+    PeerToPeer::tJNI_HANDLE handles [16];
+    if (readyHandles == NULL)
+    {
+        ALOGE ("%s: no array for handles", __FUNCTION__);
+        return -1;
+    }
+    jsize maxHandles = e->GetArrayLength (readyHandles);
+    if (maxHandles > (jsize) NELEM(handles))
+        maxHandles = NELEM(handles);
+
+    int count = PeerToPeer::getInstance().waitForReadable (handles, maxHandles, timeoutMs);
+    if (count > 0)
+    {
+        jint ready [16];
+        for (int i = 0; i < count; i++)
+            ready [i] = (jint) handles [i];
+        e->SetIntArrayRegion (readyHandles, 0, count, ready);
+    }
+    return count;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        nfcManager_doActivateLlcp
@@ -1505,7 +1555,8 @@ static jint nfcManager_doGetTimeout(JNIEnv*, jobject, jint tech)
 **
 ** Function:        nfcManager_doDump
 **
-** Description:     Not used.
+** Description:     Dump LLC errors, data-path latency statistics and
+**                  RF interface switch counters.
 **                  e: JVM environment.
 **                  o: Java object.
 **
@@ -1515,8 +1566,18 @@ static jint nfcManager_doGetTimeout(JNIEnv*, jobject, jint tech)
 static jstring nfcManager_doDump(JNIEnv* e, jobject)
 {
     char buffer[100];
-    snprintf(buffer, sizeof(buffer), "libnfc llc error_count=%u", /*libnfc_llc_error_count*/ 0);
-    return e->NewStringUTF(buffer);
+    snprintf(buffer, sizeof(buffer), "libnfc llc error_count=%u\n", /*libnfc_llc_error_count*/ 0);
+    std::string dump (buffer);
+    gTransceiveLatency.dump (dump);
+    gNdefReadLatency.dump (dump);
+    gNdefWriteLatency.dump (dump);
+    gLlcpSendLatency.dump (dump);
+    gHceAssemblyLatency.dump (dump);
+    gHceDataLatency.dump (dump);
+    nativeLlcpConnectionlessSocket_dump (dump);
+    nativeNfcTag_dump (dump);
+    TimerWheel::getInstance ().dump (dump);
+    return e->NewStringUTF(dump.c_str());
 }
 
 
@@ -1616,7 +1677,7 @@ static JNINativeMethod gMethods[] =
     {"commitRouting", "()Z",
             (void*) nfcManager_commitRouting},
 
-    {"doEnableDiscovery", "(IZZZZ)V",
+    {"doEnableDiscovery", "(IZZZZZ)V",
             (void*) nfcManager_enableDiscovery},
 
     {"doCheckLlcp", "()Z",
@@ -1625,6 +1686,9 @@ static JNINativeMethod gMethods[] =
     {"doActivateLlcp", "()Z",
             (void *)nfcManager_doActivateLlcp},
 
+    {"doWaitForLlcpData", "([II)I",
+            (void *)nfcManager_doWaitForLlcpData},
+
     {"doCreateLlcpConnectionlessSocket", "(ILjava/lang/String;)Lcom/android/nfc/dhimpl/NativeLlcpConnectionlessSocket;",
             (void *)nfcManager_doCreateLlcpConnectionlessSocket},
 
@@ -23,12 +23,16 @@
 #include "NfcTag.h"
 #include "config.h"
 #include "Mutex.h"
+#include "Completion.h"
 #include "IntervalTimer.h"
 #include "JavaClassConstants.h"
 #include "Pn544Interop.h"
+#include "NdefCache.h"
+#include "LatencyStats.h"
 #include <ScopedLocalRef.h>
 #include <ScopedPrimitiveArray.h>
 #include <string>
+#include <algorithm>
 
 extern "C"
 {
@@ -77,29 +81,61 @@ namespace android
 #define NDEF_MIFARE_CLASSIC_TAG    101
 
 #define STATUS_CODE_TARGET_LOST    146	// this error code comes from the service
+#define DEFAULT_RF_SWITCH_HYSTERESIS 50 // ms a requested RF interface switch waits to be undone
+#define PRESENCE_CHECK_TIMEOUT     3000 // ms to wait for the stack's presence check result; not a presence verdict
+
+// Results of checkPresence()
+#define TAG_PRESENT                0
+#define TAG_ABSENT                 1
+#define TAG_BUSY                   2
+
+// Response to one raw frame, filled by nativeNfcTag_doTransceiveStatus()
+struct TransceiveResponse
+{
+    std::basic_string<UINT8> mData; // response
+    bool    mRfTimeout; // stack reported an RF timeout instead of a response
+
+    TransceiveResponse () : mRfTimeout (false) {}
+
+    void swap (TransceiveResponse& other)
+    {
+        mData.swap (other.mData);
+        std::swap (mRfTimeout, other.mRfTimeout);
+    }
+};
+
+// Presence check carries no payload; its result is the completion status
+struct PresenceCheckResult
+{
+    void swap (PresenceCheckResult&) {}
+};
 
 static uint32_t     sCheckNdefCurrentSize = 0;
 static tNFA_STATUS  sCheckNdefStatus = 0; //whether tag already contains a NDEF message
 static bool         sCheckNdefCapable = false; //whether tag has NDEF capability
 static tNFA_HANDLE  sNdefTypeHandlerHandle = NFA_HANDLE_INVALID;
 static tNFA_INTF_TYPE   sCurrentRfInterface = NFA_INTERFACE_ISO_DEP;
-static std::basic_string<UINT8> sRxDataBuffer;
-static tNFA_STATUS  sRxDataStatus = NFA_STATUS_OK;
-static bool         sWaitingForTransceive = false;
-static bool         sTransceiveRfTimeout = false;
+static Completion<TransceiveResponse> sTransceive; // raw frame waiting for the tag's response
 static Mutex        sRfInterfaceMutex;
+static Mutex        sTagOpMutex; // held by every tag operation, so the presence watcher never overlaps one
 static uint32_t     sReadDataLen = 0;
 static uint8_t*     sReadData = NULL;
 static bool         sIsReadingNdefMessage = false;
 static SyncEvent    sReadEvent;
 static sem_t        sWriteSem;
 static sem_t        sFormatSem;
-static SyncEvent    sTransceiveEvent;
 static SyncEvent    sReconnectEvent;
 static sem_t        sCheckNdefSem;
-static SyncEvent    sPresenceCheckEvent;
+static Completion<PresenceCheckResult> sPresenceCheck;
 static sem_t        sMakeReadonlySem;
-static IntervalTimer sSwitchBackTimer; // timer used to tell us to switch back to ISO_DEP frame interface
+static IntervalTimer sSwitchBackTimer; // applies a deferred RF interface switch once the hysteresis expires
+static Mutex        sRfSwitchMutex; // guards the deferred RF interface switch
+static bool         sRfSwitchPending = false; // Java connected to a technology on another RF interface
+static bool         sRfSwitchFailed = false; // a deferred switch failed; tag operations fail until reconnect
+static tNFA_INTF_TYPE sPendingRfInterface = NFA_INTERFACE_ISO_DEP;
+static int          sRfSwitchHysteresis = DEFAULT_RF_SWITCH_HYSTERESIS; // 0 switches at once
+static uint32_t     sRfSwitchesPerformed = 0;
+static uint32_t     sRfSwitchesAvoided = 0;
 static jboolean     sWriteOk = JNI_FALSE;
 static jboolean     sWriteWaitingForComplete = JNI_FALSE;
 static bool         sFormatOk = false;
@@ -109,13 +145,34 @@ static bool         sGotDeactivate = false;
 static uint32_t     sCheckNdefMaxSize = 0;
 static bool         sCheckNdefCardReadOnly = false;
 static jboolean     sCheckNdefWaitingForComplete = JNI_FALSE;
-static bool         sIsTagPresent = true;
+static bool         sIsTagPresent = true; // last presence check result; reported if a check is aborted
 static tNFA_STATUS  sMakeReadonlyStatus = NFA_STATUS_FAILED;
 static jboolean     sMakeReadonlyWaitingForComplete = JNI_FALSE;
 static int          sCurrentConnectedTargetType = TARGET_TYPE_UNKNOWN;
+static bool         sNdefFromCache = false; // NDEF check and read are answered from NdefCache
+static NdefCache::Bytes sCachedNdefMessage; // message served while sNdefFromCache is true
+static NdefCache::Bytes sNdefFingerprint; // fingerprint of the activated tag, once read
+static IntervalTimer sPresenceWatchTimer; // schedules presence checks of the presence watcher
+static Mutex        sPresenceWatchMutex;
+static bool         sPresenceWatchActive = false;
+static int          sPresenceWatchInterval = 0; // current interval; doubles while tag stays present
+static int          sPresenceWatchMinInterval = 0;
+static int          sPresenceWatchMaxInterval = 0;
+static JavaVM*      sPresenceWatchVm = NULL;
+static jobject      sPresenceWatchTag = NULL; // global ref to Java NativeNfcTag being watched
+static jmethodID    sCachedNfcTagNotifyTagLost = NULL;
+enum {EAGER_NDEF_IDLE, EAGER_NDEF_DETECTING, EAGER_NDEF_READING};
+static int          sEagerNdefState = EAGER_NDEF_IDLE; // NDEF check and read started at activation
 
 static int reSelect (tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded);
 static bool switchRfInterface(tNFA_INTF_TYPE rfInterface);
+static bool requestRfInterface (tNFA_INTF_TYPE rfInterface);
+static bool applyPendingRfInterface ();
+static void cancelPendingRfInterface ();
+static bool transceiveFrame (uint8_t* buf, size_t bufLen, int timeout, bool& targetLost, TransceiveResponse& response);
+static void finishEagerNdefRead (bool haveMessage);
+static bool readNdefFingerprint (NdefCache::Bytes& fingerprint);
+static void presenceWatchCallback (union sigval);
 
 
 /*******************************************************************************
@@ -136,23 +193,25 @@ void nativeNfcTag_abortWaits ()
     }
     sem_post (&sWriteSem);
     sem_post (&sFormatSem);
-    {
-        SyncEventGuard g (sTransceiveEvent);
-        sTransceiveEvent.notifyOne ();
-    }
+    sTransceive.abort (NFA_STATUS_FAILED);
     {
         SyncEventGuard g (sReconnectEvent);
         sReconnectEvent.notifyOne ();
     }
 
     sem_post (&sCheckNdefSem);
+    sPresenceCheck.abort (sIsTagPresent ? NFA_STATUS_OK : NFA_STATUS_FAILED);
+    sem_post (&sMakeReadonlySem);
+    if (sEagerNdefState != EAGER_NDEF_IDLE)
     {
-        SyncEventGuard guard (sPresenceCheckEvent);
-        sPresenceCheckEvent.notifyOne ();
+        sEagerNdefState = EAGER_NDEF_IDLE;
+        sIsReadingNdefMessage = false;
     }
-    sem_post (&sMakeReadonlySem);
+    sRfSwitchPending = false; //not locked; a switch in progress holds sRfSwitchMutex until it times out
+    sRfSwitchFailed = false;
     sCurrentRfInterface = NFA_INTERFACE_ISO_DEP;
     sCurrentConnectedTargetType = TARGET_TYPE_UNKNOWN;
+    sNdefFromCache = false;
 }
 
 /*******************************************************************************
@@ -173,6 +232,13 @@ void nativeNfcTag_doReadCompleted (tNFA_STATUS status)
     if (sIsReadingNdefMessage == false)
         return; //not reading NDEF message right now, so just return
 
+    if (sEagerNdefState == EAGER_NDEF_READING)
+    {
+        sIsReadingNdefMessage = false;
+        finishEagerNdefRead ((status == NFA_STATUS_OK) && (sReadDataLen > 0));
+        return;
+    }
+
     if (status != NFA_STATUS_OK)
     {
         sReadDataLen = 0;
@@ -226,6 +292,76 @@ static void ndefHandlerCallback (tNFA_NDEF_EVT event, tNFA_NDEF_EVT_DATA *eventD
 }
 
 
+/*******************************************************************************
+**
+** Function:        storeNdefCache
+**
+** Description:     Remember the NDEF message of the activated tag together with
+**                  its fingerprint.  Only read-only tags are cached: the
+**                  fingerprint covers the capability container and the NDEF
+**                  length, not the message, so it cannot detect a rewrite of
+**                  the same length.  It does detect a tag that is no longer
+**                  read-only, because the access bits are in the capability
+**                  container.
+**                  data: NDEF message.
+**                  dataLen: Length of NDEF message.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void storeNdefCache (const UINT8* data, UINT32 dataLen)
+{
+    const NdefCache::Bytes& key = NfcTag::getInstance ().getNdefCacheKey ();
+    if (key.empty () || !sCheckNdefCardReadOnly || (dataLen > NdefCache::MAX_MESSAGE_SIZE))
+        return;
+    if (sNdefFingerprint.empty () && !readNdefFingerprint (sNdefFingerprint))
+        return;
+
+    NdefCache::Entry entry;
+    entry.mKey = key;
+    entry.mFingerprint = sNdefFingerprint;
+    entry.mMessage.assign (data, dataLen);
+    entry.mMaxSize = sCheckNdefMaxSize;
+    entry.mReadOnly = sCheckNdefCardReadOnly;
+    NdefCache::getInstance ().put (entry);
+}
+
+
+/*******************************************************************************
+**
+** Function:        invalidateNdefCache
+**
+** Description:     Forget the cached NDEF message of the activated tag before
+**                  the tag is modified.  If the last NDEF check was answered
+**                  from the cache, let the stack detect NDEF now since it must
+**                  know the tag's NDEF layout to modify it.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void invalidateNdefCache ()
+{
+    NdefCache::getInstance ().remove (NfcTag::getInstance ().getNdefCacheKey ());
+    sNdefFingerprint.clear ();
+    if (!sNdefFromCache)
+        return;
+
+    ALOGD ("%s: detect NDEF skipped by cache", __FUNCTION__);
+    sNdefFromCache = false;
+    sCachedNdefMessage.clear ();
+    if (sem_init (&sCheckNdefSem, 0, 0) == -1)
+    {
+        ALOGE ("%s: Check NDEF semaphore creation failed (errno=0x%08x)", __FUNCTION__, errno);
+        return;
+    }
+    sCheckNdefWaitingForComplete = JNI_TRUE;
+    if (NFA_RwDetectNDef () == NFA_STATUS_OK)
+        sem_wait (&sCheckNdefSem);
+    sem_destroy (&sCheckNdefSem);
+    sCheckNdefWaitingForComplete = JNI_FALSE;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        nativeNfcTag_doRead
@@ -242,6 +378,22 @@ static jbyteArray nativeNfcTag_doRead (JNIEnv* e, jobject)
     ALOGD ("%s: enter", __FUNCTION__);
     tNFA_STATUS status = NFA_STATUS_FAILED;
     jbyteArray buf = NULL;
+    AutoMutex op (sTagOpMutex);
+
+    if (!applyPendingRfInterface ())
+    {
+        ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+        return NULL;
+    }
+
+    if (sNdefFromCache)
+    {
+        ALOGD ("%s: %zu bytes from cache", __FUNCTION__, sCachedNdefMessage.size());
+        buf = e->NewByteArray (sCachedNdefMessage.size());
+        if (buf != NULL)
+            e->SetByteArrayRegion (buf, 0, sCachedNdefMessage.size(), (const jbyte*) sCachedNdefMessage.data());
+        return buf;
+    }
 
     sReadDataLen = 0;
     if (sReadData != NULL)
@@ -252,6 +404,8 @@ static jbyteArray nativeNfcTag_doRead (JNIEnv* e, jobject)
 
     if (sCheckNdefCurrentSize > 0)
     {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
         {
             SyncEventGuard g (sReadEvent);
             sIsReadingNdefMessage = true;
@@ -265,6 +419,8 @@ static jbyteArray nativeNfcTag_doRead (JNIEnv* e, jobject)
             ALOGD ("%s: read %u bytes", __FUNCTION__, sReadDataLen);
             buf = e->NewByteArray (sReadDataLen);
             e->SetByteArrayRegion (buf, 0, sReadDataLen, (jbyte*) sReadData);
+            storeNdefCache (sReadData, sReadDataLen);
+            gNdefReadLatency.record (start, sReadDataLen);
         }
     }
     else
@@ -352,6 +508,17 @@ static jboolean nativeNfcTag_doWrite (JNIEnv* e, jobject, jbyteArray buf)
     UINT8* p_data = const_cast<UINT8*>(reinterpret_cast<const UINT8*>(&bytes[0])); // TODO: const-ness API bug in NFA_RwWriteNDef!
 
     ALOGD ("%s: enter; len = %zu", __FUNCTION__, bytes.size());
+    AutoMutex op (sTagOpMutex);
+
+    if (!applyPendingRfInterface ())
+    {
+        ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+        return JNI_FALSE;
+    }
+
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    invalidateNdefCache ();
 
     /* Create the write semaphore */
     if (sem_init (&sWriteSem, 0, 0) == -1)
@@ -408,6 +575,8 @@ static jboolean nativeNfcTag_doWrite (JNIEnv* e, jobject, jbyteArray buf)
     }
 
     result = sWriteOk;
+    if (result)
+        gNdefWriteLatency.record (start, bytes.size());
 
 TheEnd:
     /* Destroy semaphore */
@@ -465,7 +634,9 @@ void nativeNfcTag_doDeactivateStatus (int status)
 **
 ** Function:        nativeNfcTag_doConnect
 **
-** Description:     Connect to the tag in RF field.
+** Description:     Connect to the tag in RF field.  An RF interface switch
+**                  may be deferred by the hysteresis; the operation that
+**                  next uses the tag performs it and fails if it fails.
 **                  e: JVM environment.
 **                  o: Java object.
 **                  targetHandle: Handle of the tag.
@@ -479,6 +650,7 @@ static jint nativeNfcTag_doConnect (JNIEnv*, jobject, jint targetHandle)
     int i = targetHandle;
     NfcTag& natTag = NfcTag::getInstance ();
     int retCode = NFCSTATUS_SUCCESS;
+    AutoMutex op (sTagOpMutex);
 
     if (i >= NfcTag::MAX_NUM_TECHNOLOGY)
     {
@@ -505,11 +677,11 @@ static jint nativeNfcTag_doConnect (JNIEnv*, jobject, jint targetHandle)
     if (natTag.mTechList[i] == TARGET_TYPE_ISO14443_3A || natTag.mTechList[i] == TARGET_TYPE_ISO14443_3B)
     {
         ALOGD ("%s: switching to tech: %d need to switch rf intf to frame", __FUNCTION__, natTag.mTechList[i]);
-        retCode = switchRfInterface(NFA_INTERFACE_FRAME) ? NFA_STATUS_OK : NFA_STATUS_FAILED;
+        retCode = requestRfInterface(NFA_INTERFACE_FRAME) ? NFA_STATUS_OK : NFA_STATUS_FAILED;
     }
     else
     {
-        retCode = switchRfInterface(NFA_INTERFACE_ISO_DEP) ? NFA_STATUS_OK : NFA_STATUS_FAILED;
+        retCode = requestRfInterface(NFA_INTERFACE_ISO_DEP) ? NFA_STATUS_OK : NFA_STATUS_FAILED;
     }
 
 TheEnd:
@@ -618,7 +790,10 @@ static int reSelect (tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded)
         if (sConnectOk)
         {
             rVal = 0;   // success
+            if (rfInterface != sCurrentRfInterface)
+                sRfSwitchesPerformed++;
             sCurrentRfInterface = rfInterface;
+            sTransceive.abort (NFA_STATUS_FAILED); //tag re-selected; a timed-out frame gets no response
         }
         else
         {
@@ -662,16 +837,179 @@ static bool switchRfInterface (tNFA_INTF_TYPE rfInterface)
 
 /*******************************************************************************
 **
-** Function:        nativeNfcTag_doReconnect
+** Function:        rfSwitchWork
 **
-** Description:     Re-connect to the tag in RF field.
-**                  e: JVM environment.
-**                  o: Java object.
+** Description:     Apply a deferred RF interface switch that was not undone
+**                  within the hysteresis.  Runs on the timer wheel's worker
+**                  thread.  Skipped while a tag operation or presence check
+**                  holds sTagOpMutex; the next operation applies it instead.
+**                  A failure is recorded so that the next operation fails.
+**                  arg: Unused.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void rfSwitchWork (void*)
+{
+    if (!sTagOpMutex.tryLock ())
+    {
+        ALOGD ("%s: tag busy; switch left to next operation", __FUNCTION__);
+        return;
+    }
+    {
+        AutoMutex mutex (sRfSwitchMutex);
+        if (sRfSwitchPending)
+        {
+            sRfSwitchPending = false;
+            ALOGD ("%s: switch to rf intf %d", __FUNCTION__, sPendingRfInterface);
+            if (!switchRfInterface (sPendingRfInterface))
+            {
+                ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+                sRfSwitchFailed = true;
+            }
+        }
+    }
+    sTagOpMutex.unlock ();
+}
+
+
+/*******************************************************************************
+**
+** Function:        rfSwitchTimerProc
+**
+** Description:     Hand the deferred RF interface switch to the worker
+**                  thread; re-selecting blocks.
+**                  sigval: Unused.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void rfSwitchTimerProc (union sigval)
+{
+    TimerWheel::getInstance ().post (rfSwitchWork, NULL);
+}
+
+
+/*******************************************************************************
+**
+** Function:        requestRfInterface
+**
+** Description:     Record the RF interface of the technology Java connects to.
+**                  The switch is deferred until the tag is used or the
+**                  hysteresis expires, so that a switch undone by the next
+**                  connect never reactivates the tag.
+**                  rfInterface: Type of RF interface.
+**
+** Returns:         True if ok; false if an earlier deferred switch failed.
+**
+*******************************************************************************/
+static bool requestRfInterface (tNFA_INTF_TYPE rfInterface)
+{
+    if ((sRfSwitchHysteresis <= 0) ||
+            (NfcTag::getInstance ().mTechLibNfcTypes[0] != NFC_PROTOCOL_ISO_DEP))
+        return switchRfInterface (rfInterface);
+
+    AutoMutex mutex (sRfSwitchMutex);
+    if (sRfSwitchFailed)
+    {
+        ALOGE ("%s: earlier rf interface switch failed", __FUNCTION__);
+        return false;
+    }
+    if (rfInterface == sCurrentRfInterface)
+    {
+        if (sRfSwitchPending)
+        {
+            //the pending switch and the one undoing it are both elided
+            ALOGD ("%s: rf intf %d; pending switch undone", __FUNCTION__, rfInterface);
+            sRfSwitchPending = false;
+            sSwitchBackTimer.kill ();
+            sRfSwitchesAvoided += 2;
+        }
+        return true;
+    }
+
+    ALOGD ("%s: defer switch to rf intf %d by %d ms", __FUNCTION__, rfInterface, sRfSwitchHysteresis);
+    sPendingRfInterface = rfInterface;
+    sRfSwitchPending = true;
+    sSwitchBackTimer.set (sRfSwitchHysteresis, rfSwitchTimerProc);
+    return true;
+}
+
+
+/*******************************************************************************
+**
+** Function:        applyPendingRfInterface
+**
+** Description:     Perform a deferred RF interface switch before the tag is used.
+**                  The caller holds sTagOpMutex.
+**
+** Returns:         True if ok; false if this or an earlier deferred switch
+**                  failed, until the tag is reconnected.
+**
+*******************************************************************************/
+static bool applyPendingRfInterface ()
+{
+    AutoMutex mutex (sRfSwitchMutex);
+    sSwitchBackTimer.kill ();
+    if (sRfSwitchPending)
+    {
+        sRfSwitchPending = false;
+        if (!switchRfInterface (sPendingRfInterface))
+            sRfSwitchFailed = true;
+    }
+    return !sRfSwitchFailed;
+}
+
+
+/*******************************************************************************
+**
+** Function:        cancelPendingRfInterface
+**
+** Description:     Forget a deferred RF interface switch; the tag session ended
+**                  or the tag is re-selected anyway.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void cancelPendingRfInterface ()
+{
+    AutoMutex mutex (sRfSwitchMutex);
+    sSwitchBackTimer.kill ();
+    sRfSwitchPending = false;
+    sRfSwitchFailed = false;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_dump
+**
+** Description:     Append RF interface switch counters to a dump.
+**                  dump: Text to append to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_dump (std::string& dump)
+{
+    char buffer [100];
+    snprintf (buffer, sizeof(buffer), "rf interface switches: performed=%u avoided=%u\n",
+            sRfSwitchesPerformed, sRfSwitchesAvoided);
+    dump.append (buffer);
+}
+
+
+/*******************************************************************************
+**
+** Function:        reconnect
+**
+** Description:     Re-connect to the tag in RF field.  The caller holds
+**                  sTagOpMutex.
 **
 ** Returns:         Status code.
 **
 *******************************************************************************/
-static jint nativeNfcTag_doReconnect (JNIEnv*, jobject)
+static jint reconnect ()
 {
     ALOGD ("%s: enter", __FUNCTION__);
     int retCode = NFCSTATUS_SUCCESS;
@@ -692,6 +1030,7 @@ static jint nativeNfcTag_doReconnect (JNIEnv*, jobject)
     }
 
      // this is only supported for type 2 or 4 (ISO_DEP) tags
+    cancelPendingRfInterface ();
     if (natTag.mTechLibNfcTypes[0] == NFA_PROTOCOL_ISO_DEP)
         retCode = reSelect(NFA_INTERFACE_ISO_DEP, false);
     else if (natTag.mTechLibNfcTypes[0] == NFA_PROTOCOL_T2T)
@@ -703,6 +1042,24 @@ TheEnd:
 }
 
 
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doReconnect
+**
+** Description:     Re-connect to the tag in RF field.
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         Status code.
+**
+*******************************************************************************/
+static jint nativeNfcTag_doReconnect (JNIEnv*, jobject)
+{
+    AutoMutex op (sTagOpMutex);
+    return reconnect ();
+}
+
+
 /*******************************************************************************
 **
 ** Function:        nativeNfcTag_doHandleReconnect
@@ -739,6 +1096,7 @@ static jboolean nativeNfcTag_doDisconnect (JNIEnv*, jobject)
     tNFA_STATUS nfaStat = NFA_STATUS_OK;
 
     NfcTag::getInstance().resetAllTransceiveTimeouts ();
+    cancelPendingRfInterface ();
 
     if (NfcTag::getInstance ().getActivationState () != NfcTag::Active)
     {
@@ -770,32 +1128,122 @@ TheEnd:
 *******************************************************************************/
 void nativeNfcTag_doTransceiveStatus (tNFA_STATUS status, uint8_t* buf, uint32_t bufLen)
 {
-    SyncEventGuard g (sTransceiveEvent);
+    Completion<TransceiveResponse>::Pending pending (sTransceive);
     ALOGD ("%s: data len=%d", __FUNCTION__, bufLen);
-    if (!sWaitingForTransceive)
+    if (pending.isLate ())
+    {
+        //response to a frame whose wait timed out; the next frame's follows
+        ALOGE ("%s: drop late data", __FUNCTION__);
+        if (status != NFA_STATUS_CONTINUE)
+            pending.dropLate ();
+        return;
+    }
+    if (!pending.isActive ())
     {
         ALOGE ("%s: drop data", __FUNCTION__);
         return;
     }
-    sRxDataStatus = status;
-    if (sRxDataStatus == NFA_STATUS_OK || sRxDataStatus == NFA_STATUS_CONTINUE)
-        sRxDataBuffer.append (buf, bufLen);
+    if (status == NFA_STATUS_OK || status == NFA_STATUS_CONTINUE)
+        pending.payload ().mData.append (buf, bufLen);
 
-    if (sRxDataStatus == NFA_STATUS_OK)
-        sTransceiveEvent.notifyOne ();
+    if (status == NFA_STATUS_OK)
+        pending.complete (status);
 }
 
 
 void nativeNfcTag_notifyRfTimeout ()
 {
-    SyncEventGuard g (sTransceiveEvent);
-    ALOGD ("%s: waiting for transceive: %d", __FUNCTION__, sWaitingForTransceive);
-    if (!sWaitingForTransceive)
+    Completion<TransceiveResponse>::Pending pending (sTransceive);
+    ALOGD ("%s: waiting for transceive: %d", __FUNCTION__, pending.isActive ());
+    if (pending.isLate ())
+    {
+        pending.dropLate (); //the timed-out frame got no response either
         return;
+    }
+    if (!pending.isActive ())
+        return;
+
+    pending.payload ().mRfTimeout = true;
+    pending.complete (NFA_STATUS_TIMEOUT);
+}
+
+
+/*******************************************************************************
+**
+** Function:        transceiveFrame
+**
+** Description:     Send one raw frame to the tag and wait for its response.
+**                  buf: Frame to send.
+**                  bufLen: Length of frame.
+**                  timeout: Timeout in milliseconds.
+**                  targetLost: Set to true if tag times out or is deactivated.
+**                  response: Receives the response.
+**
+** Returns:         True if a response was received.
+**
+*******************************************************************************/
+static bool transceiveFrame (uint8_t* buf, size_t bufLen, int timeout, bool& targetLost, TransceiveResponse& response)
+{
+    bool retVal = false;
+    struct timespec start, end;
+    int waitStatus = NFA_STATUS_OK;
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    response.mData.clear ();
+    response.mRfTimeout = false;
+
+    uint32_t id = sTransceive.begin (response);
+
+    do
+    {
+        tNFA_STATUS status = NFA_SendRawFrame (buf, bufLen,
+                NFA_DM_DEFAULT_PRESENCE_CHECK_START_DELAY);
+        if (status != NFA_STATUS_OK)
+        {
+            ALOGE ("%s: fail send; error=%d", __FUNCTION__, status);
+            sTransceive.withdraw (id, response);
+            break;
+        }
+
+        if (!sTransceive.wait (id, timeout, waitStatus, response)) //if timeout occurred
+        {
+            ALOGE ("%s: wait response timeout", __FUNCTION__);
+            NfcTag::getInstance ().recordTransceiveLatency (sCurrentConnectedTargetType, timeout);
+            targetLost = true;
+            break;
+        }
+
+        if (waitStatus != NFA_STATUS_OK)
+        {
+            ALOGE ("%s: wait aborted; status=%d", __FUNCTION__, waitStatus);
+            targetLost = true;
+            break;
+        }
+
+        if (response.mRfTimeout)
+        {
+            ALOGE ("%s: rf timeout", __FUNCTION__);
+            targetLost = true;
+            break;
+        }
+
+        if (NfcTag::getInstance ().getActivationState () != NfcTag::Active)
+        {
+            ALOGE ("%s: already deactivated", __FUNCTION__);
+            targetLost = true;
+            break;
+        }
 
-    sTransceiveRfTimeout = true;
+        UINT32 responseLen = response.mData.size ();
+        ALOGD ("%s: response %u bytes", __FUNCTION__, responseLen);
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        NfcTag::getInstance ().recordTransceiveLatency (sCurrentConnectedTargetType,
+                (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+        gTransceiveLatency.record (start, bufLen + responseLen);
+        retVal = true;
+    } while (0);
 
-    sTransceiveEvent.notifyOne ();
+    return retVal;
 }
 
 
@@ -814,11 +1262,12 @@ void nativeNfcTag_notifyRfTimeout ()
 *******************************************************************************/
 static jbyteArray nativeNfcTag_doTransceive (JNIEnv* e, jobject, jbyteArray data, jboolean raw, jintArray statusTargetLost)
 {
-    int timeout = NfcTag::getInstance ().getTransceiveTimeout (sCurrentConnectedTargetType);
+    int timeout = NfcTag::getInstance ().getEffectiveTransceiveTimeout (sCurrentConnectedTargetType);
     ALOGD ("%s: enter; raw=%u; timeout = %d", __FUNCTION__, raw, timeout);
-    bool waitOk = false;
     bool isNack = false;
+    bool isTargetLost = false;
     jint *targetLost = NULL;
+    AutoMutex op (sTagOpMutex);
 
     if (NfcTag::getInstance ().getActivationState () != NfcTag::Active)
     {
@@ -847,51 +1296,23 @@ static jbyteArray nativeNfcTag_doTransceive (JNIEnv* e, jobject, jbyteArray data
             *targetLost = 0; //success, tag is still present
     }
 
-    sSwitchBackTimer.kill ();
     ScopedLocalRef<jbyteArray> result(e, NULL);
-    do
+    TransceiveResponse response;
+    if (!applyPendingRfInterface ())
     {
-        {
-            SyncEventGuard g (sTransceiveEvent);
-            sTransceiveRfTimeout = false;
-            sWaitingForTransceive = true;
-            sRxDataStatus = NFA_STATUS_OK;
-            sRxDataBuffer.clear ();
-            tNFA_STATUS status = NFA_SendRawFrame (buf, bufLen,
-                    NFA_DM_DEFAULT_PRESENCE_CHECK_START_DELAY);
-            if (status != NFA_STATUS_OK)
-            {
-                ALOGE ("%s: fail send; error=%d", __FUNCTION__, status);
-                break;
-            }
-            waitOk = sTransceiveEvent.wait (timeout);
-        }
-
-        if (waitOk == false || sTransceiveRfTimeout) //if timeout occurred
-        {
-            ALOGE ("%s: wait response timeout", __FUNCTION__);
-            if (targetLost)
-                *targetLost = 1; //causes NFC service to throw TagLostException
-            break;
-        }
-
-        if (NfcTag::getInstance ().getActivationState () != NfcTag::Active)
-        {
-            ALOGE ("%s: already deactivated", __FUNCTION__);
-            if (targetLost)
-                *targetLost = 1; //causes NFC service to throw TagLostException
-            break;
-        }
-
-        ALOGD ("%s: response %d bytes", __FUNCTION__, sRxDataBuffer.size());
-
+        ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+        isTargetLost = true;
+    }
+    else if (transceiveFrame (buf, bufLen, timeout, isTargetLost, response))
+    {
+        std::basic_string<UINT8>& rxData = response.mData;
         if ((natTag.getProtocol () == NFA_PROTOCOL_T2T) &&
-            natTag.isT2tNackResponse (sRxDataBuffer.data(), sRxDataBuffer.size()))
+            natTag.isT2tNackResponse (rxData.data(), rxData.size()))
         {
             isNack = true;
         }
 
-        if (sRxDataBuffer.size() > 0)
+        if (rxData.size() > 0)
         {
             if (isNack)
             {
@@ -899,28 +1320,29 @@ static jbyteArray nativeNfcTag_doTransceive (JNIEnv* e, jobject, jbyteArray data
                 //responds with a NACK.  Need to perform a "reconnect" operation
                 //to wake it.
                 ALOGD ("%s: try reconnect", __FUNCTION__);
-                nativeNfcTag_doReconnect (NULL, NULL);
+                reconnect ();
                 ALOGD ("%s: reconnect finish", __FUNCTION__);
             }
             else
             {
                 // marshall data to java for return
-                result.reset(e->NewByteArray(sRxDataBuffer.size()));
+                result.reset(e->NewByteArray(rxData.size()));
                 if (result.get() != NULL)
                 {
-                    e->SetByteArrayRegion(result.get(), 0, sRxDataBuffer.size(), (const jbyte *) sRxDataBuffer.data());
+                    e->SetByteArrayRegion(result.get(), 0, rxData.size(), (const jbyte *) rxData.data());
                 }
                 else
                     ALOGE ("%s: Failed to allocate java byte array", __FUNCTION__);
             } // else a nack is treated as a transceive failure to the upper layers
-
-            sRxDataBuffer.clear();
         }
-    } while (0);
+    }
 
-    sWaitingForTransceive = false;
     if (targetLost)
+    {
+        if (isTargetLost)
+            *targetLost = 1; //causes NFC service to throw TagLostException
         e->ReleaseIntArrayElements (statusTargetLost, targetLost, 0);
+    }
 
     ALOGD ("%s: exit", __FUNCTION__);
     return result.release();
@@ -977,10 +1399,134 @@ static jint nativeNfcTag_doGetNdefType (JNIEnv*, jobject, jint libnfcType, jint
 
 /*******************************************************************************
 **
-** Function:        nativeNfcTag_doCheckNdefResult
+** Function:        transceiveApdu
 **
-** Description:     Receive the result of checking whether the tag contains a NDEF
-**                  message.  Called by the NFA_NDEF_DETECT_EVT.
+** Description:     Send an APDU to an ISO-DEP tag and check its status word.
+**                  apdu: Command APDU.
+**                  apduLen: Length of command APDU.
+**                  timeout: Timeout in milliseconds.
+**                  response: Receives the response APDU.
+**
+** Returns:         True if the tag answered 90 00.
+**
+*******************************************************************************/
+static bool transceiveApdu (UINT8* apdu, size_t apduLen, int timeout, TransceiveResponse& response)
+{
+    bool targetLost = false;
+    if (!transceiveFrame (apdu, apduLen, timeout, targetLost, response))
+        return false;
+    size_t len = response.mData.size ();
+    return (len >= 2) && (response.mData [len - 2] == 0x90) && (response.mData [len - 1] == 0x00);
+}
+
+
+/*******************************************************************************
+**
+** Function:        readNdefFingerprint
+**
+** Description:     Read the few tag bytes that change whenever the NDEF message
+**                  changes.  T2T: capability container and start of the NDEF
+**                  TLV (pages 3 to 6).  T4T: capability container file and NLEN.
+**                  fingerprint: receives the bytes.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static bool readNdefFingerprint (NdefCache::Bytes& fingerprint)
+{
+    NfcTag& natTag = NfcTag::getInstance ();
+    int timeout = natTag.getEffectiveTransceiveTimeout (sCurrentConnectedTargetType);
+    bool targetLost = false;
+    TransceiveResponse response;
+
+    fingerprint.clear ();
+    if (natTag.getProtocol () == NFA_PROTOCOL_T2T)
+    {
+        UINT8 readCmd [] = {0x30, 0x03}; //READ returns 4 pages starting at page 3
+        if (!transceiveFrame (readCmd, sizeof(readCmd), timeout, targetLost, response) || (response.mData.size () != 16))
+            return false;
+        fingerprint.swap (response.mData);
+    }
+    else if ((natTag.getProtocol () == NFA_PROTOCOL_ISO_DEP) && (sCurrentRfInterface == NFA_INTERFACE_ISO_DEP))
+    {
+        //see NFC Forum Type 4 Tag Operation Specification 2.0, section 5.4
+        UINT8 selectApp [] = {0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00};
+        UINT8 selectCc [] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03};
+        UINT8 readCc [] = {0x00, 0xB0, 0x00, 0x00, 0x0F};
+        UINT8 selectNdef [] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0x00, 0x00};
+        UINT8 readNlen [] = {0x00, 0xB0, 0x00, 0x00, 0x02};
+
+        if (!transceiveApdu (selectApp, sizeof(selectApp), timeout, response) ||
+            !transceiveApdu (selectCc, sizeof(selectCc), timeout, response) ||
+            !transceiveApdu (readCc, sizeof(readCc), timeout, response) ||
+            (response.mData.size () != 0x0F + 2))
+            return false;
+        fingerprint.assign (response.mData.data (), 0x0F);
+        selectNdef [5] = fingerprint [9]; //NDEF file ID from the NDEF File Control TLV
+        selectNdef [6] = fingerprint [10];
+        if (!transceiveApdu (selectNdef, sizeof(selectNdef), timeout, response) ||
+            !transceiveApdu (readNlen, sizeof(readNlen), timeout, response) ||
+            (response.mData.size () != 2 + 2))
+        {
+            fingerprint.clear ();
+            return false;
+        }
+        fingerprint.append (response.mData.data (), 2);
+    }
+    return !fingerprint.empty ();
+}
+
+
+/*******************************************************************************
+**
+** Function:        lookupNdefCache
+**
+** Description:     If the activated tag is in NdefCache, read its fingerprint
+**                  and, if it matches the cached one, load the NDEF check
+**                  results from the cache so that the stack's NDEF detection
+**                  and read can be skipped.  A tag that is not cached costs
+**                  no extra command.
+**
+** Returns:         True if the cached NDEF message is still valid.
+**
+*******************************************************************************/
+static bool lookupNdefCache ()
+{
+    const NdefCache::Bytes& key = NfcTag::getInstance ().getNdefCacheKey ();
+    NdefCache::Entry entry;
+
+    sNdefFromCache = false;
+    sCachedNdefMessage.clear ();
+    if (key.empty () || !NdefCache::getInstance ().find (key, entry))
+        return false;
+
+    if (!readNdefFingerprint (sNdefFingerprint))
+        return false;
+
+    if (entry.mFingerprint != sNdefFingerprint)
+    {
+        ALOGD ("%s: tag changed", __FUNCTION__);
+        NdefCache::getInstance ().remove (key);
+        return false;
+    }
+
+    sCheckNdefStatus = NFA_STATUS_OK;
+    sCheckNdefCapable = true;
+    sCheckNdefMaxSize = entry.mMaxSize;
+    sCheckNdefCurrentSize = entry.mMessage.size ();
+    sCheckNdefCardReadOnly = entry.mReadOnly;
+    sCachedNdefMessage.swap (entry.mMessage);
+    sNdefFromCache = true;
+    return true;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doCheckNdefResult
+**
+** Description:     Receive the result of checking whether the tag contains a NDEF
+**                  message.  Called by the NFA_NDEF_DETECT_EVT.
 **                  status: Status of the operation.
 **                  maxSize: Maximum size of NDEF message.
 **                  currentSize: Current size of NDEF message.
@@ -999,7 +1545,7 @@ void nativeNfcTag_doCheckNdefResult (tNFA_STATUS status, uint32_t maxSize, uint3
     //#define RW_NDEF_FL_UNKNOWN    0x08    /* Unable to find if tag is ndef capable/formated/read only */
     //#define RW_NDEF_FL_FORMATABLE 0x10    /* Tag supports format operation */
 
-    if (!sCheckNdefWaitingForComplete)
+    if (!sCheckNdefWaitingForComplete && (sEagerNdefState != EAGER_NDEF_DETECTING))
     {
         ALOGE ("%s: not waiting", __FUNCTION__);
         return;
@@ -1048,10 +1594,156 @@ void nativeNfcTag_doCheckNdefResult (tNFA_STATUS status, uint32_t maxSize, uint3
         sCheckNdefCurrentSize = 0;
         sCheckNdefCardReadOnly = false;
     }
+
+    if (sEagerNdefState == EAGER_NDEF_DETECTING)
+    {
+        if ((sCheckNdefStatus == NFA_STATUS_OK) && (sCheckNdefCurrentSize > 0))
+        {
+            //still on the stack's thread; NFA_READ_CPLT_EVT completes the read
+            sEagerNdefState = EAGER_NDEF_READING;
+            sIsReadingNdefMessage = true;
+            if (NFA_RwReadNDef () == NFA_STATUS_OK)
+                return;
+            ALOGE ("%s: eager NFA_RwReadNDef failed", __FUNCTION__);
+            sIsReadingNdefMessage = false;
+            finishEagerNdefRead (false);
+        }
+        else
+            finishEagerNdefRead (sCheckNdefStatus == NFA_STATUS_OK);
+        return;
+    }
     sem_post (&sCheckNdefSem);
 }
 
 
+/*******************************************************************************
+**
+** Function:        interopStopPollingWork
+**
+** Description:     Stop polling for PN544 interop off the stack's thread;
+**                  stopping discovery waits for the stack's own callback.
+**                  Runs on the timer wheel's worker thread.
+**                  arg: Unused.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void interopStopPollingWork (void*)
+{
+    pn544InteropStopPolling ();
+}
+
+
+/*******************************************************************************
+**
+** Function:        getCheckNdefResult
+**
+** Description:     Translate the result of the last NDEF check for NFC service.
+**                  maxSize: Receives maximum NDEF message size.
+**                  mode: Receives NDEF_MODE_READ_ONLY or NDEF_MODE_READ_WRITE.
+**
+** Returns:         Status code; 0 is success.  maxSize and mode are only
+**                  set when status is NFA_STATUS_OK or NFA_STATUS_FAILED.
+**
+*******************************************************************************/
+static tNFA_STATUS getCheckNdefResult (jint& maxSize, jint& mode)
+{
+    if ((sCheckNdefStatus == NFA_STATUS_OK) || (sCheckNdefStatus == NFA_STATUS_FAILED))
+    {
+        //NFA_STATUS_FAILED: stack did not find a NDEF message on the tag;
+        if (NfcTag::getInstance ().getProtocol () == NFA_PROTOCOL_T1T)
+            maxSize = NfcTag::getInstance ().getT1tMaxMessageSize ();
+        else
+            maxSize = sCheckNdefMaxSize;
+        if (sCheckNdefCardReadOnly)
+            mode = NDEF_MODE_READ_ONLY;
+        else
+            mode = NDEF_MODE_READ_WRITE;
+    }
+    else if ((sCheckNdefStatus == NFA_STATUS_TIMEOUT) && (NfcTag::getInstance ().getProtocol() == NFC_PROTOCOL_ISO_DEP))
+    {
+        if (sEagerNdefState != EAGER_NDEF_IDLE)
+        {
+            //eager read completes on the stack's thread, which must not block
+            if (!TimerWheel::getInstance ().post (interopStopPollingWork, NULL))
+                ALOGE ("%s: fail post interop stop", __FUNCTION__);
+        }
+        else
+            pn544InteropStopPolling ();
+    }
+    else
+    {
+        ALOGD ("%s: unknown status 0x%X", __FUNCTION__, sCheckNdefStatus);
+    }
+    return sCheckNdefStatus;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_startEagerNdefRead
+**
+** Description:     Start checking and reading the NDEF message of a tag that
+**                  was just activated, before NFC service knows about it.
+**                  Called on the stack's thread; NfcTag::deliverEagerNdefResult()
+**                  is called once the check and read are done.
+**
+** Returns:         True if NDEF check started.
+**
+*******************************************************************************/
+bool nativeNfcTag_startEagerNdefRead ()
+{
+    ALOGD ("%s", __FUNCTION__);
+    sNdefFromCache = false;
+    sNdefFingerprint.clear ();
+    sReadDataLen = 0;
+    if (sReadData != NULL)
+    {
+        free (sReadData);
+        sReadData = NULL;
+    }
+
+    sEagerNdefState = EAGER_NDEF_DETECTING;
+    tNFA_STATUS status = NFA_RwDetectNDef ();
+    if (status != NFA_STATUS_OK)
+    {
+        ALOGE ("%s: NFA_RwDetectNDef failed, status = 0x%X", __FUNCTION__, status);
+        sEagerNdefState = EAGER_NDEF_IDLE;
+        return false;
+    }
+    return true;
+}
+
+
+/*******************************************************************************
+**
+** Function:        finishEagerNdefRead
+**
+** Description:     Hand the result of the eager NDEF check and read to NfcTag.
+**                  haveMessage: Whether sReadData holds the NDEF message.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void finishEagerNdefRead (bool haveMessage)
+{
+    jint maxSize = 0;
+    jint mode = NDEF_MODE_UNKNOWN;
+    tNFA_STATUS status = getCheckNdefResult (maxSize, mode);
+
+    sEagerNdefState = EAGER_NDEF_IDLE;
+    NfcTag::getInstance ().deliverEagerNdefResult (status, maxSize, mode,
+            sReadData, haveMessage ? (int) sReadDataLen : -1);
+
+    sReadDataLen = 0;
+    if (sReadData != NULL)
+    {
+        free (sReadData);
+        sReadData = NULL;
+    }
+}
+
+
 /*******************************************************************************
 **
 ** Function:        nativeNfcTag_doCheckNdef
@@ -1068,6 +1760,7 @@ static jint nativeNfcTag_doCheckNdef (JNIEnv* e, jobject, jintArray ndefInfo)
 {
     tNFA_STATUS status = NFA_STATUS_FAILED;
     jint* ndef = NULL;
+    AutoMutex op (sTagOpMutex);
 
     ALOGD ("%s: enter", __FUNCTION__);
 
@@ -1095,6 +1788,24 @@ static jint nativeNfcTag_doCheckNdef (JNIEnv* e, jobject, jintArray ndefInfo)
         goto TheEnd;
     }
 
+    if (!applyPendingRfInterface ())
+    {
+        ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+        status = STATUS_CODE_TARGET_LOST;
+        goto TheEnd;
+    }
+    sNdefFingerprint.clear ();
+    if (lookupNdefCache ())
+    {
+        ALOGD ("%s: NDEF from cache", __FUNCTION__);
+        ndef = e->GetIntArrayElements (ndefInfo, 0);
+        ndef[0] = sCheckNdefMaxSize;
+        ndef[1] = sCheckNdefCardReadOnly ? NDEF_MODE_READ_ONLY : NDEF_MODE_READ_WRITE;
+        e->ReleaseIntArrayElements (ndefInfo, ndef, 0);
+        status = NFA_STATUS_OK;
+        goto TheEnd;
+    }
+
     ALOGD ("%s: try NFA_RwDetectNDef", __FUNCTION__);
     sCheckNdefWaitingForComplete = JNI_TRUE;
     status = NFA_RwDetectNDef ();
@@ -1112,45 +1823,17 @@ static jint nativeNfcTag_doCheckNdef (JNIEnv* e, jobject, jintArray ndefInfo)
         goto TheEnd;
     }
 
-    if (sCheckNdefStatus == NFA_STATUS_OK)
-    {
-        //stack found a NDEF message on the tag
-        ndef = e->GetIntArrayElements (ndefInfo, 0);
-        if (NfcTag::getInstance ().getProtocol () == NFA_PROTOCOL_T1T)
-            ndef[0] = NfcTag::getInstance ().getT1tMaxMessageSize ();
-        else
-            ndef[0] = sCheckNdefMaxSize;
-        if (sCheckNdefCardReadOnly)
-            ndef[1] = NDEF_MODE_READ_ONLY;
-        else
-            ndef[1] = NDEF_MODE_READ_WRITE;
-        e->ReleaseIntArrayElements (ndefInfo, ndef, 0);
-        status = NFA_STATUS_OK;
-    }
-    else if (sCheckNdefStatus == NFA_STATUS_FAILED)
-    {
-        //stack did not find a NDEF message on the tag;
-        ndef = e->GetIntArrayElements (ndefInfo, 0);
-        if (NfcTag::getInstance ().getProtocol () == NFA_PROTOCOL_T1T)
-            ndef[0] = NfcTag::getInstance ().getT1tMaxMessageSize ();
-        else
-            ndef[0] = sCheckNdefMaxSize;
-        if (sCheckNdefCardReadOnly)
-            ndef[1] = NDEF_MODE_READ_ONLY;
-        else
-            ndef[1] = NDEF_MODE_READ_WRITE;
-        e->ReleaseIntArrayElements (ndefInfo, ndef, 0);
-        status = NFA_STATUS_FAILED;
-    }
-    else if ((sCheckNdefStatus == NFA_STATUS_TIMEOUT) && (NfcTag::getInstance ().getProtocol() == NFC_PROTOCOL_ISO_DEP))
     {
-        pn544InteropStopPolling ();
-        status = sCheckNdefStatus;
-    }
-    else
-    {
-        ALOGD ("%s: unknown status 0x%X", __FUNCTION__, sCheckNdefStatus);
-        status = sCheckNdefStatus;
+        jint maxSize = 0;
+        jint mode = NDEF_MODE_UNKNOWN;
+        status = getCheckNdefResult (maxSize, mode);
+        if ((status == NFA_STATUS_OK) || (status == NFA_STATUS_FAILED))
+        {
+            ndef = e->GetIntArrayElements (ndefInfo, 0);
+            ndef[0] = maxSize;
+            ndef[1] = mode;
+            e->ReleaseIntArrayElements (ndefInfo, ndef, 0);
+        }
     }
 
 TheEnd:
@@ -1192,28 +1875,29 @@ void nativeNfcTag_resetPresenceCheck ()
 *******************************************************************************/
 void nativeNfcTag_doPresenceCheckResult (tNFA_STATUS status)
 {
-    SyncEventGuard guard (sPresenceCheckEvent);
     sIsTagPresent = status == NFA_STATUS_OK;
-    sPresenceCheckEvent.notifyOne ();
+    sPresenceCheck.complete (status);
 }
 
 
 /*******************************************************************************
 **
-** Function:        nativeNfcTag_doPresenceCheck
+** Function:        checkPresence
 **
-** Description:     Check if the tag is in the RF field.
-**                  e: JVM environment.
-**                  o: Java object.
+** Description:     Check if the tag is in the RF field.  The caller holds
+**                  sTagOpMutex.  If the stack does not answer within
+**                  PRESENCE_CHECK_TIMEOUT, the last known state is reported,
+**                  as for a check that is aborted.
 **
-** Returns:         True if tag is in RF field.
+** Returns:         TAG_PRESENT, TAG_ABSENT, or TAG_BUSY if the stack did not
+**                  start the check.
 **
 *******************************************************************************/
-static jboolean nativeNfcTag_doPresenceCheck (JNIEnv*, jobject)
+static int checkPresence ()
 {
     ALOGD ("%s", __FUNCTION__);
     tNFA_STATUS status = NFA_STATUS_OK;
-    jboolean isPresent = JNI_FALSE;
+    int presence = TAG_ABSENT;
 
     // Special case for Kovio.  The deactivation would have already occurred
     // but was ignored so that normal tag opertions could complete.  Now we
@@ -1234,19 +1918,19 @@ static jboolean nativeNfcTag_doPresenceCheck (JNIEnv*, jobject)
         nativeNfcTag_abortWaits();
         NfcTag::getInstance().abort ();
 
-        return JNI_FALSE;
+        return TAG_ABSENT;
     }
 
     if (nfcManager_isNfcActive() == false)
     {
         ALOGD ("%s: NFC is no longer active.", __FUNCTION__);
-        return JNI_FALSE;
+        return TAG_ABSENT;
     }
 
     if (!sRfInterfaceMutex.tryLock())
     {
         ALOGD ("%s: tag is being reSelected assume it is present", __FUNCTION__);
-        return JNI_TRUE;
+        return TAG_PRESENT;
     }
 
     sRfInterfaceMutex.unlock();
@@ -1254,22 +1938,211 @@ static jboolean nativeNfcTag_doPresenceCheck (JNIEnv*, jobject)
     if (NfcTag::getInstance ().isActivated () == false)
     {
         ALOGD ("%s: tag already deactivated", __FUNCTION__);
-        return JNI_FALSE;
+        return TAG_ABSENT;
     }
 
     {
-        SyncEventGuard guard (sPresenceCheckEvent);
+        PresenceCheckResult none;
+        int result = NFA_STATUS_FAILED;
+        uint32_t id = sPresenceCheck.begin (none);
         status = NFA_RwPresenceCheck (NfcTag::getInstance().getPresenceCheckAlgorithm());
         if (status == NFA_STATUS_OK)
         {
-            sPresenceCheckEvent.wait ();
-            isPresent = sIsTagPresent ? JNI_TRUE : JNI_FALSE;
+            if (!sPresenceCheck.wait (id, PRESENCE_CHECK_TIMEOUT, result, none))
+            {
+                //a slow stack says nothing about the tag; report what was last known
+                ALOGE ("%s: timeout waiting for result; last known present=%u", __FUNCTION__, sIsTagPresent);
+                result = sIsTagPresent ? NFA_STATUS_OK : NFA_STATUS_FAILED;
+            }
+            presence = (result == NFA_STATUS_OK) ? TAG_PRESENT : TAG_ABSENT;
+        }
+        else
+        {
+            ALOGE ("%s: fail start; status=0x%X", __FUNCTION__, status);
+            sPresenceCheck.withdraw (id, none);
+            presence = TAG_BUSY;
         }
     }
 
-    if (isPresent == JNI_FALSE)
+    if (presence == TAG_ABSENT)
         ALOGD ("%s: tag absent", __FUNCTION__);
-    return isPresent;
+    return presence;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doPresenceCheck
+**
+** Description:     Check if the tag is in the RF field.  Waits at most
+**                  PRESENCE_CHECK_TIMEOUT for the stack; after that the
+**                  result of the previous check is returned.
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         True if tag is in RF field.
+**
+*******************************************************************************/
+static jboolean nativeNfcTag_doPresenceCheck (JNIEnv*, jobject)
+{
+    AutoMutex op (sTagOpMutex);
+    return (checkPresence () == TAG_PRESENT) ? JNI_TRUE : JNI_FALSE;
+}
+
+
+/*******************************************************************************
+**
+** Function:        presenceWatchWork
+**
+** Description:     Check whether the watched tag is still in the RF field.
+**                  While it is, check again later with a longer interval, up
+**                  to the maximum.  When it is gone, notify Java.  A tag that
+**                  is in use by another operation is present.  Runs on the
+**                  timer wheel's worker thread.
+**                  arg: Unused.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void presenceWatchWork (void*)
+{
+    {
+        AutoMutex mutex (sPresenceWatchMutex);
+        if (!sPresenceWatchActive)
+            return;
+    }
+
+    bool isPresent = true;
+    bool isBusy = true;
+    if (sTagOpMutex.tryLock ())
+    {
+        int presence = checkPresence ();
+        sTagOpMutex.unlock ();
+        isPresent = presence != TAG_ABSENT;
+        isBusy = presence == TAG_BUSY;
+    }
+
+    jobject tag = NULL;
+    {
+        AutoMutex mutex (sPresenceWatchMutex);
+        if (!sPresenceWatchActive)
+            return;
+        if (isBusy)
+        {
+            //the tag is in use; look again soon
+            sPresenceWatchInterval = sPresenceWatchMinInterval;
+            sPresenceWatchTimer.set (sPresenceWatchInterval, presenceWatchCallback);
+            return;
+        }
+        if (isPresent)
+        {
+            sPresenceWatchInterval *= 2;
+            if (sPresenceWatchInterval > sPresenceWatchMaxInterval)
+                sPresenceWatchInterval = sPresenceWatchMaxInterval;
+            sPresenceWatchTimer.set (sPresenceWatchInterval, presenceWatchCallback);
+            return;
+        }
+        sPresenceWatchActive = false;
+        tag = sPresenceWatchTag;
+        sPresenceWatchTag = NULL;
+    }
+
+    ALOGD ("%s: tag lost", __FUNCTION__);
+    JNIEnv* e = NULL;
+    ScopedAttach attach (sPresenceWatchVm, &e);
+    if (e == NULL)
+    {
+        ALOGE ("%s: jni env is null", __FUNCTION__);
+        return;
+    }
+    e->CallVoidMethod (tag, sCachedNfcTagNotifyTagLost);
+    if (e->ExceptionCheck())
+    {
+        e->ExceptionClear();
+        ALOGE ("%s: fail notify tag lost", __FUNCTION__);
+    }
+    e->DeleteGlobalRef (tag);
+}
+
+
+/*******************************************************************************
+**
+** Function:        presenceWatchCallback
+**
+** Description:     Hand a presence check of the watched tag to the worker
+**                  thread; the check blocks.
+**                  sigval: Unused.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void presenceWatchCallback (union sigval)
+{
+    TimerWheel::getInstance ().post (presenceWatchWork, NULL);
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doStartPresenceWatch
+**
+** Description:     Check the tag's presence in the background on a timer and
+**                  call the Java object back only when the tag is gone.  No
+**                  Java thread waits while the tag stays in the field.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  minInterval: First interval between checks in milliseconds.
+**                  maxInterval: Interval never grows beyond this.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+static jboolean nativeNfcTag_doStartPresenceWatch (JNIEnv* e, jobject o, jint minInterval, jint maxInterval)
+{
+    ALOGD ("%s: interval=%d..%d", __FUNCTION__, minInterval, maxInterval);
+    if ((minInterval <= 0) || (maxInterval < minInterval))
+        return JNI_FALSE;
+
+    AutoMutex mutex (sPresenceWatchMutex);
+    if (sPresenceWatchActive)
+    {
+        ALOGE ("%s: already watching", __FUNCTION__);
+        return JNI_FALSE;
+    }
+    if (sPresenceWatchTag != NULL)
+        e->DeleteGlobalRef (sPresenceWatchTag);
+    e->GetJavaVM (&sPresenceWatchVm);
+    sPresenceWatchTag = e->NewGlobalRef (o);
+    sPresenceWatchMinInterval = minInterval;
+    sPresenceWatchMaxInterval = maxInterval;
+    sPresenceWatchInterval = minInterval;
+    sPresenceWatchActive = sPresenceWatchTimer.set (sPresenceWatchInterval, presenceWatchCallback);
+    return sPresenceWatchActive ? JNI_TRUE : JNI_FALSE;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doStopPresenceWatch
+**
+** Description:     Stop checking the tag's presence in the background.
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void nativeNfcTag_doStopPresenceWatch (JNIEnv* e, jobject)
+{
+    ALOGD ("%s", __FUNCTION__);
+    AutoMutex mutex (sPresenceWatchMutex);
+    sPresenceWatchActive = false;
+    sPresenceWatchTimer.kill ();
+    if (sPresenceWatchTag != NULL)
+    {
+        e->DeleteGlobalRef (sPresenceWatchTag);
+        sPresenceWatchTag = NULL;
+    }
 }
 
 
@@ -1356,6 +2229,7 @@ static jboolean nativeNfcTag_doNdefFormat (JNIEnv*, jobject, jbyteArray)
 {
     ALOGD ("%s: enter", __FUNCTION__);
     tNFA_STATUS status = NFA_STATUS_OK;
+    AutoMutex op (sTagOpMutex);
 
     // Do not try to format if tag is already deactivated.
     if (NfcTag::getInstance ().isActivated () == false)
@@ -1364,6 +2238,15 @@ static jboolean nativeNfcTag_doNdefFormat (JNIEnv*, jobject, jbyteArray)
         return JNI_FALSE;
     }
 
+    if (!applyPendingRfInterface ())
+    {
+        ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+        return JNI_FALSE;
+    }
+
+    NdefCache::getInstance ().remove (NfcTag::getInstance ().getNdefCacheKey ());
+    sNdefFromCache = false;
+
     sem_init (&sFormatSem, 0, 0);
     sFormatOk = false;
     status = NFA_RwFormatTag ();
@@ -1421,9 +2304,17 @@ static jboolean nativeNfcTag_doMakeReadonly (JNIEnv*, jobject, jbyteArray)
 {
     jboolean result = JNI_FALSE;
     tNFA_STATUS status;
+    AutoMutex op (sTagOpMutex);
 
     ALOGD ("%s", __FUNCTION__);
 
+    if (!applyPendingRfInterface ())
+    {
+        ALOGE ("%s: fail switch rf interface", __FUNCTION__);
+        return JNI_FALSE;
+    }
+    invalidateNdefCache ();
+
     /* Create the make_readonly semaphore */
     if (sem_init (&sMakeReadonlySem, 0, 0) == -1)
     {
@@ -1527,6 +2418,8 @@ static JNINativeMethod gMethods[] =
    {"doRead", "()[B", (void *)nativeNfcTag_doRead},
    {"doWrite", "([B)Z", (void *)nativeNfcTag_doWrite},
    {"doPresenceCheck", "()Z", (void *)nativeNfcTag_doPresenceCheck},
+   {"doStartPresenceWatch", "(II)Z", (void *)nativeNfcTag_doStartPresenceWatch},
+   {"doStopPresenceWatch", "()V", (void *)nativeNfcTag_doStopPresenceWatch},
    {"doIsIsoDepNdefFormatable", "([B[B)Z", (void *)nativeNfcTag_doIsIsoDepNdefFormatable},
    {"doNdefFormat", "([B)Z", (void *)nativeNfcTag_doNdefFormat},
    {"doMakeReadonly", "([B)Z", (void *)nativeNfcTag_doMakeReadonly},
@@ -1546,6 +2439,16 @@ static JNINativeMethod gMethods[] =
 int register_com_android_nfc_NativeNfcTag (JNIEnv *e)
 {
     ALOGD ("%s", __FUNCTION__);
+    ScopedLocalRef<jclass> tagCls(e, e->FindClass(gNativeNfcTagClassName));
+    if (tagCls.get() == NULL)
+    {
+        ALOGE ("%s: fail find NativeNfcTag", __FUNCTION__);
+        return -1;
+    }
+    sCachedNfcTagNotifyTagLost = e->GetMethodID (tagCls.get(), "notifyTagLost", "()V");
+    long num = 0;
+    if (GetNumValue ("RF_INTF_SWITCH_HYSTERESIS", &num, sizeof (num)))
+        sRfSwitchHysteresis = num;
     return jniRegisterNativeMethods (e, gNativeNfcTagClassName, gMethods, NELEM (gMethods));
 }
 
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Remember the NDEF messages of recently read tags.
+ */
+#include "OverrideLog.h"
+#include "NdefCache.h"
+
+
+/*******************************************************************************
+**
+** Function:        NdefCache
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+NdefCache::NdefCache ()
+{
+}
+
+
+/*******************************************************************************
+**
+** Function:        getInstance
+**
+** Description:     Get the singleton of this object.
+**
+** Returns:         Reference to this object.
+**
+*******************************************************************************/
+NdefCache& NdefCache::getInstance ()
+{
+    static NdefCache cache;
+    return cache;
+}
+
+
+/*******************************************************************************
+**
+** Function:        find
+**
+** Description:     Look up a tag and mark it as most recently used.
+**                  key: protocol and UID of the tag.
+**                  entry: receives a copy of the cached entry.
+**
+** Returns:         True if the tag is in the cache.
+**
+*******************************************************************************/
+bool NdefCache::find (const Bytes& key, Entry& entry)
+{
+    AutoMutex mutex (mMutex);
+    for (EntryList::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+    {
+        if (it->mKey == key)
+        {
+            mEntries.splice (mEntries.begin(), mEntries, it);
+            entry = mEntries.front ();
+            ALOGD ("NdefCache::find: hit; len=%zu", entry.mMessage.size());
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*******************************************************************************
+**
+** Function:        put
+**
+** Description:     Add or replace a tag's entry; evict the least recently
+**                  used entry if the cache is full.
+**                  entry: entry to store.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::put (const Entry& entry)
+{
+    if (entry.mKey.empty() || entry.mFingerprint.empty() || (entry.mMessage.size() > MAX_MESSAGE_SIZE))
+        return;
+
+    AutoMutex mutex (mMutex);
+    for (EntryList::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+    {
+        if (it->mKey == entry.mKey)
+        {
+            mEntries.erase (it);
+            break;
+        }
+    }
+    mEntries.push_front (entry);
+    if (mEntries.size() > MAX_ENTRIES)
+        mEntries.pop_back ();
+    ALOGD ("NdefCache::put: len=%zu; entries=%zu", entry.mMessage.size(), mEntries.size());
+}
+
+
+/*******************************************************************************
+**
+** Function:        remove
+**
+** Description:     Forget a tag.
+**                  key: protocol and UID of the tag.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::remove (const Bytes& key)
+{
+    AutoMutex mutex (mMutex);
+    for (EntryList::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+    {
+        if (it->mKey == key)
+        {
+            mEntries.erase (it);
+            return;
+        }
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        clear
+**
+** Description:     Forget all tags.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::clear ()
+{
+    AutoMutex mutex (mMutex);
+    mEntries.clear ();
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Remember the NDEF messages of recently read tags.
+ */
+
+#pragma once
+#include "NfcJniUtil.h"
+#include "Mutex.h"
+#include <list>
+#include <string>
+extern "C"
+{
+    #include "nfa_api.h"
+}
+
+
+class NdefCache
+{
+public:
+    typedef std::basic_string<UINT8> Bytes;
+
+    struct Entry
+    {
+        Bytes mKey; //protocol followed by UID
+        Bytes mFingerprint; //tag bytes that change whenever the NDEF message changes
+        Bytes mMessage; //NDEF message
+        UINT32 mMaxSize; //maximum NDEF message size of the tag
+        bool mReadOnly; //whether the tag is read-only
+    };
+
+    static const size_t MAX_ENTRIES = 8; //number of tags remembered
+    static const size_t MAX_MESSAGE_SIZE = 4096; //larger messages are not cached
+
+
+    /*******************************************************************************
+    **
+    ** Function:        getInstance
+    **
+    ** Description:     Get the singleton of this object.
+    **
+    ** Returns:         Reference to this object.
+    **
+    *******************************************************************************/
+    static NdefCache& getInstance ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        find
+    **
+    ** Description:     Look up a tag and mark it as most recently used.
+    **                  key: protocol and UID of the tag.
+    **                  entry: receives a copy of the cached entry.
+    **
+    ** Returns:         True if the tag is in the cache.
+    **
+    *******************************************************************************/
+    bool find (const Bytes& key, Entry& entry);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        put
+    **
+    ** Description:     Add or replace a tag's entry; evict the least recently
+    **                  used entry if the cache is full.
+    **                  entry: entry to store.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void put (const Entry& entry);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        remove
+    **
+    ** Description:     Forget a tag.
+    **                  key: protocol and UID of the tag.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void remove (const Bytes& key);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        clear
+    **
+    ** Description:     Forget all tags.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void clear ();
+
+private:
+    typedef std::list<Entry> EntryList;
+
+    EntryList mEntries; //most recently used first
+    Mutex mMutex;
+
+    NdefCache ();
+    NdefCache (const NdefCache&);
+    NdefCache& operator= (const NdefCache&);
+};
@@ -20,15 +20,20 @@
 #include "OverrideLog.h"
 #include "NfcTag.h"
 #include "JavaClassConstants.h"
+#include "NdefCache.h"
 #include "config.h"
 #include <ScopedLocalRef.h>
-#include <ScopedPrimitiveArray.h>
 
 extern "C"
 {
     #include "rw_int.h"
 }
 
+namespace android
+{
+    extern bool nativeNfcTag_startEagerNdefRead ();
+}
+
 
 /*******************************************************************************
 **
@@ -42,6 +47,7 @@ extern "C"
 NfcTag::NfcTag ()
 :   mNumTechList (0),
     mTechnologyTimeoutsTable (MAX_NUM_TECHNOLOGY),
+    mTechnologyDefaultTimeoutsTable (MAX_NUM_TECHNOLOGY),
     mNativeData (NULL),
     mIsActivated (false),
     mActivationState (Idle),
@@ -52,7 +58,14 @@ NfcTag::NfcTag ()
     mNdefDetectionTimedOut (false),
     mIsDynamicTagId (false),
     mPresenceCheckAlgorithm (NFA_RW_PRES_CHK_DEFAULT),
-    mIsFelicaLite(false)
+    mIsFelicaLite(false),
+    mTagClass (0),
+    mIsoDepWaitTime (0),
+    mNativeTagClass (NULL),
+    mNativeTagCtor (NULL),
+    mNativeTagDescriptorField (NULL),
+    mEagerNdefRead (false),
+    mSkipNdefCheck (false)
 {
     memset (mTechList, 0, sizeof(mTechList));
     memset (mTechHandles, 0, sizeof(mTechHandles));
@@ -102,6 +115,9 @@ void NfcTag::initialize (nfc_jni_native_data* native)
     resetTechnologies ();
     if (GetNumValue(NAME_PRESENCE_CHECK_ALGORITHM, &num, sizeof(num)))
         mPresenceCheckAlgorithm = num;
+    if (GetNumValue("EAGER_NDEF_READ", &num, sizeof(num)))
+        mEagerNdefRead = (num != 0);
+    mPendingDescriptor.clear ();
 }
 
 
@@ -524,12 +540,55 @@ TheEnd:
 }
 
 
+/*******************************************************************************
+**
+** Function:        packBytes
+**
+** Description:     Append a length-prefixed byte string to a descriptor.
+**                  descriptor: Descriptor being built.
+**                  data: Bytes to append.
+**                  len: Number of bytes; at most 255.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void packBytes (std::vector<UINT8>& descriptor, const UINT8* data, int len)
+{
+    if (len > 0xFF)
+        len = 0xFF;
+    if (len < 0)
+        len = 0;
+    descriptor.push_back ((UINT8) len);
+    descriptor.insert (descriptor.end(), data, data + len);
+}
+
+
+/*******************************************************************************
+**
+** Function:        packInt
+**
+** Description:     Append a big-endian 32-bit integer to a descriptor.
+**                  descriptor: Descriptor being built.
+**                  value: Integer to append.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void packInt (std::vector<UINT8>& descriptor, int value)
+{
+    descriptor.push_back ((UINT8) (value >> 24));
+    descriptor.push_back ((UINT8) (value >> 16));
+    descriptor.push_back ((UINT8) (value >> 8));
+    descriptor.push_back ((UINT8) value);
+}
+
+
 /*******************************************************************************
 **
 ** Function:        createNativeNfcTag
 **
 ** Description:     Create a brand new Java NativeNfcTag object;
-**                  fill the objects's member variables with data;
+**                  hand it all activation data as one packed descriptor;
 **                  notify NFC service;
 **                  activationData: data from activation.
 **
@@ -549,32 +608,81 @@ void NfcTag::createNativeNfcTag (tNFA_ACTIVATED& activationData)
         return;
     }
 
-    ScopedLocalRef<jclass> tag_cls(e, e->GetObjectClass(mNativeData->cached_NfcTag));
-    if (e->ExceptionCheck())
+    //fill native copies of the tech lists; build the descriptor in one pass
+    std::vector<UINT8> descriptor;
+    descriptor.reserve (ACTIVATION_DESCRIPTOR_RESERVE);
+    descriptor.push_back (ACTIVATION_DESCRIPTOR_VERSION);
+    descriptor.push_back ((UINT8) mNumTechList);
+    packTechLists (descriptor);
+    packPollBytes (descriptor, activationData);
+    packActivationBytes (descriptor, activationData);
+    packUid (descriptor, activationData);
+
+    //must follow packUid, which detects dynamic tag IDs
+    computeNdefCacheKey ();
+    computeTagClass ();
+    computeIsoDepWaitTime (activationData);
+
+    //a cached tag is checked against its fingerprint when NFC service asks;
+    //that I/O must not run here on the stack thread
+    NdefCache::Entry cached;
+    if (mEagerNdefRead && !mSkipNdefCheck && isNdefProtocol (mProtocol) &&
+            (mTechList [0] != TARGET_TYPE_KOVIO_BARCODE) &&
+            (mNdefCacheKey.empty () || !NdefCache::getInstance ().find (mNdefCacheKey, cached)))
     {
-        e->ExceptionClear();
-        ALOGE("%s: failed to get class", fn);
-        return;
+        //hold the tag back until its NDEF message has been read;
+        //deliverEagerNdefResult() hands it to NFC service
+        mPendingDescriptor.swap (descriptor);
+        if (android::nativeNfcTag_startEagerNdefRead ())
+        {
+            ALOGD ("%s: exit; eager NDEF read started", fn);
+            return;
+        }
+        descriptor.swap (mPendingDescriptor);
+        mPendingDescriptor.clear ();
     }
 
-    //create a new Java NativeNfcTag object
-    jmethodID ctor = e->GetMethodID(tag_cls.get(), "<init>", "()V");
-    ScopedLocalRef<jobject> tag(e, e->NewObject(tag_cls.get(), ctor));
-
-    //fill NativeNfcTag's mProtocols, mTechList, mTechHandles, mTechLibNfcTypes
-    fillNativeNfcTagMembers1(e, tag_cls.get(), tag.get());
+    descriptor.push_back (0); //no NDEF result attached
+    notifyNativeNfcTag (e, descriptor);
+    ALOGD ("%s: exit", fn);
+}
 
-    //fill NativeNfcTag's members: mHandle, mConnectedTechnology
-    fillNativeNfcTagMembers2(e, tag_cls.get(), tag.get(), activationData);
 
-    //fill NativeNfcTag's members: mTechPollBytes
-    fillNativeNfcTagMembers3(e, tag_cls.get(), tag.get(), activationData);
+/*******************************************************************************
+**
+** Function:        notifyNativeNfcTag
+**
+** Description:     Create a Java NativeNfcTag object that holds an activation
+**                  descriptor; notify NFC service about it.
+**                  e: JVM environment.
+**                  descriptor: Complete activation descriptor.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::notifyNativeNfcTag (JNIEnv* e, const std::vector<UINT8>& descriptor)
+{
+    static const char fn [] = "NfcTag::notifyNativeNfcTag";
 
-    //fill NativeNfcTag's members: mTechActBytes
-    fillNativeNfcTagMembers4(e, tag_cls.get(), tag.get(), activationData);
+    if (mNativeTagClass == NULL)
+    {
+        ScopedLocalRef<jclass> tag_cls(e, e->GetObjectClass(mNativeData->cached_NfcTag));
+        if (e->ExceptionCheck())
+        {
+            e->ExceptionClear();
+            ALOGE("%s: failed to get class", fn);
+            return;
+        }
+        mNativeTagCtor = e->GetMethodID(tag_cls.get(), "<init>", "()V");
+        mNativeTagDescriptorField = e->GetFieldID(tag_cls.get(), "mActivationDescriptor", "[B");
+        mNativeTagClass = (jclass) e->NewGlobalRef(tag_cls.get());
+    }
 
-    //fill NativeNfcTag's members: mUid
-    fillNativeNfcTagMembers5(e, tag_cls.get(), tag.get(), activationData);
+    //create a new Java NativeNfcTag object; it decodes the descriptor on first use
+    ScopedLocalRef<jobject> tag(e, e->NewObject(mNativeTagClass, mNativeTagCtor));
+    ScopedLocalRef<jbyteArray> packed(e, e->NewByteArray(descriptor.size()));
+    e->SetByteArrayRegion(packed.get(), 0, descriptor.size(), (const jbyte*) &descriptor[0]);
+    e->SetObjectField(tag.get(), mNativeTagDescriptorField, packed.get());
 
     if (mNativeData->tag != NULL)
     {
@@ -583,111 +691,107 @@ void NfcTag::createNativeNfcTag (tNFA_ACTIVATED& activationData)
     mNativeData->tag = e->NewGlobalRef(tag.get());
 
     //notify NFC service about this new tag
-    ALOGD ("%s: try notify nfc service", fn);
+    ALOGD ("%s: try notify nfc service; descriptor len=%u", fn, (unsigned) descriptor.size());
     e->CallVoidMethod(mNativeData->manager, android::gCachedNfcManagerNotifyNdefMessageListeners, tag.get());
     if (e->ExceptionCheck())
     {
         e->ExceptionClear();
         ALOGE ("%s: fail notify nfc service", fn);
     }
-
-    ALOGD ("%s: exit", fn);
 }
 
 
 /*******************************************************************************
 **
-** Function:        fillNativeNfcTagMembers1
+** Function:        deliverEagerNdefResult
 **
-** Description:     Fill NativeNfcTag's members: mProtocols, mTechList, mTechHandles, mTechLibNfcTypes.
-**                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
+** Description:     Attach the result of the eager NDEF check and read to the
+**                  tag held back by createNativeNfcTag; notify NFC service.
+**                  status: Status of NDEF check.
+**                  maxSize: Maximum NDEF message size.
+**                  mode: NDEF_MODE_READ_ONLY, NDEF_MODE_READ_WRITE, NDEF_MODE_UNKNOWN.
+**                  message: NDEF message.
+**                  messageLen: Length of message; -1 if it could not be read.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers1 (JNIEnv* e, jclass tag_cls, jobject tag)
+void NfcTag::deliverEagerNdefResult (tNFA_STATUS status, int maxSize, int mode, const UINT8* message, int messageLen)
 {
-    static const char fn [] = "NfcTag::fillNativeNfcTagMembers1";
-    ALOGD ("%s", fn);
-
-    //create objects that represent NativeNfcTag's member variables
-    ScopedLocalRef<jintArray> techList(e, e->NewIntArray(mNumTechList));
-    ScopedLocalRef<jintArray> handleList(e, e->NewIntArray(mNumTechList));
-    ScopedLocalRef<jintArray> typeList(e, e->NewIntArray(mNumTechList));
+    static const char fn [] = "NfcTag::deliverEagerNdefResult";
+    ALOGD ("%s: status=0x%X; max=%d; mode=%d; len=%d", fn, status, maxSize, mode, messageLen);
 
+    if (mPendingDescriptor.empty ())
     {
-        ScopedIntArrayRW technologies(e, techList.get());
-        ScopedIntArrayRW handles(e, handleList.get());
-        ScopedIntArrayRW types(e, typeList.get());
-        for (int i = 0; i < mNumTechList; i++) {
-            mNativeData->tProtocols [i] = mTechLibNfcTypes [i];
-            mNativeData->handles [i] = mTechHandles [i];
-            technologies [i] = mTechList [i];
-            handles [i]      = mTechHandles [i];
-            types [i]        = mTechLibNfcTypes [i];
-        }
+        ALOGE ("%s: no tag pending", fn);
+        return;
     }
 
-    jfieldID f = NULL;
-
-    f = e->GetFieldID(tag_cls, "mTechList", "[I");
-    e->SetObjectField(tag, f, techList.get());
-
-    f = e->GetFieldID(tag_cls, "mTechHandles", "[I");
-    e->SetObjectField(tag, f, handleList.get());
+    JNIEnv* e = NULL;
+    ScopedAttach attach(mNativeData->vm, &e);
+    if (e == NULL)
+    {
+        ALOGE("%s: jni env is null", fn);
+        mPendingDescriptor.clear ();
+        return;
+    }
 
-    f = e->GetFieldID(tag_cls, "mTechLibNfcTypes", "[I");
-    e->SetObjectField(tag, f, typeList.get());
+    std::vector<UINT8> descriptor;
+    descriptor.swap (mPendingDescriptor);
+    descriptor.push_back (1); //NDEF result attached
+    packInt (descriptor, status);
+    packInt (descriptor, maxSize);
+    packInt (descriptor, mode);
+    packInt (descriptor, messageLen);
+    if (messageLen > 0)
+        descriptor.insert (descriptor.end(), message, message + messageLen);
+    notifyNativeNfcTag (e, descriptor);
 }
 
 
 /*******************************************************************************
 **
-** Function:        fillNativeNfcTagMembers2
+** Function:        packTechLists
 **
-** Description:     Fill NativeNfcTag's members: mConnectedTechIndex or mConnectedTechnology.
-**                  The original Google's implementation is in set_target_pollBytes(
-**                  in com_android_nfc_NativeNfcTag.cpp;
-**                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
-**                  activationData: data from activation.
+** Description:     Append mTechList, mTechHandles, mTechLibNfcTypes to the
+**                  descriptor and keep native copies of protocols and handles.
+**                  descriptor: Descriptor being built.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers2 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& /*activationData*/)
+void NfcTag::packTechLists (std::vector<UINT8>& descriptor)
 {
-    static const char fn [] = "NfcTag::fillNativeNfcTagMembers2";
+    static const char fn [] = "NfcTag::packTechLists";
     ALOGD ("%s", fn);
-    jfieldID f = e->GetFieldID(tag_cls, "mConnectedTechIndex", "I");
-    e->SetIntField(tag, f, (jint) 0);
+
+    for (int i = 0; i < mNumTechList; i++) {
+        mNativeData->tProtocols [i] = mTechLibNfcTypes [i];
+        mNativeData->handles [i] = mTechHandles [i];
+        packInt (descriptor, mTechList [i]);
+        packInt (descriptor, mTechHandles [i]);
+        packInt (descriptor, mTechLibNfcTypes [i]);
+    }
 }
 
 
 /*******************************************************************************
 **
-** Function:        fillNativeNfcTagMembers3
+** Function:        packPollBytes
 **
-** Description:     Fill NativeNfcTag's members: mTechPollBytes.
+** Description:     Append each technology's poll bytes (NativeNfcTag's
+**                  mTechPollBytes) to the descriptor.
 **                  The original Google's implementation is in set_target_pollBytes(
 **                  in com_android_nfc_NativeNfcTag.cpp;
-**                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
+**                  descriptor: Descriptor being built.
 **                  activationData: data from activation.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData)
+void NfcTag::packPollBytes (std::vector<UINT8>& descriptor, tNFA_ACTIVATED& activationData)
 {
-    static const char fn [] = "NfcTag::fillNativeNfcTagMembers3";
-    ScopedLocalRef<jbyteArray> pollBytes(e, e->NewByteArray(0));
-    ScopedLocalRef<jclass> byteArrayClass(e, e->GetObjectClass(pollBytes.get()));
-    ScopedLocalRef<jobjectArray> techPollBytes(e, e->NewObjectArray(mNumTechList, byteArrayClass.get(), 0));
+    static const char fn [] = "NfcTag::packPollBytes";
     int len = 0;
 
     for (int i = 0; i < mNumTechList; i++)
@@ -700,8 +804,7 @@ void NfcTag::fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, t
         case NFC_DISCOVERY_TYPE_LISTEN_A:
         case NFC_DISCOVERY_TYPE_LISTEN_A_ACTIVE:
             ALOGD ("%s: tech A", fn);
-            pollBytes.reset(e->NewByteArray(2));
-            e->SetByteArrayRegion(pollBytes.get(), 0, 2, (jbyte*) mTechParams [i].param.pa.sens_res);
+            packBytes (descriptor, mTechParams [i].param.pa.sens_res, 2);
             break;
 
         case NFC_DISCOVERY_TYPE_POLL_B:
@@ -718,12 +821,11 @@ void NfcTag::fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, t
                 ALOGD ("%s: tech B; TARGET_TYPE_ISO14443_3B", fn);
                 len = mTechParams [i].param.pb.sensb_res_len;
                 len = len - 4; //subtract 4 bytes for NFCID0 at byte 2 through 5
-                pollBytes.reset(e->NewByteArray(len));
-                e->SetByteArrayRegion(pollBytes.get(), 0, len, (jbyte*) (mTechParams [i].param.pb.sensb_res+4));
+                packBytes (descriptor, mTechParams [i].param.pb.sensb_res+4, len);
             }
             else
             {
-                pollBytes.reset(e->NewByteArray(0));
+                packBytes (descriptor, NULL, 0);
             }
             break;
 
@@ -743,13 +845,6 @@ void NfcTag::fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, t
                 memset (result, 0, sizeof(result));
                 len =  10;
 
-                /****
-                for (int ii = 0; ii < mTechParams [i].param.pf.sensf_res_len; ii++)
-                {
-                    ALOGD ("%s: tech F, sendf_res[%d]=%d (0x%x)",
-                          fn, ii, mTechParams [i].param.pf.sensf_res[ii],mTechParams [i].param.pf.sensf_res[ii]);
-                }
-                ***/
                 memcpy (result, mTechParams [i].param.pf.sensf_res + 8, 8); //copy PMm
                 if (activationData.params.t3t.num_system_codes > 0) //copy the first System Code
                 {
@@ -758,8 +853,7 @@ void NfcTag::fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, t
                     result [9] = (UINT8) systemCode;
                     ALOGD ("%s: tech F; sys code=0x%X 0x%X", fn, result [8], result [9]);
                 }
-                pollBytes.reset(e->NewByteArray(len));
-                e->SetByteArrayRegion(pollBytes.get(), 0, len, (jbyte*) result);
+                packBytes (descriptor, result, len);
             }
             break;
 
@@ -771,44 +865,36 @@ void NfcTag::fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, t
                 //iso 15693 Data Structure Format Identifier (DSF ID): 1 octet
                 //used by public API: NfcV.getDsfId(), NfcV.getResponseFlags();
                 uint8_t data [2]= {activationData.params.i93.afi, activationData.params.i93.dsfid};
-                pollBytes.reset(e->NewByteArray(2));
-                e->SetByteArrayRegion(pollBytes.get(), 0, 2, (jbyte *) data);
+                packBytes (descriptor, data, 2);
             }
             break;
 
         default:
             ALOGE ("%s: tech unknown ????", fn);
-            pollBytes.reset(e->NewByteArray(0));
+            packBytes (descriptor, NULL, 0);
             break;
         } //switch: every type of technology
-        e->SetObjectArrayElement(techPollBytes.get(), i, pollBytes.get());
     } //for: every technology in the array
-    jfieldID f = e->GetFieldID(tag_cls, "mTechPollBytes", "[[B");
-    e->SetObjectField(tag, f, techPollBytes.get());
 }
 
 
 /*******************************************************************************
 **
-** Function:        fillNativeNfcTagMembers4
+** Function:        packActivationBytes
 **
-** Description:     Fill NativeNfcTag's members: mTechActBytes.
+** Description:     Append each technology's activation bytes (NativeNfcTag's
+**                  mTechActBytes) to the descriptor.
 **                  The original Google's implementation is in set_target_activationBytes()
 **                  in com_android_nfc_NativeNfcTag.cpp;
-**                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
+**                  descriptor: Descriptor being built.
 **                  activationData: data from activation.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData)
+void NfcTag::packActivationBytes (std::vector<UINT8>& descriptor, tNFA_ACTIVATED& activationData)
 {
-    static const char fn [] = "NfcTag::fillNativeNfcTagMembers4";
-    ScopedLocalRef<jbyteArray> actBytes(e, e->NewByteArray(0));
-    ScopedLocalRef<jclass> byteArrayClass(e, e->GetObjectClass(actBytes.get()));
-    ScopedLocalRef<jobjectArray> techActBytes(e, e->NewObjectArray(mNumTechList, byteArrayClass.get(), 0));
+    static const char fn [] = "NfcTag::packActivationBytes";
 
     for (int i = 0; i < mNumTechList; i++)
     {
@@ -822,8 +908,7 @@ void NfcTag::fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, t
                     ALOGD ("%s: T1T; tech A", fn);
                 else if (mTechLibNfcTypes[i] == NFC_PROTOCOL_T2T)
                     ALOGD ("%s: T2T; tech A", fn);
-                actBytes.reset(e->NewByteArray(1));
-                e->SetByteArrayRegion(actBytes.get(), 0, 1, (jbyte*) &mTechParams [i].param.pa.sel_rsp);
+                packBytes (descriptor, &mTechParams [i].param.pa.sel_rsp, 1);
             }
             break;
 
@@ -831,7 +916,7 @@ void NfcTag::fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, t
             {
                 ALOGD ("%s: T3T; felica; tech F", fn);
                 //really, there is no data
-                actBytes.reset(e->NewByteArray(0));
+                packBytes (descriptor, NULL, 0);
             }
             break;
 
@@ -851,14 +936,12 @@ void NfcTag::fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, t
                         {
                             tNFC_INTF_PA_ISO_DEP& pa_iso = activationData.activate_ntf.intf_param.intf_param.pa_iso;
                             ALOGD ("%s: T4T; ISO_DEP for tech A; copy historical bytes; len=%u", fn, pa_iso.his_byte_len);
-                            actBytes.reset(e->NewByteArray(pa_iso.his_byte_len));
-                            if (pa_iso.his_byte_len > 0)
-                                e->SetByteArrayRegion(actBytes.get(), 0, pa_iso.his_byte_len, (jbyte*) (pa_iso.his_byte));
+                            packBytes (descriptor, pa_iso.his_byte, pa_iso.his_byte_len);
                         }
                         else
                         {
                             ALOGE ("%s: T4T; ISO_DEP for tech A; wrong interface=%u", fn, activationData.activate_ntf.intf_param.type);
-                            actBytes.reset(e->NewByteArray(0));
+                            packBytes (descriptor, NULL, 0);
                         }
                     }
                     else if ( (mTechParams[i].mode == NFC_DISCOVERY_TYPE_POLL_B) ||
@@ -873,26 +956,27 @@ void NfcTag::fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, t
                         {
                             tNFC_INTF_PB_ISO_DEP& pb_iso = activationData.activate_ntf.intf_param.intf_param.pb_iso;
                             ALOGD ("%s: T4T; ISO_DEP for tech B; copy response bytes; len=%u", fn, pb_iso.hi_info_len);
-                            actBytes.reset(e->NewByteArray(pb_iso.hi_info_len));
-                            if (pb_iso.hi_info_len > 0)
-                                e->SetByteArrayRegion(actBytes.get(), 0, pb_iso.hi_info_len, (jbyte*) (pb_iso.hi_info));
+                            packBytes (descriptor, pb_iso.hi_info, pb_iso.hi_info_len);
                         }
                         else
                         {
                             ALOGE ("%s: T4T; ISO_DEP for tech B; wrong interface=%u", fn, activationData.activate_ntf.intf_param.type);
-                            actBytes.reset(e->NewByteArray(0));
+                            packBytes (descriptor, NULL, 0);
                         }
                     }
+                    else
+                    {
+                        packBytes (descriptor, NULL, 0);
+                    }
                 }
                 else if (mTechList [i] == TARGET_TYPE_ISO14443_3A) //is TagTechnology.NFC_A by Java API
                 {
                     ALOGD ("%s: T4T; tech A", fn);
-                    actBytes.reset(e->NewByteArray(1));
-                    e->SetByteArrayRegion(actBytes.get(), 0, 1, (jbyte*) &mTechParams [i].param.pa.sel_rsp);
+                    packBytes (descriptor, &mTechParams [i].param.pa.sel_rsp, 1);
                 }
                 else
                 {
-                    actBytes.reset(e->NewByteArray(0));
+                    packBytes (descriptor, NULL, 0);
                 }
             } //case NFC_PROTOCOL_ISO_DEP: //t4t
             break;
@@ -904,52 +988,41 @@ void NfcTag::fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, t
                 //iso 15693 Data Structure Format Identifier (DSF ID): 1 octet
                 //used by public API: NfcV.getDsfId(), NfcV.getResponseFlags();
                 uint8_t data [2]= {activationData.params.i93.afi, activationData.params.i93.dsfid};
-                actBytes.reset(e->NewByteArray(2));
-                e->SetByteArrayRegion(actBytes.get(), 0, 2, (jbyte *) data);
+                packBytes (descriptor, data, 2);
             }
             break;
 
         default:
             ALOGD ("%s: tech unknown ????", fn);
-            actBytes.reset(e->NewByteArray(0));
+            packBytes (descriptor, NULL, 0);
             break;
         }//switch
-        e->SetObjectArrayElement(techActBytes.get(), i, actBytes.get());
     } //for: every technology in the array
-    jfieldID f = e->GetFieldID (tag_cls, "mTechActBytes", "[[B");
-    e->SetObjectField(tag, f, techActBytes.get());
 }
 
 
 /*******************************************************************************
 **
-** Function:        fillNativeNfcTagMembers5
+** Function:        packUid
 **
-** Description:     Fill NativeNfcTag's members: mUid.
+** Description:     Append the tag's UID (NativeNfcTag's mUid) to the descriptor.
 **                  The original Google's implementation is in nfc_jni_Discovery_notification_callback()
 **                  in com_android_nfc_NativeNfcManager.cpp;
-**                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
+**                  descriptor: Descriptor being built.
 **                  activationData: data from activation.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers5 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData)
+void NfcTag::packUid (std::vector<UINT8>& descriptor, tNFA_ACTIVATED& activationData)
 {
-    static const char fn [] = "NfcTag::fillNativeNfcTagMembers5";
-    int len = 0;
-    ScopedLocalRef<jbyteArray> uid(e, NULL);
+    static const char fn [] = "NfcTag::packUid";
 
     switch (mTechParams [0].mode)
     {
     case NFC_DISCOVERY_TYPE_POLL_KOVIO:
         ALOGD ("%s: Kovio", fn);
-        len = mTechParams [0].param.pk.uid_len;
-        uid.reset(e->NewByteArray(len));
-        e->SetByteArrayRegion(uid.get(), 0, len,
-                (jbyte*) &mTechParams [0].param.pk.uid);
+        packBytes (descriptor, mTechParams [0].param.pk.uid, mTechParams [0].param.pk.uid_len);
         break;
 
     case NFC_DISCOVERY_TYPE_POLL_A:
@@ -957,10 +1030,7 @@ void NfcTag::fillNativeNfcTagMembers5 (JNIEnv* e, jclass tag_cls, jobject tag, t
     case NFC_DISCOVERY_TYPE_LISTEN_A:
     case NFC_DISCOVERY_TYPE_LISTEN_A_ACTIVE:
         ALOGD ("%s: tech A", fn);
-        len = mTechParams [0].param.pa.nfcid1_len;
-        uid.reset(e->NewByteArray(len));
-        e->SetByteArrayRegion(uid.get(), 0, len,
-                (jbyte*) &mTechParams [0].param.pa.nfcid1);
+        packBytes (descriptor, mTechParams [0].param.pa.nfcid1, mTechParams [0].param.pa.nfcid1_len);
         //a tag's NFCID1 can change dynamically at each activation;
         //only the first byte (0x08) is constant; a dynamic NFCID1's length
         //must be 4 bytes (see NFC Digitial Protocol,
@@ -974,18 +1044,14 @@ void NfcTag::fillNativeNfcTagMembers5 (JNIEnv* e, jclass tag_cls, jobject tag, t
     case NFC_DISCOVERY_TYPE_LISTEN_B:
     case NFC_DISCOVERY_TYPE_LISTEN_B_PRIME:
         ALOGD ("%s: tech B", fn);
-        uid.reset(e->NewByteArray(NFC_NFCID0_MAX_LEN));
-        e->SetByteArrayRegion(uid.get(), 0, NFC_NFCID0_MAX_LEN,
-                (jbyte*) &mTechParams [0].param.pb.nfcid0);
+        packBytes (descriptor, mTechParams [0].param.pb.nfcid0, NFC_NFCID0_MAX_LEN);
         break;
 
     case NFC_DISCOVERY_TYPE_POLL_F:
     case NFC_DISCOVERY_TYPE_POLL_F_ACTIVE:
     case NFC_DISCOVERY_TYPE_LISTEN_F:
     case NFC_DISCOVERY_TYPE_LISTEN_F_ACTIVE:
-        uid.reset(e->NewByteArray(NFC_NFCID2_LEN));
-        e->SetByteArrayRegion(uid.get(), 0, NFC_NFCID2_LEN,
-                (jbyte*) &mTechParams [0].param.pf.nfcid2);
+        packBytes (descriptor, mTechParams [0].param.pf.nfcid2, NFC_NFCID2_LEN);
         ALOGD ("%s: tech F", fn);
         break;
 
@@ -993,21 +1059,122 @@ void NfcTag::fillNativeNfcTagMembers5 (JNIEnv* e, jclass tag_cls, jobject tag, t
     case NFC_DISCOVERY_TYPE_LISTEN_ISO15693:
         {
             ALOGD ("%s: tech iso 15693", fn);
-            jbyte data [I93_UID_BYTE_LEN];  //8 bytes
+            UINT8 data [I93_UID_BYTE_LEN];  //8 bytes
             for (int i=0; i<I93_UID_BYTE_LEN; ++i) //reverse the ID
                 data[i] = activationData.params.i93.uid [I93_UID_BYTE_LEN - i - 1];
-            uid.reset(e->NewByteArray(I93_UID_BYTE_LEN));
-            e->SetByteArrayRegion(uid.get(), 0, I93_UID_BYTE_LEN, data);
+            packBytes (descriptor, data, I93_UID_BYTE_LEN);
         }
         break;
 
     default:
         ALOGE ("%s: tech unknown ????", fn);
-        uid.reset(e->NewByteArray(0));
+        packBytes (descriptor, NULL, 0);
         break;
     }
-    jfieldID f = e->GetFieldID(tag_cls, "mUid", "[B");
-    e->SetObjectField(tag, f, uid.get());
+}
+
+
+/*******************************************************************************
+**
+** Function:        isNdefProtocol
+**
+** Description:     Whether the stack can detect and read NDEF over a protocol.
+**                  protocol: NFC protocol.
+**
+** Returns:         True if NDEF-capable.
+**
+*******************************************************************************/
+bool NfcTag::isNdefProtocol (tNFC_PROTOCOL protocol)
+{
+    switch (protocol)
+    {
+    case NFC_PROTOCOL_T1T:
+    case NFC_PROTOCOL_T2T:
+    case NFC_PROTOCOL_T3T:
+    case NFC_PROTOCOL_ISO_DEP:
+    case NFC_PROTOCOL_15693:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        computeNdefCacheKey
+**
+** Description:     Build the NdefCache key of the activated tag from its
+**                  protocol and UID.  Tags with a dynamic ID and protocols
+**                  that cannot be revalidated get an empty key.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::computeNdefCacheKey ()
+{
+    static const char fn [] = "NfcTag::computeNdefCacheKey";
+    mNdefCacheKey.clear ();
+
+    //a random ID changes at every activation, so it cannot identify the tag
+    if (isDynamicTagId () || mIsDynamicTagId)
+    {
+        ALOGD ("%s: dynamic tag id; not cacheable", fn);
+        return;
+    }
+
+    if ((mProtocol != NFC_PROTOCOL_T2T) && (mProtocol != NFC_PROTOCOL_ISO_DEP))
+        return;
+
+    switch (mTechParams [0].mode)
+    {
+    case NFC_DISCOVERY_TYPE_POLL_A:
+    case NFC_DISCOVERY_TYPE_POLL_A_ACTIVE:
+        mNdefCacheKey.push_back (mProtocol);
+        mNdefCacheKey.append (mTechParams [0].param.pa.nfcid1, mTechParams [0].param.pa.nfcid1_len);
+        break;
+
+    case NFC_DISCOVERY_TYPE_POLL_B:
+    case NFC_DISCOVERY_TYPE_POLL_B_PRIME:
+        mNdefCacheKey.push_back (mProtocol);
+        mNdefCacheKey.append (mTechParams [0].param.pb.nfcid0, NFC_NFCID0_MAX_LEN);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        getNdefCacheKey
+**
+** Description:     Get the key that identifies the activated tag in NdefCache.
+**
+** Returns:         Protocol followed by UID; empty if the tag must not be cached.
+**
+*******************************************************************************/
+const std::basic_string<UINT8>& NfcTag::getNdefCacheKey ()
+{
+    return mNdefCacheKey;
+}
+
+
+/*******************************************************************************
+**
+** Function:        setSkipNdefCheck
+**
+** Description:     Set whether reader mode skips the NDEF check.  Tags are
+**                  not read eagerly at activation while it is set.
+**                  skip: True to skip the NDEF check.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfcTag::setSkipNdefCheck (bool skip)
+{
+    mSkipNdefCheck = skip;
 }
 
 
@@ -1110,6 +1277,12 @@ void NfcTag::resetTechnologies ()
     memset (mTechParams, 0, sizeof(mTechParams));
     mIsDynamicTagId = false;
     mIsFelicaLite = false;
+    mNdefCacheKey.clear ();
+    {
+        AutoMutex mutex (mLatencyMutex);
+        mTagClass = 0;
+        mIsoDepWaitTime = 0;
+    }
     resetAllTransceiveTimeouts ();
 }
 
@@ -1360,6 +1533,11 @@ void NfcTag::connectionEventHandler (UINT8 event, tNFA_CONN_EVT_DATA* data)
         break;
 
     case NFA_DEACTIVATED_EVT:
+        if (!mPendingDescriptor.empty ())
+        {
+            ALOGD ("%s: tag left during eager NDEF read; drop it", fn);
+            mPendingDescriptor.clear ();
+        }
         mIsActivated = false;
         mProtocol = NFC_PROTOCOL_UNKNOWN;
         resetTechnologies ();
@@ -1437,8 +1615,29 @@ void NfcTag::resetAllTransceiveTimeouts ()
     mTechnologyTimeoutsTable [TARGET_TYPE_MIFARE_CLASSIC] = 618; //MifareClassic
     mTechnologyTimeoutsTable [TARGET_TYPE_MIFARE_UL] = 618; //MifareUltralight
     mTechnologyTimeoutsTable [TARGET_TYPE_KOVIO_BARCODE] = 1000; //NfcBarcode
+    mTechnologyDefaultTimeoutsTable = mTechnologyTimeoutsTable;
+}
+
+
+/*******************************************************************************
+**
+** Function:        isDefaultTransceiveTimeout
+**
+** Description:     Is the timeout value for a technology the default value?
+**                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h.
+**                  timeout: Check this value against the default value.
+**
+** Returns:         True if timeout is equal to the default value.
+**
+*******************************************************************************/
+bool NfcTag::isDefaultTransceiveTimeout (int techId, int timeout)
+{
+    if ((techId >= 0) && (techId < (int) mTechnologyDefaultTimeoutsTable.size()))
+        return mTechnologyDefaultTimeoutsTable [techId] == timeout;
+    return false;
 }
 
+
 /*******************************************************************************
 **
 ** Function:        getTransceiveTimeout
@@ -1482,6 +1681,220 @@ void NfcTag::setTransceiveTimeout (int techId, int timeout)
 }
 
 
+/*******************************************************************************
+**
+** Function:        computeTagClass
+**
+** Description:     Classify the activated tag so that tags which answer alike
+**                  share round-trip statistics: protocol, ATQA and SAK for
+**                  technology A; protocol and mode otherwise.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::computeTagClass ()
+{
+    UINT32 tagClass = (UINT32) mProtocol << 24;
+    switch (mTechParams [0].mode)
+    {
+    case NFC_DISCOVERY_TYPE_POLL_A:
+    case NFC_DISCOVERY_TYPE_POLL_A_ACTIVE:
+        tagClass |= ((UINT32) mTechParams [0].param.pa.sens_res [0] << 16) |
+                ((UINT32) mTechParams [0].param.pa.sens_res [1] << 8) |
+                mTechParams [0].param.pa.sel_rsp;
+        break;
+
+    default:
+        tagClass |= (UINT32) mTechParams [0].mode << 16;
+        break;
+    }
+
+    AutoMutex mutex (mLatencyMutex);
+    mTagClass = tagClass;
+}
+
+
+/*******************************************************************************
+**
+** Function:        computeIsoDepWaitTime
+**
+** Description:     Derive the shortest safe timeout of an ISO-DEP tag from the
+**                  frame waiting time integer (FWI) it announced: in the ATS
+**                  for technology A, in the SENSB_RES protocol info for B.
+**                  activationData: data from activation.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::computeIsoDepWaitTime (tNFA_ACTIVATED& activationData)
+{
+    static const char fn [] = "NfcTag::computeIsoDepWaitTime";
+    static const int DEFAULT_FWI = 4; //see ISO/IEC 14443-4, section 5.2.5
+    tNFC_ACTIVATE_DEVT& activate = activationData.activate_ntf;
+    int fwi = -1;
+
+    if ((mProtocol == NFC_PROTOCOL_ISO_DEP) && (activate.intf_param.type == NFC_INTERFACE_ISO_DEP))
+    {
+        switch (activate.rf_tech_param.mode)
+        {
+        case NFC_DISCOVERY_TYPE_POLL_A:
+        case NFC_DISCOVERY_TYPE_POLL_A_ACTIVE:
+            fwi = activate.intf_param.intf_param.pa_iso.fwi;
+            break;
+
+        case NFC_DISCOVERY_TYPE_POLL_B:
+            //SENSB_RES without its first byte: NFCID0, application data, protocol info
+            if (activate.rf_tech_param.param.pb.sensb_res_len > 10)
+                fwi = activate.rf_tech_param.param.pb.sensb_res [10] >> 4;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    int waitTime = 0;
+    if (fwi >= 0)
+    {
+        if (fwi > 14)
+            fwi = DEFAULT_FWI; //15 is reserved
+        //FWT = (256 * 16 / fc) * 2^FWI, about 302 us * 2^FWI
+        waitTime = (int) ((((UINT32) 302 << fwi) + 999) / 1000) * ISO_DEP_FWT_MARGIN;
+        ALOGD ("%s: fwi=%d; wait time=%d", fn, fwi, waitTime);
+    }
+
+    AutoMutex mutex (mLatencyMutex);
+    mIsoDepWaitTime = waitTime;
+}
+
+
+/*******************************************************************************
+**
+** Function:        findLatencyHistogram
+**
+** Description:     Find the round-trip statistics of the activated tag's class.
+**                  The caller holds mLatencyMutex.
+**                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h
+**
+** Returns:         Histogram; NULL if there is none.
+**
+*******************************************************************************/
+NfcTag::tLatencyHistogram* NfcTag::findLatencyHistogram (int techId)
+{
+    for (size_t i = 0; i < mLatencyHistograms.size(); i++)
+    {
+        if ((mLatencyHistograms [i].mTagClass == mTagClass) && (mLatencyHistograms [i].mTechId == techId))
+            return &mLatencyHistograms [i];
+    }
+    return NULL;
+}
+
+
+/*******************************************************************************
+**
+** Function:        recordTransceiveLatency
+**
+** Description:     Remember how long the activated tag took to answer a frame.
+**                  A frame that timed out is recorded with the timeout, so
+**                  that timeouts raise the learned percentile.
+**                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h
+**                  millisec: round-trip time, or timeout, in millisecond.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::recordTransceiveLatency (int techId, int millisec)
+{
+    AutoMutex mutex (mLatencyMutex);
+    if (mTagClass == 0)
+        return;
+
+    tLatencyHistogram* histogram = findLatencyHistogram (techId);
+    if (histogram == NULL)
+    {
+        if ((int) mLatencyHistograms.size() >= MAX_LATENCY_HISTOGRAMS)
+            mLatencyHistograms.erase (mLatencyHistograms.begin());
+        tLatencyHistogram newHistogram;
+        memset (&newHistogram, 0, sizeof(newHistogram));
+        newHistogram.mTagClass = mTagClass;
+        newHistogram.mTechId = techId;
+        mLatencyHistograms.push_back (newHistogram);
+        histogram = &mLatencyHistograms.back ();
+    }
+
+    int bucket = 0;
+    while ((bucket < NUM_LATENCY_BUCKETS - 1) && (millisec >= (1 << bucket)))
+        bucket++;
+    histogram->mBuckets [bucket]++;
+    histogram->mCount++;
+
+    //age the history so the timeout follows changes in the tag's behavior
+    if (histogram->mCount >= MAX_LATENCY_SAMPLES)
+    {
+        histogram->mCount = 0;
+        for (int i = 0; i < NUM_LATENCY_BUCKETS; i++)
+        {
+            histogram->mBuckets [i] /= 2;
+            histogram->mCount += histogram->mBuckets [i];
+        }
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        getEffectiveTransceiveTimeout
+**
+** Description:     Get the timeout to use for the activated tag.  Once enough
+**                  round trips of tags like this one are known, the timeout
+**                  shrinks to a margin above their 99th percentile; it never
+**                  exceeds the configured value, and a value set by an
+**                  application is used as is.  For ISO-DEP tags the timeout
+**                  never drops below the frame waiting time the tag announced,
+**                  with room for retransmissions; a tag that announced none
+**                  keeps the configured value.  Waiting time extensions the
+**                  tag asks for are part of the round trips that are learned.
+**                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h
+**
+** Returns:         Timeout value in millisecond.
+**
+*******************************************************************************/
+int NfcTag::getEffectiveTransceiveTimeout (int techId)
+{
+    static const char fn [] = "NfcTag::getEffectiveTransceiveTimeout";
+    int configured = getTransceiveTimeout (techId);
+    if (!isDefaultTransceiveTimeout (techId, configured))
+        return configured;
+
+    AutoMutex mutex (mLatencyMutex);
+    if ((mProtocol == NFC_PROTOCOL_ISO_DEP) && (mIsoDepWaitTime == 0))
+        return configured;
+    tLatencyHistogram* histogram = findLatencyHistogram (techId);
+    if ((histogram == NULL) || (histogram->mCount < MIN_LATENCY_SAMPLES))
+        return configured;
+
+    UINT32 needed = histogram->mCount - (histogram->mCount / 100); //99 percent
+    UINT32 sum = 0;
+    int bucket = 0;
+    for (; bucket < NUM_LATENCY_BUCKETS - 1; bucket++)
+    {
+        sum += histogram->mBuckets [bucket];
+        if (sum >= needed)
+            break;
+    }
+
+    int timeout = (1 << bucket) * LATENCY_TIMEOUT_MARGIN;
+    if (timeout < MIN_ADAPTIVE_TIMEOUT)
+        timeout = MIN_ADAPTIVE_TIMEOUT;
+    if ((mProtocol == NFC_PROTOCOL_ISO_DEP) && (timeout < mIsoDepWaitTime))
+        timeout = mIsoDepWaitTime;
+    if (timeout > configured)
+        timeout = configured;
+    ALOGD ("%s: tech=%d; configured=%d; effective=%d", fn, techId, configured, timeout);
+    return timeout;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        getPresenceCheckAlgorithm
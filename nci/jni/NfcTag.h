@@ -22,6 +22,7 @@
 #include "SyncEvent.h"
 #include "NfcJniUtil.h"
 #include <vector>
+#include <string>
 extern "C"
 {
     #include "nfa_rw_api.h"
@@ -335,6 +336,40 @@ public:
     void setTransceiveTimeout (int techId, int timeout);
 
 
+    /*******************************************************************************
+    **
+    ** Function:        recordTransceiveLatency
+    **
+    ** Description:     Remember how long the activated tag took to answer a frame.
+    **                  A frame that timed out is recorded with the timeout, so
+    **                  that timeouts raise the learned percentile.
+    **                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h
+    **                  millisec: round-trip time, or timeout, in millisecond.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void recordTransceiveLatency (int techId, int millisec);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        getEffectiveTransceiveTimeout
+    **
+    ** Description:     Get the timeout to use for the activated tag.  Once enough
+    **                  round trips of tags like this one are known, the timeout
+    **                  shrinks to a margin above their 99th percentile; it never
+    **                  exceeds the configured value, and a value set by an
+    **                  application is used as is.  For ISO-DEP tags the timeout
+    **                  never drops below the frame waiting time the tag announced.
+    **                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h
+    **
+    ** Returns:         Timeout value in millisecond.
+    **
+    *******************************************************************************/
+    int getEffectiveTransceiveTimeout (int techId);
+
+
     /*******************************************************************************
     **
     ** Function:        getPresenceCheckAlgorithm
@@ -372,7 +407,70 @@ public:
     bool isKovioType2Tag ();
 
 
+
+    /*******************************************************************************
+    **
+    ** Function:        getNdefCacheKey
+    **
+    ** Description:     Get the key that identifies the activated tag in NdefCache.
+    **
+    ** Returns:         Protocol followed by UID; empty if the tag must not be cached.
+    **
+    *******************************************************************************/
+    const std::basic_string<UINT8>& getNdefCacheKey ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        setSkipNdefCheck
+    **
+    ** Description:     Set whether reader mode skips the NDEF check.  Tags are
+    **                  not read eagerly at activation while it is set.
+    **                  skip: True to skip the NDEF check.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void setSkipNdefCheck (bool skip);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        deliverEagerNdefResult
+    **
+    ** Description:     Attach the result of the eager NDEF check and read to the
+    **                  tag held back at activation; notify NFC service.
+    **                  status: Status of NDEF check.
+    **                  maxSize: Maximum NDEF message size.
+    **                  mode: NDEF_MODE_READ_ONLY, NDEF_MODE_READ_WRITE, NDEF_MODE_UNKNOWN.
+    **                  message: NDEF message.
+    **                  messageLen: Length of message; -1 if it could not be read.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void deliverEagerNdefResult (tNFA_STATUS status, int maxSize, int mode, const UINT8* message, int messageLen);
+
+
 private:
+    static const int NUM_LATENCY_BUCKETS = 12; //bucket i counts round trips shorter than 2^i ms
+    static const int MAX_LATENCY_HISTOGRAMS = 16; //number of tag classes remembered
+    static const UINT32 MIN_LATENCY_SAMPLES = 32; //round trips needed before the timeout adapts
+    static const UINT32 MAX_LATENCY_SAMPLES = 1024; //history is halved when reaching this
+    static const int LATENCY_TIMEOUT_MARGIN = 4; //multiple of the 99th percentile
+    static const int MIN_ADAPTIVE_TIMEOUT = 100; //adaptive timeout never drops below this (ms)
+    static const int ISO_DEP_FWT_MARGIN = 4; //frame waiting times per ISO-DEP frame: the frame and two retransmissions, plus slack
+    static const UINT8 ACTIVATION_DESCRIPTOR_VERSION = 1; //must match NativeNfcTag.java
+    static const size_t ACTIVATION_DESCRIPTOR_RESERVE = 128; //fits most tags without regrowing
+
+    struct tLatencyHistogram
+    {
+        UINT32 mTagClass; //tags of one class answer alike, e.g. same ATQA and SAK
+        int mTechId;
+        UINT32 mCount;
+        UINT32 mBuckets [NUM_LATENCY_BUCKETS];
+    };
+
     std::vector<int> mTechnologyTimeoutsTable;
     std::vector<int> mTechnologyDefaultTimeoutsTable;
     nfc_jni_native_data* mNativeData;
@@ -390,6 +488,17 @@ private:
     bool mIsDynamicTagId; // whether the tag has dynamic tag ID
     tNFA_RW_PRES_CHK_OPTION mPresenceCheckAlgorithm;
     bool mIsFelicaLite;
+    std::basic_string<UINT8> mNdefCacheKey; //key of the activated tag in NdefCache
+    UINT32 mTagClass; //latency class of the activated tag
+    int mIsoDepWaitTime; //floor of the ISO-DEP timeout in ms; 0 if the tag is not ISO-DEP
+    std::vector<tLatencyHistogram> mLatencyHistograms; //least recently created first
+    Mutex mLatencyMutex; //guards mTagClass and mLatencyHistograms
+    jclass mNativeTagClass; //global ref to Java NativeNfcTag class; cached on first tag
+    jmethodID mNativeTagCtor;
+    jfieldID mNativeTagDescriptorField; //NativeNfcTag.mActivationDescriptor
+    bool mEagerNdefRead; //check and read NDEF before NFC service sees the tag
+    bool mSkipNdefCheck; //reader mode asked not to check NDEF; no eager read
+    std::vector<UINT8> mPendingDescriptor; //tag held back until its eager NDEF read completes
 
     /*******************************************************************************
     **
@@ -439,7 +548,7 @@ private:
     ** Function:        createNativeNfcTag
     **
     ** Description:     Create a brand new Java NativeNfcTag object;
-    **                  fill the objects's member variables with data;
+    **                  hand it all activation data as one packed descriptor;
     **                  notify NFC service;
     **                  activationData: data from activation.
     **
@@ -451,89 +560,150 @@ private:
 
     /*******************************************************************************
     **
-    ** Function:        fillNativeNfcTagMembers1
+    ** Function:        notifyNativeNfcTag
     **
-    ** Description:     Fill NativeNfcTag's members: mProtocols, mTechList, mTechHandles, mTechLibNfcTypes.
+    ** Description:     Create a Java NativeNfcTag object that holds an activation
+    **                  descriptor; notify NFC service about it.
     **                  e: JVM environment.
-    **                  tag_cls: Java NativeNfcTag class.
-    **                  tag: Java NativeNfcTag object.
+    **                  descriptor: Complete activation descriptor.
     **
     ** Returns:         None
     **
     *******************************************************************************/
-    void fillNativeNfcTagMembers1 (JNIEnv* e, jclass tag_cls, jobject tag);
+    void notifyNativeNfcTag (JNIEnv* e, const std::vector<UINT8>& descriptor);
 
 
     /*******************************************************************************
     **
-    ** Function:        fillNativeNfcTagMembers2
+    ** Function:        isNdefProtocol
     **
-    ** Description:     Fill NativeNfcTag's members: mConnectedTechIndex or mConnectedTechnology.
-    **                  The original Google's implementation is in set_target_pollBytes(
-    **                  in com_android_nfc_NativeNfcTag.cpp;
-    **                  e: JVM environment.
-    **                  tag_cls: Java NativeNfcTag class.
-    **                  tag: Java NativeNfcTag object.
-    **                  activationData: data from activation.
+    ** Description:     Whether the stack can detect and read NDEF over a protocol.
+    **                  protocol: NFC protocol.
+    **
+    ** Returns:         True if NDEF-capable.
+    **
+    *******************************************************************************/
+    bool isNdefProtocol (tNFC_PROTOCOL protocol);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        packTechLists
+    **
+    ** Description:     Append NativeNfcTag's mTechList, mTechHandles, mTechLibNfcTypes
+    **                  to the activation descriptor; fill mProtocols and handles
+    **                  of the native data.
+    **                  descriptor: Descriptor being built.
     **
     ** Returns:         None
     **
     *******************************************************************************/
-    void fillNativeNfcTagMembers2 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData);
+    void packTechLists (std::vector<UINT8>& descriptor);
 
 
     /*******************************************************************************
     **
-    ** Function:        fillNativeNfcTagMembers3
+    ** Function:        packPollBytes
     **
-    ** Description:     Fill NativeNfcTag's members: mTechPollBytes.
+    ** Description:     Append NativeNfcTag's mTechPollBytes to the activation descriptor.
     **                  The original Google's implementation is in set_target_pollBytes(
     **                  in com_android_nfc_NativeNfcTag.cpp;
-    **                  e: JVM environment.
-    **                  tag_cls: Java NativeNfcTag class.
-    **                  tag: Java NativeNfcTag object.
+    **                  descriptor: Descriptor being built.
     **                  activationData: data from activation.
     **
     ** Returns:         None
     **
     *******************************************************************************/
-    void fillNativeNfcTagMembers3 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData);
+    void packPollBytes (std::vector<UINT8>& descriptor, tNFA_ACTIVATED& activationData);
 
 
     /*******************************************************************************
     **
-    ** Function:        fillNativeNfcTagMembers4
+    ** Function:        packActivationBytes
     **
-    ** Description:     Fill NativeNfcTag's members: mTechActBytes.
+    ** Description:     Append NativeNfcTag's mTechActBytes to the activation descriptor.
     **                  The original Google's implementation is in set_target_activationBytes()
     **                  in com_android_nfc_NativeNfcTag.cpp;
-    **                  e: JVM environment.
-    **                  tag_cls: Java NativeNfcTag class.
-    **                  tag: Java NativeNfcTag object.
+    **                  descriptor: Descriptor being built.
     **                  activationData: data from activation.
     **
     ** Returns:         None
     **
     *******************************************************************************/
-    void fillNativeNfcTagMembers4 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData);
+    void packActivationBytes (std::vector<UINT8>& descriptor, tNFA_ACTIVATED& activationData);
 
 
     /*******************************************************************************
     **
-    ** Function:        fillNativeNfcTagMembers5
+    ** Function:        packUid
     **
-    ** Description:     Fill NativeNfcTag's members: mUid.
+    ** Description:     Append NativeNfcTag's mUid to the activation descriptor;
+    **                  detect dynamic tag IDs.
     **                  The original Google's implementation is in nfc_jni_Discovery_notification_callback()
     **                  in com_android_nfc_NativeNfcManager.cpp;
-    **                  e: JVM environment.
-    **                  tag_cls: Java NativeNfcTag class.
-    **                  tag: Java NativeNfcTag object.
+    **                  descriptor: Descriptor being built.
+    **                  activationData: data from activation.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void packUid (std::vector<UINT8>& descriptor, tNFA_ACTIVATED& activationData);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        computeNdefCacheKey
+    **
+    ** Description:     Build the NdefCache key of the activated tag from its
+    **                  protocol and UID.  Tags with a dynamic ID and protocols
+    **                  that cannot be revalidated get an empty key.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void computeNdefCacheKey ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        computeTagClass
+    **
+    ** Description:     Classify the activated tag so that tags which answer alike
+    **                  share round-trip statistics: protocol, ATQA and SAK for
+    **                  technology A; protocol and mode otherwise.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void computeTagClass ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        computeIsoDepWaitTime
+    **
+    ** Description:     Derive the shortest safe timeout of an ISO-DEP tag from the
+    **                  frame waiting time integer (FWI) it announced: in the ATS
+    **                  for technology A, in the SENSB_RES protocol info for B.
     **                  activationData: data from activation.
     **
     ** Returns:         None
     **
     *******************************************************************************/
-    void fillNativeNfcTagMembers5 (JNIEnv* e, jclass tag_cls, jobject tag, tNFA_ACTIVATED& activationData);
+    void computeIsoDepWaitTime (tNFA_ACTIVATED& activationData);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        findLatencyHistogram
+    **
+    ** Description:     Find the round-trip statistics of the activated tag's class.
+    **                  techId: one of the values in TARGET_TYPE_* defined in NfcJniUtil.h
+    **
+    ** Returns:         Histogram; NULL if there is none.
+    **
+    *******************************************************************************/
+    tLatencyHistogram* findLatencyHistogram (int techId);
 
 
     /*******************************************************************************
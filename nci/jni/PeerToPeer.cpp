@@ -23,7 +23,12 @@
 #include "llcp_defs.h"
 #include "config.h"
 #include "JavaClassConstants.h"
+#include "LatencyStats.h"
 #include <ScopedLocalRef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
 
 /* Some older PN544-based solutions would only send the first SYMM back
  * (as an initiator) after the full LTO (750ms). But our connect timer
@@ -63,10 +68,14 @@ PeerToPeer::PeerToPeer ()
                         | NFA_TECHNOLOGY_MASK_F
                         | NFA_TECHNOLOGY_MASK_A_ACTIVE
                         | NFA_TECHNOLOGY_MASK_F_ACTIVE),
+    mMaxServers (DEFAULT_MAX_P2P_SERVERS),
+    mMaxClients (DEFAULT_MAX_P2P_CLIENTS),
+    mMaxConnsPerServer (MAX_NFA_CONNS_PER_SERVER),
     mNextJniHandle (1)
 {
-    memset (mServers, 0, sizeof(mServers));
-    memset (mClients, 0, sizeof(mClients));
+    mReadyEpollFd = epoll_create (DEFAULT_MAX_P2P_CLIENTS);
+    if (mReadyEpollFd < 0)
+        ALOGE ("PeerToPeer: epoll_create failed; errno=%d", errno);
 }
 
 
@@ -81,6 +90,8 @@ PeerToPeer::PeerToPeer ()
 *******************************************************************************/
 PeerToPeer::~PeerToPeer ()
 {
+    if (mReadyEpollFd >= 0)
+        close (mReadyEpollFd);
 }
 
 
@@ -115,6 +126,14 @@ void PeerToPeer::initialize ()
 
     if (GetNumValue ("P2P_LISTEN_TECH_MASK", &num, sizeof (num)))
         mP2pListenTechMask = num;
+    if (GetNumValue ("P2P_MAX_SERVERS", &num, sizeof (num)) && (num > 0))
+        mMaxServers = num;
+    if (GetNumValue ("P2P_MAX_CLIENTS", &num, sizeof (num)) && (num > 0))
+        mMaxClients = num;
+    if (GetNumValue ("P2P_MAX_CONNS_PER_SERVER", &num, sizeof (num)) && (num > 0))
+        mMaxConnsPerServer = num;
+    ALOGD ("PeerToPeer::initialize: max servers=%u  max clients=%u  max conns per server=%u",
+            mMaxServers, mMaxClients, mMaxConnsPerServer);
 }
 
 
@@ -131,13 +150,10 @@ void PeerToPeer::initialize ()
 *******************************************************************************/
 sp<P2pServer> PeerToPeer::findServerLocked (tNFA_HANDLE nfaP2pServerHandle)
 {
-    for (int i = 0; i < sMax; i++)
+    for (tServerMap::const_iterator it = mServers.begin(); it != mServers.end(); ++it)
     {
-        if ( (mServers[i] != NULL)
-          && (mServers[i]->mNfaP2pServerHandle == nfaP2pServerHandle) )
-        {
-            return (mServers [i]);
-        }
+        if (it->second->mNfaP2pServerHandle == nfaP2pServerHandle)
+            return (it->second);
     }
 
     // If here, not found
@@ -158,14 +174,9 @@ sp<P2pServer> PeerToPeer::findServerLocked (tNFA_HANDLE nfaP2pServerHandle)
 *******************************************************************************/
 sp<P2pServer> PeerToPeer::findServerLocked (tJNI_HANDLE jniHandle)
 {
-    for (int i = 0; i < sMax; i++)
-    {
-        if ( (mServers[i] != NULL)
-          && (mServers[i]->mJniHandle == jniHandle) )
-        {
-            return (mServers [i]);
-        }
-    }
+    tServerMap::const_iterator it = mServers.find (jniHandle);
+    if (it != mServers.end())
+        return (it->second);
 
     // If here, not found
     return NULL;
@@ -185,10 +196,10 @@ sp<P2pServer> PeerToPeer::findServerLocked (tJNI_HANDLE jniHandle)
 *******************************************************************************/
 sp<P2pServer> PeerToPeer::findServerLocked (const char *serviceName)
 {
-    for (int i = 0; i < sMax; i++)
+    for (tServerMap::const_iterator it = mServers.begin(); it != mServers.end(); ++it)
     {
-        if ( (mServers[i] != NULL) && (mServers[i]->mServiceName.compare(serviceName) == 0) )
-            return (mServers [i]);
+        if (it->second->mServiceName.compare(serviceName) == 0)
+            return (it->second);
     }
 
     // If here, not found
@@ -220,20 +231,18 @@ bool PeerToPeer::registerServer (tJNI_HANDLE jniHandle, const char *serviceName)
         ALOGD ("%s: service name=%s  already registered, handle: 0x%04x", fn, serviceName, pSrv->mNfaP2pServerHandle);
 
         // Update JNI handle
+        mServers.erase (pSrv->mJniHandle);
         pSrv->mJniHandle = jniHandle;
+        mServers [jniHandle] = pSrv;
         mMutex.unlock();
         return (true);
     }
 
-    for (int ii = 0; ii < sMax; ii++)
+    if (mServers.size() < mMaxServers)
     {
-        if (mServers[ii] == NULL)
-        {
-            pSrv = mServers[ii] = new P2pServer(jniHandle, serviceName);
+        pSrv = mServers [jniHandle] = new P2pServer(jniHandle, serviceName, mMaxConnsPerServer);
 
-            ALOGD ("%s: added new p2p server  index: %d  handle: %u  name: %s", fn, ii, jniHandle, serviceName);
-            break;
-        }
+        ALOGD ("%s: added new p2p server  count: %u  handle: %u  name: %s", fn, mServers.size(), jniHandle, serviceName);
     }
     mMutex.unlock();
 
@@ -267,21 +276,24 @@ bool PeerToPeer::registerServer (tJNI_HANDLE jniHandle, const char *serviceName)
 void PeerToPeer::removeServer (tJNI_HANDLE jniHandle)
 {
     static const char fn [] = "PeerToPeer::removeServer";
+    std::vector<sp<NfaConn> > removed;
 
     AutoMutex mutex(mMutex);
 
-    for (int i = 0; i < sMax; i++)
+    tServerMap::iterator it = mServers.find (jniHandle);
+    if (it == mServers.end())
     {
-        if ( (mServers[i] != NULL) && (mServers[i]->mJniHandle == jniHandle) )
-        {
-            ALOGD ("%s: server jni_handle: %u;  nfa_handle: 0x%04x; name: %s; index=%d",
-                    fn, jniHandle, mServers[i]->mNfaP2pServerHandle, mServers[i]->mServiceName.c_str(), i);
-
-            mServers [i] = NULL;
-            return;
-        }
+        ALOGE ("%s: unknown server jni handle: %u", fn, jniHandle);
+        return;
     }
-    ALOGE ("%s: unknown server jni handle: %u", fn, jniHandle);
+
+    ALOGD ("%s: server jni_handle: %u;  nfa_handle: 0x%04x; name: %s",
+            fn, jniHandle, it->second->mNfaP2pServerHandle, it->second->mServiceName.c_str());
+
+    it->second->removeAllConnections (removed);
+    mServers.erase (it);
+    for (size_t ii = 0; ii < removed.size(); ii++)
+        removeConnIndex (removed[ii]);
 }
 
 
@@ -516,22 +528,18 @@ bool PeerToPeer::deregisterServer (tJNI_HANDLE jniHandle)
 bool PeerToPeer::createClient (tJNI_HANDLE jniHandle, UINT16 miu, UINT8 rw)
 {
     static const char fn [] = "PeerToPeer::createClient";
-    int i = 0;
     ALOGD ("%s: enter: jni h: %u  miu: %u  rw: %u", fn, jniHandle, miu, rw);
 
     mMutex.lock();
     sp<P2pClient> client = NULL;
-    for (i = 0; i < sMax; i++)
+    if ((mClients.size() < mMaxClients) && (mClients.find (jniHandle) == mClients.end()))
     {
-        if (mClients[i] == NULL)
-        {
-            mClients [i] = client = new P2pClient();
+        mClients [jniHandle] = client = new P2pClient();
 
-            mClients [i]->mClientConn->mJniHandle   = jniHandle;
-            mClients [i]->mClientConn->mMaxInfoUnit = miu;
-            mClients [i]->mClientConn->mRecvWindow  = rw;
-            break;
-        }
+        client->mClientConn->mJniHandle   = jniHandle;
+        client->mClientConn->mMaxInfoUnit = miu;
+        client->mClientConn->mRecvWindow  = rw;
+        addConnIndex (client->mClientConn);
     }
     mMutex.unlock();
 
@@ -544,12 +552,12 @@ bool PeerToPeer::createClient (tJNI_HANDLE jniHandle, UINT16 miu, UINT8 rw)
     ALOGD ("%s: pClient: 0x%p  assigned for client jniHandle: %u", fn, client.get(), jniHandle);
 
     {
-        SyncEventGuard guard (mClients[i]->mRegisteringEvent);
+        SyncEventGuard guard (client->mRegisteringEvent);
         NFA_P2pRegisterClient (NFA_P2P_DLINK_TYPE, nfaClientCallback);
-        mClients[i]->mRegisteringEvent.wait(); //wait for NFA_P2P_REG_CLIENT_EVT
+        client->mRegisteringEvent.wait(); //wait for NFA_P2P_REG_CLIENT_EVT
     }
 
-    if (mClients[i]->mNfaP2pClientHandle != NFA_HANDLE_INVALID)
+    if (client->mNfaP2pClientHandle != NFA_HANDLE_INVALID)
     {
         ALOGD ("%s: exit; new client jniHandle: %u   NFA Handle: 0x%04x", fn, jniHandle, client->mClientConn->mNfaConnHandle);
         return (true);
@@ -579,27 +587,23 @@ void PeerToPeer::removeConn(tJNI_HANDLE jniHandle)
 
     AutoMutex mutex(mMutex);
     // If the connection is a for a client, delete the client itself
-    for (int ii = 0; ii < sMax; ii++)
+    tClientMap::iterator client = mClients.find (jniHandle);
+    if (client != mClients.end())
     {
-        if ((mClients[ii] != NULL) && (mClients[ii]->mClientConn->mJniHandle == jniHandle))
-        {
-            if (mClients[ii]->mNfaP2pClientHandle != NFA_HANDLE_INVALID)
-                NFA_P2pDeregister (mClients[ii]->mNfaP2pClientHandle);
+        if (client->second->mNfaP2pClientHandle != NFA_HANDLE_INVALID)
+            NFA_P2pDeregister (client->second->mNfaP2pClientHandle);
 
-            mClients[ii] = NULL;
-            ALOGD ("%s: deleted client handle: %u  index: %u", fn, jniHandle, ii);
-            return;
-        }
+        removeConnIndex (client->second->mClientConn);
+        mClients.erase (client);
+        ALOGD ("%s: deleted client handle: %u", fn, jniHandle);
+        return;
     }
 
     // If the connection is for a server, just delete the connection
-    for (int ii = 0; ii < sMax; ii++)
+    for (tServerMap::const_iterator it = mServers.begin(); it != mServers.end(); ++it)
     {
-        if (mServers[ii] != NULL)
-        {
-            if (mServers[ii]->removeServerConnection(jniHandle)) {
-                return;
-            }
+        if (it->second->removeServerConnection(jniHandle)) {
+            return;
         }
     }
 
@@ -726,10 +730,10 @@ bool PeerToPeer::createDataLinkConn (tJNI_HANDLE jniHandle, const char* serviceN
 sp<P2pClient> PeerToPeer::findClient (tNFA_HANDLE nfaConnHandle)
 {
     AutoMutex mutex(mMutex);
-    for (int i = 0; i < sMax; i++)
+    for (tClientMap::const_iterator it = mClients.begin(); it != mClients.end(); ++it)
     {
-        if ((mClients[i] != NULL) && (mClients[i]->mNfaP2pClientHandle == nfaConnHandle))
-            return (mClients[i]);
+        if (it->second->mNfaP2pClientHandle == nfaConnHandle)
+            return (it->second);
     }
     return (NULL);
 }
@@ -748,11 +752,9 @@ sp<P2pClient> PeerToPeer::findClient (tNFA_HANDLE nfaConnHandle)
 sp<P2pClient> PeerToPeer::findClient (tJNI_HANDLE jniHandle)
 {
     AutoMutex mutex(mMutex);
-    for (int i = 0; i < sMax; i++)
-    {
-        if ((mClients[i] != NULL) && (mClients[i]->mClientConn->mJniHandle == jniHandle))
-            return (mClients[i]);
-    }
+    tClientMap::const_iterator it = mClients.find (jniHandle);
+    if (it != mClients.end())
+        return (it->second);
     return (NULL);
 }
 
@@ -770,10 +772,10 @@ sp<P2pClient> PeerToPeer::findClient (tJNI_HANDLE jniHandle)
 sp<P2pClient> PeerToPeer::findClientCon (tNFA_HANDLE nfaConnHandle)
 {
     AutoMutex mutex(mMutex);
-    for (int i = 0; i < sMax; i++)
+    for (tClientMap::const_iterator it = mClients.begin(); it != mClients.end(); ++it)
     {
-        if ((mClients[i] != NULL) && (mClients[i]->mClientConn->mNfaConnHandle == nfaConnHandle))
-            return (mClients[i]);
+        if (it->second->mClientConn->mNfaConnHandle == nfaConnHandle)
+            return (it->second);
     }
     return (NULL);
 }
@@ -791,27 +793,10 @@ sp<P2pClient> PeerToPeer::findClientCon (tNFA_HANDLE nfaConnHandle)
 *******************************************************************************/
 sp<NfaConn> PeerToPeer::findConnection (tNFA_HANDLE nfaConnHandle)
 {
-    AutoMutex mutex(mMutex);
-    // First, look through all the client control blocks
-    for (int ii = 0; ii < sMax; ii++)
-    {
-        if ( (mClients[ii] != NULL)
-           && (mClients[ii]->mClientConn->mNfaConnHandle == nfaConnHandle) ) {
-            return mClients[ii]->mClientConn;
-        }
-    }
-
-    // Not found yet. Look through all the server control blocks
-    for (int ii = 0; ii < sMax; ii++)
-    {
-        if (mServers[ii] != NULL)
-        {
-            sp<NfaConn> conn = mServers[ii]->findServerConnection(nfaConnHandle);
-            if (conn != NULL) {
-                return conn;
-            }
-        }
-    }
+    AutoMutex mutex(mConnIndexMutex);
+    tNfaConnMap::const_iterator it = mConnsByNfaHandle.find (nfaConnHandle);
+    if (it != mConnsByNfaHandle.end())
+        return it->second;
 
     // Not found...
     return NULL;
@@ -830,30 +815,141 @@ sp<NfaConn> PeerToPeer::findConnection (tNFA_HANDLE nfaConnHandle)
 *******************************************************************************/
 sp<NfaConn> PeerToPeer::findConnection (tJNI_HANDLE jniHandle)
 {
-    AutoMutex mutex(mMutex);
-    // First, look through all the client control blocks
-    for (int ii = 0; ii < sMax; ii++)
+    AutoMutex mutex(mConnIndexMutex);
+    tJniConnMap::const_iterator it = mConnsByJniHandle.find (jniHandle);
+    if (it != mConnsByJniHandle.end())
+        return it->second;
+
+    // Not found...
+    return NULL;
+}
+
+
+/*******************************************************************************
+**
+** Function:        addConnIndex
+**
+** Description:     Make a connection findable by its JNI handle (and by its
+**                  NFA handle, if it already has one).
+**                  conn: Connection.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::addConnIndex (const sp<NfaConn>& conn)
+{
+    AutoMutex mutex(mConnIndexMutex);
+    mConnsByJniHandle [conn->mJniHandle] = conn;
+    if (conn->mNfaConnHandle != NFA_HANDLE_INVALID)
+        mConnsByNfaHandle [conn->mNfaConnHandle] = conn;
+}
+
+
+/*******************************************************************************
+**
+** Function:        removeConnIndex
+**
+** Description:     Stop a connection from being found by either handle.
+**                  conn: Connection.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::removeConnIndex (const sp<NfaConn>& conn)
+{
+    AutoMutex mutex(mConnIndexMutex);
+    tJniConnMap::iterator jniIt = mConnsByJniHandle.find (conn->mJniHandle);
+    if ((jniIt != mConnsByJniHandle.end()) && (jniIt->second == conn))
     {
-        if ( (mClients[ii] != NULL)
-          && (mClients[ii]->mClientConn->mJniHandle == jniHandle) ) {
-            return mClients[ii]->mClientConn;
-        }
+        mConnsByJniHandle.erase (jniIt);
+        if ((mReadyEpollFd >= 0) && (conn->mReadyFd >= 0))
+            epoll_ctl (mReadyEpollFd, EPOLL_CTL_DEL, conn->mReadyFd, NULL);
+    }
+    tNfaConnMap::iterator nfaIt = mConnsByNfaHandle.find (conn->mNfaConnHandle);
+    if ((nfaIt != mConnsByNfaHandle.end()) && (nfaIt->second == conn))
+        mConnsByNfaHandle.erase (nfaIt);
+}
+
+
+/*******************************************************************************
+**
+** Function:        watchReadable
+**
+** Description:     Report a connection to waitForReadable() from now on.
+**                  Connections that are read with the blocking receive()
+**                  are not watched, so they never wake a dispatcher.
+**                  jniHandle: Handle of connection.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool PeerToPeer::watchReadable (tJNI_HANDLE jniHandle)
+{
+    AutoMutex mutex(mConnIndexMutex);
+    tJniConnMap::iterator it = mConnsByJniHandle.find (jniHandle);
+    if (it == mConnsByJniHandle.end())
+    {
+        ALOGE ("PeerToPeer::watchReadable: can't find connection handle: %u", jniHandle);
+        return false;
     }
+    if ((mReadyEpollFd < 0) || (it->second->mReadyFd < 0))
+        return false;
 
-    // Not found yet. Look through all the server control blocks
-    for (int ii = 0; ii < sMax; ii++)
+    struct epoll_event event;
+    memset (&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = jniHandle;
+    if ((epoll_ctl (mReadyEpollFd, EPOLL_CTL_ADD, it->second->mReadyFd, &event) < 0) && (errno != EEXIST))
     {
-        if (mServers[ii] != NULL)
-        {
-            sp<NfaConn> conn = mServers[ii]->findServerConnection(jniHandle);
-            if (conn != NULL) {
-                return conn;
-            }
-        }
+        ALOGE ("PeerToPeer::watchReadable: epoll add failed; jni h: %u  errno=%d", jniHandle, errno);
+        return false;
     }
+    return true;
+}
 
-    // Not found...
-    return NULL;
+
+/*******************************************************************************
+**
+** Function:        unwatchReadable
+**
+** Description:     Stop reporting a connection to waitForReadable().  Its
+**                  eventfd stays set once the peer disconnects, so without
+**                  this a dispatcher would be woken for it forever.
+**                  conn: Connection.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::unwatchReadable (const sp<NfaConn>& conn)
+{
+    AutoMutex mutex(mConnIndexMutex);
+    if ((mReadyEpollFd >= 0) && (conn->mReadyFd >= 0))
+        epoll_ctl (mReadyEpollFd, EPOLL_CTL_DEL, conn->mReadyFd, NULL);
+}
+
+
+/*******************************************************************************
+**
+** Function:        setConnNfaHandle
+**
+** Description:     Assign a connection's NFA handle and keep the index in step.
+**                  conn: Connection.
+**                  nfaConnHandle: New NFA handle; NFA_HANDLE_INVALID to unbind.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::setConnNfaHandle (const sp<NfaConn>& conn, tNFA_HANDLE nfaConnHandle)
+{
+    AutoMutex mutex(mConnIndexMutex);
+    tNfaConnMap::iterator it = mConnsByNfaHandle.find (conn->mNfaConnHandle);
+    if ((it != mConnsByNfaHandle.end()) && (it->second == conn))
+        mConnsByNfaHandle.erase (it);
+    if ((nfaConnHandle == NFA_HANDLE_INVALID) && (conn->mNfaConnHandle != NFA_HANDLE_INVALID))
+        conn->setReady (); // a disconnect is reported to waitForReadable() like data
+    conn->mNfaConnHandle = nfaConnHandle;
+    if ((nfaConnHandle != NFA_HANDLE_INVALID) && (mConnsByJniHandle.find (conn->mJniHandle) != mConnsByJniHandle.end()))
+        mConnsByNfaHandle [nfaConnHandle] = conn;
 }
 
 
@@ -884,32 +980,126 @@ bool PeerToPeer::send (tJNI_HANDLE jniHandle, UINT8 *buffer, UINT16 bufferLen)
     ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: send data; jniHandle: %u  nfaHandle: 0x%04X",
             fn, pConn->mJniHandle, pConn->mNfaConnHandle);
 
-    while (true)
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    nfaStat = sendPdu (pConn, buffer, bufferLen);
+
+    if (nfaStat == NFA_STATUS_OK)
     {
-        SyncEventGuard guard (pConn->mCongEvent);
-        nfaStat = NFA_P2pSendData (pConn->mNfaConnHandle, bufferLen, buffer);
-        if (nfaStat == NFA_STATUS_CONGESTED)
-            pConn->mCongEvent.wait (); //wait for NFA_P2P_CONGEST_EVT
-        else
-            break;
+        gLlcpSendLatency.record (start, bufferLen);
+        ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: exit OK; JNI handle: %u  NFA Handle: 0x%04x", fn, jniHandle, pConn->mNfaConnHandle);
+    }
+    else if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) //peer already disconnected
+        ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: peer disconnected", fn);
+    else
+        ALOGE ("%s: Data not sent; JNI handle: %u  NFA Handle: 0x%04x  error: 0x%04x",
+              fn, jniHandle, pConn->mNfaConnHandle, nfaStat);
 
-        if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) //peer already disconnected
+    return nfaStat == NFA_STATUS_OK;
+}
+
+
+/*******************************************************************************
+**
+** Function:        sendSegmented
+**
+** Description:     Send a payload of any length to peer.  The payload is
+**                  split into I-PDUs of at most the peer's MIU, which are
+**                  sent straight from the buffer (the stack copies them).
+**                  jniHandle: Handle of connection.
+**                  data: Buffer of data.
+**                  dataLen: Length of data.
+**                  maxSegmentLen: Upper bound for a PDU; 0 to use peer's MIU.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool PeerToPeer::sendSegmented (tJNI_HANDLE jniHandle, const UINT8* data, UINT32 dataLen, UINT16 maxSegmentLen)
+{
+    static const char fn [] = "PeerToPeer::sendSegmented";
+    tNFA_STATUS nfaStat = NFA_STATUS_OK;
+    sp<NfaConn> pConn = NULL;
+    UINT32      sentLen = 0;
+    int         numPdus = 0;
+
+    if ((pConn = findConnection (jniHandle)) == NULL)
+    {
+        ALOGE ("%s: can't find connection handle: %u", fn, jniHandle);
+        return (false);
+    }
+
+    // Without a negotiated MIU the peer must accept the LLCP default of 128
+    UINT16 segmentLen = (pConn->mRemoteMaxInfoUnit > 0) ? pConn->mRemoteMaxInfoUnit : LLCP_DEFAULT_MIU;
+    if ((maxSegmentLen > 0) && (maxSegmentLen < segmentLen))
+        segmentLen = maxSegmentLen;
+
+    ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: enter; jniHandle: %u  nfaHandle: 0x%04X  len: %u  segment len: %u  remote rw: %u",
+            fn, jniHandle, pConn->mNfaConnHandle, dataLen, segmentLen, pConn->mRemoteRecvWindow);
+
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    while ((sentLen < dataLen) && (nfaStat == NFA_STATUS_OK))
+    {
+        UINT16 pduLen = (dataLen - sentLen < segmentLen) ? (UINT16) (dataLen - sentLen) : segmentLen;
+        nfaStat = sendPdu (pConn, data + sentLen, pduLen);
+        if (nfaStat == NFA_STATUS_OK)
         {
-            ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: peer disconnected", fn);
-            return (false);
+            sentLen += pduLen;
+            numPdus++;
         }
     }
 
     if (nfaStat == NFA_STATUS_OK)
-        ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: exit OK; JNI handle: %u  NFA Handle: 0x%04x", fn, jniHandle, pConn->mNfaConnHandle);
+    {
+        gLlcpSendLatency.record (start, dataLen);
+        ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: exit OK; JNI handle: %u  bytes: %u  PDUs: %d", fn, jniHandle, dataLen, numPdus);
+    }
+    else if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) //peer already disconnected
+        ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: peer disconnected after %d PDUs", fn, numPdus);
     else
-        ALOGE ("%s: Data not sent; JNI handle: %u  NFA Handle: 0x%04x  error: 0x%04x",
-              fn, jniHandle, pConn->mNfaConnHandle, nfaStat);
+        ALOGE ("%s: Data not sent; JNI handle: %u  NFA Handle: 0x%04x  PDUs sent: %d  error: 0x%04x",
+              fn, jniHandle, pConn->mNfaConnHandle, numPdus, nfaStat);
 
     return nfaStat == NFA_STATUS_OK;
 }
 
 
+/*******************************************************************************
+**
+** Function:        sendPdu
+**
+** Description:     Send one I-PDU; wait while the connection is congested.
+**                  The stack keeps up to the peer's receive window of I-PDUs
+**                  outstanding and reports congestion once that is full.
+**                  pConn: Connection.
+**                  data: PDU payload.
+**                  dataLen: Length of payload; not more than peer's MIU.
+**
+** Returns:         NFA_STATUS_OK if ok.
+**
+*******************************************************************************/
+tNFA_STATUS PeerToPeer::sendPdu (const sp<NfaConn>& pConn, const UINT8* data, UINT16 dataLen)
+{
+    tNFA_STATUS nfaStat = NFA_STATUS_FAILED;
+
+    while (true)
+    {
+        SyncEventGuard guard (pConn->mCongEvent);
+        nfaStat = NFA_P2pSendData (pConn->mNfaConnHandle, dataLen, const_cast<UINT8*>(data));
+        if (nfaStat == NFA_STATUS_CONGESTED)
+            pConn->mCongEvent.wait (); //wait for NFA_P2P_CONGEST_EVT
+        else
+            break;
+
+        if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) //peer already disconnected
+            return (NFA_STATUS_FAILED);
+    }
+    return nfaStat;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        receive
@@ -963,6 +1153,103 @@ bool PeerToPeer::receive (tJNI_HANDLE jniHandle, UINT8* buffer, UINT16 bufferLen
 }
 
 
+/*******************************************************************************
+**
+** Function:        receiveNonBlocking
+**
+** Description:     Receive data from peer if any is queued; never waits.
+**                  jniHandle: Handle of connection.
+**                  buffer: Buffer to store data.
+**                  bufferLen: Max length of buffer.
+**                  actualLen: Actual length received.
+**
+** Returns:         RECV_OK, RECV_NO_DATA or RECV_CLOSED.
+**
+*******************************************************************************/
+PeerToPeer::tRecvStatus PeerToPeer::receiveNonBlocking (tJNI_HANDLE jniHandle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen)
+{
+    static const char fn [] = "PeerToPeer::receiveNonBlocking";
+    sp<NfaConn> pConn = NULL;
+    UINT32 actualDataLen2 = 0;
+    BOOLEAN isMoreData = FALSE;
+
+    actualLen = 0;
+    if ((pConn = findConnection (jniHandle)) == NULL)
+    {
+        ALOGE ("%s: can't find connection handle: %u", fn, jniHandle);
+        return RECV_CLOSED;
+    }
+
+    if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID)
+    {
+        unwatchReadable (pConn);
+        return RECV_CLOSED;
+    }
+
+    // Clear before reading: data that arrives from here on sets it again
+    pConn->clearReady ();
+
+    tNFA_STATUS stat = NFA_P2pReadData (pConn->mNfaConnHandle, bufferLen, &actualDataLen2, buffer, &isMoreData);
+    if ((stat != NFA_STATUS_OK) || (actualDataLen2 == 0))
+    {
+        if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID)
+        {
+            unwatchReadable (pConn);
+            return RECV_CLOSED;
+        }
+        return RECV_NO_DATA;
+    }
+
+    if (isMoreData)
+        pConn->setReady ();
+
+    actualLen = (UINT16) actualDataLen2;
+    ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: jniHandle: %u  actual len: %u  more: %u", fn, jniHandle, actualLen, isMoreData);
+    return RECV_OK;
+}
+
+
+/*******************************************************************************
+**
+** Function:        waitForReadable
+**
+** Description:     Wait until at least one watched connection has data
+**                  queued or has been disconnected.
+**                  handles: Receives JNI handles of the ready connections.
+**                  maxHandles: Capacity of handles.
+**                  timeoutMs: Max wait; -1 waits forever, 0 only polls.
+**
+** Returns:         Number of ready connections; 0 on timeout; -1 on error.
+**
+*******************************************************************************/
+int PeerToPeer::waitForReadable (tJNI_HANDLE* handles, int maxHandles, int timeoutMs)
+{
+    static const char fn [] = "PeerToPeer::waitForReadable";
+    struct epoll_event events [16];
+
+    if ((mReadyEpollFd < 0) || (maxHandles <= 0))
+        return -1;
+    if (maxHandles > (int) (sizeof(events) / sizeof(events[0])))
+        maxHandles = sizeof(events) / sizeof(events[0]);
+
+    int count = 0;
+    do
+    {
+        count = epoll_wait (mReadyEpollFd, events, maxHandles, timeoutMs);
+    } while ((count < 0) && (errno == EINTR));
+
+    if (count < 0)
+    {
+        ALOGE ("%s: epoll_wait failed; errno=%d", fn, errno);
+        return -1;
+    }
+
+    for (int ii = 0; ii < count; ii++)
+        handles[ii] = events[ii].data.u32;
+    return count;
+}
+
+
 /*******************************************************************************
 **
 ** Function:        disconnectConnOriented
@@ -1192,43 +1479,47 @@ void PeerToPeer::handleNfcOnOff (bool isOn)
     if (isOn)
     {
         // Start with no clients or servers
-        memset (mServers, 0, sizeof(mServers));
-        memset (mClients, 0, sizeof(mClients));
+        mServers.clear ();
+        mClients.clear ();
+
+        AutoMutex indexMutex(mConnIndexMutex);
+        for (tJniConnMap::const_iterator it = mConnsByJniHandle.begin(); it != mConnsByJniHandle.end(); ++it)
+        {
+            if ((mReadyEpollFd >= 0) && (it->second->mReadyFd >= 0))
+                epoll_ctl (mReadyEpollFd, EPOLL_CTL_DEL, it->second->mReadyFd, NULL);
+        }
+        mConnsByJniHandle.clear ();
+        mConnsByNfaHandle.clear ();
     }
     else
     {
         // Disconnect through all the clients
-        for (int ii = 0; ii < sMax; ii++)
+        for (tClientMap::const_iterator it = mClients.begin(); it != mClients.end(); ++it)
         {
-            if (mClients[ii] != NULL)
+            const sp<P2pClient>& client = it->second;
+            if (client->mClientConn->mNfaConnHandle == NFA_HANDLE_INVALID)
+            {
+                SyncEventGuard guard (client->mConnectingEvent);
+                client->mConnectingEvent.notifyOne();
+            }
+            else
             {
-                if (mClients[ii]->mClientConn->mNfaConnHandle == NFA_HANDLE_INVALID)
+                setConnNfaHandle (client->mClientConn, NFA_HANDLE_INVALID);
                 {
-                    SyncEventGuard guard (mClients[ii]->mConnectingEvent);
-                    mClients[ii]->mConnectingEvent.notifyOne();
+                    SyncEventGuard guard1 (client->mClientConn->mCongEvent);
+                    client->mClientConn->mCongEvent.notifyOne (); //unblock send()
                 }
-                else
                 {
-                    mClients[ii]->mClientConn->mNfaConnHandle = NFA_HANDLE_INVALID;
-                    {
-                        SyncEventGuard guard1 (mClients[ii]->mClientConn->mCongEvent);
-                        mClients[ii]->mClientConn->mCongEvent.notifyOne (); //unblock send()
-                    }
-                    {
-                        SyncEventGuard guard2 (mClients[ii]->mClientConn->mReadEvent);
-                        mClients[ii]->mClientConn->mReadEvent.notifyOne (); //unblock receive()
-                    }
+                    SyncEventGuard guard2 (client->mClientConn->mReadEvent);
+                    client->mClientConn->mReadEvent.notifyOne (); //unblock receive()
                 }
             }
         } //loop
 
         // Now look through all the server control blocks
-        for (int ii = 0; ii < sMax; ii++)
+        for (tServerMap::const_iterator it = mServers.begin(); it != mServers.end(); ++it)
         {
-            if (mServers[ii] != NULL)
-            {
-                mServers[ii]->unblockAll();
-            }
+            it->second->unblockAll();
         } //loop
 
     }
@@ -1306,7 +1597,7 @@ void PeerToPeer::nfaServerCallback (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* ev
         else
         {
             SyncEventGuard guard (pSrv->mConnRequestEvent);
-            pConn->mNfaConnHandle = eventData->conn_req.conn_handle;
+            sP2p.setConnNfaHandle (pConn, eventData->conn_req.conn_handle);
             pConn->mRemoteMaxInfoUnit = eventData->conn_req.remote_miu;
             pConn->mRemoteRecvWindow = eventData->conn_req.remote_rw;
             ALOGD ("%s: NFA_P2P_CONN_REQ_EVT; server jni h=%u; conn jni h=%u; notify conn req", fn, pSrv->mJniHandle, pConn->mJniHandle);
@@ -1329,7 +1620,7 @@ void PeerToPeer::nfaServerCallback (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* ev
         else
         {
             sP2p.mDisconnectMutex.lock ();
-            pConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+            sP2p.setConnNfaHandle (pConn, NFA_HANDLE_INVALID);
             {
                 ALOGD ("%s: NFA_P2P_DISC_EVT; try guard disconn event", fn);
                 SyncEventGuard guard3 (pConn->mDisconnectingEvent);
@@ -1362,6 +1653,7 @@ void PeerToPeer::nfaServerCallback (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* ev
         {
             ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: NFA_P2P_DATA_EVT; h=0x%X; remote sap=0x%X", fn,
                     eventData->data.handle, eventData->data.remote_sap);
+            pConn->setReady ();
             SyncEventGuard guard (pConn->mReadEvent);
             pConn->mReadEvent.notifyOne();
         }
@@ -1458,7 +1750,7 @@ void PeerToPeer::nfaClientCallback (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* ev
                     eventData->connected.client_handle, eventData->connected.conn_handle, eventData->connected.remote_sap, pClient.get());
 
             SyncEventGuard guard (pClient->mConnectingEvent);
-            pClient->mClientConn->mNfaConnHandle     = eventData->connected.conn_handle;
+            sP2p.setConnNfaHandle (pClient->mClientConn, eventData->connected.conn_handle);
             pClient->mClientConn->mRemoteMaxInfoUnit = eventData->connected.remote_miu;
             pClient->mClientConn->mRemoteRecvWindow  = eventData->connected.remote_rw;
             pClient->mConnectingEvent.notifyOne(); //unblock createDataLinkConn()
@@ -1483,7 +1775,7 @@ void PeerToPeer::nfaClientCallback (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* ev
         else
         {
             sP2p.mDisconnectMutex.lock ();
-            pConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+            sP2p.setConnNfaHandle (pConn, NFA_HANDLE_INVALID);
             {
                 ALOGD ("%s: NFA_P2P_DISC_EVT; try guard disconn event", fn);
                 SyncEventGuard guard3 (pConn->mDisconnectingEvent);
@@ -1516,6 +1808,7 @@ void PeerToPeer::nfaClientCallback (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* ev
         {
             ALOGD_IF ((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: NFA_P2P_DATA_EVT; h=0x%X; remote sap=0x%X", fn,
                     eventData->data.handle, eventData->data.remote_sap);
+            pConn->setReady ();
             SyncEventGuard guard (pConn->mReadEvent);
             pConn->mReadEvent.notifyOne();
         }
@@ -1602,13 +1895,12 @@ PeerToPeer::tJNI_HANDLE PeerToPeer::getNewJniHandle ()
 ** Returns:         None
 **
 *******************************************************************************/
-P2pServer::P2pServer(PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName)
+P2pServer::P2pServer(PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName, size_t maxConns)
 :   mNfaP2pServerHandle (NFA_HANDLE_INVALID),
-    mJniHandle (jniHandle)
+    mJniHandle (jniHandle),
+    mMaxConns (maxConns)
 {
     mServiceName.assign (serviceName);
-
-    memset (mServerConn, 0, sizeof(mServerConn));
 }
 
 bool P2pServer::registerWithStack()
@@ -1715,19 +2007,16 @@ bool P2pServer::accept(PeerToPeer::tJNI_HANDLE serverJniHandle, PeerToPeer::tJNI
 void P2pServer::unblockAll()
 {
     AutoMutex mutex(mMutex);
-    for (int jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++)
+    for (size_t jj = 0; jj < mServerConn.size(); jj++)
     {
-        if (mServerConn[jj] != NULL)
+        PeerToPeer::getInstance().setConnNfaHandle (mServerConn[jj], NFA_HANDLE_INVALID);
         {
-            mServerConn[jj]->mNfaConnHandle = NFA_HANDLE_INVALID;
-            {
-                SyncEventGuard guard1 (mServerConn[jj]->mCongEvent);
-                mServerConn[jj]->mCongEvent.notifyOne (); //unblock write (if congested)
-            }
-            {
-                SyncEventGuard guard2 (mServerConn[jj]->mReadEvent);
-                mServerConn[jj]->mReadEvent.notifyOne (); //unblock receive()
-            }
+            SyncEventGuard guard1 (mServerConn[jj]->mCongEvent);
+            mServerConn[jj]->mCongEvent.notifyOne (); //unblock write (if congested)
+        }
+        {
+            SyncEventGuard guard2 (mServerConn[jj]->mReadEvent);
+            mServerConn[jj]->mReadEvent.notifyOne (); //unblock receive()
         }
     }
 }
@@ -1735,18 +2024,14 @@ void P2pServer::unblockAll()
 sp<NfaConn> P2pServer::allocateConnection (PeerToPeer::tJNI_HANDLE jniHandle)
 {
     AutoMutex mutex(mMutex);
-    // First, find a free connection block to handle the connection
-    for (int ii = 0; ii < MAX_NFA_CONNS_PER_SERVER; ii++)
-    {
-        if (mServerConn[ii] == NULL)
-        {
-            mServerConn[ii] = new NfaConn;
-            mServerConn[ii]->mJniHandle = jniHandle;
-            return mServerConn[ii];
-        }
-    }
-
-    return NULL;
+    if (mServerConn.size() >= mMaxConns)
+        return NULL;
+
+    sp<NfaConn> conn = new NfaConn;
+    conn->mJniHandle = jniHandle;
+    mServerConn.push_back (conn);
+    PeerToPeer::getInstance().addConnIndex (conn);
+    return conn;
 }
 
 
@@ -1762,12 +2047,10 @@ sp<NfaConn> P2pServer::allocateConnection (PeerToPeer::tJNI_HANDLE jniHandle)
 *******************************************************************************/
 sp<NfaConn> P2pServer::findServerConnection (tNFA_HANDLE nfaConnHandle)
 {
-    int jj = 0;
-
     AutoMutex mutex(mMutex);
-    for (jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++)
+    for (size_t jj = 0; jj < mServerConn.size(); jj++)
     {
-        if ( (mServerConn[jj] != NULL) && (mServerConn[jj]->mNfaConnHandle == nfaConnHandle) )
+        if (mServerConn[jj]->mNfaConnHandle == nfaConnHandle)
             return (mServerConn[jj]);
     }
 
@@ -1787,12 +2070,10 @@ sp<NfaConn> P2pServer::findServerConnection (tNFA_HANDLE nfaConnHandle)
 *******************************************************************************/
 sp<NfaConn> P2pServer::findServerConnection (PeerToPeer::tJNI_HANDLE jniHandle)
 {
-    int jj = 0;
-
     AutoMutex mutex(mMutex);
-    for (jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++)
+    for (size_t jj = 0; jj < mServerConn.size(); jj++)
     {
-        if ( (mServerConn[jj] != NULL) && (mServerConn[jj]->mJniHandle == jniHandle) )
+        if (mServerConn[jj]->mJniHandle == jniHandle)
             return (mServerConn[jj]);
     }
 
@@ -1812,13 +2093,12 @@ sp<NfaConn> P2pServer::findServerConnection (PeerToPeer::tJNI_HANDLE jniHandle)
 *******************************************************************************/
 bool P2pServer::removeServerConnection (PeerToPeer::tJNI_HANDLE jniHandle)
 {
-    int jj = 0;
-
     AutoMutex mutex(mMutex);
-    for (jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++)
+    for (size_t jj = 0; jj < mServerConn.size(); jj++)
     {
-        if ( (mServerConn[jj] != NULL) && (mServerConn[jj]->mJniHandle == jniHandle) ) {
-            mServerConn[jj] = NULL;
+        if (mServerConn[jj]->mJniHandle == jniHandle) {
+            PeerToPeer::getInstance().removeConnIndex (mServerConn[jj]);
+            mServerConn.erase (mServerConn.begin() + jj);
             return true;
         }
     }
@@ -1826,6 +2106,24 @@ bool P2pServer::removeServerConnection (PeerToPeer::tJNI_HANDLE jniHandle)
     // If here, not found
     return false;
 }
+
+
+/*******************************************************************************
+**
+** Function:        removeAllConnections
+**
+** Description:     Remove every server connection.
+**                  removed: Receives the connections that were removed.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void P2pServer::removeAllConnections (std::vector<sp<NfaConn> >& removed)
+{
+    AutoMutex mutex(mMutex);
+    removed.insert (removed.end(), mServerConn.begin(), mServerConn.end());
+    mServerConn.clear ();
+}
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
@@ -1882,4 +2180,57 @@ NfaConn::NfaConn()
     mRemoteMaxInfoUnit (0),
     mRemoteRecvWindow (0)
 {
+    mReadyFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mReadyFd < 0)
+        ALOGE ("NfaConn: eventfd failed; errno=%d", errno);
+}
+
+
+/*******************************************************************************
+**
+** Function:        ~NfaConn
+**
+** Description:     Release the readiness descriptor.
+**
+** Returns:         None
+**
+*******************************************************************************/
+NfaConn::~NfaConn()
+{
+    if (mReadyFd >= 0)
+        close (mReadyFd);
+}
+
+
+/*******************************************************************************
+**
+** Function:        setReady
+**
+** Description:     Make mReadyFd readable.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfaConn::setReady ()
+{
+    uint64_t one = 1;
+    if (mReadyFd >= 0)
+        write (mReadyFd, &one, sizeof(one));
+}
+
+
+/*******************************************************************************
+**
+** Function:        clearReady
+**
+** Description:     Make mReadyFd not readable.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfaConn::clearReady ()
+{
+    uint64_t count = 0;
+    if (mReadyFd >= 0)
+        read (mReadyFd, &count, sizeof(count));
 }
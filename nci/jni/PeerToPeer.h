@@ -23,6 +23,8 @@
 #include "SyncEvent.h"
 #include "NfcJniUtil.h"
 #include <string>
+#include <map>
+#include <vector>
 extern "C"
 {
     #include "nfa_p2p_api.h"
@@ -31,6 +33,8 @@ extern "C"
 class P2pServer;
 class P2pClient;
 class NfaConn;
+#define DEFAULT_MAX_P2P_SERVERS     10
+#define DEFAULT_MAX_P2P_CLIENTS     10
 #define MAX_NFA_CONNS_PER_SERVER    5
 
 /*****************************************************************************
@@ -45,6 +49,14 @@ class PeerToPeer
 public:
     typedef unsigned int tJNI_HANDLE;
 
+    // Result of receiveNonBlocking()
+    enum tRecvStatus
+    {
+        RECV_OK,            // data was copied to the caller's buffer
+        RECV_NO_DATA,       // nothing queued; wait for readiness and try again
+        RECV_CLOSED         // connection is gone
+    };
+
     /*******************************************************************************
     **
     ** Function:        PeerToPeer
@@ -236,6 +248,26 @@ public:
     bool send (tJNI_HANDLE jniHandle, UINT8* buffer, UINT16 bufferLen);
 
 
+    /*******************************************************************************
+    **
+    ** Function:        sendSegmented
+    **
+    ** Description:     Send a payload of any length to peer.  The payload is
+    **                  split into I-PDUs of at most the peer's MIU.  PDUs are
+    **                  handed to the stack back to back; the caller only blocks
+    **                  when the stack reports congestion (peer's receive window
+    **                  is full).
+    **                  jniHandle: Handle of connection.
+    **                  data: Buffer of data.
+    **                  dataLen: Length of data.
+    **                  maxSegmentLen: Upper bound for a PDU; 0 to use peer's MIU.
+    **
+    ** Returns:         True if ok.
+    **
+    *******************************************************************************/
+    bool sendSegmented (tJNI_HANDLE jniHandle, const UINT8* data, UINT32 dataLen, UINT16 maxSegmentLen);
+
+
     /*******************************************************************************
     **
     ** Function:        receive
@@ -252,6 +284,56 @@ public:
     bool receive (tJNI_HANDLE jniHandle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen);
 
 
+    /*******************************************************************************
+    **
+    ** Function:        receiveNonBlocking
+    **
+    ** Description:     Receive data from peer if any is queued; never waits.
+    **                  Once this reports RECV_CLOSED, waitForReadable() no
+    **                  longer reports the connection.
+    **                  jniHandle: Handle of connection.
+    **                  buffer: Buffer to store data.
+    **                  bufferLen: Max length of buffer.
+    **                  actualLen: Actual length received.
+    **
+    ** Returns:         RECV_OK, RECV_NO_DATA or RECV_CLOSED.
+    **
+    *******************************************************************************/
+    tRecvStatus receiveNonBlocking (tJNI_HANDLE jniHandle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        watchReadable
+    **
+    ** Description:     Report a connection to waitForReadable() from now on,
+    **                  until receiveNonBlocking() returns RECV_CLOSED for it
+    **                  or it is closed.
+    **                  jniHandle: Handle of connection.
+    **
+    ** Returns:         True if ok.
+    **
+    *******************************************************************************/
+    bool watchReadable (tJNI_HANDLE jniHandle);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        waitForReadable
+    **
+    ** Description:     Wait until at least one watched connection has data
+    **                  queued or has been disconnected, so that one thread can
+    **                  service those connections with receiveNonBlocking().
+    **                  handles: Receives JNI handles of the ready connections.
+    **                  maxHandles: Capacity of handles.
+    **                  timeoutMs: Max wait; -1 waits forever, 0 only polls.
+    **
+    ** Returns:         Number of ready connections; 0 on timeout; -1 on error.
+    **
+    *******************************************************************************/
+    int waitForReadable (tJNI_HANDLE* handles, int maxHandles, int timeoutMs);
+
+
     /*******************************************************************************
     **
     ** Function:        disconnectConnOriented
@@ -391,14 +473,90 @@ public:
     *******************************************************************************/
     static void nfaClientCallback  (tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA *eventData);
 
+
+    /*******************************************************************************
+    **
+    ** Function:        addConnIndex
+    **
+    ** Description:     Make a connection findable by its JNI handle (and by its
+    **                  NFA handle, if it already has one).
+    **                  conn: Connection.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void addConnIndex (const android::sp<NfaConn>& conn);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        removeConnIndex
+    **
+    ** Description:     Stop a connection from being found by either handle.
+    **                  conn: Connection.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void removeConnIndex (const android::sp<NfaConn>& conn);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        unwatchReadable
+    **
+    ** Description:     Stop reporting a connection to waitForReadable().
+    **                  conn: Connection.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void unwatchReadable (const android::sp<NfaConn>& conn);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        setConnNfaHandle
+    **
+    ** Description:     Assign a connection's NFA handle and keep the index in step.
+    **                  conn: Connection.
+    **                  nfaConnHandle: New NFA handle; NFA_HANDLE_INVALID to unbind.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void setConnNfaHandle (const android::sp<NfaConn>& conn, tNFA_HANDLE nfaConnHandle);
+
 private:
-    static const int sMax = 10;
+    typedef std::map<tJNI_HANDLE, android::sp<P2pServer> > tServerMap;
+    typedef std::map<tJNI_HANDLE, android::sp<P2pClient> > tClientMap;
+    typedef std::map<tJNI_HANDLE, android::sp<NfaConn> >   tJniConnMap;
+    typedef std::map<tNFA_HANDLE, android::sp<NfaConn> >   tNfaConnMap;
+
     static PeerToPeer sP2p;
 
+
+    /*******************************************************************************
+    **
+    ** Function:        sendPdu
+    **
+    ** Description:     Send one I-PDU; wait while the connection is congested.
+    **                  pConn: Connection.
+    **                  data: PDU payload.
+    **                  dataLen: Length of payload; not more than peer's MIU.
+    **
+    ** Returns:         NFA_STATUS_OK if ok.
+    **
+    *******************************************************************************/
+    tNFA_STATUS sendPdu (const android::sp<NfaConn>& pConn, const UINT8* data, UINT16 dataLen);
+
     // Variables below only accessed from a single thread
     UINT16          mRemoteWKS;                 // Peer's well known services
     bool            mIsP2pListening;            // If P2P listening is enabled or not
     tNFA_TECHNOLOGY_MASK    mP2pListenTechMask; // P2P Listen mask
+    size_t          mMaxServers;                // capacity of mServers; config P2P_MAX_SERVERS
+    size_t          mMaxClients;                // capacity of mClients; config P2P_MAX_CLIENTS
+    size_t          mMaxConnsPerServer;         // config P2P_MAX_CONNS_PER_SERVER
 
     // Variable below is protected by mNewJniHandleMutex
     tJNI_HANDLE     mNextJniHandle;
@@ -407,8 +565,16 @@ private:
     // A note on locking order: mMutex in PeerToPeer is *ALWAYS*
     // locked before any locks / guards in P2pServer / P2pClient
     Mutex                    mMutex;
-    android::sp<P2pServer>   mServers [sMax];
-    android::sp<P2pClient>   mClients [sMax];
+    tServerMap               mServers;          // keyed by server's JNI handle
+    tClientMap               mClients;          // keyed by client connection's JNI handle
+
+    // Variables below protected by mConnIndexMutex, which is a leaf lock:
+    // nothing else is ever acquired while it is held, so the index can be
+    // updated from any context, including under mMutex or a SyncEventGuard
+    Mutex                    mConnIndexMutex;
+    tJniConnMap              mConnsByJniHandle;
+    tNfaConnMap              mConnsByNfaHandle;
+    int                      mReadyEpollFd;     // every indexed connection's mReadyFd
 
     // Synchronization variables
     SyncEvent       mSetTechEvent;              // completion event for NFA_SetP2pListenTech()
@@ -597,6 +763,7 @@ public:
     SyncEvent           mReadEvent;             // event for reading
     SyncEvent           mCongEvent;             // event for congestion
     SyncEvent           mDisconnectingEvent;     // event for disconnecting
+    int                 mReadyFd;               // eventfd; readable while data is queued or after disconnect
 
 
     /*******************************************************************************
@@ -609,6 +776,42 @@ public:
     **
     *******************************************************************************/
     NfaConn();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        ~NfaConn
+    **
+    ** Description:     Release the readiness descriptor.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    ~NfaConn();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        setReady
+    **
+    ** Description:     Make mReadyFd readable.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void setReady ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        clearReady
+    **
+    ** Description:     Make mReadyFd not readable.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void clearReady ();
 };
 
 
@@ -639,7 +842,7 @@ public:
     ** Returns:         None
     **
     *******************************************************************************/
-    P2pServer (PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName);
+    P2pServer (PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName, size_t maxConns);
 
     /*******************************************************************************
     **
@@ -715,10 +918,23 @@ public:
     *******************************************************************************/
     bool removeServerConnection(PeerToPeer::tJNI_HANDLE jniHandle);
 
+    /*******************************************************************************
+    **
+    ** Function:        removeAllConnections
+    **
+    ** Description:     Remove every server connection.
+    **                  removed: Receives the connections that were removed.
+    **
+    ** Returns:         None
+    **
+    *******************************************************************************/
+    void removeAllConnections (std::vector<android::sp<NfaConn> >& removed);
+
 private:
     Mutex           mMutex;
+    size_t          mMaxConns;
     // mServerConn is protected by mMutex
-    android::sp<NfaConn>     mServerConn[MAX_NFA_CONNS_PER_SERVER];
+    std::vector<android::sp<NfaConn> >  mServerConn;
 
     /*******************************************************************************
     **
@@ -43,6 +43,7 @@ static const int gIntervalTime = 1000; //millisecond between the check to restor
 static IntervalTimer gTimer;
 static Mutex gMutex;
 static void pn544InteropStartPolling (union sigval); //callback function for interval timer
+static void startPollingWork (void*); //restarts polling on the timer wheel's worker thread
 static bool gIsBusy = false; //is timer busy?
 static bool gAbortNow = false; //stop timer during next callback
 
@@ -75,13 +76,30 @@ void pn544InteropStopPolling ()
 **
 ** Function:        pn544InteropStartPolling
 **
-** Description:     Start polling when activation state is idle.
+** Description:     Hand the restart of polling to the worker thread; starting
+**                  polling waits for the stack.
 **                  sigval: Unused.
 **
 ** Returns:         None
 **
 *******************************************************************************/
 void pn544InteropStartPolling (union sigval)
+{
+    TimerWheel::getInstance ().post (startPollingWork, NULL);
+}
+
+
+/*******************************************************************************
+**
+** Function:        startPollingWork
+**
+** Description:     Start polling when activation state is idle.
+**                  arg: Unused.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void startPollingWork (void*)
 {
     ALOGD ("%s: enter", __FUNCTION__);
     gMutex.lock ();
@@ -18,12 +18,15 @@
  *  Manage the listen-mode routing table.
  */
 
+#include <time.h>
 #include <cutils/log.h>
 #include <ScopedLocalRef.h>
+#include <ScopedPrimitiveArray.h>
 #include <JNIHelp.h>
 #include "config.h"
 #include "JavaClassConstants.h"
 #include "RoutingManager.h"
+#include "LatencyStats.h"
 
 extern "C"
 {
@@ -38,12 +41,15 @@ const JNINativeMethod RoutingManager::sMethods [] =
 {
     {"doGetDefaultRouteDestination", "()I", (void*) RoutingManager::com_android_nfc_cardemulation_doGetDefaultRouteDestination},
     {"doGetDefaultOffHostRouteDestination", "()I", (void*) RoutingManager::com_android_nfc_cardemulation_doGetDefaultOffHostRouteDestination},
-    {"doGetAidMatchingMode", "()I", (void*) RoutingManager::com_android_nfc_cardemulation_doGetAidMatchingMode}
+    {"doGetAidMatchingMode", "()I", (void*) RoutingManager::com_android_nfc_cardemulation_doGetAidMatchingMode},
+    {"doSetHostAidTable", "([B[I)V", (void*) RoutingManager::com_android_nfc_cardemulation_doSetHostAidTable},
+    {"doSetRejectUnknownAids", "(Z)V", (void*) RoutingManager::com_android_nfc_cardemulation_doSetRejectUnknownAids}
 };
 
 static const int MAX_NUM_EE = 5;
 
 RoutingManager::RoutingManager ()
+:   mCommittedAids (NFA_EeAddAidRouting, NFA_EeRemoveAidRouting)
 {
     static const char fn [] = "RoutingManager::RoutingManager()";
     unsigned long num = 0;
@@ -78,6 +84,13 @@ RoutingManager::RoutingManager ()
     memset (&mEeInfo, 0, sizeof(mEeInfo));
     mReceivedEeInfo = false;
     mSeTechMask = 0x00;
+    mRxDataLen = 0;
+    mRxDataOverflow = false;
+    memset (&mRxStartTime, 0, sizeof(mRxStartTime));
+    mRxDirectBuffer = NULL;
+    mRoutingChanged = false;
+    mHostAidsLoaded = false;
+    mRejectUnknownAids = false;
 }
 
 RoutingManager::~RoutingManager ()
@@ -103,7 +116,11 @@ bool RoutingManager::initialize (nfc_jni_native_data* native)
         mEeRegisterEvent.wait ();
     }
 
-    mRxDataBuffer.clear ();
+    mRxDataLen = 0;
+    mRxDataOverflow = false;
+    //the stack starts with an empty AID table
+    mAidRoutes.clear ();
+    mCommittedAids.clear ();
 
     if (mActiveSe != 0) {
         {
@@ -165,6 +182,7 @@ RoutingManager& RoutingManager::getInstance ()
 void RoutingManager::enableRoutingToHost()
 {
     tNFA_STATUS nfaStat;
+    mRoutingChanged = true;
 
     {
         SyncEventGuard guard (mRoutingEvent);
@@ -191,6 +209,7 @@ void RoutingManager::enableRoutingToHost()
 void RoutingManager::disableRoutingToHost()
 {
     tNFA_STATUS nfaStat;
+    mRoutingChanged = true;
 
     {
         SyncEventGuard guard (mRoutingEvent);
@@ -217,32 +236,73 @@ bool RoutingManager::addAidRouting(const UINT8* aid, UINT8 aidLen, int route)
 {
     static const char fn [] = "RoutingManager::addAidRouting";
     ALOGD ("%s: enter", fn);
-    tNFA_STATUS nfaStat = NFA_EeAddAidRouting(route, aidLen, (UINT8*) aid, 0x01);
-    if (nfaStat == NFA_STATUS_OK)
+    if ((aid == NULL) || (aidLen == 0))
     {
-        ALOGD ("%s: routed AID", fn);
-        return true;
-    } else
-    {
-        ALOGE ("%s: failed to route AID", fn);
+        ALOGE ("%s: no AID", fn);
         return false;
     }
+    //sent to the stack by commitRouting()
+    mAidRoutes.put (aid, aidLen, route);
+    return true;
 }
 
 bool RoutingManager::removeAidRouting(const UINT8* aid, UINT8 aidLen)
 {
     static const char fn [] = "RoutingManager::removeAidRouting";
     ALOGD ("%s: enter", fn);
-    tNFA_STATUS nfaStat = NFA_EeRemoveAidRouting(aidLen, (UINT8*) aid);
-    if (nfaStat == NFA_STATUS_OK)
-    {
-        ALOGD ("%s: removed AID", fn);
-        return true;
-    } else
+    if ((aid == NULL) || !mAidRoutes.remove (aid, aidLen))
     {
-        ALOGE ("%s: failed to remove AID", fn);
+        ALOGE ("%s: AID not routed", fn);
         return false;
     }
+    //sent to the stack by commitRouting()
+    return true;
+}
+
+/*******************************************************************************
+**
+** Function:        lookupHostAid
+**
+** Description:     Match a SELECT by AID command against the host AID table
+**                  that Java pushed with doSetHostAidTable().  Any other
+**                  command, or any SELECT before Java pushed a table, is
+**                  left for Java to handle.  So is an unknown AID while
+**                  Java would not answer it either (no activation yet, or
+**                  waiting for deactivation).
+**                  apdu: buffer of the command APDU.
+**                  apduLen: length of the command APDU.
+**
+** Returns:         Token of the only matching entry; HOST_AID_NOT_FOUND if no
+**                  host service can take the AID; else HOST_AID_UNRESOLVED.
+**
+*******************************************************************************/
+int RoutingManager::lookupHostAid (const UINT8* apdu, UINT32 apduLen)
+{
+    static const UINT32 SELECT_APDU_HDR_LEN = 5;
+    static const UINT8 MIN_AID_LEN = 5;
+    static const UINT8 MAX_AID_LEN = 16;
+
+    //same acceptance rules as HostEmulationManager.findSelectAid(); CLA 00, INS A4, P1 04
+    if ((apduLen < SELECT_APDU_HDR_LEN + MIN_AID_LEN) || (apdu[0] != 0x00) || (apdu[1] != 0xA4) || (apdu[2] != 0x04))
+        return HOST_AID_UNRESOLVED;
+    const UINT8* aid = apdu + SELECT_APDU_HDR_LEN;
+    UINT8 aidLen = apdu[4];
+    if ((aidLen > MAX_AID_LEN) || (apduLen < SELECT_APDU_HDR_LEN + aidLen))
+        return HOST_AID_UNRESOLVED;
+
+    AutoMutex mutex (mHostAidMutex);
+    if (!mHostAidsLoaded)
+        return HOST_AID_UNRESOLVED;
+    int token = AidTrie::NO_ROUTE;
+    if (aidLen >= MIN_AID_LEN)
+    {
+        token = mHostExactAids.find (aid, aidLen);
+        if (token == AidTrie::NO_ROUTE)
+            token = mHostPrefixAids.findLongestPrefix (aid, aidLen);
+    }
+    if (token != AidTrie::NO_ROUTE)
+        return token;
+    return mRejectUnknownAids ? HOST_AID_NOT_FOUND : HOST_AID_UNRESOLVED;
 }
 
 bool RoutingManager::commitRouting()
@@ -250,12 +310,19 @@ bool RoutingManager::commitRouting()
     static const char fn [] = "RoutingManager::commitRouting";
     tNFA_STATUS nfaStat = 0;
     ALOGD ("%s", fn);
+    bool aidsChanged = mCommittedAids.update (mAidRoutes, mAidMatchingMode == AID_MATCHING_PREFIX_ONLY);
+    if (!aidsChanged && !mRoutingChanged)
+    {
+        ALOGD ("%s: routing unchanged", fn);
+        return true;
+    }
     {
         SyncEventGuard guard (mEeUpdateEvent);
         nfaStat = NFA_EeUpdateNow();
         if (nfaStat == NFA_STATUS_OK)
         {
             mEeUpdateEvent.wait (); //wait for NFA_EE_UPDATED_EVT
+            mRoutingChanged = false;
         }
     }
     return (nfaStat == NFA_STATUS_OK);
@@ -323,7 +390,8 @@ void RoutingManager::notifyActivated ()
 
 void RoutingManager::notifyDeactivated ()
 {
-    mRxDataBuffer.clear();
+    mRxDataLen = 0;
+    mRxDataOverflow = false;
     JNIEnv* e = NULL;
     ScopedAttach attach(mNativeData->vm, &e);
     if (e == NULL)
@@ -348,15 +416,26 @@ void RoutingManager::handleData (const UINT8* data, UINT32 dataLen, tNFA_STATUS
         goto TheEnd;
     }
 
-    if (status == NFA_STATUS_CONTINUE)
-    {
-        mRxDataBuffer.insert (mRxDataBuffer.end(), &data[0], &data[dataLen]); //append data; more to come
-        return; //expect another NFA_CE_DATA_EVT to come
-    }
-    else if (status == NFA_STATUS_OK)
+    if ((mRxDataLen == 0) && !mRxDataOverflow)
+        clock_gettime (CLOCK_MONOTONIC, &mRxStartTime);
+
+    if ((status == NFA_STATUS_CONTINUE) || (status == NFA_STATUS_OK))
     {
-        mRxDataBuffer.insert (mRxDataBuffer.end(), &data[0], &data[dataLen]); //append data
+        if (dataLen > MAX_APDU_LEN - mRxDataLen)
+            mRxDataOverflow = true;
+        if (!mRxDataOverflow)
+        {
+            memcpy (mRxDataBuffer + mRxDataLen, data, dataLen); //append data
+            mRxDataLen += dataLen;
+        }
+        if (status == NFA_STATUS_CONTINUE)
+            return; //expect another NFA_CE_DATA_EVT to come
         //entire data packet has been received; no more NFA_CE_DATA_EVT
+        if (mRxDataOverflow)
+        {
+            ALOGE("RoutingManager::handleData: APDU exceeds %u bytes; dropped", MAX_APDU_LEN);
+            goto TheEnd;
+        }
     }
     else if (status == NFA_STATUS_FAILED)
     {
@@ -365,6 +444,18 @@ void RoutingManager::handleData (const UINT8* data, UINT32 dataLen, tNFA_STATUS
     }
 
     {
+        gHceAssemblyLatency.record (mRxStartTime, mRxDataLen);
+        int aidToken = lookupHostAid (mRxDataBuffer, mRxDataLen);
+        if (aidToken == HOST_AID_NOT_FOUND)
+        {
+            //no host service registered the AID; answer the reader without a round trip through Java
+            static UINT8 aidNotFound [] = {0x6A, 0x82};
+            if (NFA_SendRawFrame (aidNotFound, sizeof(aidNotFound), 0) != NFA_STATUS_OK)
+                ALOGE ("RoutingManager::handleData: fail send AID not found");
+            gHceDataLatency.record (mRxStartTime, mRxDataLen);
+            goto TheEnd;
+        }
+
         JNIEnv* e = NULL;
         ScopedAttach attach(mNativeData->vm, &e);
         if (e == NULL)
@@ -373,31 +464,52 @@ void RoutingManager::handleData (const UINT8* data, UINT32 dataLen, tNFA_STATUS
             goto TheEnd;
         }
 
-        ScopedLocalRef<jobject> dataJavaArray(e, e->NewByteArray(mRxDataBuffer.size()));
-        if (dataJavaArray.get() == NULL)
+        if (mRxDirectBuffer == NULL)
         {
-            ALOGE ("fail allocate array");
-            goto TheEnd;
+            //wrap the assembly buffer once; Java must not retain it after the callback returns
+            ScopedLocalRef<jobject> directBuffer(e, e->NewDirectByteBuffer(mRxDataBuffer, MAX_APDU_LEN));
+            if (directBuffer.get() != NULL)
+                mRxDirectBuffer = e->NewGlobalRef(directBuffer.get());
+            if (e->ExceptionCheck())
+                e->ExceptionClear();
         }
 
-        e->SetByteArrayRegion ((jbyteArray)dataJavaArray.get(), 0, mRxDataBuffer.size(),
-                (jbyte *)(&mRxDataBuffer[0]));
-        if (e->ExceptionCheck())
+        if (mRxDirectBuffer != NULL)
         {
-            e->ExceptionClear();
-            ALOGE ("fail fill array");
-            goto TheEnd;
+            e->CallVoidMethod (mNativeData->manager, android::gCachedNfcManagerNotifyHostEmuDataDirect,
+                    mRxDirectBuffer, (jint) mRxDataLen, (jint) aidToken);
         }
+        else
+        {
+            ScopedLocalRef<jobject> dataJavaArray(e, e->NewByteArray(mRxDataLen));
+            if (dataJavaArray.get() == NULL)
+            {
+                ALOGE ("fail allocate array");
+                goto TheEnd;
+            }
 
-        e->CallVoidMethod (mNativeData->manager, android::gCachedNfcManagerNotifyHostEmuData, dataJavaArray.get());
+            e->SetByteArrayRegion ((jbyteArray)dataJavaArray.get(), 0, mRxDataLen,
+                    (jbyte *)(mRxDataBuffer));
+            if (e->ExceptionCheck())
+            {
+                e->ExceptionClear();
+                ALOGE ("fail fill array");
+                goto TheEnd;
+            }
+
+            e->CallVoidMethod (mNativeData->manager, android::gCachedNfcManagerNotifyHostEmuData, dataJavaArray.get());
+        }
         if (e->ExceptionCheck())
         {
             e->ExceptionClear();
             ALOGE ("fail notify");
         }
+
+        gHceDataLatency.record (mRxStartTime, mRxDataLen);
     }
 TheEnd:
-    mRxDataBuffer.clear();
+    mRxDataLen = 0;
+    mRxDataOverflow = false;
 }
 
 void RoutingManager::stackCallback (UINT8 event, tNFA_CONN_EVT_DATA* eventData)
@@ -589,3 +701,83 @@ int RoutingManager::com_android_nfc_cardemulation_doGetAidMatchingMode (JNIEnv*)
 {
     return getInstance().mAidMatchingMode;
 }
+
+/*******************************************************************************
+**
+** Function:        com_android_nfc_cardemulation_doSetHostAidTable
+**
+** Description:     Replace the host AID table that lookupHostAid() matches
+**                  SELECT commands against.
+**                  e: JVM environment.
+**                  aids: each entry is a length octet, a prefix flag octet,
+**                        then the AID; NULL disables native matching.
+**                  tokens: token for each entry, handed back to Java when a
+**                          SELECT matches only that entry.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::com_android_nfc_cardemulation_doSetHostAidTable (JNIEnv* e, jobject, jbyteArray aids, jintArray tokens)
+{
+    static const char fn [] = "RoutingManager::doSetHostAidTable";
+    RoutingManager& rm = getInstance();
+    AutoMutex mutex (rm.mHostAidMutex);
+
+    rm.mHostAidsLoaded = false;
+    rm.mHostExactAids.clear ();
+    rm.mHostPrefixAids.clear ();
+    if ((aids == NULL) || (tokens == NULL))
+    {
+        ALOGD ("%s: native AID matching disabled", fn);
+        return;
+    }
+
+    ScopedByteArrayRO aidBytes (e, aids);
+    ScopedIntArrayRO tokenInts (e, tokens);
+    const UINT8* p = reinterpret_cast<const UINT8*>(aidBytes.get());
+    size_t remaining = aidBytes.size();
+    size_t i = 0;
+    for (; (remaining >= 2) && (i < tokenInts.size()); i++)
+    {
+        UINT8 aidLen = p[0];
+        bool isPrefix = (p[1] != 0);
+        if (remaining < 2u + aidLen)
+            break;
+        if (isPrefix)
+            rm.mHostPrefixAids.put (p + 2, aidLen, tokenInts[i]);
+        else
+            rm.mHostExactAids.put (p + 2, aidLen, tokenInts[i]);
+        p += 2 + aidLen;
+        remaining -= 2 + aidLen;
+    }
+    if ((remaining != 0) || (i != tokenInts.size()))
+    {
+        ALOGE ("%s: malformed table; native AID matching disabled", fn);
+        rm.mHostExactAids.clear ();
+        rm.mHostPrefixAids.clear ();
+        return;
+    }
+    rm.mHostAidsLoaded = true;
+    ALOGD ("%s: %u host AIDs", fn, (unsigned) i);
+}
+
+/*******************************************************************************
+**
+** Function:        com_android_nfc_cardemulation_doSetRejectUnknownAids
+**
+** Description:     Follow HostEmulationManager's state: whether a SELECT of
+**                  an AID no host service registered may be answered with
+**                  6A82 here, or must go up to Java (which drops it while
+**                  idle or waiting for deactivation).
+**                  e: JVM environment.
+**                  reject: Java would answer such a SELECT with 6A82.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::com_android_nfc_cardemulation_doSetRejectUnknownAids (JNIEnv*, jobject, jboolean reject)
+{
+    RoutingManager& rm = getInstance();
+    AutoMutex mutex (rm.mHostAidMutex);
+    rm.mRejectUnknownAids = (reject == JNI_TRUE);
+}
@@ -19,8 +19,11 @@
  */
 #pragma once
 #include "SyncEvent.h"
+#include "Mutex.h"
 #include "NfcJniUtil.h"
 #include "RouteDataSet.h"
+#include "AidTrie.h"
+#include "AidRoutingTable.h"
 #include <vector>
 extern "C"
 {
@@ -47,6 +50,7 @@ private:
     RoutingManager& operator=(const RoutingManager&);
 
     void handleData (const UINT8* data, UINT32 dataLen, tNFA_STATUS status);
+    int lookupHostAid (const UINT8* apdu, UINT32 apduLen);
     void notifyActivated ();
     void notifyDeactivated ();
 
@@ -65,8 +69,32 @@ private:
     static int com_android_nfc_cardemulation_doGetDefaultRouteDestination (JNIEnv* e);
     static int com_android_nfc_cardemulation_doGetDefaultOffHostRouteDestination (JNIEnv* e);
     static int com_android_nfc_cardemulation_doGetAidMatchingMode (JNIEnv* e);
+    static void com_android_nfc_cardemulation_doSetHostAidTable (JNIEnv* e, jobject, jbyteArray aids, jintArray tokens);
+    static void com_android_nfc_cardemulation_doSetRejectUnknownAids (JNIEnv* e, jobject, jboolean reject);
 
-    std::vector<UINT8> mRxDataBuffer;
+    // Results of lookupHostAid() besides a token from the host AID table;
+    // see AidRoutingManager.java for the corresponding constants
+    static const int HOST_AID_UNRESOLVED = -1; //not a SELECT by AID, or Java must resolve it
+    static const int HOST_AID_NOT_FOUND = -2; //no host service can take the selected AID
+
+    // Longest command APDU: header, 3-octet Lc, 65535 octets of data, 2-octet Le
+    static const UINT32 MAX_APDU_LEN = 4 + 3 + 65535 + 2;
+
+    UINT8 mRxDataBuffer [MAX_APDU_LEN]; //APDU being assembled from NFA_CE_DATA_EVT fragments
+    UINT32 mRxDataLen;
+    bool mRxDataOverflow; //APDU longer than MAX_APDU_LEN; dropped when complete
+    struct timespec mRxStartTime; //arrival of the APDU's first fragment
+    jobject mRxDirectBuffer; //global ref to direct ByteBuffer over mRxDataBuffer
+
+    AidTrie mAidRoutes; //AIDs as requested by addAidRouting() and removeAidRouting()
+    AidRoutingTable mCommittedAids; //AIDs in the stack's table
+
+    Mutex mHostAidMutex; //guards the host AID table below
+    bool mHostAidsLoaded; //Java has pushed a host AID table
+    bool mRejectUnknownAids; //Java would answer 6A82 itself in its current HCE state
+    AidTrie mHostExactAids; //exact host AIDs, mapped to their token
+    AidTrie mHostPrefixAids; //prefix host AIDs (without '*'), mapped to their token
+    bool mRoutingChanged; //default routes changed since the last commitRouting()
 
     // Fields below are final after initialize()
     nfc_jni_native_data* mNativeData;
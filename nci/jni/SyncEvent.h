@@ -81,8 +81,28 @@ public:
     *******************************************************************************/
     bool wait (long millisec)
     {
-        bool retVal = mCondVar.wait (mMutex, millisec);
-        return retVal;
+        struct timespec deadline;
+        CondVar::deadlineAfter (millisec, deadline);
+        return waitUntil (deadline);
+    }
+
+
+    /*******************************************************************************
+    **
+    ** Function:        waitUntil
+    **
+    ** Description:     Block the thread and wait for the event to occur.  Loops
+    **                  that wait again after a spurious wake-up pass the same
+    **                  deadline, so the total timeout does not grow.
+    **                  deadline: Absolute time on CLOCK_MONOTONIC; see
+    **                            CondVar::deadlineAfter().
+    **
+    ** Returns:         True if wait is successful; false if the deadline passes.
+    **
+    *******************************************************************************/
+    bool waitUntil (const struct timespec& deadline)
+    {
+        return mCondVar.waitUntil (mMutex, deadline);
     }
 
 
@@ -101,6 +121,22 @@ public:
     }
 
 
+    /*******************************************************************************
+    **
+    ** Function:        notifyAll
+    **
+    ** Description:     Notify all blocked threads that the event has occured.
+    **                  Unblocks them.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void notifyAll ()
+    {
+        mCondVar.notifyAll ();
+    }
+
+
     /*******************************************************************************
     **
     ** Function:        end
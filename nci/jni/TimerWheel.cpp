@@ -0,0 +1,537 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ *  Run every interval timer of the process from one thread.
+ */
+
+#include "TimerWheel.h"
+#include "OverrideLog.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/*******************************************************************************
+**
+** Function:        TimerWheel
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+TimerWheel::TimerWheel ()
+:   mThreadStarted (false),
+    mCurrentTick (nowTick (false)),
+    mWakeTick (0),
+    mNumArmed (0),
+    mRunning (NULL),
+    mFired (0),
+    mCoalesced (0),
+    mRescheduled (0),
+    mWorkerStarted (false),
+    mPosted (0)
+{
+    memset (mSlots, 0, sizeof(mSlots));
+}
+
+
+/*******************************************************************************
+**
+** Function:        getInstance
+**
+** Description:     Get the singleton of this object.  It is never destroyed,
+**                  so static IntervalTimer objects can still cancel their
+**                  timers while the process exits.
+**
+** Returns:         Reference to this object.
+**
+*******************************************************************************/
+TimerWheel& TimerWheel::getInstance ()
+{
+    static TimerWheel* wheel = new TimerWheel ();
+    return *wheel;
+}
+
+
+/*******************************************************************************
+**
+** Function:        schedule
+**
+** Description:     Arm a timer, or move it if it is already armed.
+**                  timer: The timer.
+**                  ms: Milliseconds from now.
+**                  cb: Function called on the timer thread when the timer fires.
+**                  arg: Handed to cb as sival_ptr.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool TimerWheel::schedule (Timer& timer, int ms, TIMER_FUNC cb, void* arg)
+{
+    if (cb == NULL)
+        return false;
+
+    AutoMutex mutex (mMutex);
+    if (!mThreadStarted)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        int res = pthread_create (&mThread, &attr, threadProc, this);
+        pthread_attr_destroy (&attr);
+        if (res)
+        {
+            ALOGE ("TimerWheel::schedule: fail create thread; error=0x%X", res);
+            return false;
+        }
+        mThreadStarted = true;
+    }
+
+    if (timer.mArmed)
+    {
+        unlinkLocked (timer);
+        mRescheduled++;
+    }
+    if (mNumArmed == 0)
+    {
+        //nothing to process in between; skip the ticks that passed while idle
+        uint64_t now = nowTick (false);
+        if (now > mCurrentTick)
+            mCurrentTick = now;
+    }
+
+    uint64_t expiry = nowTick (true) + ((ms > 0) ? ms : 0);
+    if (expiry < mCurrentTick)
+        expiry = mCurrentTick;
+    timer.mExpiry = expiry;
+    timer.mCb = cb;
+    timer.mArg = arg;
+    timer.mGeneration++;
+    timer.mArmed = true;
+    insertLocked (timer);
+    mNumArmed++;
+
+    if (expiry < mWakeTick)
+        mCondVar.notifyOne (); //thread sleeps past the new expiry
+    return true;
+}
+
+
+/*******************************************************************************
+**
+** Function:        cancel
+**
+** Description:     Disarm a timer; wait for its running callback.
+**                  timer: The timer.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerWheel::cancel (Timer& timer)
+{
+    AutoMutex mutex (mMutex);
+    timer.mGeneration++;
+    if (timer.mArmed)
+        unlinkLocked (timer);
+    //the timer may be destroyed once this returns; forget it everywhere
+    for (size_t i = 0; i < mExpired.size (); i++)
+    {
+        if (mExpired [i].mTimer == &timer)
+            mExpired [i].mTimer = NULL;
+    }
+    for (size_t i = 0; i < mFiring.size (); i++)
+    {
+        if (mFiring [i].mTimer == &timer)
+            mFiring [i].mTimer = NULL;
+    }
+    if (mThreadStarted && pthread_equal (pthread_self (), mThread))
+        return; //cancelled by a callback; waiting would deadlock
+    while (mRunning == &timer)
+        mIdleCondVar.wait (mMutex);
+}
+
+
+/*******************************************************************************
+**
+** Function:        post
+**
+** Description:     Run work on the worker thread.
+**                  cb: Function to call.
+**                  arg: Handed to cb.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool TimerWheel::post (WORK_FUNC cb, void* arg)
+{
+    if (cb == NULL)
+        return false;
+
+    AutoMutex mutex (mWorkMutex);
+    if (!mWorkerStarted)
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        int res = pthread_create (&thread, &attr, workerProc, this);
+        pthread_attr_destroy (&attr);
+        if (res)
+        {
+            ALOGE ("TimerWheel::post: fail create thread; error=0x%X", res);
+            return false;
+        }
+        mWorkerStarted = true;
+    }
+
+    Work work = {cb, arg};
+    mWork.push_back (work);
+    mPosted++;
+    mWorkCondVar.notifyOne ();
+    return true;
+}
+
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Append a line with the counts of fired, coalesced and
+**                  rescheduled timers.
+**                  out: receives the text.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerWheel::dump (std::string& out)
+{
+    char buffer [120];
+    uint32_t posted;
+    {
+        AutoMutex mutex (mWorkMutex);
+        posted = mPosted;
+    }
+    AutoMutex mutex (mMutex);
+    snprintf (buffer, sizeof(buffer), "timer wheel: fired=%u coalesced=%u rescheduled=%u armed=%u posted=%u\n",
+            mFired, mCoalesced, mRescheduled, mNumArmed, posted);
+    out.append (buffer);
+}
+
+
+/*******************************************************************************
+**
+** Function:        nowTick
+**
+** Description:     Get the current tick.
+**                  roundUp: Round a partial millisecond up, so that a timer
+**                           never fires early.
+**
+** Returns:         Milliseconds of CLOCK_MONOTONIC.
+**
+*******************************************************************************/
+uint64_t TimerWheel::nowTick (bool roundUp)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    uint64_t tick = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    if (roundUp && (now.tv_nsec % 1000000))
+        tick++;
+    return tick;
+}
+
+
+/*******************************************************************************
+**
+** Function:        threadProc
+**
+** Description:     Entry point of the timer thread.
+**                  arg: The timer wheel.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void* TimerWheel::threadProc (void* arg)
+{
+    static_cast<TimerWheel*> (arg)->run ();
+    return NULL;
+}
+
+
+/*******************************************************************************
+**
+** Function:        workerProc
+**
+** Description:     Entry point of the worker thread.
+**                  arg: The timer wheel.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void* TimerWheel::workerProc (void* arg)
+{
+    static_cast<TimerWheel*> (arg)->runWork ();
+    return NULL;
+}
+
+
+/*******************************************************************************
+**
+** Function:        runWork
+**
+** Description:     Run posted work in order, outside the lock.
+**
+** Returns:         Never.
+**
+*******************************************************************************/
+void TimerWheel::runWork ()
+{
+    mWorkMutex.lock ();
+    for (;;)
+    {
+        while (mWork.empty ())
+            mWorkCondVar.wait (mWorkMutex);
+        Work work = mWork.front ();
+        mWork.pop_front ();
+        mWorkMutex.unlock ();
+        work.mCb (work.mArg);
+        mWorkMutex.lock ();
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        run
+**
+** Description:     Advance the wheel to the current tick, run the callbacks
+**                  of expired timers outside the lock, then sleep until the
+**                  next timer can fire.
+**
+** Returns:         Never.
+**
+*******************************************************************************/
+void TimerWheel::run ()
+{
+    mMutex.lock ();
+    for (;;)
+    {
+        uint64_t now = nowTick (false);
+        while ((mCurrentTick <= now) && (mNumArmed > 0))
+            advanceLocked ();
+
+        if (!mExpired.empty ())
+        {
+            mFiring.swap (mExpired);
+            uint32_t ran = 0;
+            for (size_t i = 0; i < mFiring.size (); i++)
+            {
+                //entries are read under mMutex; cancel() clears them
+                Expired x = mFiring [i];
+                if ((x.mTimer == NULL) || (x.mTimer->mGeneration != x.mGeneration))
+                    continue; //cancelled or scheduled again since it expired
+                mFired++;
+                if (ran++ > 0)
+                    mCoalesced++;
+                mRunning = x.mTimer;
+                mMutex.unlock ();
+                union sigval val;
+                val.sival_ptr = x.mArg;
+                x.mCb (val);
+                mMutex.lock ();
+                mRunning = NULL;
+                mIdleCondVar.notifyAll ();
+            }
+            mFiring.clear ();
+            continue; //callbacks took time and may have armed timers
+        }
+
+        mWakeTick = nextWakeLocked ();
+        if (mWakeTick == NO_WAKE)
+            mCondVar.wait (mMutex);
+        else
+        {
+            struct timespec deadline;
+            deadline.tv_sec = mWakeTick / 1000;
+            deadline.tv_nsec = (mWakeTick % 1000) * 1000000;
+            mCondVar.waitUntil (mMutex, deadline);
+        }
+        mWakeTick = 0; //awake; schedule() need not signal
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        insertLocked
+**
+** Description:     Link a timer into the slot for its expiry.  Level n holds
+**                  timers due in less than 64^(n+1) ticks.
+**                  timer: The timer; its expiry is not before mCurrentTick.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerWheel::insertLocked (Timer& timer)
+{
+    static const uint64_t SPAN = 1ULL << (LEVEL_BITS * NUM_LEVELS);
+    uint64_t delta = timer.mExpiry - mCurrentTick;
+    uint64_t expiry = timer.mExpiry;
+    int level = 0;
+
+    while ((level < NUM_LEVELS - 1) && (delta >= (1ULL << (LEVEL_BITS * (level + 1)))))
+        level++;
+    if (delta >= SPAN)
+        expiry = mCurrentTick + SPAN - 1; //placed again when its slot cascades
+
+    Timer** slot = &mSlots [level][(expiry >> (LEVEL_BITS * level)) & (NUM_SLOTS - 1)];
+    timer.mSlot = slot;
+    timer.mPrev = NULL;
+    timer.mNext = *slot;
+    if (*slot != NULL)
+        (*slot)->mPrev = &timer;
+    *slot = &timer;
+}
+
+
+/*******************************************************************************
+**
+** Function:        unlinkLocked
+**
+** Description:     Remove an armed timer from its slot.
+**                  timer: The timer.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerWheel::unlinkLocked (Timer& timer)
+{
+    if (timer.mPrev != NULL)
+        timer.mPrev->mNext = timer.mNext;
+    else
+        *timer.mSlot = timer.mNext;
+    if (timer.mNext != NULL)
+        timer.mNext->mPrev = timer.mPrev;
+    timer.mPrev = timer.mNext = NULL;
+    timer.mSlot = NULL;
+    timer.mArmed = false;
+    mNumArmed--;
+}
+
+
+/*******************************************************************************
+**
+** Function:        cascadeLocked
+**
+** Description:     Move the timers of a slot down to the levels that now cover them.
+**                  level: Level of the slot.
+**                  slot: Index of the slot.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerWheel::cascadeLocked (int level, int slot)
+{
+    Timer* timer = mSlots [level][slot];
+    mSlots [level][slot] = NULL;
+    while (timer != NULL)
+    {
+        Timer* next = timer->mNext;
+        insertLocked (*timer);
+        timer = next;
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function:        advanceLocked
+**
+** Description:     Process mCurrentTick: cascade the higher levels whose slot
+**                  starts at this tick, then collect the timers that expire.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerWheel::advanceLocked ()
+{
+    uint64_t tick = mCurrentTick;
+    for (int level = 1; level < NUM_LEVELS; level++)
+    {
+        if (tick & ((1ULL << (LEVEL_BITS * level)) - 1))
+            break;
+        cascadeLocked (level, (tick >> (LEVEL_BITS * level)) & (NUM_SLOTS - 1));
+    }
+
+    Timer* timer = mSlots [0][tick & (NUM_SLOTS - 1)];
+    while (timer != NULL)
+    {
+        Timer* next = timer->mNext;
+        Expired x = {timer, timer->mCb, timer->mArg, timer->mGeneration};
+        unlinkLocked (*timer);
+        mExpired.push_back (x);
+        timer = next;
+    }
+    mCurrentTick++;
+}
+
+
+/*******************************************************************************
+**
+** Function:        nextWakeLocked
+**
+** Description:     Find the first tick at which a timer expires or a slot
+**                  cascades.  Waking at a cascade that brings nothing due is
+**                  harmless; the thread just sleeps again.
+**
+** Returns:         The tick; NO_WAKE if no timer is armed.
+**
+*******************************************************************************/
+uint64_t TimerWheel::nextWakeLocked ()
+{
+    if (mNumArmed == 0)
+        return NO_WAKE;
+
+    uint64_t wake = NO_WAKE;
+    for (int i = 0; i < NUM_SLOTS; i++)
+    {
+        if (mSlots [0][(mCurrentTick + i) & (NUM_SLOTS - 1)] != NULL)
+        {
+            wake = mCurrentTick + i;
+            break;
+        }
+    }
+    for (int level = 1; level < NUM_LEVELS; level++)
+    {
+        int shift = LEVEL_BITS * level;
+        uint64_t base = mCurrentTick >> shift;
+        for (int k = 0; k < NUM_SLOTS; k++)
+        {
+            if (mSlots [level][(base + k) & (NUM_SLOTS - 1)] == NULL)
+                continue;
+            uint64_t tick = (base + k) << shift;
+            if (tick < mCurrentTick)
+                tick = (base + NUM_SLOTS) << shift; //slot of the current index holds the next lap
+            if (tick < wake)
+                wake = tick;
+            if (k > 0)
+                break; //later slots cascade later still
+        }
+    }
+    return wake;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ *  Run every interval timer of the process from one thread.  Callbacks
+ *  must not block; they post blocking work to the wheel's worker thread.
+ */
+
+#pragma once
+#include "CondVar.h"
+#include "Mutex.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+class TimerWheel
+{
+public:
+    typedef void (*TIMER_FUNC) (union sigval);
+    typedef void (*WORK_FUNC) (void* arg);
+
+    // One timer; owned by the caller, linked into a wheel slot while armed
+    struct Timer
+    {
+        Timer* mPrev;
+        Timer* mNext;
+        Timer** mSlot; //head of the slot list the timer is linked into
+        uint64_t mExpiry; //tick (millisecond of CLOCK_MONOTONIC) when the timer fires
+        TIMER_FUNC mCb;
+        void* mArg; //handed to mCb as sival_ptr
+        uint32_t mGeneration; //changes whenever the timer is scheduled or cancelled
+        bool mArmed;
+
+        Timer () : mPrev (NULL), mNext (NULL), mSlot (NULL), mExpiry (0), mCb (NULL), mArg (NULL), mGeneration (0), mArmed (false) {}
+    };
+
+
+    /*******************************************************************************
+    **
+    ** Function:        getInstance
+    **
+    ** Description:     Get the singleton of this object.
+    **
+    ** Returns:         Reference to this object.
+    **
+    *******************************************************************************/
+    static TimerWheel& getInstance ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        schedule
+    **
+    ** Description:     Arm a timer, or move it if it is already armed.  Only
+    **                  wakes the timer thread if the timer fires before the
+    **                  thread would wake anyway.
+    **                  timer: The timer.
+    **                  ms: Milliseconds from now.
+    **                  cb: Function called on the timer thread when the timer
+    **                      fires; it must not block.
+    **                  arg: Handed to cb as sival_ptr.
+    **
+    ** Returns:         True if ok.
+    **
+    *******************************************************************************/
+    bool schedule (Timer& timer, int ms, TIMER_FUNC cb, void* arg);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        cancel
+    **
+    ** Description:     Disarm a timer.  A timer that has expired but whose
+    **                  callback has not started yet does not fire.  Waits for
+    **                  a callback that is already running, unless called from
+    **                  that callback, so the timer may be destroyed afterwards.
+    **                  timer: The timer.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void cancel (Timer& timer);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        post
+    **
+    ** Description:     Run work on the worker thread, after work posted earlier.
+    **                  For timer callbacks and stack callbacks that must not
+    **                  block; the work may block, which delays only other work.
+    **                  cb: Function to call.
+    **                  arg: Handed to cb.
+    **
+    ** Returns:         True if ok.
+    **
+    *******************************************************************************/
+    bool post (WORK_FUNC cb, void* arg);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        dump
+    **
+    ** Description:     Append a line with the counts of fired, coalesced and
+    **                  rescheduled timers, and of posted work.
+    **                  out: receives the text.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    void dump (std::string& out);
+
+private:
+    // Four levels of 64 slots; level n slots are 64^n ticks wide, so the
+    // wheel spans 2^24 ms (about 4.6 hours).  Longer timers are parked in
+    // the last level and placed again when they cascade.
+    static const int LEVEL_BITS = 6;
+    static const int NUM_SLOTS = 1 << LEVEL_BITS;
+    static const int NUM_LEVELS = 4;
+    static const uint64_t NO_WAKE = ~0ULL;
+
+    struct Expired
+    {
+        Timer* mTimer;
+        TIMER_FUNC mCb;
+        void* mArg;
+        uint32_t mGeneration;
+    };
+
+    struct Work
+    {
+        WORK_FUNC mCb;
+        void* mArg;
+    };
+
+    Mutex mMutex;
+    CondVar mCondVar;
+    CondVar mIdleCondVar; //signalled when a callback returns
+    bool mThreadStarted;
+    pthread_t mThread;
+    uint64_t mCurrentTick; //next tick to process
+    uint64_t mWakeTick; //tick the timer thread sleeps until; NO_WAKE if indefinitely
+    uint32_t mNumArmed;
+    Timer* mSlots [NUM_LEVELS][NUM_SLOTS];
+    std::vector<Expired> mExpired; //timers expired since the last wake-up
+    std::vector<Expired> mFiring; //timers whose callbacks run now; cancel() clears entries
+    Timer* mRunning; //timer whose callback runs outside mMutex; NULL if none
+    uint32_t mFired; //callbacks run
+    uint32_t mCoalesced; //callbacks that shared a wake-up with an earlier one
+    uint32_t mRescheduled; //timers moved while armed
+    Mutex mWorkMutex; //guards the work queue
+    CondVar mWorkCondVar;
+    bool mWorkerStarted;
+    std::deque<Work> mWork;
+    uint32_t mPosted; //work items posted
+
+    TimerWheel ();
+    TimerWheel (const TimerWheel&);
+    TimerWheel& operator= (const TimerWheel&);
+
+    static uint64_t nowTick (bool roundUp);
+    static void* threadProc (void* arg);
+    static void* workerProc (void* arg);
+    void run ();
+    void runWork ();
+    void insertLocked (Timer& timer);
+    void unlinkLocked (Timer& timer);
+    void cascadeLocked (int level, int slot);
+    void advanceLocked ();
+    uint64_t nextWakeLocked ();
+};
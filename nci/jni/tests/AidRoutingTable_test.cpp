@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host tests for the AID routing table diff: only changed AIDs reach the
+ *  stack, failures are retried, and prefix-only controllers get the whole
+ *  table in the order the AIDs were added.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "AidRoutingTable.h"
+
+static const UINT8 kAidA [] = {0xA0, 0x00, 0x00, 0x00, 0x01};
+static const UINT8 kAidB [] = {0xA0, 0x00, 0x00, 0x00, 0x02};
+static const UINT8 kAidB1 [] = {0xA0, 0x00, 0x00, 0x00, 0x02, 0x01};
+static const UINT8 kAidC [] = {0xA0, 0x00, 0x00, 0x00, 0x03};
+
+struct StackOp
+{
+    bool mAdd;
+    std::vector<UINT8> mAid;
+    int mRoute;
+};
+
+//what the fake stack was asked to do, and what it answers
+static std::vector<StackOp> sOps;
+static tNFA_STATUS sAddStatus = NFA_STATUS_OK;
+static tNFA_STATUS sRemoveStatus = NFA_STATUS_OK;
+
+static tNFA_STATUS fakeAddAid (tNFA_HANDLE eeHandle, UINT8 aidLen, UINT8* aid, tNFA_EE_PWR_STATE)
+{
+    StackOp op = {true, std::vector<UINT8> (aid, aid + aidLen), eeHandle};
+    sOps.push_back (op);
+    return sAddStatus;
+}
+
+static tNFA_STATUS fakeRemoveAid (UINT8 aidLen, UINT8* aid)
+{
+    StackOp op = {false, std::vector<UINT8> (aid, aid + aidLen), AidTrie::NO_ROUTE};
+    sOps.push_back (op);
+    return sRemoveStatus;
+}
+
+class AidRoutingTableTest : public ::testing::Test
+{
+protected:
+    AidRoutingTableTest () : mTable (fakeAddAid, fakeRemoveAid) {}
+
+    virtual void SetUp ()
+    {
+        sOps.clear ();
+        sAddStatus = NFA_STATUS_OK;
+        sRemoveStatus = NFA_STATUS_OK;
+    }
+
+    void expectOp (size_t i, bool add, const UINT8* aid, size_t aidLen, int route = AidTrie::NO_ROUTE)
+    {
+        ASSERT_LT (i, sOps.size ());
+        EXPECT_EQ (add, sOps [i].mAdd) << "op " << i;
+        EXPECT_EQ (std::vector<UINT8> (aid, aid + aidLen), sOps [i].mAid) << "op " << i;
+        EXPECT_EQ (route, sOps [i].mRoute) << "op " << i;
+    }
+
+    AidTrie mRoutes;
+    AidRoutingTable mTable;
+};
+
+
+/* The first update adds every AID, in ascending byte order */
+TEST_F(AidRoutingTableTest, FirstUpdateAddsAll)
+{
+    mRoutes.put (kAidC, sizeof(kAidC), 0x400);
+    mRoutes.put (kAidA, sizeof(kAidA), 0x4C0);
+
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    ASSERT_EQ (2u, sOps.size ());
+    expectOp (0, true, kAidA, sizeof(kAidA), 0x4C0);
+    expectOp (1, true, kAidC, sizeof(kAidC), 0x400);
+    EXPECT_EQ (2u, mTable.getEntries ().size ());
+}
+
+
+/* Nothing reaches the stack when the routes did not change */
+TEST_F(AidRoutingTableTest, UnchangedRoutesSendNothing)
+{
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    mRoutes.put (kAidB, sizeof(kAidB), 0x400);
+    mTable.update (mRoutes, false);
+    sOps.clear ();
+
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    EXPECT_FALSE (mTable.update (mRoutes, false));
+    EXPECT_TRUE (sOps.empty ());
+}
+
+
+/* Only the removed and the new AIDs are sent */
+TEST_F(AidRoutingTableTest, SendsOnlyTheDelta)
+{
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    mRoutes.put (kAidB, sizeof(kAidB), 0x400);
+    mTable.update (mRoutes, false);
+    sOps.clear ();
+
+    mRoutes.remove (kAidA, sizeof(kAidA));
+    mRoutes.put (kAidC, sizeof(kAidC), 0x400);
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    ASSERT_EQ (2u, sOps.size ());
+    expectOp (0, false, kAidA, sizeof(kAidA));
+    expectOp (1, true, kAidC, sizeof(kAidC), 0x400);
+
+    const std::vector<AidTrie::Entry>& entries = mTable.getEntries ();
+    ASSERT_EQ (2u, entries.size ());
+    EXPECT_EQ (std::vector<UINT8> (kAidB, kAidB + sizeof(kAidB)), entries [0].mAid);
+    EXPECT_EQ (std::vector<UINT8> (kAidC, kAidC + sizeof(kAidC)), entries [1].mAid);
+}
+
+
+/* A re-routed AID is removed and added back with its new route */
+TEST_F(AidRoutingTableTest, RerouteRemovesThenAdds)
+{
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    mTable.update (mRoutes, false);
+    sOps.clear ();
+
+    mRoutes.put (kAidA, sizeof(kAidA), 0x4C0);
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    ASSERT_EQ (2u, sOps.size ());
+    expectOp (0, false, kAidA, sizeof(kAidA));
+    expectOp (1, true, kAidA, sizeof(kAidA), 0x4C0);
+    ASSERT_EQ (1u, mTable.getEntries ().size ());
+    EXPECT_EQ (0x4C0, mTable.getEntries () [0].mRoute);
+}
+
+
+/* An AID the stack would not remove stays committed, and is retried next time */
+TEST_F(AidRoutingTableTest, FailedRemoveIsRetried)
+{
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    mTable.update (mRoutes, false);
+    sOps.clear ();
+
+    sRemoveStatus = NFA_STATUS_FAILED;
+    mRoutes.put (kAidA, sizeof(kAidA), 0x4C0);
+    EXPECT_FALSE (mTable.update (mRoutes, false));
+    ASSERT_EQ (1u, sOps.size ());
+    expectOp (0, false, kAidA, sizeof(kAidA));
+
+    sOps.clear ();
+    sRemoveStatus = NFA_STATUS_OK;
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    ASSERT_EQ (2u, sOps.size ());
+    expectOp (0, false, kAidA, sizeof(kAidA));
+    expectOp (1, true, kAidA, sizeof(kAidA), 0x4C0);
+}
+
+
+/* An AID the stack would not add is not committed, and is retried next time */
+TEST_F(AidRoutingTableTest, FailedAddIsRetried)
+{
+    sAddStatus = NFA_STATUS_FAILED;
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    EXPECT_TRUE (mTable.getEntries ().empty ());
+
+    sOps.clear ();
+    sAddStatus = NFA_STATUS_OK;
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    ASSERT_EQ (1u, sOps.size ());
+    expectOp (0, true, kAidA, sizeof(kAidA), 0x400);
+    EXPECT_EQ (1u, mTable.getEntries ().size ());
+}
+
+
+/* Prefix-only controllers get the whole table rewritten in the order the AIDs were added */
+TEST_F(AidRoutingTableTest, PrefixOnlyRewritesInAddedOrder)
+{
+    mRoutes.put (kAidB1, sizeof(kAidB1), 0x4C0);
+    mRoutes.put (kAidB, sizeof(kAidB), 0x400);
+    EXPECT_TRUE (mTable.update (mRoutes, true));
+    ASSERT_EQ (2u, sOps.size ());
+    expectOp (0, true, kAidB1, sizeof(kAidB1), 0x4C0);
+    expectOp (1, true, kAidB, sizeof(kAidB), 0x400);
+
+    sOps.clear ();
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    EXPECT_TRUE (mTable.update (mRoutes, true));
+    ASSERT_EQ (5u, sOps.size ());
+    expectOp (0, false, kAidB, sizeof(kAidB));
+    expectOp (1, false, kAidB1, sizeof(kAidB1));
+    expectOp (2, true, kAidB1, sizeof(kAidB1), 0x4C0);
+    expectOp (3, true, kAidB, sizeof(kAidB), 0x400);
+    expectOp (4, true, kAidA, sizeof(kAidA), 0x400);
+    EXPECT_EQ (3u, mTable.getEntries ().size ());
+}
+
+
+/* Prefix-only controllers see nothing when the routes did not change */
+TEST_F(AidRoutingTableTest, PrefixOnlyUnchangedSendsNothing)
+{
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    mTable.update (mRoutes, true);
+    sOps.clear ();
+
+    EXPECT_FALSE (mTable.update (mRoutes, true));
+    EXPECT_TRUE (sOps.empty ());
+}
+
+
+/* After clear() the table is assumed empty, so every AID is added again */
+TEST_F(AidRoutingTableTest, ClearForgetsCommittedAids)
+{
+    mRoutes.put (kAidA, sizeof(kAidA), 0x400);
+    mTable.update (mRoutes, false);
+    sOps.clear ();
+
+    mTable.clear ();
+    EXPECT_TRUE (mTable.update (mRoutes, false));
+    ASSERT_EQ (1u, sOps.size ());
+    expectOp (0, true, kAidA, sizeof(kAidA), 0x400);
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host tests for the AID prefix tree: exact and longest-prefix lookup,
+ *  removal, and the order entries are listed in.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "AidTrie.h"
+
+static const UINT8 kPpse [] = {0x32, 0x50, 0x41, 0x59, 0x2E, 0x53, 0x59, 0x53, 0x2E, 0x44, 0x44, 0x46, 0x30, 0x31};
+static const UINT8 kVisa [] = {0xA0, 0x00, 0x00, 0x00, 0x03};
+static const UINT8 kVisaCredit [] = {0xA0, 0x00, 0x00, 0x00, 0x03, 0x10, 0x10};
+static const UINT8 kMastercard [] = {0xA0, 0x00, 0x00, 0x00, 0x04, 0x10, 0x10};
+
+static std::vector<UINT8> aidOf (const UINT8* aid, size_t aidLen)
+{
+    return std::vector<UINT8> (aid, aid + aidLen);
+}
+
+
+/* find() only matches the whole AID, never a prefix or an extension of it */
+TEST(AidTrieTest, FindMatchesExactAid)
+{
+    AidTrie trie;
+    trie.put (kVisa, sizeof(kVisa), 1);
+    trie.put (kPpse, sizeof(kPpse), 2);
+
+    EXPECT_EQ (2u, trie.size ());
+    EXPECT_EQ (1, trie.find (kVisa, sizeof(kVisa)));
+    EXPECT_EQ (2, trie.find (kPpse, sizeof(kPpse)));
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.find (kVisaCredit, sizeof(kVisaCredit)));
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.find (kVisa, sizeof(kVisa) - 1));
+}
+
+
+/* findLongestPrefix() prefers the longest registered AID the selection starts with */
+TEST(AidTrieTest, FindLongestPrefixPrefersLongestMatch)
+{
+    AidTrie trie;
+    trie.put (kVisa, sizeof(kVisa), 1);
+    trie.put (kVisaCredit, sizeof(kVisaCredit), 2);
+
+    static const UINT8 visaCreditExtended [] = {0xA0, 0x00, 0x00, 0x00, 0x03, 0x10, 0x10, 0x01};
+    static const UINT8 visaOther [] = {0xA0, 0x00, 0x00, 0x00, 0x03, 0x20, 0x10};
+    EXPECT_EQ (2, trie.findLongestPrefix (visaCreditExtended, sizeof(visaCreditExtended)));
+    EXPECT_EQ (2, trie.findLongestPrefix (kVisaCredit, sizeof(kVisaCredit)));
+    EXPECT_EQ (1, trie.findLongestPrefix (visaOther, sizeof(visaOther)));
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.findLongestPrefix (kMastercard, sizeof(kMastercard)));
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.findLongestPrefix (kVisa, sizeof(kVisa) - 1));
+}
+
+
+/* Removing an AID leaves its prefixes and extensions routed */
+TEST(AidTrieTest, RemoveKeepsOtherAids)
+{
+    AidTrie trie;
+    trie.put (kVisa, sizeof(kVisa), 1);
+    trie.put (kVisaCredit, sizeof(kVisaCredit), 2);
+
+    EXPECT_TRUE (trie.remove (kVisaCredit, sizeof(kVisaCredit)));
+    EXPECT_FALSE (trie.remove (kVisaCredit, sizeof(kVisaCredit)));
+    EXPECT_EQ (1u, trie.size ());
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.find (kVisaCredit, sizeof(kVisaCredit)));
+    EXPECT_EQ (1, trie.findLongestPrefix (kVisaCredit, sizeof(kVisaCredit)));
+
+    trie.put (kVisaCredit, sizeof(kVisaCredit), 2);
+    EXPECT_TRUE (trie.remove (kVisa, sizeof(kVisa)));
+    EXPECT_EQ (2, trie.find (kVisaCredit, sizeof(kVisaCredit)));
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.findLongestPrefix (kVisa, sizeof(kVisa)));
+}
+
+
+/* Removing an AID that is only an inner node of the tree is a no-op */
+TEST(AidTrieTest, RemoveInnerNodeIsNoOp)
+{
+    AidTrie trie;
+    trie.put (kVisaCredit, sizeof(kVisaCredit), 2);
+
+    EXPECT_FALSE (trie.remove (kVisa, sizeof(kVisa)));
+    EXPECT_FALSE (trie.remove (kMastercard, sizeof(kMastercard)));
+    EXPECT_EQ (1u, trie.size ());
+    EXPECT_EQ (2, trie.find (kVisaCredit, sizeof(kVisaCredit)));
+}
+
+
+/* Entries come out in ascending byte order, a prefix before its extensions */
+TEST(AidTrieTest, GetEntriesInByteOrder)
+{
+    AidTrie trie;
+    trie.put (kMastercard, sizeof(kMastercard), 3);
+    trie.put (kVisaCredit, sizeof(kVisaCredit), 2);
+    trie.put (kPpse, sizeof(kPpse), 4);
+    trie.put (kVisa, sizeof(kVisa), 1);
+
+    std::vector<AidTrie::Entry> entries;
+    trie.getEntries (entries);
+    ASSERT_EQ (4u, entries.size ());
+    EXPECT_EQ (aidOf (kPpse, sizeof(kPpse)), entries [0].mAid);
+    EXPECT_EQ (aidOf (kVisa, sizeof(kVisa)), entries [1].mAid);
+    EXPECT_EQ (aidOf (kVisaCredit, sizeof(kVisaCredit)), entries [2].mAid);
+    EXPECT_EQ (aidOf (kMastercard, sizeof(kMastercard)), entries [3].mAid);
+    EXPECT_EQ (4, entries [0].mRoute);
+    EXPECT_EQ (1, entries [1].mRoute);
+
+    //the sequence records the order the AIDs were added in
+    EXPECT_LT (entries [3].mSequence, entries [2].mSequence);
+    EXPECT_LT (entries [2].mSequence, entries [0].mSequence);
+    EXPECT_LT (entries [0].mSequence, entries [1].mSequence);
+}
+
+
+/* Re-routing an AID moves it to the end of the added order; putting the same route does not */
+TEST(AidTrieTest, PutReplacesRoute)
+{
+    AidTrie trie;
+    trie.put (kVisa, sizeof(kVisa), 1);
+    trie.put (kMastercard, sizeof(kMastercard), 1);
+
+    std::vector<AidTrie::Entry> entries;
+    trie.put (kVisa, sizeof(kVisa), 1);
+    trie.getEntries (entries);
+    ASSERT_EQ (2u, entries.size ());
+    EXPECT_LT (entries [0].mSequence, entries [1].mSequence);
+
+    trie.put (kVisa, sizeof(kVisa), 2);
+    trie.getEntries (entries);
+    ASSERT_EQ (2u, entries.size ());
+    EXPECT_EQ (2, entries [0].mRoute);
+    EXPECT_GT (entries [0].mSequence, entries [1].mSequence);
+}
+
+
+/* clear() forgets every AID */
+TEST(AidTrieTest, ClearRemovesAll)
+{
+    AidTrie trie;
+    trie.put (kVisa, sizeof(kVisa), 1);
+    trie.put (kVisaCredit, sizeof(kVisaCredit), 2);
+    trie.clear ();
+
+    std::vector<AidTrie::Entry> entries;
+    trie.getEntries (entries);
+    EXPECT_EQ (0u, trie.size ());
+    EXPECT_TRUE (entries.empty ());
+    EXPECT_EQ (AidTrie::NO_ROUTE, trie.findLongestPrefix (kVisaCredit, sizeof(kVisaCredit)));
+}
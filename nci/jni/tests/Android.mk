@@ -0,0 +1,49 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    ../AidRoutingTable.cpp \
+    ../AidTrie.cpp \
+    ../CondVar.cpp \
+    ../IntervalTimer.cpp \
+    ../Mutex.cpp \
+    ../TimerWheel.cpp \
+    AidRoutingTable_test.cpp \
+    AidTrie_test.cpp \
+    CondVar_test.cpp \
+    Completion_test.cpp \
+    TimerWheel_test.cpp
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/.. \
+    external/libnfc-nci/src/include \
+    libnativehelper/include/nativehelper
+
+LOCAL_STATIC_LIBRARIES := liblog
+
+LOCAL_MODULE := libnfc_nci_jni_tests
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    ../CondVar.cpp \
+    ../LatencyStats.cpp \
+    ../Mutex.cpp \
+    DataPath_benchmark.cpp \
+    FakeNfa.cpp
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/.. \
+    external/libnfc-nci/src/include \
+    libnativehelper/include/nativehelper
+
+LOCAL_STATIC_LIBRARIES := liblog
+
+LOCAL_MODULE := nfc_nci_jni_benchmark
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host tests for the Completion latch: completion, timeouts, and the late
+ *  callback a timed-out request is still owed.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "Completion.h"
+
+typedef std::vector<int> Payload;
+
+
+/* A completed request hands back the status and the filled payload */
+TEST(CompletionTest, CompleteFillsPayload)
+{
+    Completion<Payload> completion;
+    Payload payload;
+    uint32_t id = completion.begin (payload);
+    {
+        Completion<Payload>::Pending pending (completion);
+        ASSERT_TRUE (pending.isActive ());
+        pending.payload ().push_back (7);
+        pending.complete (3);
+    }
+    int status = 0;
+    ASSERT_TRUE (completion.wait (id, 0, status, payload));
+    EXPECT_EQ (3, status);
+    ASSERT_EQ (1u, payload.size ());
+    EXPECT_EQ (7, payload [0]);
+}
+
+
+/* The late response of a timed-out request does not complete the next one */
+TEST(CompletionTest, LateCallbackIsDropped)
+{
+    Completion<Payload> completion;
+    Payload payload;
+    int status = 0;
+    uint32_t id = completion.begin (payload);
+    ASSERT_FALSE (completion.wait (id, 10, status, payload));
+
+    id = completion.begin (payload);
+    EXPECT_FALSE (completion.complete (1)); //late response of the first request
+    EXPECT_TRUE (completion.complete (2));
+    ASSERT_TRUE (completion.wait (id, 0, status, payload));
+    EXPECT_EQ (2, status);
+}
+
+
+/* Only one callback is dropped after a timeout */
+TEST(CompletionTest, OnlyOneLateCallbackIsDropped)
+{
+    Completion<Payload> completion;
+    Payload payload;
+    int status = 0;
+    uint32_t id = completion.begin (payload);
+    ASSERT_FALSE (completion.wait (id, 10, status, payload));
+    EXPECT_FALSE (completion.complete (1));
+
+    id = completion.begin (payload);
+    EXPECT_TRUE (completion.complete (2));
+    ASSERT_TRUE (completion.wait (id, 0, status, payload));
+    EXPECT_EQ (2, status);
+}
+
+
+/* A withdrawn request expects no callback, so the next one is not delayed */
+TEST(CompletionTest, WithdrawExpectsNoCallback)
+{
+    Completion<Payload> completion;
+    Payload payload;
+    payload.push_back (5);
+    uint32_t id = completion.begin (payload);
+    EXPECT_TRUE (payload.empty ());
+    completion.withdraw (id, payload);
+    ASSERT_EQ (1u, payload.size ());
+
+    int status = 0;
+    id = completion.begin (payload);
+    EXPECT_TRUE (completion.complete (2));
+    ASSERT_TRUE (completion.wait (id, 0, status, payload));
+    EXPECT_EQ (2, status);
+}
+
+
+/* Abort completes the outstanding request and forgets a late callback */
+TEST(CompletionTest, AbortForgetsLateCallback)
+{
+    Completion<Payload> completion;
+    Payload payload;
+    int status = 0;
+    uint32_t id = completion.begin (payload);
+    ASSERT_FALSE (completion.wait (id, 10, status, payload));
+
+    id = completion.begin (payload);
+    completion.abort (4);
+    ASSERT_TRUE (completion.wait (id, 0, status, payload));
+    EXPECT_EQ (4, status);
+
+    id = completion.begin (payload);
+    EXPECT_TRUE (completion.complete (2));
+    ASSERT_TRUE (completion.wait (id, 0, status, payload));
+    EXPECT_EQ (2, status);
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host tests for the deadline arithmetic and timed waits of CondVar and
+ *  SyncEvent.
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "CondVar.h"
+#include "SyncEvent.h"
+
+static const long NSEC_PER_SEC = 1000000000L;
+
+
+static long long toMillis (const struct timespec& t)
+{
+    return (long long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+
+static long long monotonicMillis ()
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return toMillis (now);
+}
+
+
+/* Every timeout lands on a normalized deadline, whatever the current nanoseconds */
+TEST(CondVarTest, DeadlineIsNormalized)
+{
+    static const long timeouts[] = { 0, 1, 999, 1000, 1001, 1999, 2500, 123456 };
+
+    for (int round = 0; round < 2000; round++)
+    {
+        for (size_t i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++)
+        {
+            struct timespec deadline;
+            CondVar::deadlineAfter (timeouts [i], deadline);
+            ASSERT_GE (deadline.tv_nsec, 0);
+            ASSERT_LT (deadline.tv_nsec, NSEC_PER_SEC);
+        }
+    }
+}
+
+
+/* The deadline is on CLOCK_MONOTONIC, so wall-clock jumps cannot move it */
+TEST(CondVarTest, DeadlineIsOnMonotonicClock)
+{
+    static const long timeouts[] = { 0, 1, 999, 1000, 1001, 1999, 2500, 123456 };
+
+    for (size_t i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++)
+    {
+        struct timespec before, deadline, after;
+        clock_gettime (CLOCK_MONOTONIC, &before);
+        CondVar::deadlineAfter (timeouts [i], deadline);
+        clock_gettime (CLOCK_MONOTONIC, &after);
+
+        EXPECT_GE (toMillis (deadline), toMillis (before) + timeouts [i]);
+        EXPECT_LE (toMillis (deadline), toMillis (after) + timeouts [i]);
+    }
+}
+
+
+TEST(CondVarTest, NegativeTimeoutIsNow)
+{
+    struct timespec before, deadline;
+    clock_gettime (CLOCK_MONOTONIC, &before);
+    CondVar::deadlineAfter (-5, deadline);
+    EXPECT_GE (toMillis (deadline), toMillis (before));
+    EXPECT_LE (toMillis (deadline), monotonicMillis ());
+}
+
+
+TEST(CondVarTest, WaitTimesOut)
+{
+    Mutex mutex;
+    CondVar condVar;
+
+    long long start = monotonicMillis ();
+    mutex.lock ();
+    EXPECT_FALSE (condVar.wait (mutex, 50));
+    mutex.unlock ();
+    EXPECT_GE (monotonicMillis () - start, 50);
+}
+
+
+TEST(CondVarTest, PassedDeadlineReturnsAtOnce)
+{
+    Mutex mutex;
+    CondVar condVar;
+    struct timespec deadline;
+    CondVar::deadlineAfter (0, deadline);
+
+    long long start = monotonicMillis ();
+    mutex.lock ();
+    EXPECT_FALSE (condVar.waitUntil (mutex, deadline));
+    mutex.unlock ();
+    EXPECT_LT (monotonicMillis () - start, 50);
+}
+
+
+/* Notifies an event until stopped, without ever setting the waiter's condition */
+struct Notifier
+{
+    SyncEvent* mEvent;
+    volatile bool mStop;
+    volatile bool mSignaled;
+    long mDelayMs; //notify once after this delay and set mSignaled; negative notifies spuriously
+};
+
+
+static void* notifierThread (void* arg)
+{
+    Notifier* notifier = static_cast<Notifier*> (arg);
+    if (notifier->mDelayMs >= 0)
+    {
+        usleep (notifier->mDelayMs * 1000);
+        SyncEventGuard g (*notifier->mEvent);
+        notifier->mSignaled = true;
+        notifier->mEvent->notifyOne ();
+        return NULL;
+    }
+    while (!notifier->mStop)
+    {
+        {
+            SyncEventGuard g (*notifier->mEvent);
+            notifier->mEvent->notifyOne ();
+        }
+        usleep (5 * 1000);
+    }
+    return NULL;
+}
+
+
+TEST(SyncEventTest, NotifyEndsWait)
+{
+    SyncEvent event;
+    Notifier notifier = { &event, false, false, 20 };
+    pthread_t thread;
+
+    bool ok = true;
+    {
+        SyncEventGuard g (event);
+        ASSERT_EQ (0, pthread_create (&thread, NULL, notifierThread, &notifier));
+        struct timespec deadline;
+        CondVar::deadlineAfter (5000, deadline);
+        while (ok && !notifier.mSignaled)
+            ok = event.waitUntil (deadline);
+    }
+    pthread_join (thread, NULL);
+    EXPECT_TRUE (ok);
+    EXPECT_TRUE (notifier.mSignaled);
+}
+
+
+/* Re-waiting after spurious wakeups must not stretch the total timeout */
+TEST(SyncEventTest, SpuriousWakeupsKeepDeadline)
+{
+    static const long TIMEOUT_MS = 200;
+    SyncEvent event;
+    Notifier notifier = { &event, false, false, -1 };
+    pthread_t thread;
+    int wakeups = 0;
+
+    long long start = monotonicMillis ();
+    {
+        SyncEventGuard g (event);
+        ASSERT_EQ (0, pthread_create (&thread, NULL, notifierThread, &notifier));
+        struct timespec deadline;
+        CondVar::deadlineAfter (TIMEOUT_MS, deadline);
+        while (event.waitUntil (deadline))
+            wakeups++;
+    }
+    long long elapsed = monotonicMillis () - start;
+    notifier.mStop = true;
+    pthread_join (thread, NULL);
+
+    EXPECT_GT (wakeups, 0);
+    EXPECT_GE (elapsed, TIMEOUT_MS);
+    EXPECT_LT (elapsed, TIMEOUT_MS + 100);
+}
+
+
+TEST(SyncEventTest, WaitTimesOut)
+{
+    SyncEvent event;
+    long long start = monotonicMillis ();
+    {
+        SyncEventGuard g (event);
+        EXPECT_FALSE (event.wait (30));
+    }
+    EXPECT_GE (monotonicMillis () - start, 30);
+}
+
+
+struct Waiter
+{
+    SyncEvent* mEvent;
+    bool* mReleased;
+    bool mWoken;
+};
+
+
+static void* waiterThread (void* arg)
+{
+    Waiter& waiter = *(Waiter*) arg;
+    SyncEventGuard g (*waiter.mEvent);
+    struct timespec deadline;
+    CondVar::deadlineAfter (2000, deadline);
+    while (!*waiter.mReleased && waiter.mEvent->waitUntil (deadline))
+        ;
+    waiter.mWoken = *waiter.mReleased;
+    return NULL;
+}
+
+
+/* One notifyAll wakes every thread waiting on the event */
+TEST(SyncEventTest, NotifyAllWakesEveryWaiter)
+{
+    static const int NUM_WAITERS = 3;
+    SyncEvent event;
+    bool released = false;
+    Waiter waiters [NUM_WAITERS];
+    pthread_t threads [NUM_WAITERS];
+
+    for (int i = 0; i < NUM_WAITERS; i++)
+    {
+        Waiter waiter = { &event, &released, false };
+        waiters [i] = waiter;
+        ASSERT_EQ (0, pthread_create (&threads [i], NULL, waiterThread, &waiters [i]));
+    }
+    usleep (50 * 1000); //let the waiters block
+
+    long long start = monotonicMillis ();
+    {
+        SyncEventGuard g (event);
+        released = true;
+        event.notifyAll ();
+    }
+    for (int i = 0; i < NUM_WAITERS; i++)
+    {
+        pthread_join (threads [i], NULL);
+        EXPECT_TRUE (waiters [i].mWoken);
+    }
+    EXPECT_LT (monotonicMillis () - start, 1000);
+}
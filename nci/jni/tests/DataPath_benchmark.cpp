@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host benchmark of the JNI data paths against a fake NFA stack.  Each path
+ *  blocks and copies the way its JNI code does: transceive on a Completion,
+ *  NDEF read/write and LLCP on a SyncEvent, HCE by assembling fragments
+ *  into a fixed buffer.  The NFA-facing translation units themselves need
+ *  libnfc-nci and a JVM, so the stack side is FakeNfa.
+ *
+ *  usage: nfc_nci_jni_benchmark [operations per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "Completion.h"
+#include "FakeNfa.h"
+#include "LatencyStats.h"
+#include "SyncEvent.h"
+
+
+typedef std::basic_string<uint8_t> Bytes;
+
+static const uint32_t NCI_FRAGMENT_LEN = 255; //largest NCI data packet payload
+static const uint32_t LLCP_MIU = 128; //default LLCP maximum information unit
+static const int LLCP_WINDOW = 2; //sends the peer accepts before it acks
+static const uint32_t MAX_APDU_LEN = 261; //as RoutingManager
+static const uint8_t sCommand [16] = {0};
+
+
+struct Response
+{
+    Bytes mData;
+
+    void swap (Response& other)
+    {
+        mData.swap (other.mData);
+    }
+};
+
+
+/*******************************************************************************
+**
+** Function:        monotonicMicros
+**
+** Description:     Read the monotonic clock.
+**
+** Returns:         Microseconds.
+**
+*******************************************************************************/
+static uint64_t monotonicMicros ()
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+/*****************************************************************************
+**
+**  Name:           DataPath
+**
+**  Description:    One data path: how an operation is issued, how its
+**                  callback is handled, and how the caller waits.
+**
+*****************************************************************************/
+class DataPath
+{
+public:
+    virtual ~DataPath () {}
+
+    // Label in the report
+    virtual const char* name () const = 0;
+
+    // Shape the fake stack's answer for a payload size
+    virtual FakeNfa::Config config (long latencyMicros, uint32_t payloadLen) const
+    {
+        FakeNfa::Config config = {latencyMicros, payloadLen, NCI_FRAGMENT_LEN};
+        return config;
+    }
+
+    // Run one operation
+    virtual void run (FakeNfa& nfa, const Bytes& payload, LatencyStats& stats) = 0;
+
+    // Wait for operations that returned before the stack answered them
+    virtual void drain () {}
+};
+
+
+/*
+ *  nativeNfcTag_doTransceive: fragments appended in the callback, one
+ *  wake-up on the final one.
+ */
+class TransceivePath : public DataPath
+{
+public:
+    const char* name () const { return "transceive"; }
+
+    void run (FakeNfa& nfa, const Bytes&, LatencyStats& stats)
+    {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        Response response;
+        int status = 0;
+        uint32_t id = mCompletion.begin (response);
+        nfa.request (sCommand, sizeof(sCommand), callback, this);
+        mCompletion.wait (id, -1, status, response);
+        stats.record (start, response.mData.size ());
+    }
+
+private:
+    Completion<Response> mCompletion;
+
+    static void callback (void* context, int status, const uint8_t* data, uint32_t dataLen)
+    {
+        TransceivePath& path = *(TransceivePath*) context;
+        Completion<Response>::Pending pending (path.mCompletion);
+        if (!pending.isActive ())
+            return;
+        pending.payload ().mData.append (data, dataLen);
+        if (status != FakeNfa::STATUS_CONTINUE)
+            pending.complete (status);
+    }
+};
+
+
+/*
+ *  nativeNfcTag_doRead: the whole message in one NFA_NDEF_DATA_EVT, copied
+ *  into a malloc'ed buffer, then into the array handed to Java.
+ */
+class NdefReadPath : public DataPath
+{
+public:
+    NdefReadPath () : mReadData (NULL), mReadDataLen (0), mDone (false) {}
+
+    const char* name () const { return "ndef read"; }
+
+    FakeNfa::Config config (long latencyMicros, uint32_t payloadLen) const
+    {
+        FakeNfa::Config config = {latencyMicros, payloadLen, payloadLen};
+        return config;
+    }
+
+    void run (FakeNfa& nfa, const Bytes&, LatencyStats& stats)
+    {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        std::vector<uint8_t> result;
+        {
+            SyncEventGuard g (mReadEvent);
+            mDone = false;
+            nfa.request (NULL, 0, callback, this);
+            while (!mDone)
+                mReadEvent.wait ();
+            result.assign (mReadData, mReadData + mReadDataLen);
+            free (mReadData);
+            mReadData = NULL;
+        }
+        stats.record (start, result.size ());
+    }
+
+private:
+    SyncEvent mReadEvent;
+    uint8_t* mReadData;
+    uint32_t mReadDataLen;
+    bool mDone;
+
+    static void callback (void* context, int, const uint8_t* data, uint32_t dataLen)
+    {
+        NdefReadPath& path = *(NdefReadPath*) context;
+        SyncEventGuard g (path.mReadEvent);
+        path.mReadDataLen = dataLen;
+        path.mReadData = (uint8_t*) malloc (dataLen);
+        memcpy (path.mReadData, data, dataLen);
+        path.mDone = true;
+        path.mReadEvent.notifyOne ();
+    }
+};
+
+
+/*
+ *  nativeNfcTag_doWrite, and any request answered by a bare status.
+ */
+class AckedPath : public DataPath
+{
+public:
+    AckedPath (const char* name) : mName (name), mDone (false) {}
+
+    const char* name () const { return mName; }
+
+    FakeNfa::Config config (long latencyMicros, uint32_t) const
+    {
+        FakeNfa::Config config = {latencyMicros, 0, NCI_FRAGMENT_LEN};
+        return config;
+    }
+
+    void run (FakeNfa& nfa, const Bytes& payload, LatencyStats& stats)
+    {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        {
+            SyncEventGuard g (mEvent);
+            mDone = false;
+            nfa.request (payload.data (), payload.size (), callback, this);
+            while (!mDone)
+                mEvent.wait ();
+        }
+        stats.record (start, payload.size ());
+    }
+
+private:
+    const char* mName;
+    SyncEvent mEvent;
+    bool mDone;
+
+    static void callback (void* context, int, const uint8_t*, uint32_t)
+    {
+        AckedPath& path = *(AckedPath*) context;
+        SyncEventGuard g (path.mEvent);
+        path.mDone = true;
+        path.mEvent.notifyOne ();
+    }
+};
+
+
+/*
+ *  PeerToPeer::send: a PDU is accepted at once unless the peer's receive
+ *  window is full, in which case the sender waits for congestion to clear.
+ */
+class LlcpSendPath : public DataPath
+{
+public:
+    LlcpSendPath () : mOutstanding (0) {}
+
+    const char* name () const { return "llcp send"; }
+
+    FakeNfa::Config config (long latencyMicros, uint32_t) const
+    {
+        FakeNfa::Config config = {latencyMicros, 0, LLCP_MIU};
+        return config;
+    }
+
+    void run (FakeNfa& nfa, const Bytes& payload, LatencyStats& stats)
+    {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (uint32_t offset = 0; offset < payload.size (); offset += LLCP_MIU)
+        {
+            uint32_t len = payload.size () - offset;
+            if (len > LLCP_MIU)
+                len = LLCP_MIU;
+            SyncEventGuard g (mCongEvent);
+            while (mOutstanding >= LLCP_WINDOW)
+                mCongEvent.wait ();
+            mOutstanding++;
+            nfa.request (payload.data () + offset, len, callback, this);
+        }
+        stats.record (start, payload.size ());
+    }
+
+    void drain ()
+    {
+        SyncEventGuard g (mCongEvent);
+        while (mOutstanding > 0)
+            mCongEvent.wait ();
+    }
+
+private:
+    SyncEvent mCongEvent;
+    int mOutstanding;
+
+    static void callback (void* context, int, const uint8_t*, uint32_t)
+    {
+        LlcpSendPath& path = *(LlcpSendPath*) context;
+        SyncEventGuard g (path.mCongEvent);
+        path.mOutstanding--;
+        path.mCongEvent.notifyOne ();
+    }
+};
+
+
+/*
+ *  PeerToPeer::receive: the stack buffers the peer's PDUs; the reader wakes
+ *  and copies them out as NFA_P2pReadData does.
+ */
+class LlcpReceivePath : public DataPath
+{
+public:
+    LlcpReceivePath () : mDone (false) {}
+
+    const char* name () const { return "llcp receive"; }
+
+    FakeNfa::Config config (long latencyMicros, uint32_t payloadLen) const
+    {
+        FakeNfa::Config config = {latencyMicros, payloadLen, LLCP_MIU};
+        return config;
+    }
+
+    void run (FakeNfa& nfa, const Bytes&, LatencyStats& stats)
+    {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        std::vector<uint8_t> result;
+        {
+            SyncEventGuard g (mReadEvent);
+            mDone = false;
+            mStackBuffer.clear ();
+            nfa.request (NULL, 0, callback, this);
+            while (!mDone)
+                mReadEvent.wait ();
+            result.assign (mStackBuffer.begin (), mStackBuffer.end ());
+        }
+        stats.record (start, result.size ());
+    }
+
+private:
+    SyncEvent mReadEvent;
+    Bytes mStackBuffer;
+    bool mDone;
+
+    static void callback (void* context, int status, const uint8_t* data, uint32_t dataLen)
+    {
+        LlcpReceivePath& path = *(LlcpReceivePath*) context;
+        SyncEventGuard g (path.mReadEvent);
+        path.mStackBuffer.append (data, dataLen);
+        if (status != FakeNfa::STATUS_CONTINUE)
+        {
+            path.mDone = true;
+            path.mReadEvent.notifyOne ();
+        }
+    }
+};
+
+
+/*
+ *  RoutingManager::handleData: NFA_CE_DATA_EVT fragments assembled into a
+ *  fixed buffer, then handed to Java in one call.
+ */
+class HceDataPath : public DataPath
+{
+public:
+    HceDataPath () : mRxDataLen (0), mDone (false) {}
+
+    const char* name () const { return "hce data"; }
+
+    void run (FakeNfa& nfa, const Bytes&, LatencyStats& stats)
+    {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        uint32_t len = 0;
+        {
+            SyncEventGuard g (mEvent);
+            mDone = false;
+            nfa.request (sCommand, sizeof(sCommand), callback, this);
+            while (!mDone)
+                mEvent.wait ();
+            len = mDelivered.size ();
+        }
+        stats.record (start, len);
+    }
+
+private:
+    uint8_t mRxDataBuffer [MAX_APDU_LEN];
+    uint32_t mRxDataLen;
+    std::vector<uint8_t> mDelivered;
+    SyncEvent mEvent;
+    bool mDone;
+
+    static void callback (void* context, int status, const uint8_t* data, uint32_t dataLen)
+    {
+        HceDataPath& path = *(HceDataPath*) context;
+        if (dataLen > MAX_APDU_LEN - path.mRxDataLen)
+            dataLen = MAX_APDU_LEN - path.mRxDataLen;
+        memcpy (path.mRxDataBuffer + path.mRxDataLen, data, dataLen);
+        path.mRxDataLen += dataLen;
+        if (status == FakeNfa::STATUS_CONTINUE)
+            return;
+
+        SyncEventGuard g (path.mEvent);
+        path.mDelivered.assign (path.mRxDataBuffer, path.mRxDataBuffer + path.mRxDataLen);
+        path.mRxDataLen = 0;
+        path.mDone = true;
+        path.mEvent.notifyOne ();
+    }
+};
+
+
+/*******************************************************************************
+**
+** Function:        runPath
+**
+** Description:     Run one path against one stack configuration and print its
+**                  latency percentiles and both throughputs.  Busy throughput
+**                  divides bytes by the summed operation latencies; wall
+**                  throughput divides them by the elapsed time of the run.
+**                  path: The data path.
+**                  latencyMicros: Stack latency per request.
+**                  payloadLen: Payload of each operation.
+**                  count: Number of operations.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+static void runPath (DataPath& path, long latencyMicros, uint32_t payloadLen, int count)
+{
+    FakeNfa nfa (path.config (latencyMicros, payloadLen));
+    LatencyStats stats (path.name ());
+    Bytes payload (payloadLen, 0x5A);
+
+    uint64_t begin = monotonicMicros ();
+    for (int i = 0; i < count; i++)
+        path.run (nfa, payload, stats);
+    path.drain ();
+    uint64_t elapsed = monotonicMicros () - begin;
+
+    std::string line;
+    stats.dump (line);
+    if (!line.empty () && line [line.size () - 1] == '\n')
+        line.erase (line.size () - 1);
+    unsigned long wall = elapsed ? (unsigned long) ((uint64_t) payloadLen * count * 1000000 / elapsed) : 0;
+    printf ("latency=%5ldus payload=%5u  %s; wall throughput=%lu B/s\n", latencyMicros, payloadLen, line.c_str (), wall);
+}
+
+
+int main (int argc, char** argv)
+{
+    static const long latencies [] = {0, 500, 2000};
+    static const uint32_t payloads [] = {16, 255, 1024};
+    int count = (argc > 1) ? atoi (argv [1]) : 200;
+    if (count <= 0)
+    {
+        fprintf (stderr, "usage: %s [operations per run]\n", argv [0]);
+        return 1;
+    }
+
+    TransceivePath transceive;
+    NdefReadPath ndefRead;
+    AckedPath ndefWrite ("ndef write");
+    LlcpSendPath llcpSend;
+    LlcpReceivePath llcpReceive;
+    HceDataPath hceData;
+    DataPath* paths [] = {&transceive, &ndefRead, &ndefWrite, &llcpSend, &llcpReceive, &hceData};
+
+    for (size_t p = 0; p < sizeof(paths) / sizeof(paths [0]); p++)
+    {
+        for (size_t l = 0; l < sizeof(latencies) / sizeof(latencies [0]); l++)
+        {
+            for (size_t s = 0; s < sizeof(payloads) / sizeof(payloads [0]); s++)
+            {
+                if ((paths [p] == &hceData) && (payloads [s] > MAX_APDU_LEN))
+                    continue;
+                runPath (*paths [p], latencies [l], payloads [s], count);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Stand-in for the NFA stack thread, for host benchmarks.
+ */
+
+#include "FakeNfa.h"
+#include <time.h>
+
+
+/*******************************************************************************
+**
+** Function:        FakeNfa
+**
+** Description:     Start the stack thread.
+**                  config: How requests are answered.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+FakeNfa::FakeNfa (const Config& config)
+:   mConfig (config),
+    mStopping (false)
+{
+    mResponse.resize (mConfig.mResponseLen);
+    for (uint32_t i = 0; i < mConfig.mResponseLen; i++)
+        mResponse [i] = (uint8_t) i;
+    if (mConfig.mFragmentLen == 0)
+        mConfig.mFragmentLen = 1;
+    pthread_create (&mThread, NULL, stackProc, this);
+}
+
+
+/*******************************************************************************
+**
+** Function:        ~FakeNfa
+**
+** Description:     Answer the queued requests, then stop the stack thread.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+FakeNfa::~FakeNfa ()
+{
+    {
+        AutoMutex mutex (mMutex);
+        mStopping = true;
+        mCondVar.notifyOne ();
+    }
+    pthread_join (mThread, NULL);
+}
+
+
+/*******************************************************************************
+**
+** Function:        request
+**
+** Description:     Queue a request.  The data is copied, as NFA copies a
+**                  frame into its own buffer before it returns.
+**                  data: Request data.
+**                  dataLen: Length of request data.
+**                  cb: Called on the stack thread with each fragment.
+**                  context: Passed to cb.
+**
+** Returns:         STATUS_OK.
+**
+*******************************************************************************/
+int FakeNfa::request (const uint8_t* data, uint32_t dataLen, DATA_CBACK cb, void* context)
+{
+    Request request;
+    request.mData.assign (data, dataLen);
+    request.mCb = cb;
+    request.mContext = context;
+
+    AutoMutex mutex (mMutex);
+    mRequests.push_back (request);
+    mCondVar.notifyOne ();
+    return STATUS_OK;
+}
+
+
+/*******************************************************************************
+**
+** Function:        stackProc
+**
+** Description:     Answer requests in order, like the single NFA task.
+**                  arg: FakeNfa object.
+**
+** Returns:         NULL.
+**
+*******************************************************************************/
+void* FakeNfa::stackProc (void* arg)
+{
+    FakeNfa& nfa = *(FakeNfa*) arg;
+    nfa.mMutex.lock ();
+    for (;;)
+    {
+        while (nfa.mRequests.empty () && !nfa.mStopping)
+            nfa.mCondVar.wait (nfa.mMutex);
+        if (nfa.mRequests.empty ())
+            break;
+        Request request = nfa.mRequests.front ();
+        nfa.mRequests.pop_front ();
+        nfa.mMutex.unlock ();
+        nfa.answer (request);
+        nfa.mMutex.lock ();
+    }
+    nfa.mMutex.unlock ();
+    return NULL;
+}
+
+
+/*******************************************************************************
+**
+** Function:        answer
+**
+** Description:     Wait out the latency, then hand the response to the
+**                  request's callback one fragment at a time.
+**                  request: The request.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void FakeNfa::answer (const Request& request)
+{
+    if (mConfig.mLatencyMicros > 0)
+    {
+        struct timespec delay;
+        delay.tv_sec = mConfig.mLatencyMicros / 1000000;
+        delay.tv_nsec = (mConfig.mLatencyMicros % 1000000) * 1000;
+        while (nanosleep (&delay, &delay) != 0)
+            ;
+    }
+
+    if (mResponse.empty ())
+    {
+        request.mCb (request.mContext, STATUS_OK, NULL, 0);
+        return;
+    }
+
+    for (uint32_t offset = 0; offset < mResponse.size (); offset += mConfig.mFragmentLen)
+    {
+        uint32_t len = mResponse.size () - offset;
+        int status = STATUS_OK;
+        if (len > mConfig.mFragmentLen)
+        {
+            len = mConfig.mFragmentLen;
+            status = STATUS_CONTINUE;
+        }
+        request.mCb (request.mContext, status, mResponse.data () + offset, len);
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Stand-in for the NFA stack thread, for host benchmarks.  Requests are
+ *  answered from one thread after a configurable latency, with the response
+ *  split into fragments the way NFA_DATA_EVT and NFA_CE_DATA_EVT arrive.
+ */
+
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include "CondVar.h"
+#include "Mutex.h"
+
+
+class FakeNfa
+{
+public:
+    enum
+    {
+        STATUS_OK = 0,
+        STATUS_FAILED,
+        STATUS_CONTINUE //more fragments of the same response follow
+    };
+
+    typedef void (*DATA_CBACK) (void* context, int status, const uint8_t* data, uint32_t dataLen);
+
+    struct Config
+    {
+        long mLatencyMicros; //from request to the first fragment
+        uint32_t mResponseLen; //0 answers with a bare status, like a write or send ack
+        uint32_t mFragmentLen; //largest fragment handed to the callback
+    };
+
+
+    /*******************************************************************************
+    **
+    ** Function:        FakeNfa
+    **
+    ** Description:     Start the stack thread.
+    **                  config: How requests are answered.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    FakeNfa (const Config& config);
+
+
+    /*******************************************************************************
+    **
+    ** Function:        ~FakeNfa
+    **
+    ** Description:     Answer the queued requests, then stop the stack thread.
+    **
+    ** Returns:         None.
+    **
+    *******************************************************************************/
+    ~FakeNfa ();
+
+
+    /*******************************************************************************
+    **
+    ** Function:        request
+    **
+    ** Description:     Queue a request.  The data is copied, as NFA copies a
+    **                  frame into its own buffer before it returns.
+    **                  data: Request data.
+    **                  dataLen: Length of request data.
+    **                  cb: Called on the stack thread with each fragment.
+    **                  context: Passed to cb.
+    **
+    ** Returns:         STATUS_OK.
+    **
+    *******************************************************************************/
+    int request (const uint8_t* data, uint32_t dataLen, DATA_CBACK cb, void* context);
+
+private:
+    struct Request
+    {
+        std::basic_string<uint8_t> mData;
+        DATA_CBACK mCb;
+        void* mContext;
+    };
+
+    Config mConfig;
+    Mutex mMutex;
+    CondVar mCondVar;
+    std::deque<Request> mRequests;
+    std::basic_string<uint8_t> mResponse;
+    bool mStopping;
+    pthread_t mThread;
+
+    static void* stackProc (void* arg);
+    void answer (const Request& request);
+};
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host tests for cancelling interval timers and for the timer wheel's
+ *  worker thread.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "IntervalTimer.h"
+#include "SyncEvent.h"
+
+static volatile bool sStarted;
+static volatile bool sFinished;
+static volatile int sFired;
+
+
+static void slowCallback (union sigval)
+{
+    sStarted = true;
+    usleep (100 * 1000);
+    sFinished = true;
+}
+
+
+static void countCallback (union sigval)
+{
+    sFired++;
+}
+
+
+/* A callback that kills its own timer must not wait for itself */
+static IntervalTimer sSelfKillTimer;
+static void selfKillCallback (union sigval)
+{
+    sSelfKillTimer.kill ();
+    sFinished = true;
+}
+
+
+static bool waitFor (volatile bool& flag, int ms)
+{
+    for (int i = 0; (i < ms) && !flag; i++)
+        usleep (1000);
+    return flag;
+}
+
+
+TEST(TimerWheelTest, KillWaitsForRunningCallback)
+{
+    sStarted = sFinished = false;
+    IntervalTimer timer;
+    ASSERT_TRUE (timer.set (1, slowCallback));
+    ASSERT_TRUE (waitFor (sStarted, 1000));
+    timer.kill ();
+    EXPECT_TRUE (sFinished);
+}
+
+
+TEST(TimerWheelTest, DestroyWaitsForRunningCallback)
+{
+    sStarted = sFinished = false;
+    {
+        IntervalTimer timer;
+        ASSERT_TRUE (timer.set (1, slowCallback));
+        ASSERT_TRUE (waitFor (sStarted, 1000));
+    }
+    EXPECT_TRUE (sFinished);
+}
+
+
+TEST(TimerWheelTest, KillFromOwnCallback)
+{
+    sFinished = false;
+    ASSERT_TRUE (sSelfKillTimer.set (1, selfKillCallback));
+    EXPECT_TRUE (waitFor (sFinished, 1000));
+}
+
+
+TEST(TimerWheelTest, KilledTimerDoesNotFire)
+{
+    sFired = 0;
+    IntervalTimer timer;
+    ASSERT_TRUE (timer.set (50, countCallback));
+    timer.kill ();
+    usleep (150 * 1000);
+    EXPECT_EQ (0, sFired);
+}
+
+
+TEST(TimerWheelTest, TimersSurviveNeighbourDestruction)
+{
+    sFired = 0;
+    IntervalTimer survivor;
+    ASSERT_TRUE (survivor.set (20, countCallback));
+    for (int i = 0; i < 50; i++)
+    {
+        IntervalTimer doomed;
+        doomed.set (20, countCallback);
+    }
+    usleep (150 * 1000);
+    EXPECT_EQ (1, sFired);
+}
+
+
+static SyncEvent sWorkEvent;
+static std::string sWorkOrder;
+
+
+static void orderWork (void* arg)
+{
+    SyncEventGuard g (sWorkEvent);
+    sWorkOrder += *static_cast<const char*> (arg);
+    sWorkEvent.notifyOne ();
+}
+
+
+static void blockingWork (void*)
+{
+    usleep (50 * 1000);
+}
+
+
+TEST(TimerWheelTest, PostRunsInOrder)
+{
+    static const char work [] = "abcd";
+    sWorkOrder.clear ();
+    SyncEventGuard g (sWorkEvent);
+    ASSERT_TRUE (TimerWheel::getInstance ().post (blockingWork, NULL));
+    for (int i = 0; i < 4; i++)
+        ASSERT_TRUE (TimerWheel::getInstance ().post (orderWork, (void*) &work [i]));
+    while (sWorkOrder.size () < 4)
+        ASSERT_TRUE (sWorkEvent.wait (1000));
+    EXPECT_EQ ("abcd", sWorkOrder);
+}
+
+
+/* Blocking work on the worker does not delay timer callbacks */
+TEST(TimerWheelTest, BlockedWorkerDoesNotStallTimers)
+{
+    sFired = 0;
+    ASSERT_TRUE (TimerWheel::getInstance ().post (blockingWork, NULL));
+    IntervalTimer timer;
+    ASSERT_TRUE (timer.set (1, countCallback));
+    usleep (25 * 1000);
+    EXPECT_EQ (1, sFired);
+}
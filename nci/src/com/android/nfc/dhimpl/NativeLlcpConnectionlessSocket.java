@@ -37,6 +37,8 @@ public class NativeLlcpConnectionlessSocket implements DeviceHost.LlcpConnection
 
     public native LlcpPacket doReceiveFrom(int linkMiu);
 
+    public native LlcpPacket[] doReceiveFromBatch(int linkMiu, int maxPackets);
+
     public native boolean doClose();
 
     @Override
@@ -65,6 +67,15 @@ public class NativeLlcpConnectionlessSocket implements DeviceHost.LlcpConnection
         return packet;
     }
 
+    @Override
+    public LlcpPacket[] receiveBatch(int maxPackets) throws IOException {
+        LlcpPacket[] packets = doReceiveFromBatch(mLinkMiu, maxPackets);
+        if (packets == null) {
+            throw new IOException();
+        }
+        return packets;
+    }
+
     public int getHandle(){
         return mHandle;
     }
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.android.nfc.dhimpl;
+
+import com.android.nfc.DeviceHost.LlcpReceiveDispatcher;
+import com.android.nfc.DeviceHost.LlcpSocket;
+
+import android.util.Log;
+import android.util.SparseArray;
+
+import java.io.IOException;
+
+/**
+ * Receives on every watched LLCP socket from one thread, using
+ * {@link NativeNfcManager#waitForLlcpData} and
+ * {@link NativeLlcpSocket#receiveNonBlocking}. The thread runs only while
+ * at least one socket is watched.
+ */
+class NativeLlcpReceiveDispatcher implements LlcpReceiveDispatcher {
+    private static final String TAG = "NativeLlcpReceiveDispatcher";
+    private static final boolean DBG = false;
+
+    /** Largest information field LLCP allows: 128 plus an MIUX of 0x7FF */
+    private static final int MAX_MIU = 2175;
+    private static final int MAX_READY = 16;
+    /** Sockets are also polled this often, in case a close was never signalled */
+    private static final int WAIT_TIMEOUT_MS = 1000;
+
+    final NativeNfcManager mManager;
+
+    /** Guards mWatches and mThread */
+    final Object mLock = new Object();
+    /** Watched sockets by native handle */
+    final SparseArray<Watch> mWatches = new SparseArray<Watch>();
+    /** Null while no socket is watched */
+    DispatchThread mThread;
+
+    static class Watch {
+        final NativeLlcpSocket mSocket;
+        final Callback mCallback;
+
+        Watch(NativeLlcpSocket socket, Callback callback) {
+            mSocket = socket;
+            mCallback = callback;
+        }
+    }
+
+    NativeLlcpReceiveDispatcher(NativeNfcManager manager) {
+        mManager = manager;
+    }
+
+    @Override
+    public boolean watch(LlcpSocket socket, Callback callback) {
+        if (!(socket instanceof NativeLlcpSocket)) {
+            return false;
+        }
+        NativeLlcpSocket nativeSocket = (NativeLlcpSocket) socket;
+        synchronized (mLock) {
+            if (!nativeSocket.watchReadable()) {
+                return false;
+            }
+            mWatches.put(nativeSocket.getHandle(), new Watch(nativeSocket, callback));
+            if (mThread == null) {
+                mThread = new DispatchThread();
+                mThread.start();
+            }
+        }
+        return true;
+    }
+
+    class DispatchThread extends Thread {
+        final int[] mReady = new int[MAX_READY];
+        final byte[] mBuffer = new byte[MAX_MIU];
+
+        DispatchThread() {
+            super(TAG);
+        }
+
+        @Override
+        public void run() {
+            if (DBG) Log.d(TAG, "starting dispatch thread");
+            while (true) {
+                synchronized (mLock) {
+                    if (mWatches.size() == 0) {
+                        mThread = null;
+                        break;
+                    }
+                }
+
+                int count;
+                try {
+                    count = mManager.waitForLlcpData(mReady, WAIT_TIMEOUT_MS);
+                } catch (IOException e) {
+                    Log.e(TAG, "waiting for LLCP data failed; closing all watches");
+                    closeAll();
+                    continue;
+                }
+
+                if (count == 0) {
+                    drainAll();
+                }
+                for (int i = 0; i < count; i++) {
+                    Watch watch;
+                    synchronized (mLock) {
+                        watch = mWatches.get(mReady[i]);
+                    }
+                    if (watch != null) {
+                        drain(watch);
+                    }
+                }
+            }
+            if (DBG) Log.d(TAG, "finished dispatch thread");
+        }
+
+        /** Delivers everything queued on the socket, and its close */
+        void drain(Watch watch) {
+            try {
+                int size;
+                while ((size = watch.mSocket.receiveNonBlocking(mBuffer)) > 0) {
+                    watch.mCallback.onDataReceived(watch.mSocket, mBuffer, size);
+                }
+                return;
+            } catch (IOException e) {
+                if (DBG) Log.d(TAG, "socket " + watch.mSocket.getHandle() + " closed");
+            }
+            synchronized (mLock) {
+                mWatches.remove(watch.mSocket.getHandle());
+            }
+            watch.mCallback.onClosed(watch.mSocket);
+        }
+
+        void drainAll() {
+            Watch[] watches;
+            synchronized (mLock) {
+                watches = new Watch[mWatches.size()];
+                for (int i = 0; i < watches.length; i++) {
+                    watches[i] = mWatches.valueAt(i);
+                }
+            }
+            for (Watch watch : watches) {
+                drain(watch);
+            }
+        }
+
+        void closeAll() {
+            Watch[] watches;
+            synchronized (mLock) {
+                watches = new Watch[mWatches.size()];
+                for (int i = 0; i < watches.length; i++) {
+                    watches[i] = mWatches.valueAt(i);
+                }
+                mWatches.clear();
+            }
+            for (Watch watch : watches) {
+                watch.mCallback.onClosed(watch.mSocket);
+            }
+        }
+    }
+}
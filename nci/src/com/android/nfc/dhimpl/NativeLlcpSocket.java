@@ -64,6 +64,16 @@ public class NativeLlcpSocket implements DeviceHost.LlcpSocket {
         }
     }
 
+    private native boolean doSendSegmented(byte[] data, int offset, int length,
+            int segmentSize);
+    @Override
+    public void sendSegmented(byte[] data, int offset, int length, int segmentSize)
+            throws IOException {
+        if (!doSendSegmented(data, offset, length, segmentSize)) {
+            throw new IOException();
+        }
+    }
+
     private native int doReceive(byte[] recvBuff);
     @Override
     public int receive(byte[] recvBuff) throws IOException {
@@ -74,6 +84,32 @@ public class NativeLlcpSocket implements DeviceHost.LlcpSocket {
         return receiveLength;
     }
 
+    private native boolean doWatchReadable();
+    /**
+     * Makes {@link NativeNfcManager#waitForLlcpData} report this socket from now
+     * on, until {@link #receiveNonBlocking} reports it closed.
+     */
+    public boolean watchReadable() {
+        return doWatchReadable();
+    }
+
+    private native int doReceiveNonBlocking(byte[] recvBuff);
+    /**
+     * Like {@link #receive}, but returns 0 instead of waiting when no data is
+     * queued. See {@link NativeNfcManager#waitForLlcpData}.
+     */
+    public int receiveNonBlocking(byte[] recvBuff) throws IOException {
+        int receiveLength = doReceiveNonBlocking(recvBuff);
+        if (receiveLength == -1) {
+            throw new IOException();
+        }
+        return receiveLength;
+    }
+
+    public int getHandle() {
+        return mHandle;
+    }
+
     private native int doGetRemoteSocketMiu();
     @Override
     public int getRemoteMiu() { return doGetRemoteSocketMiu(); }
@@ -26,6 +26,9 @@ import com.android.nfc.DeviceHost;
 import com.android.nfc.LlcpException;
 import com.android.nfc.NfcDiscoveryParameters;
 
+import java.io.IOException;
+import java.nio.ByteBuffer;
+
 /**
  * Native interface to the NFC Manager functions
  */
@@ -48,6 +51,8 @@ public class NativeNfcManager implements DeviceHost {
 
     private final DeviceHostListener mListener;
     private final Context mContext;
+    private final NativeLlcpReceiveDispatcher mLlcpReceiveDispatcher =
+            new NativeLlcpReceiveDispatcher(this);
 
 
     public NativeNfcManager(Context context, DeviceHostListener listener) {
@@ -102,11 +107,13 @@ public class NativeNfcManager implements DeviceHost {
                                           boolean enableLowPowerPolling,
                                           boolean enableReaderMode,
                                           boolean enableHostRouting,
+                                          boolean skipNdefCheck,
                                           boolean restart);
     @Override
     public void enableDiscovery(NfcDiscoveryParameters params, boolean restart) {
         doEnableDiscovery(params.getTechMask(), params.shouldEnableLowPowerDiscovery(),
-                params.shouldEnableReaderMode(), params.shouldEnableHostRouting(), restart);
+                params.shouldEnableReaderMode(), params.shouldEnableHostRouting(),
+                params.shouldSkipNdefCheck(), restart);
     }
 
     @Override
@@ -191,6 +198,32 @@ public class NativeNfcManager implements DeviceHost {
     @Override
     public native boolean doActivateLlcp();
 
+    private native int doWaitForLlcpData(int[] readyHandles, int timeoutMs);
+
+    /**
+     * Blocks until one or more LLCP connection-oriented sockets passed to
+     * {@link NativeLlcpSocket#watchReadable} are readable, that is, have data
+     * queued or were closed by the peer. Lets one thread service many sockets
+     * through {@link NativeLlcpSocket#receiveNonBlocking}.
+     *
+     * @param readyHandles receives {@link NativeLlcpSocket#getHandle} of each
+     *        readable socket
+     * @param timeoutMs max time to wait; -1 waits forever, 0 only polls
+     * @return number of entries written to readyHandles; 0 on timeout
+     */
+    public int waitForLlcpData(int[] readyHandles, int timeoutMs) throws IOException {
+        int count = doWaitForLlcpData(readyHandles, timeoutMs);
+        if (count < 0) {
+            throw new IOException();
+        }
+        return count;
+    }
+
+    @Override
+    public LlcpReceiveDispatcher getLlcpReceiveDispatcher() {
+        return mLlcpReceiveDispatcher;
+    }
+
     private native void doResetTimeouts();
 
     @Override
@@ -329,7 +362,18 @@ public class NativeNfcManager implements DeviceHost {
     }
 
     private void notifyHostEmuData(byte[] data) {
-        mListener.onHostCardEmulationData(data);
+        mListener.onHostCardEmulationData(ByteBuffer.wrap(data), DeviceHost.AID_TOKEN_UNRESOLVED);
+    }
+
+    /**
+     * Notifies a command APDU held in the native assembly buffer. The buffer is
+     * handed to the listener as is and reused for the next APDU once this returns.
+     * aidToken identifies the host AID table entry a SELECT matched, if any.
+     */
+    private void notifyHostEmuDataDirect(ByteBuffer apdu, int length, int aidToken) {
+        apdu.clear();
+        apdu.limit(length);
+        mListener.onHostCardEmulationData(apdu, aidToken);
     }
 
     private void notifyHostEmuDeactivated() {
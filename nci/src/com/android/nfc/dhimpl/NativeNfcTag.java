@@ -35,6 +35,8 @@ import android.nfc.tech.TagTechnology;
 import android.os.Bundle;
 import android.util.Log;
 
+import java.nio.ByteBuffer;
+
 /**
  * Native interface to the NFC tag functions
  */
@@ -51,6 +53,18 @@ public class NativeNfcTag implements TagEndpoint {
     private byte[][] mTechActBytes;
     private byte[] mUid;
 
+    // Activation data packed by native code when the tag is created;
+    // unpacked into the fields above on first use.
+    private static final int ACTIVATION_DESCRIPTOR_VERSION = 1;
+    private byte[] mActivationDescriptor;
+
+    // NDEF check and read done by native code before the tag was delivered;
+    // used once by findAndReadNdef() instead of checking and reading again.
+    private boolean mHasEagerNdef;
+    private int mEagerNdefStatus;
+    private int[] mEagerNdefInfo;
+    private byte[] mEagerNdefMessage; // null if the message could not be read
+
     // mConnectedHandle stores the *real* libnfc handle
     // that we're connected to.
     private int mConnectedHandle;
@@ -69,6 +83,13 @@ public class NativeNfcTag implements TagEndpoint {
 
     private boolean mIsPresent; // Whether the tag is known to be still present
 
+    // Presence checking may grow to this many times the requested delay
+    // while the tag stays in the field.
+    static final int PRESENCE_WATCH_MAX_BACKOFF = 4;
+
+    private boolean mPresenceWatchActive; // Whether native code watches presence
+    private DeviceHost.TagDisconnectedCallback mPresenceWatchCallback;
+
     private PresenceCheckWatchdog mWatchdog;
     class PresenceCheckWatchdog extends Thread {
 
@@ -148,6 +169,7 @@ public class NativeNfcTag implements TagEndpoint {
 
     private native int doConnect(int handle);
     public synchronized int connectWithStatus(int technology) {
+        decodeActivationDescriptor();
         if (mWatchdog != null) {
             mWatchdog.pause();
         }
@@ -234,12 +256,45 @@ public class NativeNfcTag implements TagEndpoint {
         // Once we start presence checking, we allow the upper layers
         // to know the tag is in the field.
         mIsPresent = true;
+        if (mPresenceWatchActive) {
+            return;
+        }
+        // Prefer the native watcher, which needs no thread while the tag is present
         if (mWatchdog == null) {
+            mPresenceWatchCallback = callback;
+            mPresenceWatchActive = doStartPresenceWatch(presenceCheckDelay,
+                    presenceCheckDelay * PRESENCE_WATCH_MAX_BACKOFF);
+            if (mPresenceWatchActive) {
+                return;
+            }
+            mPresenceWatchCallback = null;
             mWatchdog = new PresenceCheckWatchdog(presenceCheckDelay, callback);
             mWatchdog.start();
         }
     }
 
+    private native boolean doStartPresenceWatch(int minIntervalMs, int maxIntervalMs);
+    private native void doStopPresenceWatch();
+
+    // Called from native code when the presence watcher finds the tag gone.
+    private void notifyTagLost() {
+        DeviceHost.TagDisconnectedCallback callback;
+        synchronized (this) {
+            if (!mPresenceWatchActive) {
+                return;
+            }
+            mPresenceWatchActive = false;
+            mIsPresent = false;
+            callback = mPresenceWatchCallback;
+            mPresenceWatchCallback = null;
+        }
+        Log.d(TAG, "Tag lost, restarting polling loop");
+        doDisconnect();
+        if (callback != null) {
+            callback.onTagDisconnected(mConnectedHandle);
+        }
+    }
+
     @Override
     public synchronized boolean isPresent() {
         // Returns whether the tag is still in the field to the best
@@ -252,7 +307,12 @@ public class NativeNfcTag implements TagEndpoint {
         boolean result = false;
 
         mIsPresent = false;
-        if (mWatchdog != null) {
+        if (mPresenceWatchActive) {
+            doStopPresenceWatch();
+            mPresenceWatchActive = false;
+            mPresenceWatchCallback = null;
+            result = doDisconnect();
+        } else if (mWatchdog != null) {
             // Watchdog has already disconnected or will do it
             mWatchdog.end();
             try {
@@ -312,6 +372,66 @@ public class NativeNfcTag implements TagEndpoint {
         return result;
     }
 
+    /**
+     * Unpacks the activation descriptor built by NfcTag::createNativeNfcTag:
+     * version, tech count, then per tech (tech, handle, libnfc type) as
+     * big-endian ints, the length-prefixed poll bytes of each tech, the
+     * length-prefixed activation bytes of each tech, the length-prefixed
+     * UID and a flag byte; when the flag is set, the NDEF check status, max
+     * size, mode and message length follow as ints, then the message.
+     * Does nothing once decoded.
+     */
+    private synchronized void decodeActivationDescriptor() {
+        if (mActivationDescriptor == null) return;
+        ByteBuffer buffer = ByteBuffer.wrap(mActivationDescriptor);
+        mActivationDescriptor = null;
+        int version = buffer.get() & 0xff;
+        if (version != ACTIVATION_DESCRIPTOR_VERSION) {
+            Log.e(TAG, "Unknown activation descriptor version " + version);
+            mTechList = new int[0];
+            mTechHandles = new int[0];
+            mTechLibNfcTypes = new int[0];
+            mTechPollBytes = new byte[0][];
+            mTechActBytes = new byte[0][];
+            mUid = new byte[0];
+            return;
+        }
+        int numTech = buffer.get() & 0xff;
+        mTechList = new int[numTech];
+        mTechHandles = new int[numTech];
+        mTechLibNfcTypes = new int[numTech];
+        for (int i = 0; i < numTech; i++) {
+            mTechList[i] = buffer.getInt();
+            mTechHandles[i] = buffer.getInt();
+            mTechLibNfcTypes[i] = buffer.getInt();
+        }
+        mTechPollBytes = new byte[numTech][];
+        for (int i = 0; i < numTech; i++) {
+            mTechPollBytes[i] = readLengthPrefixed(buffer);
+        }
+        mTechActBytes = new byte[numTech][];
+        for (int i = 0; i < numTech; i++) {
+            mTechActBytes[i] = readLengthPrefixed(buffer);
+        }
+        mUid = readLengthPrefixed(buffer);
+        if (buffer.hasRemaining() && buffer.get() != 0) {
+            mHasEagerNdef = true;
+            mEagerNdefStatus = buffer.getInt();
+            mEagerNdefInfo = new int[] { buffer.getInt(), buffer.getInt() };
+            int length = buffer.getInt();
+            if (length >= 0) {
+                mEagerNdefMessage = new byte[length];
+                buffer.get(mEagerNdefMessage);
+            }
+        }
+    }
+
+    private static byte[] readLengthPrefixed(ByteBuffer buffer) {
+        byte[] bytes = new byte[buffer.get() & 0xff];
+        buffer.get(bytes);
+        return bytes;
+    }
+
     private native int doCheckNdef(int[] ndefinfo);
     private synchronized int checkNdefWithStatus(int[] ndefinfo) {
         if (mWatchdog != null) {
@@ -402,6 +522,7 @@ public class NativeNfcTag implements TagEndpoint {
     native boolean doIsIsoDepNdefFormatable(byte[] poll, byte[] act);
     @Override
     public synchronized boolean isNdefFormatable() {
+        decodeActivationDescriptor();
         // Let native code decide whether the currently activated tag
         // is formatable.  Although the name of the JNI function refers
         // to ISO-DEP, the JNI function checks all tag types.
@@ -413,6 +534,7 @@ public class NativeNfcTag implements TagEndpoint {
     public int getHandle() {
         // This is just a handle for the clients; it can simply use the first
         // technology handle we have.
+        decodeActivationDescriptor();
         if (mTechHandles.length > 0) {
             return mTechHandles[0];
         } else {
@@ -422,11 +544,13 @@ public class NativeNfcTag implements TagEndpoint {
 
     @Override
     public byte[] getUid() {
+        decodeActivationDescriptor();
         return mUid;
     }
 
     @Override
     public int[] getTechList() {
+        decodeActivationDescriptor();
         return mTechList;
     }
 
@@ -435,6 +559,7 @@ public class NativeNfcTag implements TagEndpoint {
     }
 
     private int getConnectedLibNfcType() {
+        decodeActivationDescriptor();
         if (mConnectedTechIndex != -1 && mConnectedTechIndex < mTechLibNfcTypes.length) {
             return mTechLibNfcTypes[mConnectedTechIndex];
         } else {
@@ -444,6 +569,7 @@ public class NativeNfcTag implements TagEndpoint {
 
     @Override
     public int getConnectedTechnology() {
+        decodeActivationDescriptor();
         if (mConnectedTechIndex != -1 && mConnectedTechIndex < mTechList.length) {
             return mTechList[mConnectedTechIndex];
         } else {
@@ -456,6 +582,7 @@ public class NativeNfcTag implements TagEndpoint {
     }
 
     private void addTechnology(int tech, int handle, int libnfctype) {
+            decodeActivationDescriptor();
             int[] mNewTechList = new int[mTechList.length + 1];
             System.arraycopy(mTechList, 0, mNewTechList, 0, mTechList.length);
             mNewTechList[mTechList.length] = tech;
@@ -553,6 +680,7 @@ public class NativeNfcTag implements TagEndpoint {
     }
 
     private int getTechIndex(int tech) {
+      decodeActivationDescriptor();
       int techIndex = -1;
       for (int i = 0; i < mTechList.length; i++) {
           if (mTechList[i] == tech) {
@@ -564,6 +692,7 @@ public class NativeNfcTag implements TagEndpoint {
     }
 
     private boolean hasTech(int tech) {
+      decodeActivationDescriptor();
       boolean hasTech = false;
       for (int i = 0; i < mTechList.length; i++) {
           if (mTechList[i] == tech) {
@@ -575,6 +704,7 @@ public class NativeNfcTag implements TagEndpoint {
     }
 
     private boolean hasTechOnHandle(int tech, int handle) {
+      decodeActivationDescriptor();
       boolean hasTech = false;
       for (int i = 0; i < mTechList.length; i++) {
           if (mTechList[i] == tech && mTechHandles[i] == handle) {
@@ -643,6 +773,7 @@ public class NativeNfcTag implements TagEndpoint {
     public Bundle[] getTechExtras() {
         synchronized (this) {
             if (mTechExtras != null) return mTechExtras;
+            decodeActivationDescriptor();
             mTechExtras = new Bundle[mTechList.length];
             for (int i = 0; i < mTechList.length; i++) {
                 Bundle extras = new Bundle();
@@ -759,6 +890,8 @@ public class NativeNfcTag implements TagEndpoint {
                 }
                 continue;  // try next handle
             }
+            // The tag was already checked and read on activation
+            boolean useEagerNdef = (techIndex == 0 && mHasEagerNdef);
             // Check if this type is NDEF formatable
             if (!foundFormattable) {
                 if (isNdefFormatable()) {
@@ -769,11 +902,23 @@ public class NativeNfcTag implements TagEndpoint {
                     // found - this is because libNFC refuses to format
                     // an already NDEF formatted tag.
                 }
-                reconnect();
+                if (!useEagerNdef) {
+                    reconnect();
+                }
             }
 
             int[] ndefinfo = new int[2];
-            status = checkNdefWithStatus(ndefinfo);
+            byte[] buff;
+            if (useEagerNdef) {
+                mHasEagerNdef = false;
+                status = mEagerNdefStatus;
+                ndefinfo = mEagerNdefInfo;
+                buff = mEagerNdefMessage;
+                mEagerNdefMessage = null;
+            } else {
+                status = checkNdefWithStatus(ndefinfo);
+                buff = null;
+            }
             if (status != 0) {
                 Log.d(TAG, "Check NDEF Failed - status = " + status);
                 if (status == STATUS_CODE_TARGET_LOST) {
@@ -787,7 +932,9 @@ public class NativeNfcTag implements TagEndpoint {
 
             int supportedNdefLength = ndefinfo[0];
             int cardState = ndefinfo[1];
-            byte[] buff = readNdef();
+            if (buff == null) {
+                buff = readNdef();
+            }
             if (buff != null) {
                 try {
                     ndefMsg = new NdefMessage(buff);
@@ -12,6 +12,7 @@ LOCAL_SRC_FILES:= \
     com_android_nfc_NativeNfcTag.cpp \
     com_android_nfc_NativeP2pDevice.cpp \
     com_android_nfc_list.cpp \
+    com_android_nfc_crc.cpp \
     com_android_nfc.cpp
 
 LOCAL_C_INCLUDES += \
@@ -34,3 +35,5 @@ LOCAL_MODULE := libnfc_jni
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
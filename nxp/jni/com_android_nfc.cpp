@@ -21,6 +21,7 @@
 #include "com_android_nfc_list.h"
 #include "phLibNfcStatus.h"
 #include <ScopedLocalRef.h>
+#include <cutils/atomic.h>
 
 /*
  * JNI Initialization
@@ -37,6 +38,8 @@ jint JNI_OnLoad(JavaVM *jvm, void* /*reserved*/)
 
    android::vm = jvm;
 
+   if (android::nfc_jni_cache_ids(e) == -1)
+      return JNI_ERR;
    if (android::register_com_android_nfc_NativeNfcManager(e) == -1)
       return JNI_ERR;
    if (android::register_com_android_nfc_NativeNfcTag(e) == -1)
@@ -58,6 +61,7 @@ namespace android {
 extern struct nfc_jni_native_data *exported_nat;
 
 JavaVM *vm;
+nfc_jni_ids_t nfc_jni_ids;
 
 /*
  * JNI Utils
@@ -150,12 +154,97 @@ int nfc_jni_cache_object(JNIEnv *e, const char *clsname,
 }
 
 
+static jclass nfc_jni_cache_class(JNIEnv *e, const char *clsname)
+{
+   ScopedLocalRef<jclass> cls(e, e->FindClass(clsname));
+   if (cls.get() == NULL) {
+      ALOGE("Find class %s error", clsname);
+      return NULL;
+   }
+   return (jclass) e->NewGlobalRef(cls.get());
+}
+
+static jfieldID nfc_jni_cache_field(JNIEnv *e, jclass cls, const char *name, const char *sig)
+{
+   jfieldID f = e->GetFieldID(cls, name, sig);
+   if (f == NULL) {
+      ALOGE("Get field %s error", name);
+   }
+   return f;
+}
+
+/*
+ * Resolve the classes and field IDs used by the helpers below. Called once
+ * from JNI_OnLoad; the IDs stay valid as long as the classes are loaded, which
+ * the global class references guarantee.
+ */
+int nfc_jni_cache_ids(JNIEnv *e)
+{
+   nfc_jni_ids_t *ids = &nfc_jni_ids;
+
+   memset(ids, 0, sizeof(*ids));
+
+   ScopedLocalRef<jclass> manager(e, e->FindClass("com/android/nfc/dhimpl/NativeNfcManager"));
+   ScopedLocalRef<jclass> tag(e, e->FindClass("com/android/nfc/dhimpl/NativeNfcTag"));
+   if (manager.get() == NULL || tag.get() == NULL) {
+      ALOGE("Find class error");
+      return -1;
+   }
+
+   ids->p2pDeviceClass = nfc_jni_cache_class(e, "com/android/nfc/dhimpl/NativeP2pDevice");
+   ids->llcpSocketClass = nfc_jni_cache_class(e, "com/android/nfc/dhimpl/NativeLlcpSocket");
+   ids->llcpServiceSocketClass = nfc_jni_cache_class(e, "com/android/nfc/dhimpl/NativeLlcpServiceSocket");
+   ids->llcpConnectionlessSocketClass =
+         nfc_jni_cache_class(e, "com/android/nfc/dhimpl/NativeLlcpConnectionlessSocket");
+   if (ids->p2pDeviceClass == NULL || ids->llcpSocketClass == NULL ||
+         ids->llcpServiceSocketClass == NULL || ids->llcpConnectionlessSocketClass == NULL) {
+      return -1;
+   }
+
+   ids->managerNative = nfc_jni_cache_field(e, manager.get(), "mNative", "J");
+   ids->tagConnectedTechIndex = nfc_jni_cache_field(e, tag.get(), "mConnectedTechIndex", "I");
+   ids->tagConnectedHandle = nfc_jni_cache_field(e, tag.get(), "mConnectedHandle", "I");
+   ids->tagTechList = nfc_jni_cache_field(e, tag.get(), "mTechList", "[I");
+   ids->tagTechLibNfcTypes = nfc_jni_cache_field(e, tag.get(), "mTechLibNfcTypes", "[I");
+   ids->p2pDeviceHandle = nfc_jni_cache_field(e, ids->p2pDeviceClass, "mHandle", "I");
+   ids->p2pDeviceMode = nfc_jni_cache_field(e, ids->p2pDeviceClass, "mMode", "I");
+   ids->llcpSocketHandle = nfc_jni_cache_field(e, ids->llcpSocketClass, "mHandle", "I");
+   ids->llcpServiceSocketHandle = nfc_jni_cache_field(e, ids->llcpServiceSocketClass, "mHandle", "I");
+   ids->llcpConnectionlessSocketHandle =
+         nfc_jni_cache_field(e, ids->llcpConnectionlessSocketClass, "mHandle", "I");
+
+   if (e->ExceptionCheck()) {
+      e->ExceptionClear();
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Several Java classes keep their libnfc handle in an int field named
+ * "mHandle"; pick the cached ID that matches the object's class.
+ */
+static jfieldID nfc_jni_get_handle_field(JNIEnv *e, jobject o)
+{
+   if (e->IsInstanceOf(o, nfc_jni_ids.llcpSocketClass)) {
+      return nfc_jni_ids.llcpSocketHandle;
+   } else if (e->IsInstanceOf(o, nfc_jni_ids.p2pDeviceClass)) {
+      return nfc_jni_ids.p2pDeviceHandle;
+   } else if (e->IsInstanceOf(o, nfc_jni_ids.llcpConnectionlessSocketClass)) {
+      return nfc_jni_ids.llcpConnectionlessSocketHandle;
+   } else if (e->IsInstanceOf(o, nfc_jni_ids.llcpServiceSocketClass)) {
+      return nfc_jni_ids.llcpServiceSocketHandle;
+   }
+
+   /* Unknown class; fall back to reflection */
+   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
+   return e->GetFieldID(c.get(), "mHandle", "I");
+}
+
 struct nfc_jni_native_data* nfc_jni_get_nat(JNIEnv *e, jobject o)
 {
    /* Retrieve native structure address */
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mNative", "J");
-   return (struct nfc_jni_native_data*) e->GetLongField(o, f);
+   return (struct nfc_jni_native_data*) e->GetLongField(o, nfc_jni_ids.managerNative);
 }
 
 struct nfc_jni_native_data* nfc_jni_get_nat_ext(JNIEnv*)
@@ -188,12 +277,21 @@ nfc_jni_native_monitor_t* nfc_jni_init_monitor(void)
          return NULL;
       }
 
-      if(pthread_mutex_init(&nfc_jni_native_monitor->concurrency_mutex, NULL) == -1)
+      if(pthread_rwlock_init(&nfc_jni_native_monitor->discovery_lock, NULL) != 0)
       {
-         ALOGE("NFC Manager Concurrency Mutex creation returned 0x%08x", errno);
+         ALOGE("NFC Manager Discovery Lock creation returned 0x%08x", errno);
          return NULL;
       }
 
+      for (int i = 0; i < NFC_JNI_LOCK_COUNT; i++)
+      {
+         if(pthread_mutex_init(&nfc_jni_native_monitor->subsystem_mutex[i], NULL) == -1)
+         {
+            ALOGE("NFC Manager Subsystem Mutex creation returned 0x%08x", errno);
+            return NULL;
+         }
+      }
+
       if(!listInit(&nfc_jni_native_monitor->sem_list))
       {
          ALOGE("NFC Manager Semaphore List creation failed");
@@ -224,89 +322,113 @@ nfc_jni_native_monitor_t* nfc_jni_get_monitor(void)
    return nfc_jni_native_monitor;
 }
 
+void nfc_jni_lock_discovery(void)
+{
+   nfc_jni_native_monitor_t *monitor = nfc_jni_get_monitor();
+
+   if (pthread_rwlock_trywrlock(&monitor->discovery_lock) != 0)
+   {
+      android_atomic_inc(&monitor->discovery_contention);
+      pthread_rwlock_wrlock(&monitor->discovery_lock);
+   }
+}
+
+void nfc_jni_unlock_discovery(void)
+{
+   pthread_rwlock_unlock(&nfc_jni_get_monitor()->discovery_lock);
+}
+
+void nfc_jni_lock_subsystem(nfc_jni_lock_id_t id)
+{
+   nfc_jni_native_monitor_t *monitor = nfc_jni_get_monitor();
+
+   if (pthread_rwlock_tryrdlock(&monitor->discovery_lock) != 0)
+   {
+      android_atomic_inc(&monitor->discovery_contention);
+      pthread_rwlock_rdlock(&monitor->discovery_lock);
+   }
+   if (pthread_mutex_trylock(&monitor->subsystem_mutex[id]) != 0)
+   {
+      android_atomic_inc(&monitor->subsystem_contention[id]);
+      pthread_mutex_lock(&monitor->subsystem_mutex[id]);
+   }
+}
+
+void nfc_jni_unlock_subsystem(nfc_jni_lock_id_t id)
+{
+   nfc_jni_native_monitor_t *monitor = nfc_jni_get_monitor();
+
+   pthread_mutex_unlock(&monitor->subsystem_mutex[id]);
+   pthread_rwlock_unlock(&monitor->discovery_lock);
+}
+
 
 phLibNfc_Handle nfc_jni_get_p2p_device_handle(JNIEnv *e, jobject o)
 {
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
-   return e->GetIntField(o, f);
+   return e->GetIntField(o, nfc_jni_get_handle_field(e, o));
 }
 
 jshort nfc_jni_get_p2p_device_mode(JNIEnv *e, jobject o)
 {
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mMode", "S");
-   return e->GetShortField(o, f);
+   return (jshort) e->GetIntField(o, nfc_jni_ids.p2pDeviceMode);
 }
 
 
 int nfc_jni_get_connected_tech_index(JNIEnv *e, jobject o)
 {
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mConnectedTechIndex", "I");
-   return e->GetIntField(o, f);
-
+   return e->GetIntField(o, nfc_jni_ids.tagConnectedTechIndex);
 }
 
-jint nfc_jni_get_connected_technology(JNIEnv *e, jobject o)
+/*
+ * Read one element of an int[] field without pinning the array.
+ */
+static jint nfc_jni_get_int_array_element(JNIEnv *e, jobject o, jfieldID f, int index)
 {
-   int connectedTech = -1;
+   jint value = -1;
 
-   int connectedTechIndex = nfc_jni_get_connected_tech_index(e,o);
-   jintArray techTypes = nfc_jni_get_nfc_tag_type(e, o);
-
-   if ((connectedTechIndex != -1) && (techTypes != NULL) &&
-           (connectedTechIndex < e->GetArrayLength(techTypes))) {
-       jint* technologies = e->GetIntArrayElements(techTypes, 0);
-       if (technologies != NULL) {
-           connectedTech = technologies[connectedTechIndex];
-           e->ReleaseIntArrayElements(techTypes, technologies, JNI_ABORT);
-       }
+   if (index == -1) {
+      return value;
    }
 
-   return connectedTech;
+   ScopedLocalRef<jintArray> array(e, (jintArray) e->GetObjectField(o, f));
+   if ((array.get() != NULL) && (index < e->GetArrayLength(array.get()))) {
+      e->GetIntArrayRegion(array.get(), index, 1, &value);
+   }
+   return value;
+}
 
+jint nfc_jni_get_connected_technology(JNIEnv *e, jobject o)
+{
+   int connectedTechIndex = nfc_jni_get_connected_tech_index(e,o);
+   return nfc_jni_get_int_array_element(e, o, nfc_jni_ids.tagTechList, connectedTechIndex);
 }
 
 jint nfc_jni_get_connected_technology_libnfc_type(JNIEnv *e, jobject o)
 {
-   jint connectedLibNfcType = -1;
-
    int connectedTechIndex = nfc_jni_get_connected_tech_index(e,o);
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mTechLibNfcTypes", "[I");
-   ScopedLocalRef<jintArray> libNfcTypes(e, (jintArray) e->GetObjectField(o, f));
-
-   if ((connectedTechIndex != -1) && (libNfcTypes.get() != NULL) &&
-           (connectedTechIndex < e->GetArrayLength(libNfcTypes.get()))) {
-       jint* types = e->GetIntArrayElements(libNfcTypes.get(), 0);
-       if (types != NULL) {
-           connectedLibNfcType = types[connectedTechIndex];
-           e->ReleaseIntArrayElements(libNfcTypes.get(), types, JNI_ABORT);
-       }
-   }
-   return connectedLibNfcType;
+   return nfc_jni_get_int_array_element(e, o, nfc_jni_ids.tagTechLibNfcTypes, connectedTechIndex);
+}
+
+void nfc_jni_get_connected_tech(JNIEnv *e, jobject o, nfc_jni_connected_tech_t *tech)
+{
+   tech->index = nfc_jni_get_connected_tech_index(e, o);
+   tech->technology = nfc_jni_get_int_array_element(e, o, nfc_jni_ids.tagTechList, tech->index);
+   tech->libNfcType = nfc_jni_get_int_array_element(e, o, nfc_jni_ids.tagTechLibNfcTypes, tech->index);
 }
 
 phLibNfc_Handle nfc_jni_get_connected_handle(JNIEnv *e, jobject o)
 {
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mConnectedHandle", "I");
-   return e->GetIntField(o, f);
+   return e->GetIntField(o, nfc_jni_ids.tagConnectedHandle);
 }
 
 phLibNfc_Handle nfc_jni_get_nfc_socket_handle(JNIEnv *e, jobject o)
 {
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
-   return e->GetIntField(o, f);
+   return e->GetIntField(o, nfc_jni_get_handle_field(e, o));
 }
 
 jintArray nfc_jni_get_nfc_tag_type(JNIEnv *e, jobject o)
 {
-   ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-   jfieldID f = e->GetFieldID(c.get(), "mTechList","[I");
-   return (jintArray) e->GetObjectField(o, f);
+   return (jintArray) e->GetObjectField(o, nfc_jni_ids.tagTechList);
 }
 
 
@@ -173,13 +173,28 @@ struct nfc_jni_native_data
 
 };
 
+/* Subsystems with their own operation lock */
+typedef enum nfc_jni_lock_id
+{
+   NFC_JNI_LOCK_TAG = 0,
+   NFC_JNI_LOCK_P2P,
+   NFC_JNI_LOCK_COUNT
+} nfc_jni_lock_id_t;
+
 typedef struct nfc_jni_native_monitor
 {
    /* Mutex protecting native library against reentrance */
    pthread_mutex_t reentrance_mutex;
 
-   /* Mutex protecting native library against concurrency */
-   pthread_mutex_t concurrency_mutex;
+   /* Lock protecting discovery state; see CONCURRENCY_LOCK() */
+   pthread_rwlock_t discovery_lock;
+
+   /* Locks serializing operations within one subsystem; see TAG_LOCK() */
+   pthread_mutex_t subsystem_mutex[NFC_JNI_LOCK_COUNT];
+
+   /* Number of times a thread had to wait for a lock */
+   volatile int32_t discovery_contention;
+   volatile int32_t subsystem_contention[NFC_JNI_LOCK_COUNT];
 
    /* List used to track pending semaphores waiting for callback */
    struct listHead sem_list;
@@ -191,6 +206,49 @@ typedef struct nfc_jni_native_monitor
 
 } nfc_jni_native_monitor_t;
 
+/* Field IDs resolved once at JNI_OnLoad, so per-frame helpers avoid reflection */
+typedef struct nfc_jni_ids
+{
+   /* Classes whose objects carry an "mHandle" field (global references) */
+   jclass p2pDeviceClass;
+   jclass llcpSocketClass;
+   jclass llcpServiceSocketClass;
+   jclass llcpConnectionlessSocketClass;
+
+   /* NativeNfcManager */
+   jfieldID managerNative;
+
+   /* NativeNfcTag */
+   jfieldID tagConnectedTechIndex;
+   jfieldID tagConnectedHandle;
+   jfieldID tagTechList;
+   jfieldID tagTechLibNfcTypes;
+
+   /* NativeP2pDevice */
+   jfieldID p2pDeviceHandle;
+   jfieldID p2pDeviceMode;
+
+   /* LLCP sockets */
+   jfieldID llcpSocketHandle;
+   jfieldID llcpServiceSocketHandle;
+   jfieldID llcpConnectionlessSocketHandle;
+
+} nfc_jni_ids_t;
+
+/* Technology the tag object is connected to */
+typedef struct nfc_jni_connected_tech
+{
+   /* Index in mTechList, or -1 */
+   jint index;
+
+   /* TARGET_TYPE_* value, or -1 */
+   jint technology;
+
+   /* libnfc remote device type, or -1 */
+   jint libNfcType;
+
+} nfc_jni_connected_tech_t;
+
 typedef struct nfc_jni_callback_data
 {
    /* Semaphore used to wait for callback */
@@ -220,12 +278,49 @@ typedef struct nfc_jni_listen_data
 /* TODO: treat errors and add traces */
 #define REENTRANCE_LOCK()        pthread_mutex_lock(&nfc_jni_get_monitor()->reentrance_mutex)
 #define REENTRANCE_UNLOCK()      pthread_mutex_unlock(&nfc_jni_get_monitor()->reentrance_mutex)
-#define CONCURRENCY_LOCK()       pthread_mutex_lock(&nfc_jni_get_monitor()->concurrency_mutex)
-#define CONCURRENCY_UNLOCK()     pthread_mutex_unlock(&nfc_jni_get_monitor()->concurrency_mutex)
+
+/*
+ * Operation locks. Lock ordering: the discovery lock first, then at most one
+ * subsystem lock; never take the discovery lock while holding a subsystem lock.
+ *
+ * CONCURRENCY_LOCK() holds the discovery lock exclusively and so excludes every
+ * other operation. It is for whatever starts, stops or reconfigures discovery:
+ * initialize, deinitialize, enable/disable discovery, download, tag disconnect
+ * (which restarts discovery), and P2P connect and disconnect.
+ *
+ * TAG_LOCK() and P2P_LOCK() hold the discovery lock shared and then their
+ * subsystem lock, so tag and P2P operations may overlap each other but never a
+ * discovery change. Calls into libnfc are still serialized by REENTRANCE_LOCK().
+ * TAG_LOCK() covers every tag operation except disconnect, including connect
+ * and reconnect: these only select a target that discovery already found, and
+ * a concurrent disconnect or discovery change is excluded by the shared hold.
+ * It also covers the transceive timeout setters. P2P_LOCK() covers P2P
+ * transceive, send, receive and the LLCP check.
+ *
+ * SE mode has no lock of its own: phLibNfc_SE_SetMode() is only called from
+ * nfc_jni_initialize(), under CONCURRENCY_LOCK(), and the SE event callbacks
+ * only report to Java. A separate SE lock would only ever nest inside the
+ * exclusive discovery hold.
+ *
+ * LLCP sockets (NativeLlcpSocket, NativeLlcpServiceSocket and
+ * NativeLlcpConnectionlessSocket) take no operation lock, only
+ * REENTRANCE_LOCK() around each libnfc call. Accept and receive block until
+ * the peer acts: a socket lock would let a blocked receive stall every send
+ * and other sockets, and a shared discovery hold would keep disable discovery
+ * and deinitialize waiting on the peer. Each call waits on its own callback
+ * semaphore instead.
+ */
+#define CONCURRENCY_LOCK()       nfc_jni_lock_discovery()
+#define CONCURRENCY_UNLOCK()     nfc_jni_unlock_discovery()
+#define TAG_LOCK()               nfc_jni_lock_subsystem(NFC_JNI_LOCK_TAG)
+#define TAG_UNLOCK()             nfc_jni_unlock_subsystem(NFC_JNI_LOCK_TAG)
+#define P2P_LOCK()               nfc_jni_lock_subsystem(NFC_JNI_LOCK_P2P)
+#define P2P_UNLOCK()             nfc_jni_unlock_subsystem(NFC_JNI_LOCK_P2P)
 
 namespace android {
 
 extern JavaVM *vm;
+extern nfc_jni_ids_t nfc_jni_ids;
 
 JNIEnv *nfc_get_env();
 
@@ -236,10 +331,15 @@ void nfc_cb_data_releaseAll();
 const char* nfc_jni_get_status_name(NFCSTATUS status);
 int nfc_jni_cache_object(JNIEnv *e, const char *clsname,
    jobject *cached_obj);
+int nfc_jni_cache_ids(JNIEnv *e);
 struct nfc_jni_native_data* nfc_jni_get_nat(JNIEnv *e, jobject o);
 struct nfc_jni_native_data* nfc_jni_get_nat_ext(JNIEnv *e);
 nfc_jni_native_monitor_t* nfc_jni_init_monitor(void);
 nfc_jni_native_monitor_t* nfc_jni_get_monitor(void);
+void nfc_jni_lock_discovery(void);
+void nfc_jni_unlock_discovery(void);
+void nfc_jni_lock_subsystem(nfc_jni_lock_id_t id);
+void nfc_jni_unlock_subsystem(nfc_jni_lock_id_t id);
 
 int get_technology_type(phNfc_eRemDevType_t type, uint8_t sak);
 void nfc_jni_get_technology_tree(JNIEnv* e, phLibNfc_RemoteDevList_t* devList, uint8_t count,
@@ -255,6 +355,7 @@ jshort nfc_jni_get_p2p_device_mode(JNIEnv *e, jobject o);
 jint nfc_jni_get_connected_technology(JNIEnv *e, jobject o);
 jint nfc_jni_get_connected_technology_libnfc_type(JNIEnv *e, jobject o);
 phLibNfc_Handle nfc_jni_get_connected_handle(JNIEnv *e, jobject o);
+void nfc_jni_get_connected_tech(JNIEnv *e, jobject o, nfc_jni_connected_tech_t *tech);
 jintArray nfc_jni_get_nfc_tag_type(JNIEnv *e, jobject o);
 
 /* LLCP */
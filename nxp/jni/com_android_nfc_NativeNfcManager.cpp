@@ -1420,9 +1420,9 @@ clean_and_return:
 }
 
 static void com_android_nfc_NfcManager_doResetTimeouts(JNIEnv*, jobject) {
-    CONCURRENCY_LOCK();
+    TAG_LOCK();
     nfc_jni_reset_timeout_values();
-    CONCURRENCY_UNLOCK();
+    TAG_UNLOCK();
 }
 
 static void setFelicaTimeout(jint timeout) {
@@ -1498,7 +1498,7 @@ static void setNfcATimeout(jint timeout) {
 static bool com_android_nfc_NfcManager_doSetTimeout(JNIEnv*, jobject,
         jint tech, jint timeout) {
     bool success = false;
-    CONCURRENCY_LOCK();
+    TAG_LOCK();
     if (timeout <= 0) {
         ALOGE("Timeout must be positive.");
         success = false;
@@ -1525,14 +1525,14 @@ static bool com_android_nfc_NfcManager_doSetTimeout(JNIEnv*, jobject,
                 success = false;
         }
     }
-    CONCURRENCY_UNLOCK();
+    TAG_UNLOCK();
     return success;
 }
 
 static jint com_android_nfc_NfcManager_doGetTimeout(JNIEnv*, jobject,
         jint tech) {
     int timeout = -1;
-    CONCURRENCY_LOCK();
+    TAG_LOCK();
     switch (tech) {
         case TARGET_TYPE_MIFARE_CLASSIC:
         case TARGET_TYPE_MIFARE_UL:
@@ -1568,7 +1568,7 @@ static jint com_android_nfc_NfcManager_doGetTimeout(JNIEnv*, jobject,
             ALOGW("doGetTimeout: Timeout not supported for tech %d", tech);
             break;
     }
-    CONCURRENCY_UNLOCK();
+    TAG_UNLOCK();
     return timeout;
 }
 
@@ -1780,7 +1780,7 @@ static jboolean com_android_nfc_NfcManager_doCheckLlcp(JNIEnv *e, jobject o)
    struct nfc_jni_callback_data  *cb_data;
 
 
-   CONCURRENCY_LOCK();
+   P2P_LOCK();
 
    /* Memory allocation for cb_data
     * This is on the heap because it is used by libnfc
@@ -1833,7 +1833,7 @@ clean_and_return:
    if (freeData) {
        free(cb_data);
    }
-   CONCURRENCY_UNLOCK();
+   P2P_UNLOCK();
    return result;
 }
 
@@ -2347,8 +2347,12 @@ static jboolean com_android_nfc_NfcManager_doDownload(JNIEnv *e, jobject o)
 
 static jstring com_android_nfc_NfcManager_doDump(JNIEnv *e, jobject)
 {
-    char buffer[100];
-    snprintf(buffer, sizeof(buffer), "libnfc llc error_count=%u", libnfc_llc_error_count);
+    char buffer[200];
+    nfc_jni_native_monitor_t *monitor = nfc_jni_get_monitor();
+    snprintf(buffer, sizeof(buffer), "libnfc llc error_count=%u\n"
+            "lock contention: discovery=%d tag=%d p2p=%d", libnfc_llc_error_count,
+            monitor->discovery_contention, monitor->subsystem_contention[NFC_JNI_LOCK_TAG],
+            monitor->subsystem_contention[NFC_JNI_LOCK_P2P]);
     return e->NewStringUTF(buffer);
 }
 
@@ -20,6 +20,7 @@
 #include <ScopedPrimitiveArray.h>
 
 #include "com_android_nfc.h"
+#include "com_android_nfc_crc.h"
 #include "phNfcHalTypes.h"
 
 static phLibNfc_Data_t nfc_jni_ndef_rw;
@@ -182,7 +183,7 @@ static jbyteArray com_android_nfc_NativeNfcTag_doRead(JNIEnv *e,
    jbyteArray buf = NULL;
    struct nfc_jni_callback_data cb_data;
 
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -227,7 +228,7 @@ static jbyteArray com_android_nfc_NativeNfcTag_doRead(JNIEnv *e,
 
 clean_and_return:
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
 
    return buf;
 }
@@ -242,7 +243,7 @@ static jboolean com_android_nfc_NativeNfcTag_doWrite(JNIEnv *e,
 
    phLibNfc_Handle handle = nfc_jni_get_connected_handle(e, o);
 
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -284,7 +285,7 @@ clean_and_return:
    e->ReleaseByteArrayElements(buf, (jbyte *)nfc_jni_ndef_rw.buffer, JNI_ABORT);
 
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
    return result;
 }
 
@@ -444,7 +445,8 @@ static jint com_android_nfc_NativeNfcTag_doConnect(JNIEnv *e,
    struct nfc_jni_callback_data cb_data;
    phLibNfc_sRemoteDevInformation_t* pRemDevInfo = NULL;
 
-   CONCURRENCY_LOCK();
+   /* Connecting selects an already discovered target; discovery is unchanged */
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, &pRemDevInfo))
@@ -488,7 +490,7 @@ static jint com_android_nfc_NativeNfcTag_doConnect(JNIEnv *e,
 
 clean_and_return:
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
    return status;
 }
 
@@ -498,7 +500,7 @@ static jint com_android_nfc_NativeNfcTag_doHandleReconnect(JNIEnv*,
    jint status;
    struct nfc_jni_callback_data cb_data;
    phLibNfc_sRemoteDevInformation_t* pRemDevInfo = NULL;
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, &pRemDevInfo))
@@ -537,7 +539,7 @@ static jint com_android_nfc_NativeNfcTag_doHandleReconnect(JNIEnv*,
 
 clean_and_return:
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
    return status;
 }
 
@@ -640,56 +642,16 @@ clean_and_return:
    return result;
 }
 
-static uint16_t
-crc_16_ccitt1( uint8_t* msg, size_t len, uint16_t init )
-{
-    uint16_t b, crc = init;
-
-    do {
-        b = *msg++ ^ (crc & 0xFF);
-        b ^= (b << 4) & 0xFF;
-        crc = (crc >> 8) ^ (b << 8) ^ (b << 3) ^ (b >> 4);
-    } while( --len );
-
-    return crc;
-}
-
-static void
-nfc_insert_crc_a( uint8_t* msg, size_t len )
-{
-    uint16_t crc;
-
-    crc = crc_16_ccitt1( msg, len, 0x6363 );
-    msg[len] = crc & 0xFF;
-    msg[len + 1] = (crc >> 8) & 0xFF;
-}
-
-static void
-nfc_get_crc_a( uint8_t* msg, size_t len, uint8_t* byte1, uint8_t* byte2)
-{
-    uint16_t crc;
-
-    crc = crc_16_ccitt1( msg, len, 0x6363 );
-    *byte1 = crc & 0xFF;
-    *byte2 = (crc >> 8) & 0xFF;
-}
+/* Raw frames with an appended CRC are built here; guarded by TAG_LOCK() */
+static uint8_t nfc_jni_crc_scratch[NFC_JNI_CRC_SCRATCH_SIZE];
 
-static bool
-crc_valid( uint8_t* msg, size_t len)
+/* Buffer for a frame of len bytes plus its CRC; NULL if out of memory */
+static uint8_t* nfc_jni_get_crc_buffer(uint32_t len)
 {
-    uint8_t crcByte1, crcByte2;
-
-    nfc_get_crc_a(nfc_jni_transceive_buffer->buffer,
-          len - 2, &crcByte1, &crcByte2);
-
-    if (msg[len - 2] == crcByte1 &&
-          msg[len - 1] == crcByte2) {
-        return true;
+    if (len + 2 <= sizeof(nfc_jni_crc_scratch)) {
+        return nfc_jni_crc_scratch;
     }
-    else {
-        return false;
-    }
-
+    return (uint8_t*)malloc(len + 2);
 }
 
 static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
@@ -712,6 +674,7 @@ static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
     struct nfc_jni_callback_data cb_data;
     int selectedTech = 0;
     int selectedLibNfcType = 0;
+    nfc_jni_connected_tech_t connectedTech;
     jint* technologies = NULL;
     bool checkResponseCrc = false;
 
@@ -726,7 +689,7 @@ static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
     }
 
     memset(&transceive_info, 0, sizeof(transceive_info));
-    CONCURRENCY_LOCK();
+    TAG_LOCK();
 
     /* Create the local semaphore */
     if (!nfc_cb_data_init(&cb_data, NULL))
@@ -734,8 +697,9 @@ static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
        goto clean_and_return;
     }
 
-    selectedTech = nfc_jni_get_connected_technology(e, o);
-    selectedLibNfcType = nfc_jni_get_connected_technology_libnfc_type(e, o);
+    nfc_jni_get_connected_tech(e, o, &connectedTech);
+    selectedTech = connectedTech.technology;
+    selectedLibNfcType = connectedTech.libNfcType;
 
     buf = outbuf = (uint8_t *)e->GetByteArrayElements(data, NULL);
     buflen = outlen = (uint32_t)e->GetArrayLength(data);
@@ -751,10 +715,13 @@ static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
               transceive_info.cmd.MfCmd = phHal_eMifareRaw;
               transceive_info.addr = 0;
               // Need to add in the crc here
-              outbuf = (uint8_t*)malloc(buflen + 2);
+              outbuf = nfc_jni_get_crc_buffer(buflen);
+              if (outbuf == NULL) {
+                  goto clean_and_return;
+              }
               outlen += 2;
               memcpy(outbuf, buf, buflen);
-              nfc_insert_crc_a(outbuf, buflen);
+              nfc_jni_append_crc_a(outbuf, buflen);
 
               checkResponseCrc = true;
           } else {
@@ -776,10 +743,13 @@ static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
                   transceive_info.cmd.MfCmd = phHal_eMifareRaw;
                   transceive_info.addr = 0;
                   // Need to add in the crc here
-                  outbuf = (uint8_t*)malloc(buflen + 2);
+                  outbuf = nfc_jni_get_crc_buffer(buflen);
+                  if (outbuf == NULL) {
+                      goto clean_and_return;
+                  }
                   outlen += 2;
                   memcpy(outbuf, buf, buflen);
-                  nfc_insert_crc_a(outbuf, buflen);
+                  nfc_jni_append_crc_a(outbuf, buflen);
 
                   checkResponseCrc = true;
               } else {
@@ -851,7 +821,7 @@ static jbyteArray com_android_nfc_NativeNfcTag_doTransceive(JNIEnv *e,
      * and cut it off in the returned data.
      */
     if ((nfc_jni_transceive_buffer->length > 2) && checkResponseCrc) {
-        if (crc_valid(nfc_jni_transceive_buffer->buffer, nfc_jni_transceive_buffer->length)) {
+        if (nfc_jni_crc_a_valid(nfc_jni_transceive_buffer->buffer, nfc_jni_transceive_buffer->length)) {
             result = e->NewByteArray(nfc_jni_transceive_buffer->length - 2);
             if (result != NULL) {
                 e->SetByteArrayRegion(result, 0,
@@ -873,8 +843,8 @@ clean_and_return:
       free(transceive_info.sRecvData.buffer);
     }
 
-    if ((outbuf != buf) && (outbuf != NULL)) {
-        // Buf was extended and re-alloced with crc bytes, free separately
+    if ((outbuf != buf) && (outbuf != nfc_jni_crc_scratch) && (outbuf != NULL)) {
+        // Buf was too long for the scratch buffer and re-alloced with crc bytes, free separately
         free(outbuf);
     }
 
@@ -887,7 +857,7 @@ clean_and_return:
 
     nfc_cb_data_deinit(&cb_data);
 
-    CONCURRENCY_UNLOCK();
+    TAG_UNLOCK();
 
     return result;
 }
@@ -939,7 +909,7 @@ static jint com_android_nfc_NativeNfcTag_doCheckNdef(JNIEnv *e, jobject o, jintA
    jint *ndef = e->GetIntArrayElements(ndefinfo, 0);
    int apiCardState = NDEF_MODE_UNKNOWN;
 
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -999,7 +969,7 @@ static jint com_android_nfc_NativeNfcTag_doCheckNdef(JNIEnv *e, jobject o, jintA
 clean_and_return:
    e->ReleaseIntArrayElements(ndefinfo, ndef, 0);
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
    return status;
 }
 
@@ -1010,7 +980,7 @@ static jboolean com_android_nfc_NativeNfcTag_doPresenceCheck(JNIEnv *e, jobject
    jboolean result = JNI_FALSE;
    struct nfc_jni_callback_data cb_data;
 
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -1047,7 +1017,7 @@ static jboolean com_android_nfc_NativeNfcTag_doPresenceCheck(JNIEnv *e, jobject
 clean_and_return:
    nfc_cb_data_deinit(&cb_data);
 
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
 
    return result;
 }
@@ -1106,7 +1076,7 @@ static jboolean com_android_nfc_NativeNfcTag_doNdefFormat(JNIEnv *e, jobject o,
    jboolean result = JNI_FALSE;
    struct nfc_jni_callback_data cb_data;
 
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -1145,7 +1115,7 @@ static jboolean com_android_nfc_NativeNfcTag_doNdefFormat(JNIEnv *e, jobject o,
 clean_and_return:
    e->ReleaseByteArrayElements(key, (jbyte *)keyBuffer.buffer, JNI_ABORT);
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
    return result;
 }
 
@@ -1157,7 +1127,7 @@ static jboolean com_android_nfc_NativeNfcTag_doMakeReadonly(JNIEnv *e, jobject o
    struct nfc_jni_callback_data cb_data;
    phNfc_sData_t keyBuffer;
 
-   CONCURRENCY_LOCK();
+   TAG_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -1196,7 +1166,7 @@ static jboolean com_android_nfc_NativeNfcTag_doMakeReadonly(JNIEnv *e, jobject o
 clean_and_return:
    e->ReleaseByteArrayElements(key, (jbyte *)keyBuffer.buffer, JNI_ABORT);
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   TAG_UNLOCK();
    return result;
 }
 /*
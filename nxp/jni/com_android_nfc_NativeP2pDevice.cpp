@@ -279,7 +279,7 @@ static jbyteArray com_android_nfc_NativeP2pDevice_doTransceive(JNIEnv *e,
    phNfc_sData_t * receive_buffer = NULL;
    struct nfc_jni_callback_data cb_data;
 
-   CONCURRENCY_LOCK();
+   P2P_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, (void*)receive_buffer))
@@ -346,7 +346,7 @@ clean_and_return:
 
    nfc_cb_data_deinit(&cb_data);
 
-   CONCURRENCY_UNLOCK();
+   P2P_UNLOCK();
 
    return result;
 }
@@ -362,7 +362,7 @@ static jbyteArray com_android_nfc_NativeP2pDevice_doReceive(
    static phNfc_sData_t *data;
    struct nfc_jni_callback_data cb_data;
 
-   CONCURRENCY_LOCK();
+   P2P_LOCK();
 
    handle = nfc_jni_get_p2p_device_handle(e, o);
    
@@ -401,7 +401,7 @@ static jbyteArray com_android_nfc_NativeP2pDevice_doReceive(
 
 clean_and_return:
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   P2P_UNLOCK();
    return buf;
 }
 
@@ -415,7 +415,7 @@ static jboolean com_android_nfc_NativeP2pDevice_doSend(
    
    phLibNfc_Handle handle = nfc_jni_get_p2p_device_handle(e, o);
    
-   CONCURRENCY_LOCK();
+   P2P_LOCK();
 
    /* Create the local semaphore */
    if (!nfc_cb_data_init(&cb_data, NULL))
@@ -460,7 +460,7 @@ clean_and_return:
       e->ReleaseByteArrayElements(buf, (jbyte *)data.buffer, JNI_ABORT);
    }
    nfc_cb_data_deinit(&cb_data);
-   CONCURRENCY_UNLOCK();
+   P2P_UNLOCK();
    return result;
 }
 
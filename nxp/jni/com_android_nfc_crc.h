@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __COM_ANDROID_NFC_CRC_H__
+#define __COM_ANDROID_NFC_CRC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+/* Size of the scratch buffer raw frames are copied to when a CRC is appended */
+#define NFC_JNI_CRC_SCRATCH_SIZE          1024
+
+/* ISO/IEC 14443-3 type A CRC of a frame */
+uint16_t nfc_jni_crc_a(const uint8_t* msg, size_t len);
+
+/* Write the CRC of msg[0..len) to msg[len] and msg[len + 1] */
+void nfc_jni_append_crc_a(uint8_t* msg, size_t len);
+
+/* Whether the last two of len bytes are the CRC of the bytes before them */
+bool nfc_jni_crc_a_valid(const uint8_t* msg, size_t len);
+
+} // namespace android
+
+#endif
@@ -18,14 +18,103 @@
 #include <com_android_nfc.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <cutils/log.h>
 
 #undef LOG_TAG
 #define LOG_TAG "NFC_LIST"
 
+/*
+ * Nodes come from a pool owned by the list and are linked twice: in
+ * insertion order (with a tail pointer, so adding is O(1)) and in a hash
+ * bucket keyed by the data pointer (so removing by data is O(1) on average).
+ */
+struct listPoolChunk
+{
+   struct listPoolChunk* pNext;
+   struct listNode nodes[LIST_POOL_CHUNK];
+};
+
+static unsigned listHash(void* pData)
+{
+   uintptr_t key = (uintptr_t)pData;
+   /* Low bits are always zero for aligned allocations */
+   return (unsigned)((key >> 4) ^ (key >> 10)) & (LIST_HASH_SIZE - 1);
+}
+
+static struct listNode* listAllocNode(listHead* pList)
+{
+   struct listNode* pNode;
+
+   if (pList->pFree == NULL)
+   {
+      struct listPoolChunk* pChunk = (struct listPoolChunk*)malloc(sizeof(listPoolChunk));
+      if (pChunk == NULL)
+      {
+         return NULL;
+      }
+      TRACE("Allocated node chunk: %8p", pChunk);
+      pChunk->pNext = pList->pChunks;
+      pList->pChunks = pChunk;
+      for (int i = 0; i < LIST_POOL_CHUNK; i++)
+      {
+         pChunk->nodes[i].pNext = pList->pFree;
+         pList->pFree = &pChunk->nodes[i];
+      }
+   }
+
+   pNode = pList->pFree;
+   pList->pFree = pNode->pNext;
+   return pNode;
+}
+
+/* Unlink a node from both the order list and its hash bucket, and pool it */
+static void listReleaseNode(listHead* pList, struct listNode* pNode)
+{
+   struct listNode** ppLink = &pList->pBuckets[listHash(pNode->pData)];
+
+   while (*ppLink != pNode)
+   {
+      ppLink = &(*ppLink)->pHashNext;
+   }
+   *ppLink = pNode->pHashNext;
+
+   if (pNode->pPrev != NULL)
+   {
+      pNode->pPrev->pNext = pNode->pNext;
+   }
+   else
+   {
+      pList->pFirst = pNode->pNext;
+   }
+   if (pNode->pNext != NULL)
+   {
+      pNode->pNext->pPrev = pNode->pPrev;
+   }
+   else
+   {
+      pList->pLast = pNode->pPrev;
+   }
+   pList->count--;
+
+   TRACE("Releasing node: %8p (%8p)", pNode, pNode->pData);
+   pNode->pData = NULL;
+   pNode->pPrev = NULL;
+   pNode->pHashNext = NULL;
+   pNode->pNext = pList->pFree;
+   pList->pFree = pNode;
+}
+
 bool listInit(listHead* pList)
 {
    pList->pFirst = NULL;
+   pList->pLast = NULL;
+   pList->pFree = NULL;
+   pList->pChunks = NULL;
+   pList->count = 0;
+   memset(pList->pBuckets, 0, sizeof(pList->pBuckets));
    if(pthread_mutex_init(&pList->mutex, NULL) == -1)
    {
       ALOGE("Mutex creation failed (errno=0x%08x)", errno);
@@ -42,6 +131,14 @@ bool listDestroy(listHead* pList)
       bListNotEmpty = listGetAndRemoveNext(pList, NULL);
    }
 
+   while (pList->pChunks != NULL)
+   {
+      struct listPoolChunk* pChunk = pList->pChunks;
+      pList->pChunks = pChunk->pNext;
+      free(pChunk);
+   }
+   pList->pFree = NULL;
+
    if(pthread_mutex_destroy(&pList->mutex) == -1)
    {
       ALOGE("Mutex destruction failed (errno=0x%08x)", errno);
@@ -54,41 +151,40 @@ bool listDestroy(listHead* pList)
 bool listAdd(listHead* pList, void* pData)
 {
    struct listNode* pNode;
-   struct listNode* pLastNode;
+   unsigned bucket;
    bool result;
 
-   /* Create node */
-   pNode = (struct listNode*)malloc(sizeof(listNode));
+   pthread_mutex_lock(&pList->mutex);
+
+   /* Take a node from the pool */
+   pNode = listAllocNode(pList);
    if (pNode == NULL)
    {
       result = false;
       ALOGE("Failed to malloc");
       goto clean_and_return;
    }
-   TRACE("Allocated node: %8p (%8p)", pNode, pData);
+   TRACE("Using node: %8p (%8p)", pNode, pData);
    pNode->pData = pData;
-   pNode->pNext = NULL;
 
-   pthread_mutex_lock(&pList->mutex);
-
-   /* Add the node to the list */
-   if (pList->pFirst == NULL)
+   /* Append the node at the tail */
+   pNode->pNext = NULL;
+   pNode->pPrev = pList->pLast;
+   if (pList->pLast != NULL)
    {
-       /* Set the node as the head */
-      pList->pFirst = pNode;
+      pList->pLast->pNext = pNode;
    }
    else
    {
-      /* Seek to the end of the list */
-      pLastNode = pList->pFirst;
-      while(pLastNode->pNext != NULL)
-      {
-          pLastNode = pLastNode->pNext;
-      }
-
-      /* Add the node to the current list */
-      pLastNode->pNext = pNode;
+      pList->pFirst = pNode;
    }
+   pList->pLast = pNode;
+
+   /* Index the node by its data */
+   bucket = listHash(pData);
+   pNode->pHashNext = pList->pBuckets[bucket];
+   pList->pBuckets[bucket] = pNode;
+   pList->count++;
 
    result = true;
 
@@ -100,7 +196,6 @@ clean_and_return:
 bool listRemove(listHead* pList, void* pData)
 {
    struct listNode* pNode;
-   struct listNode* pRemovedNode;
    bool result;
 
    pthread_mutex_lock(&pList->mutex);
@@ -113,45 +208,22 @@ bool listRemove(listHead* pList, void* pData)
       goto clean_and_return;
    }
 
-   pNode = pList->pFirst;
-   if (pList->pFirst->pData == pData)
+   /* Look the node up in its hash bucket */
+   pNode = pList->pBuckets[listHash(pData)];
+   while ((pNode != NULL) && (pNode->pData != pData))
    {
-      /* Get the removed node */
-      pRemovedNode = pNode;
-
-      /* Remove the first node */
-      pList->pFirst = pList->pFirst->pNext;
+      pNode = pNode->pHashNext;
    }
-   else
-   {
-      while (pNode->pNext != NULL)
-      {
-         if (pNode->pNext->pData == pData)
-         {
-            /* Node found ! */
-            break;
-         }
-         pNode = pNode->pNext;
-      }
-
-      if (pNode->pNext == NULL)
-      {
-         /* Node not found */
-          result = false;
-          ALOGE("Failed to deallocate (not found %8p)", pData);
-          goto clean_and_return;
-      }
 
-      /* Get the removed node */
-      pRemovedNode = pNode->pNext;
-
-      /* Remove the node from the list */
-      pNode->pNext = pNode->pNext->pNext;
+   if (pNode == NULL)
+   {
+      /* Node not found */
+      result = false;
+      ALOGE("Failed to deallocate (not found %8p)", pData);
+      goto clean_and_return;
    }
 
-   /* Deallocate the node */
-   TRACE("Deallocating node: %8p (%8p)", pRemovedNode, pRemovedNode->pData);
-   free(pRemovedNode);
+   listReleaseNode(pList, pNode);
 
    result = true;
 
@@ -167,10 +239,9 @@ bool listGetAndRemoveNext(listHead* pList, void** ppData)
 
    pthread_mutex_lock(&pList->mutex);
 
-   if (pList->pFirst)
+   if (pList->pFirst == NULL)
    {
       /* Empty list */
-      ALOGE("Failed to deallocate (list empty)");
       result = false;
       goto clean_and_return;
    }
@@ -184,27 +255,29 @@ bool listGetAndRemoveNext(listHead* pList, void** ppData)
       *ppData = pNode->pData;
    }
 
-   /* Remove and deallocate the node */
-   pList->pFirst = pNode->pNext;
-   TRACE("Deallocating node: %8p (%8p)", pNode, pNode->pData);
-   free(pNode);
+   /* Remove the node and return it to the pool */
+   listReleaseNode(pList, pNode);
 
    result = true;
 
 clean_and_return:
-   listDump(pList);
    pthread_mutex_unlock(&pList->mutex);
    return result;
 }
 
 void listDump(listHead* pList)
 {
-   struct listNode* pNode = pList->pFirst;
+   struct listNode* pNode;
 
-   TRACE("Node dump:");
+   pthread_mutex_lock(&pList->mutex);
+
+   TRACE("Node dump (%u nodes):", (unsigned)pList->count);
+   pNode = pList->pFirst;
    while (pNode != NULL)
    {
       TRACE("- %8p (%8p)", pNode, pNode->pData);
       pNode = pNode->pNext;
    }
+
+   pthread_mutex_unlock(&pList->mutex);
 }
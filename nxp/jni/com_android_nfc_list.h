@@ -18,20 +18,36 @@
 #define __COM_ANDROID_NFC_LIST_H__
 
 #include <pthread.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Number of hash buckets used to find a node from its data pointer */
+#define LIST_HASH_SIZE     64
+
+/* Number of nodes allocated at once when the node pool runs dry */
+#define LIST_POOL_CHUNK    16
+
 struct listNode
 {
    void* pData;
-   struct listNode* pNext;
+   struct listNode* pPrev;
+   struct listNode* pNext;       /* also links the free nodes of the pool */
+   struct listNode* pHashNext;   /* next node in the same hash bucket */
 };
 
+struct listPoolChunk;
+
 struct listHead
 {
     listNode* pFirst;
+    listNode* pLast;
+    listNode* pFree;                       /* pool of unused nodes */
+    listNode* pBuckets[LIST_HASH_SIZE];    /* nodes hashed by pData */
+    struct listPoolChunk* pChunks;         /* memory the pool was carved from */
+    size_t count;
     pthread_mutex_t mutex;
 };
 
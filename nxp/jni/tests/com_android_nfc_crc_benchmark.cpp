@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host microbenchmark of the table-driven CRC_A against the bitwise routine
+ * it replaced, over the frame sizes raw type A transceive sees: short
+ * commands, MIFARE block writes, a full frame, and the scratch buffer.
+ *
+ * usage: nfc_jni_crc_benchmark [megabytes per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "com_android_nfc_crc.h"
+#include "com_android_nfc_crc_bitwise.h"
+
+using namespace android;
+
+/* Keeps the compiler from dropping CRCs nobody reads */
+static volatile uint16_t sink;
+
+static uint16_t crc_a_bitwise(const uint8_t* msg, size_t len)
+{
+   return crc_16_ccitt1(msg, len, 0x6363);
+}
+
+static double now_seconds()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Nanoseconds per frame of crc over frames of len bytes, totalling about bytes */
+static double time_crc(uint16_t (*crc)(const uint8_t*, size_t), const uint8_t* msg,
+      size_t len, size_t bytes)
+{
+   size_t frames = bytes / len;
+   uint16_t acc = 0;
+   double start;
+
+   if (frames == 0) {
+      frames = 1;
+   }
+   start = now_seconds();
+   for (size_t i = 0; i < frames; i++) {
+      acc ^= crc(msg, len);
+   }
+   sink = acc;
+   return (now_seconds() - start) * 1e9 / frames;
+}
+
+int main(int argc, char** argv)
+{
+   static const size_t frame_lens[] = { 2, 4, 18, 64, 253, NFC_JNI_CRC_SCRATCH_SIZE };
+   uint8_t msg[NFC_JNI_CRC_SCRATCH_SIZE];
+   uint32_t seed = 1;
+   long megabytes = 16;
+
+   if (argc > 1) {
+      megabytes = strtol(argv[1], NULL, 10);
+      if (megabytes <= 0) {
+         fprintf(stderr, "usage: %s [megabytes per run]\n", argv[0]);
+         return 1;
+      }
+   }
+   for (size_t i = 0; i < sizeof(msg); i++) {
+      seed = seed * 1103515245 + 12345;
+      msg[i] = (uint8_t) (seed >> 16);
+   }
+
+   size_t bytes = (size_t) megabytes << 20;
+   printf("%6s %12s %12s %12s %12s %8s\n", "len", "table ns", "bitwise ns",
+         "table MB/s", "bitwise MB/s", "speedup");
+   for (size_t i = 0; i < sizeof(frame_lens) / sizeof(frame_lens[0]); i++) {
+      size_t len = frame_lens[i];
+      /* Warm up caches and the table before timing */
+      time_crc(nfc_jni_crc_a, msg, len, bytes / 16);
+      double table = time_crc(nfc_jni_crc_a, msg, len, bytes);
+      double bitwise = time_crc(crc_a_bitwise, msg, len, bytes);
+      printf("%6u %12.1f %12.1f %12.1f %12.1f %7.2fx\n", (unsigned) len, table, bitwise,
+            len * 1e3 / table, len * 1e3 / bitwise, bitwise / table);
+   }
+   return 0;
+}
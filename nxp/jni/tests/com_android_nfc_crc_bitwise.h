@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __COM_ANDROID_NFC_CRC_BITWISE_H__
+#define __COM_ANDROID_NFC_CRC_BITWISE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The bit-by-bit CRC_A the NativeNfcTag transceive path used before the table */
+static inline uint16_t crc_16_ccitt1(const uint8_t* msg, size_t len, uint16_t init)
+{
+   uint16_t b, crc = init;
+
+   do {
+      b = *msg++ ^ (crc & 0xFF);
+      b = (b ^ (b << 4)) & 0xFF;
+      crc = (crc >> 8) ^ (b << 8) ^ (b << 3) ^ (b >> 4);
+   } while( --len );
+
+   return crc;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "com_android_nfc_crc.h"
+#include "com_android_nfc_crc_bitwise.h"
+
+using namespace android;
+
+/* ISO/IEC 14443-3 annex B examples and common type A commands */
+TEST(CrcATest, GoldenVectors)
+{
+   static const struct {
+      uint8_t msg[4];
+      size_t len;
+      uint16_t crc;
+   } vectors[] = {
+      { { 0x00, 0x00 }, 2, 0x1EA0 },
+      { { 0x12, 0x34 }, 2, 0xCF26 },
+      { { 0x50, 0x00 }, 2, 0xCD57 },   /* HLTA */
+      { { 0xE0, 0x50 }, 2, 0xA5BC },   /* RATS, FSDI 5, CID 0 */
+      { { 0x30, 0x00 }, 2, 0xA802 },   /* READ block 0 */
+   };
+
+   for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+      EXPECT_EQ(vectors[i].crc, nfc_jni_crc_a(vectors[i].msg, vectors[i].len)) << "vector " << i;
+   }
+}
+
+TEST(CrcATest, MatchesBitwiseForEveryByte)
+{
+   for (int value = 0; value < 256; value++) {
+      uint8_t msg = (uint8_t) value;
+      EXPECT_EQ(crc_16_ccitt1(&msg, 1, 0x6363), nfc_jni_crc_a(&msg, 1)) << "byte " << value;
+   }
+}
+
+TEST(CrcATest, MatchesBitwiseForEveryLength)
+{
+   uint8_t msg[NFC_JNI_CRC_SCRATCH_SIZE];
+   uint32_t seed = 1;
+
+   for (size_t i = 0; i < sizeof(msg); i++) {
+      seed = seed * 1103515245 + 12345;
+      msg[i] = (uint8_t) (seed >> 16);
+   }
+   for (size_t len = 1; len <= sizeof(msg); len++) {
+      ASSERT_EQ(crc_16_ccitt1(msg, len, 0x6363), nfc_jni_crc_a(msg, len)) << "length " << len;
+   }
+}
+
+TEST(CrcATest, EmptyMessageIsInitialValue)
+{
+   EXPECT_EQ(0x6363, nfc_jni_crc_a(NULL, 0));
+}
+
+TEST(CrcATest, AppendThenValidate)
+{
+   uint8_t msg[6] = { 0xE0, 0x50 };
+
+   nfc_jni_append_crc_a(msg, 2);
+   EXPECT_EQ(0xBC, msg[2]);
+   EXPECT_EQ(0xA5, msg[3]);
+   EXPECT_TRUE(nfc_jni_crc_a_valid(msg, 4));
+
+   msg[1] ^= 0x01;
+   EXPECT_FALSE(nfc_jni_crc_a_valid(msg, 4));
+}
+
+TEST(CrcATest, ShortFrameIsInvalid)
+{
+   uint8_t msg[2] = { 0x63, 0x63 };
+
+   EXPECT_FALSE(nfc_jni_crc_a_valid(msg, 0));
+   EXPECT_FALSE(nfc_jni_crc_a_valid(msg, 1));
+   /* A bare CRC of the empty message */
+   EXPECT_TRUE(nfc_jni_crc_a_valid(msg, 2));
+}
@@ -65,6 +65,12 @@ public class NativeLlcpConnectionlessSocket implements DeviceHost.LlcpConnection
         return packet;
     }
 
+    @Override
+    public LlcpPacket[] receiveBatch(int maxPackets) throws IOException {
+        // libnfc hands over one packet per receive; nothing else is queued
+        return new LlcpPacket[] { receive() };
+    }
+
     public int getHandle(){
         return mHandle;
     }
@@ -19,6 +19,7 @@ package com.android.nfc.dhimpl;
 import com.android.nfc.DeviceHost;
 
 import java.io.IOException;
+import java.util.Arrays;
 
 /**
  * LlcpClientSocket represents a LLCP Connection-Oriented client to be used in a
@@ -64,6 +65,21 @@ public class NativeLlcpSocket implements DeviceHost.LlcpSocket {
         }
     }
 
+    @Override
+    public void sendSegmented(byte[] data, int offset, int length, int segmentSize)
+            throws IOException {
+        int miu = getRemoteMiu();
+        if (segmentSize <= 0 || segmentSize > miu) {
+            segmentSize = miu;
+        }
+        int end = offset + length;
+        while (offset < end) {
+            int chunk = Math.min(end - offset, segmentSize);
+            send(Arrays.copyOfRange(data, offset, offset + chunk));
+            offset += chunk;
+        }
+    }
+
     private native int doReceive(byte[] recvBuff);
     @Override
     public int receive(byte[] recvBuff) throws IOException {
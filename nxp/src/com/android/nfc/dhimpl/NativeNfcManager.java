@@ -250,6 +250,11 @@ public class NativeNfcManager implements DeviceHost {
     @Override
     public native boolean doActivateLlcp();
 
+    @Override
+    public LlcpReceiveDispatcher getLlcpReceiveDispatcher() {
+        return null;
+    }
+
     private native void doResetTimeouts();
 
     @Override
@@ -21,15 +21,27 @@ import android.nfc.NdefMessage;
 import android.os.Bundle;
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
 
 public interface DeviceHost {
+    /**
+     * Passed to {@link DeviceHostListener#onHostCardEmulationData} when the
+     * APDU is not a SELECT the host AID table resolved to a single entry.
+     */
+    public static final int AID_TOKEN_UNRESOLVED = -1;
+
     public interface DeviceHostListener {
         public void onRemoteEndpointDiscovered(TagEndpoint tag);
 
         /**
          */
         public void onHostCardEmulationActivated();
-        public void onHostCardEmulationData(byte[] data);
+
+        /**
+         * Notifies a command APDU between the buffer's position and limit. The
+         * buffer may be reused once this returns, so it must not be retained.
+         */
+        public void onHostCardEmulationData(ByteBuffer data, int aidToken);
         public void onHostCardEmulationDeactivated();
 
         /**
@@ -127,6 +139,14 @@ public interface DeviceHost {
 
         public void send(byte[] data) throws IOException;
 
+        /**
+         * Sends data[offset..offset+length) as a sequence of packets of at most
+         * min(segmentSize, remote MIU) bytes each; a segmentSize of 0 means
+         * the remote MIU.
+         */
+        public void sendSegmented(byte[] data, int offset, int length, int segmentSize)
+                throws IOException;
+
         public int receive(byte[] recvBuff) throws IOException;
 
         public int getRemoteMiu();
@@ -140,6 +160,39 @@ public interface DeviceHost {
         public int getLocalRw();
     }
 
+    /**
+     * Receives on many LLCP sockets from one thread, instead of one thread
+     * blocked in {@link LlcpSocket#receive} per socket. That thread serves
+     * every watched socket, so callbacks must not block; hand blocking work
+     * such as {@link LlcpSocket#close} to another thread. This suits
+     * connections that only receive. Request/response protocols that send a
+     * reply, or receive in the middle of a send as SNEP does, keep a thread
+     * per connection.
+     */
+    public interface LlcpReceiveDispatcher {
+        public interface Callback {
+            /**
+             * Called on the dispatcher thread for each packet received on socket.
+             * data is reused for the next packet.
+             */
+            public void onDataReceived(LlcpSocket socket, byte[] data, int length);
+
+            /**
+             * Called once on the dispatcher thread after socket was closed,
+             * by the peer or locally. No data follows.
+             */
+            public void onClosed(LlcpSocket socket);
+        }
+
+        /**
+         * Delivers everything received on socket to callback from now on. The
+         * caller must not call {@link LlcpSocket#receive} on it any more.
+         *
+         * @return false if socket cannot be watched; the caller receives itself
+         */
+        public boolean watch(LlcpSocket socket, Callback callback);
+    }
+
     public interface LlcpServerSocket {
         public LlcpSocket accept() throws IOException, LlcpException;
 
@@ -155,6 +208,12 @@ public interface DeviceHost {
 
         public LlcpPacket receive() throws IOException;
 
+        /**
+         * Waits for at least one packet, then returns it together with any
+         * others already received, up to maxPackets.
+         */
+        public LlcpPacket[] receiveBatch(int maxPackets) throws IOException;
+
         public void close() throws IOException;
     }
 
@@ -200,6 +259,12 @@ public interface DeviceHost {
 
     public boolean doActivateLlcp();
 
+    /**
+     * Returns null if this host has no receive dispatcher; LLCP services then
+     * receive on a thread per socket.
+     */
+    public LlcpReceiveDispatcher getLlcpReceiveDispatcher();
+
     public void resetTimeouts();
 
     public boolean setTimeout(int technology, int timeout);
@@ -55,6 +55,11 @@ public final class NfcDiscoveryParameters {
             return this;
         }
 
+        public NfcDiscoveryParameters.Builder setSkipNdefCheck(boolean skip) {
+            mParameters.mSkipNdefCheck = skip;
+            return this;
+        }
+
         public NfcDiscoveryParameters build() {
             if (mParameters.mEnableReaderMode && mParameters.mEnableLowPowerDiscovery) {
                 throw new IllegalStateException("Can't enable LPTD and reader mode simultaneously");
@@ -76,6 +81,7 @@ public final class NfcDiscoveryParameters {
     private boolean mEnableLowPowerDiscovery = true;
     private boolean mEnableReaderMode = false;
     private boolean mEnableHostRouting = false;
+    private boolean mSkipNdefCheck = false;
 
     public NfcDiscoveryParameters() {}
 
@@ -95,6 +101,10 @@ public final class NfcDiscoveryParameters {
         return mEnableHostRouting;
     }
 
+    public boolean shouldSkipNdefCheck() {
+        return mSkipNdefCheck;
+    }
+
     public boolean shouldEnableDiscovery() {
         return mTechMask != 0 || mEnableHostRouting;
     }
@@ -112,7 +122,8 @@ public final class NfcDiscoveryParameters {
         return mTechMask == params.mTechMask &&
                 (mEnableLowPowerDiscovery == params.mEnableLowPowerDiscovery) &&
                 (mEnableReaderMode == params.mEnableReaderMode) &&
-                (mEnableHostRouting == params.mEnableHostRouting);
+                (mEnableHostRouting == params.mEnableHostRouting) &&
+                (mSkipNdefCheck == params.mSkipNdefCheck);
     }
 
     @Override
@@ -125,7 +136,8 @@ public final class NfcDiscoveryParameters {
         }
         sb.append("mEnableLPD: " + Boolean.toString(mEnableLowPowerDiscovery) + "\n");
         sb.append("mEnableReader: " + Boolean.toString(mEnableReaderMode) + "\n");
-        sb.append("mEnableHostRouting: " + Boolean.toString(mEnableHostRouting));
+        sb.append("mEnableHostRouting: " + Boolean.toString(mEnableHostRouting) + "\n");
+        sb.append("mSkipNdefCheck: " + Boolean.toString(mSkipNdefCheck));
         return sb.toString();
     }
 
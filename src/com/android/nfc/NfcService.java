@@ -67,6 +67,7 @@ import android.util.Log;
 
 import com.android.nfc.DeviceHost.DeviceHostListener;
 import com.android.nfc.DeviceHost.LlcpConnectionlessSocket;
+import com.android.nfc.DeviceHost.LlcpReceiveDispatcher;
 import com.android.nfc.DeviceHost.LlcpServerSocket;
 import com.android.nfc.DeviceHost.LlcpSocket;
 import com.android.nfc.DeviceHost.NfcDepEndpoint;
@@ -77,6 +78,7 @@ import com.android.nfc.handover.HandoverManager;
 
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
+import java.nio.ByteBuffer;
 import java.util.Arrays;
 import java.util.HashMap;
 import java.util.List;
@@ -244,9 +246,9 @@ public class NfcService implements DeviceHostListener {
     }
 
     @Override
-    public void onHostCardEmulationData(byte[] data) {
+    public void onHostCardEmulationData(ByteBuffer data, int aidToken) {
         if (mCardEmulationManager != null) {
-            mCardEmulationManager.onHostCardEmulationData(data);
+            mCardEmulationManager.onHostCardEmulationData(data, aidToken);
         }
     }
 
@@ -1382,7 +1384,7 @@ public class NfcService implements DeviceHostListener {
         }
     }
 
-    static byte[] hexStringToBytes(String s) {
+    public static byte[] hexStringToBytes(String s) {
         if (s == null || s.length() == 0) return null;
         int len = s.length();
         if (len % 2 != 0) {
@@ -1467,6 +1469,8 @@ public class NfcService implements DeviceHostListener {
 
                 paramsBuilder.setTechMask(techMask);
                 paramsBuilder.setEnableReaderMode(true);
+                paramsBuilder.setSkipNdefCheck(
+                        (mReaderModeParams.flags & NfcAdapter.FLAG_READER_SKIP_NDEF_CHECK) != 0);
             } else {
                 paramsBuilder.setTechMask(NfcDiscoveryParameters.NFC_POLL_DEFAULT);
             }
@@ -1575,6 +1579,13 @@ public class NfcService implements DeviceHostListener {
         return mDeviceHost.createLlcpServerSocket(sap, sn, miu, rw, linearBufferLength);
     }
 
+    /**
+     * For use by code in this process; null if the device host has none
+     */
+    public LlcpReceiveDispatcher getLlcpReceiveDispatcher() {
+        return mDeviceHost.getLlcpReceiveDispatcher();
+    }
+
     public void sendMockNdefTag(NdefMessage msg) {
         sendMessage(MSG_MOCK_NDEF, msg);
     }
@@ -20,6 +20,7 @@ import android.util.SparseArray;
 
 import com.android.nfc.NfcService;
 
+import java.io.ByteArrayOutputStream;
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
 import java.util.HashMap;
@@ -71,6 +72,8 @@ public class AidRoutingManager {
     private native int doGetDefaultRouteDestination();
     private native int doGetDefaultOffHostRouteDestination();
     private native int doGetAidMatchingMode();
+    private native void doSetHostAidTable(byte[] aids, int[] tokens);
+    private native void doSetRejectUnknownAids(boolean reject);
 
     public AidRoutingManager() {
         mDefaultRoute = doGetDefaultRouteDestination();
@@ -86,6 +89,43 @@ public class AidRoutingManager {
                 mAidMatchingSupport == AID_MATCHING_PREFIX_ONLY;
     }
 
+    /**
+     * Hands the native layer the AIDs that host services can be selected by,
+     * so it can turn away SELECTs of any other AID without calling up to us.
+     * A SELECT that matches only aids[i] is delivered with tokens[i];
+     * prefix AIDs end with '*'. Passing null disables native matching.
+     */
+    public void setHostAidTable(String[] aids, int[] tokens) {
+        if (aids == null) {
+            doSetHostAidTable(null, null);
+            return;
+        }
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        for (String aid : aids) {
+            boolean isPrefix = aid.endsWith("*");
+            byte[] aidBytes = NfcService.hexStringToBytes(
+                    isPrefix ? aid.substring(0, aid.length() - 1) : aid);
+            if (aidBytes == null || aidBytes.length > 0xFF) {
+                Log.e(TAG, "Cannot pass AID " + aid + " to native matching; disabling it");
+                doSetHostAidTable(null, null);
+                return;
+            }
+            packed.write(aidBytes.length);
+            packed.write(isPrefix ? 1 : 0);
+            packed.write(aidBytes, 0, aidBytes.length);
+        }
+        doSetHostAidTable(packed.toByteArray(), tokens);
+    }
+
+    /**
+     * Tells the native layer whether a SELECT of an AID missing from the host
+     * AID table may be answered with "not found" without calling up to us.
+     * Only true while host emulation would answer it the same way.
+     */
+    public void setRejectUnknownAids(boolean reject) {
+        doSetRejectUnknownAids(reject);
+    }
+
     void clearNfcRoutingTableLocked() {
         for (Map.Entry<String, Integer> aidEntry : mRouteForAid.entrySet())  {
             NfcService.getInstance().unrouteAids(aidEntry.getKey());
@@ -17,6 +17,7 @@ package com.android.nfc.cardemulation;
 
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
+import java.nio.ByteBuffer;
 import java.util.List;
 
 import android.content.ComponentName;
@@ -77,8 +78,8 @@ public class CardEmulationManager implements RegisteredServicesCache.Callback,
         mPreferredServices.onHostEmulationActivated();
     }
 
-    public void onHostCardEmulationData(byte[] data) {
-        mHostEmulationManager.onHostEmulationData(data);
+    public void onHostCardEmulationData(ByteBuffer data, int aidToken) {
+        mHostEmulationManager.onHostEmulationData(data, aidToken);
     }
 
     public void onHostCardEmulationDeactivated() {
@@ -39,6 +39,7 @@ import com.android.nfc.cardemulation.RegisteredAidCache.AidResolveInfo;
 
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 
 public class HostEmulationManager {
@@ -93,7 +94,7 @@ public class HostEmulationManager {
     Messenger mActiveService;
     ComponentName mActiveServiceName;
 
-    String mLastSelectedAid;
+    AidResolveInfo mLastSelectedResolveInfo;
     int mState;
     byte[] mSelectApdu;
 
@@ -136,13 +137,22 @@ public class HostEmulationManager {
             if (mState != STATE_IDLE) {
                 Log.e(TAG, "Got activation event in non-idle state");
             }
-            mState = STATE_W4_SELECT;
+            setStateLocked(STATE_W4_SELECT);
         }
     }
 
-    public void onHostEmulationData(byte[] data) {
+    /**
+     * The APDU lies between the buffer's position and limit. The buffer belongs
+     * to the caller and is reused for the next APDU, so it is copied only when
+     * the APDU is handed to a service or queued for one.
+     */
+    public void onHostEmulationData(ByteBuffer apdu, int aidToken) {
         Log.d(TAG, "notifyHostEmulationData");
-        String selectAid = findSelectAid(data);
+        // The native layer already matched the SELECT against the host AID
+        // table when it hands us a token; only parse the APDU without one
+        AidResolveInfo resolveInfo = mAidCache.resolveAidToken(aidToken);
+        String selectAid = (resolveInfo == null) ? findSelectAid(apdu) : null;
+        boolean isSelect = resolveInfo != null || selectAid != null;
         ComponentName resolvedService = null;
         synchronized (mLock) {
             if (mState == STATE_IDLE) {
@@ -152,18 +162,20 @@ public class HostEmulationManager {
                 Log.e(TAG, "Dropping APDU in STATE_W4_DECTIVATE");
                 return;
             }
-            if (selectAid != null) {
-                if (selectAid.equals(ANDROID_HCE_AID)) {
+            if (isSelect) {
+                if (ANDROID_HCE_AID.equals(selectAid)) {
                     NfcService.getInstance().sendData(ANDROID_HCE_RESPONSE);
                     return;
                 }
-                AidResolveInfo resolveInfo = mAidCache.resolveAid(selectAid);
+                if (resolveInfo == null) {
+                    resolveInfo = mAidCache.resolveAid(selectAid);
+                }
                 if (resolveInfo == null || resolveInfo.services.size() == 0) {
                     // Tell the remote we don't handle this AID
                     NfcService.getInstance().sendData(AID_NOT_FOUND);
                     return;
                 }
-                mLastSelectedAid = selectAid;
+                mLastSelectedResolveInfo = resolveInfo;
                 if (resolveInfo.defaultService != null) {
                     // Resolve to default
                     // Check if resolvedService requires unlock
@@ -171,7 +183,7 @@ public class HostEmulationManager {
                     if (defaultServiceInfo.requiresUnlock() &&
                             mKeyguard.isKeyguardLocked() && mKeyguard.isKeyguardSecure()) {
                         // Just ignore all future APDUs until next tap
-                        mState = STATE_W4_DEACTIVATE;
+                        setStateLocked(STATE_W4_DEACTIVATE);
                         launchTapAgain(resolveInfo.defaultService, resolveInfo.category);
                         return;
                     }
@@ -196,7 +208,7 @@ public class HostEmulationManager {
                     // We have no default, and either one or more services.
                     // Ask the user to confirm.
                     // Just ignore all future APDUs until we resolve to only one
-                    mState = STATE_W4_DEACTIVATE;
+                    setStateLocked(STATE_W4_DEACTIVATE);
                     launchResolver((ArrayList<ApduServiceInfo>)resolveInfo.services, null,
                             resolveInfo.category);
                     return;
@@ -204,18 +216,18 @@ public class HostEmulationManager {
             }
             switch (mState) {
             case STATE_W4_SELECT:
-                if (selectAid != null) {
+                if (isSelect) {
                     Messenger existingService = bindServiceIfNeededLocked(resolvedService);
                     if (existingService != null) {
                         Log.d(TAG, "Binding to existing service");
-                        mState = STATE_XFER;
-                        sendDataToServiceLocked(existingService, data);
+                        setStateLocked(STATE_XFER);
+                        sendDataToServiceLocked(existingService, copyApdu(apdu));
                     } else {
                         // Waiting for service to be bound
                         Log.d(TAG, "Waiting for new service.");
                         // Queue SELECT APDU to be used
-                        mSelectApdu = data;
-                        mState = STATE_W4_SERVICE;
+                        mSelectApdu = copyApdu(apdu);
+                        setStateLocked(STATE_W4_SERVICE);
                     }
                 } else {
                     Log.d(TAG, "Dropping non-select APDU in STATE_W4_SELECT");
@@ -226,19 +238,19 @@ public class HostEmulationManager {
                 Log.d(TAG, "Unexpected APDU in STATE_W4_SERVICE");
                 break;
             case STATE_XFER:
-                if (selectAid != null) {
+                if (isSelect) {
                     Messenger existingService = bindServiceIfNeededLocked(resolvedService);
                     if (existingService != null) {
-                        sendDataToServiceLocked(existingService, data);
-                        mState = STATE_XFER;
+                        sendDataToServiceLocked(existingService, copyApdu(apdu));
+                        setStateLocked(STATE_XFER);
                     } else {
                         // Waiting for service to be bound
-                        mSelectApdu = data;
-                        mState = STATE_W4_SERVICE;
+                        mSelectApdu = copyApdu(apdu);
+                        setStateLocked(STATE_W4_SERVICE);
                     }
                 } else if (mActiveService != null) {
                     // Regular APDU data
-                    sendDataToServiceLocked(mActiveService, data);
+                    sendDataToServiceLocked(mActiveService, copyApdu(apdu));
                 } else {
                     // No SELECT AID and no active service.
                     Log.d(TAG, "Service no longer bound, dropping APDU");
@@ -258,7 +270,7 @@ public class HostEmulationManager {
             mActiveService = null;
             mActiveServiceName = null;
             unbindServiceIfNeededLocked();
-            mState = STATE_IDLE;
+            setStateLocked(STATE_IDLE);
         }
     }
 
@@ -273,7 +285,7 @@ public class HostEmulationManager {
             mActiveService = null;
             mActiveServiceName = null;
             unbindServiceIfNeededLocked();
-            mState = STATE_W4_SELECT;
+            setStateLocked(STATE_W4_SELECT);
 
             //close the TapAgainDialog
             Intent intent = new Intent(TapAgainDialog.ACTION_CLOSE);
@@ -282,6 +294,22 @@ public class HostEmulationManager {
         }
     }
 
+    /**
+     * Moves to a new state, and lets the native layer turn away SELECTs of
+     * unknown AIDs on its own only in the states that would answer them.
+     */
+    void setStateLocked(int state) {
+        boolean reject = isRejectingUnknownAids(state);
+        if (reject != isRejectingUnknownAids(mState)) {
+            mAidCache.setRejectUnknownAids(reject);
+        }
+        mState = state;
+    }
+
+    static boolean isRejectingUnknownAids(int state) {
+        return state == STATE_W4_SELECT || state == STATE_W4_SERVICE || state == STATE_XFER;
+    }
+
     Messenger bindServiceIfNeededLocked(ComponentName service) {
         if (mPaymentServiceBound && mPaymentServiceName.equals(service)) {
             Log.d(TAG, "Service already bound as payment service.");
@@ -386,8 +414,14 @@ public class HostEmulationManager {
         mContext.startActivityAsUser(intent, UserHandle.CURRENT);
     }
 
-    String findSelectAid(byte[] data) {
-        if (data == null || data.length < SELECT_APDU_HDR_LENGTH + MINIMUM_AID_LENGTH) {
+    static byte[] copyApdu(ByteBuffer apdu) {
+        byte[] data = new byte[apdu.remaining()];
+        apdu.duplicate().get(data);
+        return data;
+    }
+
+    String findSelectAid(ByteBuffer apdu) {
+        if (apdu == null || apdu.remaining() < SELECT_APDU_HDR_LENGTH + MINIMUM_AID_LENGTH) {
             if (DBG) Log.d(TAG, "Data size too small for SELECT APDU");
             return null;
         }
@@ -397,15 +431,17 @@ public class HostEmulationManager {
         // P1: must be 0x04: select by application identifier
         // P2: File control information is only relevant for higher-level application,
         //     and we only support "first or only occurrence".
-        if (data[0] == 0x00 && data[1] == INSTR_SELECT && data[2] == 0x04) {
-            if (data[3] != 0x00) {
+        int start = apdu.position();
+        if (apdu.get(start) == 0x00 && apdu.get(start + 1) == INSTR_SELECT
+                && apdu.get(start + 2) == 0x04) {
+            if (apdu.get(start + 3) != 0x00) {
                 Log.d(TAG, "Selecting next, last or previous AID occurrence is not supported");
             }
-            int aidLength = data[4];
-            if (data.length < SELECT_APDU_HDR_LENGTH + aidLength) {
+            int aidLength = apdu.get(start + 4);
+            if (apdu.remaining() < SELECT_APDU_HDR_LENGTH + aidLength) {
                 return null;
             }
-            return bytesToString(data, SELECT_APDU_HDR_LENGTH, aidLength);
+            return bytesToString(apdu, start + SELECT_APDU_HDR_LENGTH, aidLength);
         }
         return null;
     }
@@ -438,7 +474,7 @@ public class HostEmulationManager {
                 mServiceBound = true;
                 mServiceName = name;
                 Log.d(TAG, "Service bound");
-                mState = STATE_XFER;
+                setStateLocked(STATE_XFER);
                 // Send pending select APDU
                 if (mSelectApdu != null) {
                     sendDataToServiceLocked(mService, mSelectApdu);
@@ -491,9 +527,9 @@ public class HostEmulationManager {
                 }
             } else if (msg.what == HostApduService.MSG_UNHANDLED) {
                 synchronized (mLock) {
-                    AidResolveInfo resolveInfo = mAidCache.resolveAid(mLastSelectedAid);
+                    AidResolveInfo resolveInfo = mLastSelectedResolveInfo;
                     boolean isPayment = false;
-                    if (resolveInfo.services.size() > 0) {
+                    if (resolveInfo != null && resolveInfo.services.size() > 0) {
                         launchResolver((ArrayList<ApduServiceInfo>)resolveInfo.services,
                                 mActiveServiceName, resolveInfo.category);
                     }
@@ -502,12 +538,12 @@ public class HostEmulationManager {
         }
     }
 
-    static String bytesToString(byte[] bytes, int offset, int length) {
+    static String bytesToString(ByteBuffer bytes, int offset, int length) {
         final char[] hexChars = {'0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F'};
         char[] chars = new char[length * 2];
         int byteValue;
         for (int j = 0; j < length; j++) {
-            byteValue = bytes[offset + j] & 0xFF;
+            byteValue = bytes.get(offset + j) & 0xFF;
             chars[j * 2] = hexChars[byteValue >>> 4];
             chars[j * 2 + 1] = hexChars[byteValue & 0x0F];
         }
@@ -23,6 +23,7 @@ import android.nfc.cardemulation.ApduServiceInfo;
 import android.nfc.cardemulation.CardEmulation;
 import android.util.Log;
 
+import com.android.nfc.DeviceHost;
 import com.google.android.collect.Maps;
 
 import java.io.FileDescriptor;
@@ -55,6 +56,16 @@ public class RegisteredAidCache {
     // It is only valid for the current user.
     final TreeMap<String, AidResolveInfo> mAidCache = new TreeMap<String, AidResolveInfo>();
 
+    // The host AID table handed to the native layer names each entry it resolves
+    // on its own with a token: the table generation in the upper bits, and the
+    // index into mHostAidResolveInfos in the lower bits.
+    static final int HOST_AID_INDEX_BITS = 16;
+    static final int HOST_AID_INDEX_MASK = (1 << HOST_AID_INDEX_BITS) - 1;
+    static final int HOST_AID_GENERATION_MASK = 0x7FFF;
+
+    AidResolveInfo[] mHostAidResolveInfos = new AidResolveInfo[0];
+    int mHostAidGeneration = 0;
+
     // Represents a single AID registration of a service
     final class ServiceAidInfo {
         ApduServiceInfo service;
@@ -163,21 +174,7 @@ public class RegisteredAidCache {
                             entry.getKey().length() - 1) : entry.getKey(); // Cut off '*' if prefix
                     if (entryAid.equalsIgnoreCase(aid) || (isPrefix && aid.startsWith(entryAid))) {
                         if (DBG) Log.d(TAG, "resolveAid: AID " + entryAid + " matches.");
-                        AidResolveInfo entryResolveInfo = entry.getValue();
-                        if (entryResolveInfo.defaultService != null) {
-                            if (resolveInfo.defaultService != null) {
-                                // This shouldn't happen; for every prefix we have only one
-                                // default service.
-                                Log.e(TAG, "Different defaults for conflicting AIDs!");
-                            }
-                            resolveInfo.defaultService = entryResolveInfo.defaultService;
-                            resolveInfo.category = entryResolveInfo.category;
-                        }
-                        for (ApduServiceInfo serviceInfo : entryResolveInfo.services) {
-                            if (!resolveInfo.services.contains(serviceInfo)) {
-                                resolveInfo.services.add(serviceInfo);
-                            }
-                        }
+                        mergeResolveInfoLocked(resolveInfo, entry.getValue());
                     }
                 }
             } else {
@@ -188,6 +185,48 @@ public class RegisteredAidCache {
         }
     }
 
+    /**
+     * Resolves a SELECT the native layer matched against the host AID table.
+     * Returns null if the token does not name an entry of the current table,
+     * in which case the caller must fall back to {@link #resolveAid}.
+     */
+    public AidResolveInfo resolveAidToken(int token) {
+        if (token < 0) return null;
+        synchronized (mLock) {
+            int index = token & HOST_AID_INDEX_MASK;
+            if ((token >>> HOST_AID_INDEX_BITS) != mHostAidGeneration ||
+                    index >= mHostAidResolveInfos.length) {
+                if (DBG) Log.d(TAG, "resolveAidToken: stale token " + token);
+                return null;
+            }
+            return mHostAidResolveInfos[index];
+        }
+    }
+
+    void mergeResolveInfoLocked(AidResolveInfo resolveInfo, AidResolveInfo entryResolveInfo) {
+        if (entryResolveInfo.defaultService != null) {
+            if (resolveInfo.defaultService != null) {
+                // This shouldn't happen; for every prefix we have only one
+                // default service.
+                Log.e(TAG, "Different defaults for conflicting AIDs!");
+            }
+            resolveInfo.defaultService = entryResolveInfo.defaultService;
+            resolveInfo.category = entryResolveInfo.category;
+        }
+        for (ApduServiceInfo serviceInfo : entryResolveInfo.services) {
+            if (!resolveInfo.services.contains(serviceInfo)) {
+                resolveInfo.services.add(serviceInfo);
+            }
+        }
+    }
+
+    /**
+     * See {@link AidRoutingManager#setRejectUnknownAids}.
+     */
+    public void setRejectUnknownAids(boolean reject) {
+        mRoutingManager.setRejectUnknownAids(reject);
+    }
+
     public boolean supportsAidPrefixRegistration() {
         return mSupportsPrefixes;
     }
@@ -506,9 +545,81 @@ public class RegisteredAidCache {
             resolvedAids.clear();
         }
 
+        updateHostAidTableLocked();
         updateRoutingLocked();
     }
 
+    /**
+     * Hands the native layer the AIDs of mAidCache that have services, so
+     * SELECTs of any other AID get AID_NOT_FOUND without a call up to us.
+     * An entry gets a token only if a SELECT matching it matches no other
+     * entry; otherwise resolveAid() has to merge the matches.
+     */
+    void updateHostAidTableLocked() {
+        mHostAidGeneration = (mHostAidGeneration + 1) & HOST_AID_GENERATION_MASK;
+
+        ArrayList<String> aids = new ArrayList<String>();
+        ArrayList<AidResolveInfo> entryResolveInfos = new ArrayList<AidResolveInfo>();
+        HashSet<String> prefixes = new HashSet<String>();
+        for (Map.Entry<String, AidResolveInfo> entry : mAidCache.entrySet()) {
+            String aid = entry.getKey().toUpperCase();
+            boolean isPrefix = isPrefix(aid);
+            // resolveAid() never matches prefixes shorter than 5 bytes, nor any
+            // prefix if the controller cannot route them
+            if (entry.getValue().services.isEmpty() || (isPrefix &&
+                    (!mSupportsPrefixes || aid.length() < 11))) {
+                continue;
+            }
+            aids.add(aid);
+            entryResolveInfos.add(entry.getValue());
+            if (isPrefix) {
+                prefixes.add(aid.substring(0, aid.length() - 1));
+            }
+        }
+        if (aids.size() >= HOST_AID_INDEX_MASK) {
+            Log.e(TAG, "Too many AIDs for native matching");
+            mHostAidResolveInfos = new AidResolveInfo[0];
+            mRoutingManager.setHostAidTable(null, null);
+            return;
+        }
+
+        // The Android HCE AID is answered by HostEmulationManager itself
+        String[] tableAids = new String[aids.size() + 1];
+        int[] tokens = new int[aids.size() + 1];
+        AidResolveInfo[] resolveInfos = new AidResolveInfo[aids.size()];
+        for (int i = 0; i < aids.size(); i++) {
+            String aid = aids.get(i);
+            boolean isPrefix = isPrefix(aid);
+            String aidBody = isPrefix ? aid.substring(0, aid.length() - 1) : aid;
+            boolean shared = false;
+            // Any shorter prefix entry also matches a SELECT of this entry
+            int longest = isPrefix ? aidBody.length() - 2 : aidBody.length();
+            for (int len = 10; len <= longest && !shared; len += 2) {
+                shared = prefixes.contains(aidBody.substring(0, len));
+            }
+            tableAids[i] = aid;
+            if (shared) {
+                tokens[i] = DeviceHost.AID_TOKEN_UNRESOLVED;
+            } else {
+                tokens[i] = (mHostAidGeneration << HOST_AID_INDEX_BITS) | i;
+                AidResolveInfo resolveInfo = entryResolveInfos.get(i);
+                if (mSupportsPrefixes) {
+                    // Same result resolveAid() gives for a single match
+                    AidResolveInfo merged = new AidResolveInfo();
+                    merged.category = CardEmulation.CATEGORY_OTHER;
+                    mergeResolveInfoLocked(merged, resolveInfo);
+                    resolveInfo = merged;
+                }
+                resolveInfos[i] = resolveInfo;
+            }
+        }
+        tableAids[aids.size()] = HostEmulationManager.ANDROID_HCE_AID;
+        tokens[aids.size()] = DeviceHost.AID_TOKEN_UNRESOLVED;
+
+        mHostAidResolveInfos = resolveInfos;
+        mRoutingManager.setHostAidTable(tableAids, tokens);
+    }
+
     void updateRoutingLocked() {
         if (!mNfcEnabled) {
             if (DBG) Log.d(TAG, "Not updating routing table because NFC is off.");
@@ -288,7 +288,6 @@ public class EchoServer {
         @Override
         public void run() {
             boolean connectionBroken = false;
-            LlcpPacket packet;
             if (DBG) Log.d(TAG, "about create LLCP connectionless socket");
             try {
                 socket = mService.createLlcpConnectionLessSocket(
@@ -300,18 +299,17 @@ public class EchoServer {
 
                 while (mRunning && !connectionBroken) {
                     try {
-                        packet = socket.receive();
-                        if (packet == null || packet.getDataBuffer() == null) {
-                            break;
-                        }
-                        byte[] dataUnit = packet.getDataBuffer();
-                        int size = dataUnit.length;
-
-                        if (DBG) Log.d(TAG, "read " + packet.getDataBuffer().length + " bytes");
-                        if (size < 0) {
-                            connectionBroken = true;
-                            break;
-                        } else {
+                        // A burst fills the echo queue in one call
+                        LlcpPacket[] packets = socket.receiveBatch(EchoMachine.QUEUE_SIZE);
+                        for (LlcpPacket packet : packets) {
+                            if (packet == null || packet.getDataBuffer() == null) {
+                                connectionBroken = true;
+                                break;
+                            }
+                            byte[] dataUnit = packet.getDataBuffer();
+                            int size = dataUnit.length;
+
+                            if (DBG) Log.d(TAG, "read " + size + " bytes");
                             mRemoteSap = packet.getRemoteSap();
                             echoMachine.pushUnit(dataUnit, size);
                         }
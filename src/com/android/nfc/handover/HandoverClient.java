@@ -25,7 +25,6 @@ import com.android.nfc.DeviceHost.LlcpSocket;
 
 import java.io.ByteArrayOutputStream;
 import java.io.IOException;
-import java.util.Arrays;
 
 public final class HandoverClient {
     private static final String TAG = "HandoverClient";
@@ -105,20 +104,12 @@ public final class HandoverClient {
             }
             sock = mSocket;
         }
-        int offset = 0;
         byte[] buffer = msg.toByteArray();
         ByteArrayOutputStream byteStream = new ByteArrayOutputStream();
 
         try {
-            int remoteMiu = sock.getRemoteMiu();
             if (DBG) Log.d(TAG, "about to send a " + buffer.length + " byte message");
-            while (offset < buffer.length) {
-                int length = Math.min(buffer.length - offset, remoteMiu);
-                byte[] tmpBuffer = Arrays.copyOfRange(buffer, offset, offset+length);
-                if (DBG) Log.d(TAG, "about to send a " + length + " byte packet");
-                sock.send(tmpBuffer);
-                offset += length;
-            }
+            sock.sendSegmented(buffer, 0, buffer.length, 0);
 
             // Now, try to read back the handover response
             byte[] partial = new byte[sock.getLocalMiu()];
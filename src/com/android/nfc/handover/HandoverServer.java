@@ -26,7 +26,6 @@ import com.android.nfc.DeviceHost.LlcpSocket;
 
 import java.io.ByteArrayOutputStream;
 import java.io.IOException;
-import java.util.Arrays;
 
 public final class HandoverServer {
     public static final String HANDOVER_SERVICE_NAME = "urn:nfc:sn:handover";
@@ -108,6 +107,8 @@ public final class HandoverServer {
                         LlcpSocket communicationSocket = serverSocket.accept();
                         if (DBG) Log.d(TAG, "accept returned " + communicationSocket);
                         if (communicationSocket != null) {
+                            // Not on the LLCP receive dispatcher: answering a request
+                            // blocks on the handover manager and a segmented send
                             new ConnectionThread(communicationSocket).start();
                         }
 
@@ -199,15 +200,8 @@ public final class HandoverServer {
                         }
 
                         // 3) send handover response
-                        int offset = 0;
                         byte[] buffer = resp.toByteArray();
-                        int remoteMiu = mSock.getRemoteMiu();
-                        while (offset < buffer.length) {
-                            int length = Math.min(buffer.length - offset, remoteMiu);
-                            byte[] tmpBuffer = Arrays.copyOfRange(buffer, offset, offset+length);
-                            mSock.send(tmpBuffer);
-                            offset += length;
-                        }
+                        mSock.sendSegmented(buffer, 0, buffer.length, 0);
                         // We're done
                         mCallback.onHandoverRequestReceived();
                         // We can process another handover transfer
@@ -16,6 +16,7 @@
 
 package com.android.nfc.ndefpush;
 
+import com.android.nfc.DeviceHost.LlcpReceiveDispatcher;
 import com.android.nfc.DeviceHost.LlcpServerSocket;
 import com.android.nfc.DeviceHost.LlcpSocket;
 import com.android.nfc.LlcpException;
@@ -24,6 +25,7 @@ import com.android.nfc.NfcService;
 import android.nfc.FormatException;
 import android.nfc.NdefMessage;
 import android.nfc.NfcAdapter;
+import android.os.AsyncTask;
 import android.util.Log;
 
 import java.io.ByteArrayOutputStream;
@@ -59,6 +61,51 @@ public class NdefPushServer {
         mCallback = callback;
     }
 
+    /** Handles the data of a connection once the client closed it */
+    void handleConnection(LlcpSocket sock, byte[] data) {
+        try {
+            // Build NDEF message set from the stream
+            NdefPushProtocol msg = new NdefPushProtocol(data);
+            if (DBG) Log.d(TAG, "got message " + msg.toString());
+
+            // Send the intent for the fake tag
+            mCallback.onMessageReceived(msg.getImmediate());
+        } catch (FormatException e) {
+            Log.e(TAG, "badly formatted NDEF message, ignoring", e);
+        } finally {
+            try {
+                if (DBG) Log.d(TAG, "about to close");
+                sock.close();
+            } catch (IOException e) {
+                // ignore
+            }
+        }
+    }
+
+    /** Collects the data of an incoming connection on the receive dispatcher */
+    private class ConnectionReceiver implements LlcpReceiveDispatcher.Callback {
+        private final ByteArrayOutputStream mBuffer = new ByteArrayOutputStream(1024);
+
+        @Override
+        public void onDataReceived(LlcpSocket socket, byte[] data, int length) {
+            if (DBG) Log.d(TAG, "read " + length + " bytes");
+            mBuffer.write(data, 0, length);
+        }
+
+        @Override
+        public void onClosed(final LlcpSocket socket) {
+            // Closing waits for the LLCP disconnect; keep it off the dispatcher thread,
+            // which serves every other watched socket
+            final byte[] data = mBuffer.toByteArray();
+            AsyncTask.THREAD_POOL_EXECUTOR.execute(new Runnable() {
+                @Override
+                public void run() {
+                    handleConnection(socket, data);
+                }
+            });
+        }
+    }
+
     /** Connection class, used to handle incoming connections */
     private class ConnectionThread extends Thread {
         private LlcpSocket mSock;
@@ -71,46 +118,30 @@ public class NdefPushServer {
         @Override
         public void run() {
             if (DBG) Log.d(TAG, "starting connection thread");
-            try {
-                ByteArrayOutputStream buffer = new ByteArrayOutputStream(1024);
-                byte[] partial = new byte[1024];
-                int size;
-                boolean connectionBroken = false;
+            ByteArrayOutputStream buffer = new ByteArrayOutputStream(1024);
+            byte[] partial = new byte[1024];
+            int size;
+            boolean connectionBroken = false;
 
-                // Get raw data from remote server
-                while(!connectionBroken) {
-                    try {
-                        size = mSock.receive(partial);
-                        if (DBG) Log.d(TAG, "read " + size + " bytes");
-                        if (size < 0) {
-                            connectionBroken = true;
-                            break;
-                        } else {
-                            buffer.write(partial, 0, size);
-                        }
-                    } catch (IOException e) {
-                        // Connection broken
+            // Get raw data from remote server
+            while(!connectionBroken) {
+                try {
+                    size = mSock.receive(partial);
+                    if (DBG) Log.d(TAG, "read " + size + " bytes");
+                    if (size < 0) {
                         connectionBroken = true;
-                        if (DBG) Log.d(TAG, "connection broken by IOException", e);
+                        break;
+                    } else {
+                        buffer.write(partial, 0, size);
                     }
-                }
-
-                // Build NDEF message set from the stream
-                NdefPushProtocol msg = new NdefPushProtocol(buffer.toByteArray());
-                if (DBG) Log.d(TAG, "got message " + msg.toString());
-
-                // Send the intent for the fake tag
-                mCallback.onMessageReceived(msg.getImmediate());
-            } catch (FormatException e) {
-                Log.e(TAG, "badly formatted NDEF message, ignoring", e);
-            } finally {
-                try {
-                    if (DBG) Log.d(TAG, "about to close");
-                    mSock.close();
                 } catch (IOException e) {
-                    // ignore
+                    // Connection broken
+                    connectionBroken = true;
+                    if (DBG) Log.d(TAG, "connection broken by IOException", e);
                 }
             }
+
+            handleConnection(mSock, buffer.toByteArray());
             if (DBG) Log.d(TAG, "finished connection thread");
         }
     }
@@ -154,7 +185,13 @@ public class NdefPushServer {
                         LlcpSocket communicationSocket = serverSocket.accept();
                         if (DBG) Log.d(TAG, "accept returned " + communicationSocket);
                         if (communicationSocket != null) {
-                            new ConnectionThread(communicationSocket).start();
+                            // One dispatcher thread serves every connection where the
+                            // device host supports it
+                            LlcpReceiveDispatcher dispatcher = mService.getLlcpReceiveDispatcher();
+                            if (dispatcher == null || !dispatcher.watch(communicationSocket,
+                                    new ConnectionReceiver())) {
+                                new ConnectionThread(communicationSocket).start();
+                            }
                         }
 
                         synchronized (NdefPushServer.this) {
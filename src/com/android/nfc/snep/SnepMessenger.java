@@ -79,13 +79,9 @@ public class SnepMessenger {
         }
 
         // Send remaining fragments.
-        while (offset < buffer.length) {
-            length = Math.min(buffer.length - offset, mFragmentLength);
-            tmpBuffer = Arrays.copyOfRange(buffer, offset, offset + length);
-            if (DBG) Log.d(TAG, "about to send a " + length + " byte fragment");
-            mSocket.send(tmpBuffer);
-            offset += length;
-        }
+        if (DBG) Log.d(TAG, "about to send " + (buffer.length - offset) + " bytes in "
+                + mFragmentLength + " byte fragments");
+        mSocket.sendSegmented(buffer, offset, buffer.length - offset, mFragmentLength);
     }
 
     public SnepMessage getMessage() throws IOException, SnepException {
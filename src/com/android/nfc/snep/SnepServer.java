@@ -213,6 +213,8 @@ public final class SnepServer {
                         if (communicationSocket != null) {
                             int fragmentLength = (mFragmentLength == -1) ?
                                     mMiu : Math.min(mMiu, mFragmentLength);
+                            // Not on the LLCP receive dispatcher: SnepMessenger sends
+                            // replies and reads CONTINUE from inside a send, both blocking
                             new ConnectionThread(communicationSocket, fragmentLength).start();
                         }
 
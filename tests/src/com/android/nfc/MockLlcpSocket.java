@@ -19,6 +19,7 @@ package com.android.nfc;
 import android.util.Log;
 
 import java.io.IOException;
+import java.util.Arrays;
 import java.util.LinkedList;
 import java.util.List;
 
@@ -51,6 +52,20 @@ public class MockLlcpSocket implements DeviceHost.LlcpSocket {
         }
     }
 
+    @Override
+    public void sendSegmented(byte[] data, int offset, int length, int segmentSize)
+            throws IOException {
+        if (segmentSize <= 0) {
+            throw new UnsupportedOperationException("Mock socket has no remote MIU");
+        }
+        int end = offset + length;
+        while (offset < end) {
+            int chunk = Math.min(end - offset, segmentSize);
+            send(Arrays.copyOfRange(data, offset, offset + chunk));
+            offset += chunk;
+        }
+    }
+
     @Override
     public int receive(byte[] receiveBuffer) throws IOException {
         synchronized (mReceivedPackets) {